@@ -4,7 +4,6 @@
 , gettext
 , libpthreadstubs
 , libudev
-, libusb1
 , sqlite
 , qemu
 , ncurses
@@ -14,7 +13,6 @@
 , dbus
 , graphviz
 , libxml2
-, libarchive
 , virtviewer
 , tigervnc
 
@@ -64,7 +62,6 @@ stdenv.mkDerivation rec {
     gettext
     libpthreadstubs
     libudev
-    libusb1
     sqlite
     qemu_
     ncurses
@@ -73,7 +70,7 @@ stdenv.mkDerivation rec {
   ]
     ++ lib.optional withDbus dbus
     ++ lib.optional withNetworkMap graphviz
-    ++ lib.optionals withOVF [ libxml2 libarchive ]
+    ++ lib.optional withOVF libxml2
     ++ lib.optional withSpice virtviewer
     ++ lib.optional withVNC tigervnc;
 
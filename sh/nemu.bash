@@ -26,7 +26,7 @@ _nemu_completions()
 
     if [[ "$COMP_CWORD" == 1 ]]; then
         COMPREPLY=( $(compgen -W "-h --help -l --list -s --start -p --powerdown \
-            -f --force-stop -z --reset -k --kill -i --info -v --version" -- "$curr") )
+            -f --force-stop -z --reset -k --kill -i --info -j --jobs -v --version" -- "$curr") )
     elif [[ "$COMP_CWORD" == 2 ]]; then
         case "$prev" in
             "-s"|"--start")
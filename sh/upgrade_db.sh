@@ -6,7 +6,7 @@ if [ "$#" -lt 1 ] || [ "$#" -gt 2 ]; then
 fi
 
 DB_PATH="$1"
-DB_ACTUAL_VERSION=17
+DB_ACTUAL_VERSION=19
 DB_CURRENT_VERSION=$(sqlite3 "$DB_PATH" -line 'PRAGMA user_version;' | sed 's/.*[[:space:]]=[[:space:]]//')
 USER=$(whoami)
 RC=0
@@ -201,6 +201,65 @@ while [ "$DB_CURRENT_VERSION" != "$DB_ACTUAL_VERSION" ]; do
              ) || RC=1
             ;;
 
+         ( 17 )
+             # Child tables are rebuilt with foreign keys in one transaction:
+             # on error nothing is changed and the step may be run again.
+             sqlite3 -bail "$DB_PATH" <<'EOF' || RC=1
+PRAGMA foreign_keys=OFF;
+BEGIN;
+CREATE UNIQUE INDEX vms_name_idx ON vms(name);
+CREATE INDEX vms_team_idx ON vms(team);
+ALTER TABLE ifaces RENAME TO tmp;
+CREATE TABLE ifaces(id integer primary key autoincrement, vm_name char
+  REFERENCES vms(name) ON DELETE CASCADE
+  ON UPDATE CASCADE DEFERRABLE INITIALLY DEFERRED,
+  if_name char, mac_addr char, ipv4_addr char, if_drv char, vhost integer,
+  macvtap integer, parent_eth char, altname char, netuser integer, hostfwd char, smb char);
+INSERT INTO ifaces(id, vm_name, if_name, mac_addr, ipv4_addr, if_drv, vhost, macvtap, parent_eth, altname, netuser, hostfwd, smb)
+  SELECT id, vm_name, if_name, mac_addr, ipv4_addr, if_drv, vhost, macvtap, parent_eth, altname, netuser, hostfwd, smb FROM tmp WHERE vm_name IN (SELECT name FROM vms);
+DROP TABLE tmp;
+ALTER TABLE drives RENAME TO tmp;
+CREATE TABLE drives(id integer primary key autoincrement, vm_name char
+  REFERENCES vms(name) ON DELETE CASCADE
+  ON UPDATE CASCADE DEFERRABLE INITIALLY DEFERRED,
+  drive_name char, drive_drv char, capacity integer, boot integer, discard integer);
+INSERT INTO drives(id, vm_name, drive_name, drive_drv, capacity, boot, discard)
+  SELECT id, vm_name, drive_name, drive_drv, capacity, boot, discard FROM tmp WHERE vm_name IN (SELECT name FROM vms);
+DROP TABLE tmp;
+ALTER TABLE vmsnapshots RENAME TO tmp;
+CREATE TABLE vmsnapshots(id integer primary key autoincrement, vm_name char
+  REFERENCES vms(name) ON DELETE CASCADE
+  ON UPDATE CASCADE DEFERRABLE INITIALLY DEFERRED,
+  snap_name char, load integer, timestamp char);
+INSERT INTO vmsnapshots(id, vm_name, snap_name, load, timestamp)
+  SELECT id, vm_name, snap_name, load, timestamp FROM tmp WHERE vm_name IN (SELECT name FROM vms);
+DROP TABLE tmp;
+ALTER TABLE usb RENAME TO tmp;
+CREATE TABLE usb(id integer primary key autoincrement, vm_name char
+  REFERENCES vms(name) ON DELETE CASCADE
+  ON UPDATE CASCADE DEFERRABLE INITIALLY DEFERRED,
+  dev_name char, vendor_id char, product_id char, serial char);
+INSERT INTO usb(id, vm_name, dev_name, vendor_id, product_id, serial)
+  SELECT id, vm_name, dev_name, vendor_id, product_id, serial FROM tmp WHERE vm_name IN (SELECT name FROM vms);
+DROP TABLE tmp;
+CREATE INDEX ifaces_vm_name_idx ON ifaces(vm_name);
+CREATE INDEX ifaces_parent_eth_idx ON ifaces(parent_eth);
+CREATE INDEX drives_vm_name_idx ON drives(vm_name);
+CREATE INDEX vmsnapshots_vm_name_idx ON vmsnapshots(vm_name);
+CREATE INDEX usb_vm_name_idx ON usb(vm_name);
+PRAGMA user_version=18;
+COMMIT;
+EOF
+            ;;
+
+         ( 18 )
+             (
+             sqlite3 "$DB_PATH" -line 'ALTER TABLE drives ADD backing_vm char REFERENCES vms(name) ON UPDATE CASCADE ON DELETE RESTRICT;' &&
+             sqlite3 "$DB_PATH" -line 'CREATE INDEX drives_backing_vm_idx ON drives(backing_vm);' &&
+             sqlite3 "$DB_PATH" -line 'PRAGMA user_version=19'
+             ) || RC=1
+            ;;
+
         ( * )
             echo "Unsupported database user_version" >&2
             exit 1
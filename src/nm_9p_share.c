@@ -70,10 +70,10 @@ void nm_9p_share(const nm_str_t *name)
     field_opts_off(fields[NM_FLD_9PNAME], O_STATIC);
 
     set_field_buffer(fields[NM_FLD_9PMODE], 0,
-        (nm_str_cmp_st(nm_vect_str(&vm.main, NM_SQL_9FLG),
+        (nm_str_cmp_st(nm_db_res_str(&vm.main, NM_SQL_9FLG),
             NM_ENABLE) == NM_OK) ? "yes" : "no");
-    set_field_buffer(fields[NM_FLD_9PPATH], 0, nm_vect_str_ctx(&vm.main, NM_SQL_9PTH));
-    set_field_buffer(fields[NM_FLD_9PNAME], 0, nm_vect_str_ctx(&vm.main, NM_SQL_9ID));
+    set_field_buffer(fields[NM_FLD_9PPATH], 0, nm_db_res_cstr(&vm.main, NM_SQL_9PTH));
+    set_field_buffer(fields[NM_FLD_9PNAME], 0, nm_db_res_cstr(&vm.main, NM_SQL_9ID));
 
     for (size_t n = 0, y = 1, x = 2; n < NM_FLD_COUNT; n++) {
         mvwaddstr(form_data.form_window, y, x, _(nm_form_msg[n]));
@@ -111,7 +111,7 @@ static int nm_9p_get_data(nm_9p_data_t *data, const nm_vmctl_data_t *cur)
         if (nm_str_cmp_st(&data->mode, "no") == NM_OK)
             goto out;
     }
-    else if (nm_str_cmp_st(nm_vect_str(&cur->main, NM_SQL_9FLG), NM_ENABLE) != NM_OK)
+    else if (nm_str_cmp_st(nm_db_res_str(&cur->main, NM_SQL_9FLG), NM_ENABLE) != NM_OK)
             goto out;
 
     nm_form_check_data(_(nm_form_msg[1]), data->path, err);
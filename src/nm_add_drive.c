@@ -1,4 +1,5 @@
 #include <nm_core.h>
+#include <nm_job.h>
 #include <nm_form.h>
 #include <nm_menu.h>
 #include <nm_utils.h>
@@ -22,8 +23,22 @@ enum {
     NM_FLD_COUNT
 };
 
+/* Context of drive creation job */
+typedef struct {
+    nm_str_t name;
+    nm_str_t size;
+    nm_str_t type;
+    nm_str_t discard;
+    nm_vmctl_data_t vm;
+} nm_add_drive_job_t;
+
+static int nm_add_drive_run(nm_job_t *job);
+static int nm_add_drive_done(nm_job_t *job, int rc);
+static void nm_add_drive_free(void *ctx);
+static int nm_add_drive_create(const nm_str_t *name, const nm_str_t *size,
+                               size_t drive_count, nm_job_t *job);
 static void nm_add_drive_to_db(const nm_str_t *name, const nm_str_t *size,
-                               const nm_str_t *type, const nm_vect_t *drives,
+                               const nm_str_t *type, const nm_db_result_t *drives,
                                const nm_str_t *discard);
 
 void nm_add_drive(const nm_str_t *name)
@@ -38,6 +53,8 @@ void nm_add_drive(const nm_str_t *name)
     nm_vect_t err = NM_INIT_VECT;
     nm_vect_t msg_fields = NM_INIT_VECT;
     nm_form_data_t form_data = NM_INIT_FORM_DATA;
+    nm_add_drive_job_t *drv;
+    nm_job_t *job;
     size_t msg_len;
 
     nm_vmctl_get_data(name, &vm);
@@ -98,9 +115,19 @@ void nm_add_drive(const nm_str_t *name)
         goto out;
     }
 
-    if (nm_add_drive_to_fs(name, &drv_size, &vm.drives) != NM_OK)
-        nm_bug(_("%s: cannot create image file"), __func__);
-    nm_add_drive_to_db(name, &drv_size, &drv_type, &vm.drives, &discard);
+    drv = nm_calloc(1, sizeof(nm_add_drive_job_t));
+    nm_str_copy(&drv->name, name);
+    nm_str_copy(&drv->size, &drv_size);
+    nm_str_copy(&drv->type, &drv_type);
+    nm_str_copy(&drv->discard, &discard);
+    drv->vm = vm;
+    vm = NM_VMCTL_INIT_DATA;
+
+    nm_str_format(&buf, "add %sGb drive to %s", drv_size.data, name->data);
+    job = nm_job_new(&buf, nm_add_drive_run, nm_add_drive_done,
+            drv, nm_add_drive_free);
+    nm_job_add_vm(job, name);
+    nm_job_submit(job);
 
 out:
     NM_FORM_EXIT();
@@ -116,16 +143,15 @@ out:
 void nm_del_drive(const nm_str_t *name)
 {
     int ch = 0, delete_drive = 0;
-    nm_str_t query = NM_INIT_STR;
     nm_str_t drive_path = NM_INIT_STR;
     nm_vect_t drv_list = NM_INIT_VECT;
     nm_vect_t drives = NM_INIT_VECT;
     nm_menu_data_t m_drvs = NM_INIT_MENU_DATA;
     size_t drv_list_len = (getmaxy(side_window) - 4);
     size_t drv_count;
+    nm_db_stmt_t *stmt;
 
-    nm_str_format(&query, NM_VM_GET_ADDDRIVES_SQL, name->data);
-    nm_db_select(query.data, &drives);
+    nm_db_select_vm(NM_STMT_VM_GET_ADDDRIVES, name->data, &drives);
 
     if (drives.n_memb == 0) {
         nm_warn(_(NM_MSG_DRV_NONE));
@@ -202,27 +228,73 @@ void nm_del_drive(const nm_str_t *name)
     if (unlink(drive_path.data) == -1)
         nm_warn(_(NM_MSG_DRV_EDEL));
 
-    nm_str_format(&query, NM_DEL_DRIVE_SQL,
-        name->data, nm_vect_str_ctx(&drives, 2 * (m_drvs.highlight - 1)));
+    stmt = nm_db_stmt(NM_STMT_DEL_DRIVE);
+    nm_db_bind_text(stmt, 1, name->data);
+    nm_db_bind_text(stmt, 2, nm_vect_str_ctx(&drives, 2 * (m_drvs.highlight - 1)));
+    nm_db_stmt_exec(stmt);
 
 quit:
-    nm_db_edit(query.data);
     werase(side_window);
     werase(help_window);
     nm_init_help_main();
 
 out:
-    nm_str_free(&query);
     nm_str_free(&drive_path);
     nm_vect_free(&drv_list, NULL);
     nm_vect_free(&drives, nm_str_vect_free_cb);
 }
 
 int nm_add_drive_to_fs(const nm_str_t *name, const nm_str_t *size,
-    const nm_vect_t *drives)
+    const nm_db_result_t *drives)
+{
+    return nm_add_drive_create(name, size,
+            (drives != NULL) ? nm_db_res_rows(drives) : 0, NULL);
+}
+
+/* Runs in job thread */
+static int nm_add_drive_run(nm_job_t *job)
+{
+    nm_add_drive_job_t *drv = job->ctx;
+    int rc;
+
+    rc = nm_add_drive_create(&drv->name, &drv->size,
+            nm_db_res_rows(&drv->vm.drives), job);
+    if (rc != NM_OK && !nm_job_canceled(job))
+        nm_str_format(&job->error, _("cannot create image file"));
+
+    return rc;
+}
+
+static int nm_add_drive_done(nm_job_t *job, int rc)
+{
+    nm_add_drive_job_t *drv = job->ctx;
+
+    if (rc == NM_OK)
+        nm_add_drive_to_db(&drv->name, &drv->size, &drv->type,
+                &drv->vm.drives, &drv->discard);
+
+    return rc;
+}
+
+static void nm_add_drive_free(void *ctx)
+{
+    nm_add_drive_job_t *drv = ctx;
+
+    nm_str_free(&drv->name);
+    nm_str_free(&drv->size);
+    nm_str_free(&drv->type);
+    nm_str_free(&drv->discard);
+    nm_vmctl_free_data(&drv->vm);
+    free(drv);
+}
+
+/* job may be NULL, qemu-img is killed on job cancel */
+static int nm_add_drive_create(const nm_str_t *name, const nm_str_t *size,
+                               size_t drive_count, nm_job_t *job)
 {
     nm_str_t buf = NM_INIT_STR;
     nm_vect_t argv = NM_INIT_VECT;
+    int rc;
 
     nm_str_format(&buf, "%s/qemu-img", nm_cfg_get()->qemu_bin_path.data);
     nm_vect_insert(&argv, buf.data, buf.len + 1, NULL);
@@ -232,11 +304,6 @@ int nm_add_drive_to_fs(const nm_str_t *name, const nm_str_t *size,
     nm_vect_insert_cstr(&argv, "qcow2");
 
 //@TODO Fix conversion from size_t to char (might be a problem if there is too many drives)
-    size_t drive_count = 0;
-
-    if (drives != NULL)
-        drive_count = drives->n_memb / 4;
-
     char drv_ch = 'a' + drive_count;
 
 //@TODO Why add VM name twice (in directory name and in filename)?
@@ -248,21 +315,20 @@ int nm_add_drive_to_fs(const nm_str_t *name, const nm_str_t *size,
     nm_vect_insert(&argv, buf.data, buf.len + 1, NULL);
 
     nm_vect_end_zero(&argv);
-    if (nm_spawn_process(&argv, NULL) != NM_OK)
-        return NM_ERR;
+    rc = nm_job_spawn(job, &argv, NULL);
 
     nm_str_free(&buf);
     nm_vect_free(&argv, NULL);
 
-    return NM_OK;
+    return rc;
 }
 
 static void nm_add_drive_to_db(const nm_str_t *name, const nm_str_t *size,
-                               const nm_str_t *type, const nm_vect_t *drives,
+                               const nm_str_t *type, const nm_db_result_t *drives,
                                const nm_str_t *discard)
 {
 //@TODO Fix conversion from size_t to char (might be a problem if there is too many drives)
-    size_t drive_count = drives->n_memb / 4;
+    size_t drive_count = nm_db_res_rows(drives);
     char drv_ch = 'a' + drive_count;
     nm_str_t query = NM_INIT_STR;
 
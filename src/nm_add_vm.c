@@ -29,7 +29,8 @@ static const char NM_VM_FORM_NET_DRV[]   = "Net driver";
 static void nm_add_vm_field_setup(int import);
 static void nm_add_vm_field_names(nm_vect_t *msg, int import);
 static int nm_add_vm_get_data(nm_vm_t *vm, int import);
-static void nm_add_vm_to_fs(nm_vm_t *vm, int import);
+static void nm_add_vm_to_fs(nm_vm_t *vm, int import,
+        nm_file_progress_t *progress);
 static void nm_add_vm_main(int import);
 
 enum {
@@ -64,6 +65,7 @@ static void nm_add_vm_main(int import)
     nm_vm_t vm = NM_INIT_VM;
     nm_vect_t msg_fields = NM_INIT_VECT;
     nm_spinner_data_t sp_data = NM_INIT_SPINNER;
+    nm_file_progress_t progress = NM_INIT_FILE_PROGRESS;
     nm_form_data_t form_data = NM_INIT_FORM_DATA;
     uint64_t last_mac;
     uint32_t last_vnc;
@@ -112,13 +114,13 @@ static void nm_add_vm_main(int import)
 
     if (import) {
         sp_data.stop = &done;
-        sp_data.ctx = &vm;
+        sp_data.ctx = &progress;
 
         if (pthread_create(&spin_th, NULL, nm_file_progress, (void *) &sp_data) != 0)
             nm_bug(_("%s: cannot create thread"), __func__);
     }
 
-    nm_add_vm_to_fs(&vm, import);
+    nm_add_vm_to_fs(&vm, import, &progress);
     nm_add_vm_to_db(&vm, last_mac, import, NULL);
 
     if (import) {
@@ -361,7 +363,8 @@ void nm_add_vm_to_db(nm_vm_t *vm, uint64_t mac,
     nm_str_free(&query);
 }
 
-static void nm_add_vm_to_fs(nm_vm_t *vm, int import)
+static void nm_add_vm_to_fs(nm_vm_t *vm, int import,
+        nm_file_progress_t *progress)
 {
     nm_str_t vm_dir = NM_INIT_STR;
     nm_str_t buf = NM_INIT_STR;
@@ -377,8 +380,14 @@ static void nm_add_vm_to_fs(nm_vm_t *vm, int import)
         if (nm_add_drive_to_fs(&vm->name, &vm->drive.size, NULL) != NM_OK)
             nm_bug(_("%s: cannot create image file"), __func__);
     } else {
+        int err;
+
         nm_str_format(&buf, "%s/%s_a.img", vm_dir.data, vm->name.data);
-        nm_copy_file(&vm->srcp, &buf);
+        if ((err = nm_copy_file_cb(&vm->srcp, &buf,
+                        nm_file_progress_cb, progress)) != 0) {
+            nm_bug(_("%s: cannot copy %s: %s"),
+                    __func__, vm->srcp.data, strerror(err));
+        }
     }
 
     nm_str_free(&vm_dir);
@@ -62,6 +62,8 @@ static const char NM_INI_P_QLOG[]       = "log_cmd";
 static const char NM_INI_P_PID[]        = "pid";
 static const char NM_INI_P_AUTO[]       = "autostart";
 static const char NM_INI_P_SLP[]        = "sleep";
+static const char NM_INI_P_SOCK[]       = "qmp_sock";
+static const char NM_INI_P_METR[]       = "metrics";
 #if defined (NM_WITH_DBUS)
 static const char NM_INI_P_DYES[]       = "dbus_enabled";
 static const char NM_INI_P_DTMT[]       = "dbus_timeout";
@@ -276,6 +278,17 @@ void nm_cfg_init(void)
     }
 
     nm_get_param(ini, NM_INI_S_DMON, NM_INI_P_PID, &cfg.daemon_pid, NULL);
+    if (nm_get_opt_param(ini, NM_INI_S_DMON, NM_INI_P_SOCK, &cfg.daemon_sock) != NM_OK) {
+        /* /tmp/nemu-monitor.pid -> /tmp/nemu-monitor.sock */
+        nm_str_copy(&cfg.daemon_sock, &cfg.daemon_pid);
+        if (cfg.daemon_sock.len > 4 &&
+                !strcmp(cfg.daemon_sock.data + cfg.daemon_sock.len - 4, ".pid")) {
+            nm_str_trunc(&cfg.daemon_sock, cfg.daemon_sock.len - 4);
+        }
+        nm_str_add_text(&cfg.daemon_sock, ".sock");
+    }
+    /* optional, exporter is disabled if not set */
+    nm_get_opt_param(ini, NM_INI_S_DMON, NM_INI_P_METR, &cfg.daemon_metrics);
     nm_str_trunc(&tmp_buf, 0);
     if (nm_get_opt_param(ini, NM_INI_S_DMON, NM_INI_P_SLP, &tmp_buf) == NM_OK) {
         cfg.daemon_sleep = nm_str_stoul(&tmp_buf, 10);
@@ -322,6 +335,8 @@ void nm_cfg_free(void)
 #endif
     nm_str_free(&cfg.log_path);
     nm_str_free(&cfg.daemon_pid);
+    nm_str_free(&cfg.daemon_sock);
+    nm_str_free(&cfg.daemon_metrics);
     nm_str_free(&cfg.qemu_bin_path);
     nm_vect_free(&cfg.qemu_targets, NULL);
 }
@@ -463,7 +478,11 @@ static void nm_generate_cfg(const char *home, const nm_str_t *cfg_path)
                 "log_cmd = /tmp/qemu_last_cmd.log\n\n");
             fprintf(cfg_file, "[nemu-monitor]\n"
                     "# Auto start monitoring daemon\nautostart = 1\n\n"
-                    "# Monitoring daemon pid file\npid = /tmp/nemu-monitor.pid"
+                    "# Monitoring daemon pid file\npid = /tmp/nemu-monitor.pid\n\n"
+                    "# Monitoring daemon socket for QMP commands\n"
+                    "qmp_sock = /tmp/nemu-monitor.sock\n\n"
+                    "# Prometheus metrics: unix socket path or [127.0.0.1:]port\n"
+                    "# metrics = 127.0.0.1:9170"
 #ifdef NM_WITH_DBUS
                     "\n\n# Enable D-Bus feature\ndbus_enabled = 1\n\n"
                     "# Message timeout (ms)\ndbus_timeout = 2000"
@@ -1,4 +1,5 @@
 #include <nm_core.h>
+#include <nm_job.h>
 #include <nm_form.h>
 #include <nm_utils.h>
 #include <nm_string.h>
@@ -9,29 +10,64 @@
 #include <nm_vm_control.h>
 #include <nm_clone_vm.h>
 
-static const char NM_CLONE_NAME_MSG[] = "Name";
-
-static void nm_clone_vm_to_fs(const nm_str_t *src, const nm_str_t *dst,
-                              const nm_vect_t *drives);
+/*
+ * Full clone copies drives, on btrfs/xfs nm_copy_file() makes
+ * reflink copy. Linked clone creates qcow2 overlays with drives
+ * of source VM as backing files, source VM is left as read-only
+ * base while clones exist (drives.backing_vm).
+ * Drives are created by background job, VM is added to database
+ * when all of them are ready.
+ */
+
+static const char NM_QCOW2_MAGIC[] = "QFI\xfb";
+
+enum {
+    NM_FLD_NAME = 0,
+    NM_FLD_LINK,
+    NM_FLD_COUNT
+};
+
+static const char *nm_form_msg[] = {
+    "Name", "Linked clone", NULL
+};
+
+typedef struct {
+    nm_str_t src;
+    nm_str_t dst;
+    nm_vmctl_data_t vm;
+    bool linked;
+    bool created;       /* directory of clone is created by job */
+    nm_job_t *job;
+    uint64_t base;      /* bytes of drives copied before current one */
+    uint64_t total;     /* bytes of all drives */
+} nm_clone_job_t;
+
+static int nm_clone_vm_run(nm_job_t *job);
+static int nm_clone_vm_done(nm_job_t *job, int rc);
+static void nm_clone_vm_free(void *ctx);
+static int nm_clone_vm_to_fs(nm_clone_job_t *cl);
 static void nm_clone_vm_to_db(const nm_str_t *src, const nm_str_t *dst,
-                              const nm_vmctl_data_t *vm);
+                              const nm_vmctl_data_t *vm, bool linked);
+static void nm_clone_vm_drive_path(const nm_clone_job_t *cl, size_t n,
+                                   nm_str_t *src, nm_str_t *dst);
+static int nm_clone_vm_copy_cb(uint64_t done, uint64_t total, void *ctx);
+static int nm_clone_vm_overlay(const nm_str_t *base, const nm_str_t *path,
+                               nm_job_t *job);
+static const char *nm_clone_vm_drive_fmt(const nm_str_t *path);
 
 void nm_clone_vm(const nm_str_t *name)
 {
     nm_form_t *form = NULL;
-    nm_field_t *fields[2];
-    nm_vmctl_data_t vm = NM_VMCTL_INIT_DATA;
+    nm_field_t *fields[NM_FLD_COUNT + 1];
+    nm_clone_job_t *cl = NULL;
     nm_form_data_t form_data = NM_INIT_FORM_DATA;
     nm_str_t buf = NM_INIT_STR;
     nm_str_t cl_name = NM_INIT_STR;
-    nm_spinner_data_t sp_data = NM_INIT_SPINNER;
+    nm_str_t link = NM_INIT_STR;
     nm_vect_t err = NM_INIT_VECT;
-    size_t msg_len;
-    pthread_t spin_th;
-    int done = 0;
+    size_t msg_len = nm_max_msg_len(nm_form_msg);
 
-    msg_len = mbstowcs(NULL, NM_CLONE_NAME_MSG, strlen(NM_CLONE_NAME_MSG));
-    if (nm_form_calc_size(msg_len, 1, &form_data) != NM_OK)
+    if (nm_form_calc_size(msg_len, NM_FLD_COUNT, &form_data) != NM_OK)
         return;
 
     werase(action_window);
@@ -39,24 +75,30 @@ void nm_clone_vm(const nm_str_t *name)
     nm_init_action(_(NM_MSG_CLONE));
     nm_init_help_clone();
 
-    nm_vmctl_get_data(name, &vm);
+    for (size_t n = 0; n < NM_FLD_COUNT; ++n)
+        fields[n] = new_field(1, form_data.form_len, n * 2, 0, 0, 0);
 
-    fields[0] = new_field(1, form_data.form_len, 0, 0, 0, 0);
-    fields[1] = NULL;
+    fields[NM_FLD_COUNT] = NULL;
 
-    set_field_type(fields[0], TYPE_REGEXP, "^[a-zA-Z0-9_-]{1,30} *$");
+    set_field_type(fields[NM_FLD_NAME], TYPE_REGEXP, "^[a-zA-Z0-9_-]{1,30} *$");
+    set_field_type(fields[NM_FLD_LINK], TYPE_ENUM, nm_form_yes_no, false, false);
 
     nm_str_format(&buf, "%s-clone", name->data);
-    set_field_buffer(fields[0], 0, buf.data);
+    set_field_buffer(fields[NM_FLD_NAME], 0, buf.data);
+    set_field_buffer(fields[NM_FLD_LINK], 0, nm_form_yes_no[1]);
 
-    mvwaddstr(form_data.form_window, 1, 2, _(NM_CLONE_NAME_MSG));
+    for (size_t n = 0, y = 1, x = 2; n < NM_FLD_COUNT; n++) {
+        mvwaddstr(form_data.form_window, y, x, _(nm_form_msg[n]));
+        y += 2;
+    }
 
     form = nm_post_form(form_data.form_window, fields, msg_len + 4, NM_TRUE);
     if (nm_draw_form(action_window, form) != NM_OK)
         goto out;
 
-    nm_get_field_buf(fields[0], &cl_name);
-    nm_form_check_data(_(NM_CLONE_NAME_MSG), cl_name, err);
+    nm_get_field_buf(fields[NM_FLD_NAME], &cl_name);
+    nm_get_field_buf(fields[NM_FLD_LINK], &link);
+    nm_form_check_data(_(nm_form_msg[NM_FLD_NAME]), cl_name, err);
 
     if (nm_print_empty_fields(&err) == NM_ERR) {
         nm_vect_free(&err, NULL);
@@ -66,72 +108,131 @@ void nm_clone_vm(const nm_str_t *name)
     if (nm_form_name_used(&cl_name) == NM_ERR)
         goto out;
 
-    sp_data.stop = &done;
-
-    if (pthread_create(&spin_th, NULL, nm_progress_bar, (void *) &sp_data) != 0)
-        nm_bug(_("%s: cannot create thread"), __func__);
-
-    nm_clone_vm_to_fs(name, &cl_name, &vm.drives);
-    nm_clone_vm_to_db(name, &cl_name, &vm);
+    cl = nm_calloc(1, sizeof(nm_clone_job_t));
+    nm_str_copy(&cl->src, name);
+    nm_str_copy(&cl->dst, &cl_name);
+    cl->vm = NM_VMCTL_INIT_DATA;
+    nm_vmctl_get_data(name, &cl->vm);
+    cl->linked = (nm_str_cmp_st(&link, "yes") == NM_OK);
 
-    done = 1;
-    if (pthread_join(spin_th, NULL) != 0)
-        nm_bug(_("%s: cannot join thread"), __func__);
+    nm_str_format(&buf, "clone %s to %s", name->data, cl_name.data);
+    cl->job = nm_job_new(&buf, nm_clone_vm_run, nm_clone_vm_done,
+            cl, nm_clone_vm_free);
+    nm_job_add_vm(cl->job, name);
+    nm_job_add_vm(cl->job, &cl_name);
+    nm_job_submit(cl->job);
 
 out:
     NM_FORM_EXIT();
-    nm_vmctl_free_data(&vm);
     nm_form_free(form, fields);
     nm_str_free(&buf);
     nm_str_free(&cl_name);
+    nm_str_free(&link);
 }
 
-static void nm_clone_vm_to_fs(const nm_str_t *src, const nm_str_t *dst,
-                              const nm_vect_t *drives)
+/* Runs in job thread */
+static int nm_clone_vm_run(nm_job_t *job)
 {
-    nm_str_t old_vm_path = NM_INIT_STR;
-    nm_str_t new_vm_path = NM_INIT_STR;
-    nm_str_t new_vm_dir = NM_INIT_STR;
-    size_t drives_count;
-    char drv_ch = 'a';
+    return nm_clone_vm_to_fs(job->ctx);
+}
 
-    nm_str_format(&new_vm_dir, "%s/%s", nm_cfg_get()->vm_dir.data, dst->data);
+static int nm_clone_vm_done(nm_job_t *job, int rc)
+{
+    nm_clone_job_t *cl = job->ctx;
+    nm_str_t src = NM_INIT_STR;
+    nm_str_t dst = NM_INIT_STR;
 
-    if (mkdir(new_vm_dir.data, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) != 0) {
-        nm_bug(_("%s: cannot create VM directory %s: %s"),
-               __func__, new_vm_dir.data, strerror(errno));
+    if (rc == NM_OK) {
+        nm_clone_vm_to_db(&cl->src, &cl->dst, &cl->vm, cl->linked);
+        return NM_OK;
     }
 
-    nm_str_format(&new_vm_path, "%s/%s",
-        new_vm_dir.data, dst->data);
-    nm_str_format(&old_vm_path, "%s/%s/",
-        nm_cfg_get()->vm_dir.data, src->data);
+    if (!cl->created)
+        return NM_ERR;
 
-    drives_count = drives->n_memb / NM_DRV_IDX_COUNT;
+    /* incomplete clone is removed */
+    for (size_t n = 0; n < nm_db_res_rows(&cl->vm.drives); n++) {
+        nm_clone_vm_drive_path(cl, n, &src, &dst);
+        unlink(dst.data);
+    }
 
-    for (size_t n = 0; n < drives_count; n++) {
-        size_t idx_shift = NM_DRV_IDX_COUNT * n;
-        nm_str_t *drive_name = nm_vect_str(drives, NM_SQL_DRV_NAME + idx_shift);
+    nm_str_format(&dst, "%s/%s", nm_cfg_get()->vm_dir.data, cl->dst.data);
+    rmdir(dst.data);
 
-        nm_str_add_str(&old_vm_path, drive_name);
-        nm_str_append_format(&new_vm_path, "_%c.img", drv_ch);
+    nm_str_free(&src);
+    nm_str_free(&dst);
 
-        nm_copy_file(&old_vm_path, &new_vm_path);
+    return NM_ERR;
+}
 
-        nm_str_trunc(&old_vm_path, old_vm_path.len - drive_name->len);
-        nm_str_trunc(&new_vm_path, new_vm_path.len - 6);
-        drv_ch++;
+static void nm_clone_vm_free(void *ctx)
+{
+    nm_clone_job_t *cl = ctx;
+
+    nm_str_free(&cl->src);
+    nm_str_free(&cl->dst);
+    nm_vmctl_free_data(&cl->vm);
+    free(cl);
+}
+
+static int nm_clone_vm_to_fs(nm_clone_job_t *cl)
+{
+    nm_str_t src = NM_INIT_STR;
+    nm_str_t dst = NM_INIT_STR;
+    size_t drives_count = nm_db_res_rows(&cl->vm.drives);
+    uint64_t total = 0;
+    int rc = NM_OK, err;
+
+    nm_str_format(&dst, "%s/%s", nm_cfg_get()->vm_dir.data, cl->dst.data);
+
+    if (mkdir(dst.data, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) != 0) {
+        cl->job->err = errno;
+        nm_str_format(&cl->job->error, _("cannot create %s"), dst.data);
+        rc = NM_ERR;
+        goto out;
     }
+    cl->created = true;
+
+    /* progress of all drives */
+    for (size_t n = 0; n < drives_count && !cl->linked; n++) {
+        struct stat info;
 
-    nm_str_free(&old_vm_path);
-    nm_str_free(&new_vm_path);
-    nm_str_free(&new_vm_dir);
+        nm_clone_vm_drive_path(cl, n, &src, &dst);
+        if (stat(src.data, &info) == 0)
+            total += info.st_size;
+    }
+    cl->total = total;
+    nm_job_set_progress(cl->job, 0, total);
+
+    for (size_t n = 0; n < drives_count && rc == NM_OK; n++) {
+        nm_clone_vm_drive_path(cl, n, &src, &dst);
+
+        if (cl->linked) {
+            rc = nm_clone_vm_overlay(&src, &dst, cl->job);
+        } else {
+            err = nm_copy_file_cb(&src, &dst, nm_clone_vm_copy_cb, cl);
+            nm_job_get_progress(cl->job, &cl->base, &cl->total);
+            if (err && err != ECANCELED)
+                cl->job->err = err;
+            rc = err ? NM_ERR : NM_OK;
+        }
+
+        if (rc != NM_OK && !nm_job_canceled(cl->job))
+            nm_str_format(&cl->job->error, _("cannot create %s"), dst.data);
+    }
+
+out:
+    nm_str_free(&src);
+    nm_str_free(&dst);
+
+    return rc;
 }
 
 static void nm_clone_vm_to_db(const nm_str_t *src, const nm_str_t *dst,
-                              const nm_vmctl_data_t *vm)
+                              const nm_vmctl_data_t *vm, bool linked)
 {
-    nm_str_t query = NM_INIT_STR;
+    nm_str_t drive_name = NM_INIT_STR;
+    nm_db_stmt_t *stmt;
     uint64_t last_mac;
     uint32_t last_vnc;
     size_t ifs_count;
@@ -141,8 +242,11 @@ static void nm_clone_vm_to_db(const nm_str_t *src, const nm_str_t *dst,
     last_mac = nm_form_get_last_mac();
     last_vnc = nm_form_get_free_vnc();
 
-    nm_str_format(&query, NM_CLONE_VMS_SQL, dst->data, last_vnc, src->data);
-    nm_db_edit(query.data);
+    stmt = nm_db_stmt(NM_STMT_CLONE_VMS);
+    nm_db_bind_text(stmt, 1, dst->data);
+    nm_db_bind_int(stmt, 2, last_vnc);
+    nm_db_bind_text(stmt, 3, src->data);
+    nm_db_stmt_exec(stmt);
 
     /* insert network interface info */
     ifs_count = vm->ifs.n_memb / NM_IFS_IDX_COUNT;
@@ -160,17 +264,16 @@ static void nm_clone_vm_to_db(const nm_str_t *src, const nm_str_t *dst,
         nm_str_copy(&if_name_copy, &if_name);
         altname = nm_net_fix_tap_name(&if_name, &maddr);
 
-        nm_str_format(&query,
-            "INSERT INTO ifaces(vm_name, if_name, mac_addr, if_drv, vhost, "
-            "macvtap, parent_eth, altname, netuser) "
-            "VALUES ('%s', '%s', '%s', '%s', '%s', '%s', '%s', '%s', 0)",
-            dst->data, if_name.data, maddr.data,
-            nm_vect_str(&vm->ifs, NM_SQL_IF_DRV + idx_shift)->data,
-            nm_vect_str(&vm->ifs, NM_SQL_IF_VHO + idx_shift)->data,
-            nm_vect_str(&vm->ifs, NM_SQL_IF_MVT + idx_shift)->data,
-            nm_vect_str(&vm->ifs, NM_SQL_IF_PET + idx_shift)->data,
-            (altname) ? if_name_copy.data : "");
-        nm_db_edit(query.data);
+        stmt = nm_db_stmt(NM_STMT_CLONE_IFACE);
+        nm_db_bind_text(stmt, 1, dst->data);
+        nm_db_bind_text(stmt, 2, if_name.data);
+        nm_db_bind_text(stmt, 3, maddr.data);
+        nm_db_bind_text(stmt, 4, nm_db_res_cstr(&vm->ifs, NM_SQL_IF_DRV + idx_shift));
+        nm_db_bind_text(stmt, 5, nm_db_res_cstr(&vm->ifs, NM_SQL_IF_VHO + idx_shift));
+        nm_db_bind_text(stmt, 6, nm_db_res_cstr(&vm->ifs, NM_SQL_IF_MVT + idx_shift));
+        nm_db_bind_text(stmt, 7, nm_db_res_cstr(&vm->ifs, NM_SQL_IF_PET + idx_shift));
+        nm_db_bind_text(stmt, 8, (altname) ? if_name_copy.data : "");
+        nm_db_stmt_exec(stmt);
 
         nm_str_free(&if_name);
         nm_str_free(&if_name_copy);
@@ -182,21 +285,112 @@ static void nm_clone_vm_to_db(const nm_str_t *src, const nm_str_t *dst,
 
     for (size_t n = 0; n < drives_count; n++) {
         size_t idx_shift = NM_DRV_IDX_COUNT * n;
-
-        nm_str_format(&query,
-            "INSERT INTO drives(vm_name, drive_name, drive_drv, capacity, boot, discard) "
-            "VALUES('%s', '%s_%c.img', '%s', '%s', '%s', '%s')",
-            dst->data, dst->data, drv_ch,
-            nm_vect_str(&vm->drives, NM_SQL_DRV_TYPE + idx_shift)->data,
-            nm_vect_str(&vm->drives, NM_SQL_DRV_SIZE + idx_shift)->data,
-            nm_vect_str(&vm->drives, NM_SQL_DRV_BOOT + idx_shift)->data,
-            nm_vect_str(&vm->drives, NM_SQL_DRV_DISC + idx_shift)->data);
-        nm_db_edit(query.data);
+        const nm_str_t *base = nm_db_res_str(&vm->drives, NM_SQL_DRV_BACK + idx_shift);
+        const char *backing = NULL;
+
+        /* full copy of overlay keeps backing file of the source */
+        if (linked)
+            backing = src->data;
+        else if (base->len)
+            backing = base->data;
+
+        nm_str_format(&drive_name, "%s_%c.img", dst->data, drv_ch);
+
+        stmt = nm_db_stmt(NM_STMT_CLONE_DRIVE);
+        nm_db_bind_text(stmt, 1, dst->data);
+        nm_db_bind_text(stmt, 2, drive_name.data);
+        nm_db_bind_text(stmt, 3, nm_db_res_cstr(&vm->drives, NM_SQL_DRV_TYPE + idx_shift));
+        nm_db_bind_text(stmt, 4, nm_db_res_cstr(&vm->drives, NM_SQL_DRV_SIZE + idx_shift));
+        nm_db_bind_text(stmt, 5, nm_db_res_cstr(&vm->drives, NM_SQL_DRV_BOOT + idx_shift));
+        nm_db_bind_text(stmt, 6, nm_db_res_cstr(&vm->drives, NM_SQL_DRV_DISC + idx_shift));
+        /* NULL text is bound as SQL NULL */
+        nm_db_bind_text(stmt, 7, backing);
+        nm_db_stmt_exec(stmt);
 
         drv_ch++;
     }
 
-    nm_str_free(&query);
+    nm_str_free(&drive_name);
+}
+
+/* Source drive of n-th drive and its copy, names are <vm>_<a..z>.img */
+static void nm_clone_vm_drive_path(const nm_clone_job_t *cl, size_t n,
+                                   nm_str_t *src, nm_str_t *dst)
+{
+    const nm_cfg_t *cfg = nm_cfg_get();
+
+    nm_str_format(src, "%s/%s/%s", cfg->vm_dir.data, cl->src.data,
+            nm_db_res_cstr(&cl->vm.drives, NM_SQL_DRV_NAME + n * NM_DRV_IDX_COUNT));
+    nm_str_format(dst, "%s/%s/%s_%c.img", cfg->vm_dir.data,
+            cl->dst.data, cl->dst.data, (char) ('a' + n));
+}
+
+static int nm_clone_vm_copy_cb(uint64_t done, uint64_t total, void *ctx)
+{
+    nm_clone_job_t *cl = ctx;
+
+    (void) total;
+    nm_job_set_progress(cl->job, cl->base + done, cl->total);
+
+    return nm_job_canceled(cl->job) ? NM_ERR : NM_OK;
+}
+
+/* qemu-img create -f qcow2 -F fmt -b base path, size is taken from base */
+static int nm_clone_vm_overlay(const nm_str_t *base, const nm_str_t *path,
+                               nm_job_t *job)
+{
+    nm_str_t buf = NM_INIT_STR;
+    nm_vect_t argv = NM_INIT_VECT;
+    const char *fmt;
+    int rc;
+
+    if ((fmt = nm_clone_vm_drive_fmt(base)) == NULL)
+        return NM_ERR;
+
+    nm_str_format(&buf, "%s/qemu-img", nm_cfg_get()->qemu_bin_path.data);
+    nm_vect_insert(&argv, buf.data, buf.len + 1, NULL);
+
+    nm_vect_insert_cstr(&argv, "create");
+    nm_vect_insert_cstr(&argv, "-f");
+    nm_vect_insert_cstr(&argv, "qcow2");
+    nm_vect_insert_cstr(&argv, "-F");
+    nm_vect_insert_cstr(&argv, fmt);
+    nm_vect_insert_cstr(&argv, "-b");
+    nm_vect_insert(&argv, base->data, base->len + 1, NULL);
+    nm_vect_insert(&argv, path->data, path->len + 1, NULL);
+
+    nm_vect_end_zero(&argv);
+    rc = nm_job_spawn(job, &argv, NULL);
+
+    nm_str_free(&buf);
+    nm_vect_free(&argv, NULL);
+
+    return rc;
+}
+
+/*
+ * Imported drives may be raw, format is required for backing file.
+ * Returns NULL if drive cannot be read.
+ */
+static const char *nm_clone_vm_drive_fmt(const nm_str_t *path)
+{
+    char magic[sizeof(NM_QCOW2_MAGIC) - 1];
+    const char *fmt = "raw";
+    int fd;
+
+    if ((fd = open(path->data, O_RDONLY)) == -1) {
+        nm_debug("%s: cannot open file %s: %s\n",
+                __func__, path->data, strerror(errno));
+        return NULL;
+    }
+
+    if (read(fd, magic, sizeof(magic)) == sizeof(magic) &&
+            !memcmp(magic, NM_QCOW2_MAGIC, sizeof(magic)))
+        fmt = "qcow2";
+
+    close(fd);
+
+    return fmt;
 }
 
 /* vim:set ts=4 sw=4: */
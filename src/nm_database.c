@@ -5,18 +5,95 @@
 #include <nm_cfg_file.h>
 #include <nm_database.h>
 
+#include <time.h>
 #include <sqlite3.h>
 
 typedef sqlite3 nm_sqlite_t;
 
 static nm_sqlite_t *db_handler = NULL;
 static bool db_in_transaction = false;
+static bool db_in_read = false;
+static uint64_t db_generation = 0;
+static int64_t db_data_version = -1;
 static const char db_script[] = NM_FULL_DATAROOTDIR "/nemu/scripts/upgrade_db.sh";
 
+static sqlite3_stmt *db_stmt[NM_STMT_COUNT];
+static const char *const db_stmt_sql[NM_STMT_COUNT] = {
+    [NM_STMT_VM_FILTER_LIST]     = NM_VM_FILTER_LIST_SQL,
+    [NM_STMT_VM_FILTER_IFACES]   = NM_VM_FILTER_IFACES_SQL,
+    [NM_STMT_VM_GET_LIST]        = NM_VM_GET_LIST_SQL,
+    [NM_STMT_VM_GET_IFACES]      = NM_VM_GET_IFACES_SQL,
+    [NM_STMT_VM_GET_DRIVES]      = NM_VM_GET_DRIVES_SQL,
+    [NM_STMT_VM_GET_CLONES]      = NM_VM_GET_CLONES_SQL,
+    [NM_STMT_USB_GET]            = NM_USB_GET_SQL,
+    [NM_STMT_USB_GET_BOUND]      = NM_USB_GET_BOUND_SQL,
+    [NM_STMT_GET_VMSNAP_LOAD]    = NM_GET_VMSNAP_LOAD_SQL,
+    [NM_STMT_VMCTL_GET_VNC_PORT] = NM_VMCTL_GET_VNC_PORT_SQL,
+    [NM_STMT_DATA_VERSION]       = NM_GET_DATA_VERSION_SQL,
+    [NM_STMT_CLONE_VMS]          = NM_CLONE_VMS_SQL,
+    [NM_STMT_CLONE_IFACE]        = NM_CLONE_IFACE_SQL,
+    [NM_STMT_CLONE_DRIVE]        = NM_CLONE_DRIVE_SQL,
+    [NM_STMT_RENAME_VM]          = NM_RENAME_VM_SQL,
+    [NM_STMT_RENAME_DRIVE]       = NM_RENAME_DRIVE_SQL,
+    [NM_STMT_RENAME_IFACE]       = NM_RENAME_IFACE_SQL,
+    [NM_STMT_VM_SET_VNC]         = NM_VM_SET_VNC_SQL,
+    [NM_STMT_RESET_INSTALL]      = NM_RESET_INSTALL_SQL,
+    [NM_STMT_RESET_LOAD]         = NM_RESET_LOAD_SQL,
+    [NM_STMT_DEL_VM]             = NM_DEL_VM_SQL,
+    [NM_STMT_DEL_DRIVE]          = NM_DEL_DRIVE_SQL,
+    [NM_STMT_SELECT_DRIVE_NAMES] = NM_SELECT_DRIVE_NAMES_SQL,
+    [NM_STMT_VM_GET_ADDDRIVES]   = NM_VM_GET_ADDDRIVES_SQL,
+    [NM_STMT_GET_BOOT_DRIVE]     = NM_GET_BOOT_DRIVE_SQL,
+    [NM_STMT_USB_ADD]            = NM_USB_ADD_SQL,
+    [NM_STMT_USB_DELETE]         = NM_USB_DELETE_SQL,
+    [NM_STMT_USB_EXISTS]         = NM_USB_EXISTS_SQL,
+    [NM_STMT_USB_CHECK]          = NM_USB_CHECK_SQL,
+    [NM_STMT_USB_UPDATE_STATE]   = NM_USB_UPDATE_STATE_SQL,
+    [NM_STMT_GET_SNAPS_ALL]      = NM_GET_SNAPS_ALL_SQL,
+    [NM_STMT_SNAP_GET_NAME]      = NM_SNAP_GET_NAME_SQL,
+    [NM_STMT_SNAP_UPDATE_LOAD]   = NM_SNAP_UPDATE_LOAD_SQL,
+    [NM_STMT_INSERT_SNAP]        = NM_INSERT_SNAP_SQL,
+    [NM_STMT_UPDATE_SNAP]        = NM_UPDATE_SNAP_SQL,
+    [NM_STMT_DELETE_SNAP]        = NM_DELETE_SNAP_SQL
+};
+
 static void nm_db_check_version(void);
 static int nm_db_update(void);
 static int nm_db_select_cb(void *v, int argc, char **argv,
                            char **unused NM_UNUSED);
+static void nm_db_stmt_debug(const char *func, nm_db_stmt_t *stmt);
+static void nm_db_result_add(nm_db_result_t *res, nm_db_stmt_t *stmt, int col);
+static int nm_db_busy_cb(void *unused NM_UNUSED, int count);
+static int nm_db_exec(const char *query, char **errmsg);
+static void nm_db_open(void);
+
+/*
+ * Child rows follow VM: removed with it and renamed with it.
+ * Deferred, so rows may be updated in any order inside transaction.
+ */
+#define NM_DB_VM_FK "REFERENCES vms(name) ON DELETE CASCADE " \
+    "ON UPDATE CASCADE DEFERRABLE INITIALLY DEFERRED"
+
+/* Base VM of linked clone is renamed with it, but cannot be removed */
+#define NM_DB_BASE_FK "REFERENCES vms(name) ON UPDATE CASCADE " \
+    "ON DELETE RESTRICT"
+
+enum {
+    NM_DB_RES_INIT_CELLS = 32,
+    NM_DB_RES_INIT_ARENA = 512
+};
+
+/*
+ * TUI, CLI and monitor daemon share the same database file.
+ * A locked database is waited for with exponential backoff
+ * up to NM_DB_BUSY_TIMEOUT before the error is reported.
+ */
+enum {
+    NM_DB_BUSY_MIN_DELAY = 1,    /* ms */
+    NM_DB_BUSY_MAX_DELAY = 100,  /* ms */
+    NM_DB_BUSY_TIMEOUT = 10000,  /* ms */
+    NM_DB_BUSY_RETRIES = 3
+};
 
 void nm_db_init(void)
 {
@@ -24,7 +101,6 @@ void nm_db_init(void)
     const nm_cfg_t *cfg = nm_cfg_get();
     int need_create_db = 0;
     char *db_errmsg;
-    int rc;
 
     const char *query[] = {
         "PRAGMA user_version=" NM_DB_VERSION,
@@ -37,23 +113,33 @@ void nm_db_init(void)
             "fs9p_path char, fs9p_name char, usb_type char, spice integer, "
             "debug_port integer, debug_freeze integer, cmdappend char, team char, display_type char)",
         "CREATE TABLE ifaces(id integer primary key autoincrement, "
-            "vm_name char, if_name char, mac_addr char, ipv4_addr char, "
+            "vm_name char " NM_DB_VM_FK ", if_name char, mac_addr char, ipv4_addr char, "
             "if_drv char, vhost integer, macvtap integer, parent_eth char, altname char, "
             "netuser integer, hostfwd char, smb char)",
-        "CREATE TABLE drives(id integer primary key autoincrement, vm_name char, "
-            "drive_name char, drive_drv char, capacity integer, boot integer, discard integer)",
+        "CREATE TABLE drives(id integer primary key autoincrement, "
+            "vm_name char " NM_DB_VM_FK ", "
+            "drive_name char, drive_drv char, capacity integer, boot integer, discard integer, "
+            "backing_vm char " NM_DB_BASE_FK ")",
         "CREATE TABLE vmsnapshots(id integer primary key autoincrement, "
-            "vm_name char, snap_name char, load integer, timestamp char)",
+            "vm_name char " NM_DB_VM_FK ", snap_name char, load integer, timestamp char)",
         "CREATE TABLE veth(id integer primary key autoincrement, l_name char, r_name char)",
         "CREATE TABLE usb(id integer primary key autoincrement, "
-            "vm_name char, dev_name char, vendor_id char, product_id char, serial char)"
+            "vm_name char " NM_DB_VM_FK ", "
+            "dev_name char, vendor_id char, product_id char, serial char)",
+        "CREATE UNIQUE INDEX vms_name_idx ON vms(name)",
+        "CREATE INDEX vms_team_idx ON vms(team)",
+        "CREATE INDEX ifaces_vm_name_idx ON ifaces(vm_name)",
+        "CREATE INDEX ifaces_parent_eth_idx ON ifaces(parent_eth)",
+        "CREATE INDEX drives_vm_name_idx ON drives(vm_name)",
+        "CREATE INDEX drives_backing_vm_idx ON drives(backing_vm)",
+        "CREATE INDEX vmsnapshots_vm_name_idx ON vmsnapshots(vm_name)",
+        "CREATE INDEX usb_vm_name_idx ON usb(vm_name)"
     };
 
     if (stat(cfg->db_path.data, &file_info) == -1)
         need_create_db = 1;
 
-    if ((rc = sqlite3_open(cfg->db_path.data, &db_handler)) != SQLITE_OK)
-        nm_bug(_("%s: database error: %s"), __func__, sqlite3_errstr(rc));
+    nm_db_open();
 
     if (!need_create_db) {
         nm_db_check_version();
@@ -95,8 +181,10 @@ void nm_db_edit(const char *query)
 
     nm_debug("%s: \"%s\"\n", __func__, query);
 
-    if (sqlite3_exec(db_handler, query, NULL, NULL, &db_errmsg) != SQLITE_OK)
+    if (nm_db_exec(query, &db_errmsg) != SQLITE_OK)
         nm_bug(_("%s: database error: %s"), __func__, db_errmsg);
+
+    db_generation++;
 }
 
 bool nm_db_in_transaction()
@@ -111,9 +199,14 @@ void nm_db_begin_transaction()
     if (db_in_transaction)
         nm_bug(_("%s: database already in transaction"), __func__);
 
-    nm_debug("%s: BEGIN TRANSACTION\n", __func__);
+    nm_debug("%s: BEGIN IMMEDIATE TRANSACTION\n", __func__);
 
-    if (sqlite3_exec(db_handler, "BEGIN TRANSACTION", NULL, NULL, &db_errmsg) != SQLITE_OK)
+    /*
+     * Take the write lock at once: deferred transaction started
+     * before another process commits cannot be upgraded and fails
+     * with SQLITE_BUSY without calling the busy handler.
+     */
+    if (nm_db_exec("BEGIN IMMEDIATE TRANSACTION", &db_errmsg) != SQLITE_OK)
         nm_bug(_("%s: database error: %s"), __func__, db_errmsg);
 
     db_in_transaction = true;
@@ -128,7 +221,7 @@ void nm_db_atomic(const char *query)
 
     nm_debug("%s: \"%s\"\n", __func__, query);
 
-    if (sqlite3_exec(db_handler, query, NULL, NULL, &db_errmsg) != SQLITE_OK)
+    if (nm_db_exec(query, &db_errmsg) != SQLITE_OK)
         nm_bug(_("%s: database error: %s"), __func__, db_errmsg);
 }
 
@@ -141,10 +234,11 @@ void nm_db_commit()
 
     nm_debug("%s: COMMIT\n", __func__);
 
-    if (sqlite3_exec(db_handler, "COMMIT", NULL, NULL, &db_errmsg) != SQLITE_OK)
+    if (nm_db_exec("COMMIT", &db_errmsg) != SQLITE_OK)
         nm_bug(_("%s: database error: %s"), __func__, db_errmsg);
 
     db_in_transaction = false;
+    db_generation++;
 }
 
 void nm_db_rollback()
@@ -162,11 +256,249 @@ void nm_db_rollback()
     db_in_transaction = false;
 }
 
+/*
+ * Read-only snapshot: several selects see the same state of the
+ * database and take the lock once. Not a write transaction, so
+ * nm_db_select() and friends may be used inside.
+ */
+void nm_db_read_begin(void)
+{
+    char *db_errmsg;
+
+    if (db_in_transaction || db_in_read)
+        nm_bug(_("%s: database already in transaction"), __func__);
+
+    if (nm_db_exec("BEGIN", &db_errmsg) != SQLITE_OK)
+        nm_bug(_("%s: database error: %s"), __func__, db_errmsg);
+
+    db_in_read = true;
+}
+
+void nm_db_read_end(void)
+{
+    char *db_errmsg;
+
+    if (!db_in_read)
+        nm_bug(_("%s: database not in transaction"), __func__);
+
+    if (nm_db_exec("COMMIT", &db_errmsg) != SQLITE_OK)
+        nm_bug(_("%s: database error: %s"), __func__, db_errmsg);
+
+    db_in_read = false;
+}
+
+/*
+ * Counter of writes made through this connection.
+ * Cached data loaded with older value must be reloaded.
+ */
+uint64_t nm_db_generation(void)
+{
+    return db_generation;
+}
+
+/*
+ * Returns NM_OK if other process (CLI, monitor daemon, another nemu)
+ * has committed changes since the last call. Generation is bumped then.
+ */
+int nm_db_changed_outside(void)
+{
+    nm_db_stmt_t *stmt = nm_db_stmt(NM_STMT_DATA_VERSION);
+    int64_t version = -1;
+    int rc = NM_ERR;
+
+    if (nm_db_step(stmt) == NM_OK) {
+        version = nm_db_column_int(stmt, 0);
+        nm_db_stmt_done(stmt);
+    }
+
+    if (db_data_version != -1 && version != db_data_version) {
+        db_generation++;
+        rc = NM_OK;
+    }
+
+    db_data_version = version;
+
+    return rc;
+}
+
 void nm_db_close(void)
 {
+    for (size_t n = 0; n < NM_STMT_COUNT; n++) {
+        sqlite3_finalize(db_stmt[n]);
+        db_stmt[n] = NULL;
+    }
+
     sqlite3_close(db_handler);
 }
 
+nm_db_stmt_t *nm_db_stmt(enum nm_db_stmt_id id)
+{
+    int rc;
+
+    if (id >= NM_STMT_COUNT)
+        nm_bug(_("%s: invalid statement id: %d"), __func__, id);
+
+    if (db_stmt[id]) {
+        sqlite3_reset(db_stmt[id]);
+        sqlite3_clear_bindings(db_stmt[id]);
+        return db_stmt[id];
+    }
+
+    nm_debug("%s: prepare \"%s\"\n", __func__, db_stmt_sql[id]);
+
+#if SQLITE_VERSION_NUMBER >= 3020000
+    rc = sqlite3_prepare_v3(db_handler, db_stmt_sql[id], -1,
+            SQLITE_PREPARE_PERSISTENT, &db_stmt[id], NULL);
+#else
+    rc = sqlite3_prepare_v2(db_handler, db_stmt_sql[id], -1,
+            &db_stmt[id], NULL);
+#endif
+    if (rc != SQLITE_OK)
+        nm_bug(_("%s: database error: %s"), __func__, sqlite3_errmsg(db_handler));
+
+    return db_stmt[id];
+}
+
+void nm_db_bind_text(nm_db_stmt_t *stmt, int idx, const char *text)
+{
+    if (sqlite3_bind_text(stmt, idx, text, -1, SQLITE_STATIC) != SQLITE_OK)
+        nm_bug(_("%s: database error: %s"), __func__, sqlite3_errmsg(db_handler));
+}
+
+void nm_db_bind_int(nm_db_stmt_t *stmt, int idx, int64_t val)
+{
+    if (sqlite3_bind_int64(stmt, idx, val) != SQLITE_OK)
+        nm_bug(_("%s: database error: %s"), __func__, sqlite3_errmsg(db_handler));
+}
+
+/*
+ * Returns NM_OK if row is available, NM_ERR when there are no more rows.
+ * Statement is reset automatically after the last row.
+ */
+int nm_db_step(nm_db_stmt_t *stmt)
+{
+    int rc = sqlite3_step(stmt);
+
+    if (rc == SQLITE_ROW)
+        return NM_OK;
+
+    sqlite3_reset(stmt);
+
+    if (rc != SQLITE_DONE)
+        nm_bug(_("%s: database error: %s"), __func__, sqlite3_errmsg(db_handler));
+
+    return NM_ERR;
+}
+
+const char *nm_db_column_text(nm_db_stmt_t *stmt, int col)
+{
+    const unsigned char *text = sqlite3_column_text(stmt, col);
+
+    return text ? (const char *) text : "";
+}
+
+int64_t nm_db_column_int(nm_db_stmt_t *stmt, int col)
+{
+    return sqlite3_column_int64(stmt, col);
+}
+
+/* Must be called if rows were not fetched until the end */
+void nm_db_stmt_done(nm_db_stmt_t *stmt)
+{
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+}
+
+/* Fill vector with the same layout as nm_db_select() does */
+void nm_db_stmt_select(nm_db_stmt_t *stmt, nm_vect_t *v)
+{
+    nm_str_t value = NM_INIT_STR;
+    int cols = sqlite3_column_count(stmt);
+
+    if (db_in_transaction)
+        nm_bug(_("%s: database in transaction"), __func__);
+
+    nm_db_stmt_debug(__func__, stmt);
+
+    while (nm_db_step(stmt) == NM_OK) {
+        for (int n = 0; n < cols; n++) {
+            nm_str_alloc_text(&value, nm_db_column_text(stmt, n));
+            nm_vect_insert(v, &value, sizeof(nm_str_t), nm_str_vect_ins_cb);
+        }
+    }
+
+    sqlite3_clear_bindings(stmt);
+    nm_str_free(&value);
+}
+
+void nm_db_stmt_result(nm_db_stmt_t *stmt, nm_db_result_t *res)
+{
+    int cols = sqlite3_column_count(stmt);
+
+    if (db_in_transaction)
+        nm_bug(_("%s: database in transaction"), __func__);
+
+    nm_db_result_free(res);
+    res->cols = cols;
+
+    nm_db_stmt_debug(__func__, stmt);
+
+    while (nm_db_step(stmt) == NM_OK) {
+        for (int n = 0; n < cols; n++)
+            nm_db_result_add(res, stmt, n);
+    }
+
+    sqlite3_clear_bindings(stmt);
+
+    /* arena is not moved anymore, resolve offsets into pointers */
+    for (size_t n = 0; n < res->n_memb; n++) {
+        res->cells[n].data = res->arena + res->cells[n].alloc_bytes;
+        res->cells[n].alloc_bytes = res->cells[n].len + 1;
+    }
+}
+
+void nm_db_res_bug(const nm_db_result_t *res, size_t index)
+{
+    nm_bug(_("%s: invalid index %zu of %zu"), __func__, index, res->n_memb);
+}
+
+void nm_db_result_free(nm_db_result_t *res)
+{
+    if (!res)
+        return;
+
+    free(res->cells);
+    free(res->ints);
+    free(res->arena);
+
+    *res = NM_INIT_DB_RESULT;
+}
+
+void nm_db_stmt_exec(nm_db_stmt_t *stmt)
+{
+    int rc;
+
+    nm_db_stmt_debug(__func__, stmt);
+
+    /* statement has no effect if it failed with SQLITE_BUSY, repeat it */
+    for (int n = 0; ; n++) {
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+            ;
+        sqlite3_reset(stmt);
+
+        if ((rc & 0xff) != SQLITE_BUSY || n == NM_DB_BUSY_RETRIES)
+            break;
+
+        nm_debug("%s: database is busy, retry\n", __func__);
+    }
+
+    if (rc != SQLITE_DONE)
+        nm_bug(_("%s: database error: %s"), __func__, sqlite3_errmsg(db_handler));
+
+    sqlite3_clear_bindings(stmt);
+    db_generation++;
+}
+
 static void nm_db_check_version(void)
 {
     nm_str_t query = NM_INIT_STR;
@@ -197,6 +529,7 @@ static int nm_db_update(void)
 {
     int rc = NM_OK;
     nm_str_t backup = NM_INIT_STR;
+    nm_str_t path = NM_INIT_STR;
     nm_str_t answer = NM_INIT_STR;
     nm_vect_t argv = NM_INIT_VECT;
     const nm_cfg_t *cfg = nm_cfg_get();
@@ -204,6 +537,13 @@ static int nm_db_update(void)
     if (db_in_transaction)
         nm_bug(_("%s: database in transaction"), __func__);
 
+    /*
+     * The last connection closed moves WAL content into the main file,
+     * so the backup is complete and the script works with the file alone.
+     */
+    sqlite3_close(db_handler);
+    db_handler = NULL;
+
     nm_str_format(&backup, "%s-backup", cfg->db_path.data);
     nm_copy_file(&cfg->db_path, &backup);
 
@@ -216,9 +556,15 @@ static int nm_db_update(void)
     if (nm_spawn_process(&argv, &answer) != NM_OK) {
         rc = NM_ERR;
         unlink(cfg->db_path.data);
+        nm_str_format(&path, "%s-wal", cfg->db_path.data);
+        unlink(path.data);
+        nm_str_format(&path, "%s-shm", cfg->db_path.data);
+        unlink(path.data);
         nm_copy_file(&backup, &cfg->db_path);
     }
 
+    nm_db_open();
+
     if (answer.len)
         printf("%s\n", answer.data);
 
@@ -226,6 +572,7 @@ static int nm_db_update(void)
 
     nm_vect_free(&argv, NULL);
     nm_str_free(&backup);
+    nm_str_free(&path);
     nm_str_free(&answer);
 
     return rc;
@@ -247,4 +594,141 @@ static int nm_db_select_cb(void *v, int argc, char **argv,
     return 0;
 }
 
+/*
+ * Arena may be reallocated while the result is filled,
+ * so the offset of a value is kept in alloc_bytes until
+ * nm_db_stmt_result() finishes.
+ */
+static void nm_db_result_add(nm_db_result_t *res, nm_db_stmt_t *stmt, int col)
+{
+    const char *text = nm_db_column_text(stmt, col);
+    size_t len = sqlite3_column_bytes(stmt, col);
+    nm_str_t *cell;
+
+    if (res->n_memb == res->n_alloc) {
+        res->n_alloc = res->n_alloc ? res->n_alloc * 2 : NM_DB_RES_INIT_CELLS;
+        res->cells = nm_realloc(res->cells, sizeof(nm_str_t) * res->n_alloc);
+        res->ints = nm_realloc(res->ints, sizeof(int64_t) * res->n_alloc);
+    }
+
+    if (res->arena_len + len + 1 > res->arena_alloc) {
+        size_t size = res->arena_alloc ? res->arena_alloc : NM_DB_RES_INIT_ARENA;
+
+        while (res->arena_len + len + 1 > size)
+            size *= 2;
+
+        res->arena = nm_realloc(res->arena, size);
+        res->arena_alloc = size;
+    }
+
+    memcpy(res->arena + res->arena_len, text, len);
+    res->arena[res->arena_len + len] = '\0';
+
+    cell = &res->cells[res->n_memb];
+    cell->data = NULL;
+    cell->len = len;
+    cell->alloc_bytes = res->arena_len;
+
+    res->ints[res->n_memb] = sqlite3_column_int64(stmt, col);
+    res->arena_len += len + 1;
+    res->n_memb++;
+}
+
+static void nm_db_open(void)
+{
+    char *db_errmsg;
+    int rc;
+
+    if ((rc = sqlite3_open(nm_cfg_get()->db_path.data, &db_handler)) != SQLITE_OK)
+        nm_bug(_("%s: database error: %s"), __func__, sqlite3_errstr(rc));
+
+    sqlite3_busy_handler(db_handler, nm_db_busy_cb, NULL);
+
+    /* foreign keys are off by default and must be enabled per connection */
+    if (nm_db_exec("PRAGMA foreign_keys=ON", &db_errmsg) != SQLITE_OK)
+        nm_bug(_("%s: database error: %s"), __func__, db_errmsg);
+
+    /*
+     * With WAL readers do not block writer and vice versa.
+     * journal_mode is persistent, synchronous is per connection;
+     * NORMAL is durable enough in WAL mode and avoids fsync on every commit.
+     * Failure is not fatal: WAL is not supported on some filesystems.
+     */
+    if (nm_db_exec("PRAGMA journal_mode=WAL", &db_errmsg) != SQLITE_OK) {
+        nm_debug("%s: cannot enable WAL: %s\n", __func__, db_errmsg);
+        sqlite3_free(db_errmsg);
+    }
+
+    if (nm_db_exec("PRAGMA synchronous=NORMAL", &db_errmsg) != SQLITE_OK)
+        nm_bug(_("%s: database error: %s"), __func__, db_errmsg);
+}
+
+/*
+ * Called by SQLite when the database is locked by other connection.
+ * count - number of times the handler was called for this lock.
+ */
+static int nm_db_busy_cb(void *unused NM_UNUSED, int count)
+{
+    static int waited = 0;
+    struct timespec ts;
+    int delay = NM_DB_BUSY_MIN_DELAY;
+
+    if (count == 0)
+        waited = 0;
+
+    if (waited >= NM_DB_BUSY_TIMEOUT)
+        return 0;
+
+    for (int n = 0; n < count && delay < NM_DB_BUSY_MAX_DELAY; n++)
+        delay *= 2;
+
+    if (delay > NM_DB_BUSY_MAX_DELAY)
+        delay = NM_DB_BUSY_MAX_DELAY;
+
+    ts.tv_sec = 0;
+    ts.tv_nsec = delay * 1000000L;
+    nanosleep(&ts, NULL);
+    waited += delay;
+
+    return 1;
+}
+
+/*
+ * sqlite3_exec() for statements without result rows.
+ * SQLITE_BUSY may be returned even with busy handler set
+ * (e.g. deadlock between readers and writer is detected),
+ * the statement had no effect then and is repeated.
+ */
+static int nm_db_exec(const char *query, char **errmsg)
+{
+    int rc;
+
+    for (int n = 0; ; n++) {
+        *errmsg = NULL;
+        rc = sqlite3_exec(db_handler, query, NULL, NULL, errmsg);
+
+        if ((rc & 0xff) != SQLITE_BUSY || n == NM_DB_BUSY_RETRIES)
+            break;
+
+        nm_debug("%s: database is busy, retry \"%s\"\n", __func__, query);
+        sqlite3_free(*errmsg);
+    }
+
+    return rc;
+}
+
+static void nm_db_stmt_debug(const char *func, nm_db_stmt_t *stmt)
+{
+    char *sql;
+
+    if (!nm_cfg_get()->debug)
+        return;
+
+    if ((sql = sqlite3_expanded_sql(stmt)) == NULL)
+        return;
+
+    nm_debug("%s: \"%s\"\n", func, sql);
+    sqlite3_free(sql);
+}
+
 /* vim:set ts=4 sw=4: */
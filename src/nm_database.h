@@ -1,117 +1,134 @@
 #ifndef NM_DATABASE_H_
 #define NM_DATABASE_H_
 
+#include <nm_string.h>
 #include <nm_vector.h>
 #include <stdbool.h>
+#include <stdint.h>
 
-#define NM_DB_VERSION "17"
+#define NM_DB_VERSION "19"
 
 //@TODO Those queries should have constant naming convention and some kind of sorting
 static const char NM_GET_VMS_SQL[] = \
     "SELECT name FROM vms ORDER BY name ASC";
 
-static const char NM_GET_VMS_FILTER_GROUP_SQL[] = \
-    "SELECT name FROM vms WHERE team='%s' ORDER BY name ASC";
+static const char NM_VM_FILTER_LIST_SQL[] = \
+    "SELECT name, team, iso, mem, smp FROM vms ORDER BY name ASC";
+
+static const char NM_VM_FILTER_IFACES_SQL[] = \
+    "SELECT vm_name, ipv4_addr, mac_addr FROM ifaces " \
+    "ORDER BY vm_name ASC, if_name ASC";
 
 static const char NM_CLONE_VMS_SQL[] = \
-    "INSERT INTO vms SELECT NULL, '%s', mem, smp, kvm, hcpu, '%d', arch, iso, " \
+    "INSERT INTO vms SELECT NULL, ?1, mem, smp, kvm, hcpu, ?2, arch, iso, " \
     "install, usb, usbid, bios, kernel, mouse_override, kernel_append, tty_path, " \
     "socket_path, initrd, machine, fs9p_enable, fs9p_path, fs9p_name, usb_type, " \
-    "spice, debug_port, debug_freeze, cmdappend, team, display_type FROM vms WHERE name='%s'";
+    "spice, debug_port, debug_freeze, cmdappend, team, display_type FROM vms WHERE name=?3";
+
+static const char NM_CLONE_IFACE_SQL[] = \
+    "INSERT INTO ifaces(vm_name, if_name, mac_addr, if_drv, vhost, " \
+    "macvtap, parent_eth, altname, netuser) " \
+    "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, 0)";
+
+static const char NM_CLONE_DRIVE_SQL[] = \
+    "INSERT INTO drives(vm_name, drive_name, drive_drv, capacity, boot, " \
+    "discard, backing_vm) VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7)";
+
+static const char NM_RENAME_VM_SQL[] = \
+    "UPDATE vms SET name=?2 WHERE name=?1";
+
+static const char NM_RENAME_DRIVE_SQL[] = \
+    "UPDATE drives SET drive_name=?3 WHERE vm_name=?1 AND drive_name=?2";
+
+static const char NM_RENAME_IFACE_SQL[] = \
+    "UPDATE ifaces SET if_name=?2, altname=?3 WHERE if_name=?1";
+
+static const char NM_VM_SET_VNC_SQL[] = \
+    "UPDATE vms SET vnc=?2 WHERE name=?1";
+
+static const char NM_RESET_INSTALL_SQL[] = \
+    "UPDATE vms SET install='0' WHERE name=?1";
 
 static const char NM_RESET_LOAD_SQL[] = \
-    "UPDATE vmsnapshots SET load='0' WHERE vm_name='%s'";
+    "UPDATE vmsnapshots SET load='0' WHERE vm_name=?1";
 
 static const char NM_USB_GET_SQL[] = \
-    "SELECT * FROM usb WHERE vm_name='%s'";
+    "SELECT * FROM usb WHERE vm_name=?1";
 
 static const char NM_USB_ADD_SQL[] = \
     "INSERT INTO usb(vm_name, dev_name, vendor_id, product_id, serial) " \
-    "VALUES ('%s', '%s', '%s', '%s', '%s')";
+    "VALUES (?1, ?2, ?3, ?4, ?5)";
 
 static const char NM_USB_DELETE_SQL[] = \
-    "DELETE FROM usb WHERE vm_name='%s' AND dev_name='%s' " \
-    "AND vendor_id='%s' AND product_id='%s' AND serial='%s'";
+    "DELETE FROM usb WHERE vm_name=?1 AND dev_name=?2 " \
+    "AND vendor_id=?3 AND product_id=?4 AND serial=?5";
 
-static const char NM_USB_CHECK_SQL[] = \
-    "SELECT usbid FROM vms WHERE name='%s'";
+static const char NM_USB_GET_BOUND_SQL[] = \
+    "SELECT vm_name FROM usb WHERE vendor_id=?1 AND product_id=?2 AND serial=?3";
 
-static const char NM_DEL_DRIVES_SQL[] = \
-    "DELETE FROM drives WHERE vm_name='%s'";
+static const char NM_USB_CHECK_SQL[] = \
+    "SELECT usbid FROM vms WHERE name=?1";
 
 static const char NM_DEL_DRIVE_SQL[] = \
-    "DELETE FROM drives WHERE vm_name='%s' AND drive_name='%s'";
-
-static const char NM_DEL_VMSNAP_SQL[] = \
-    "DELETE FROM vmsnapshots WHERE vm_name='%s'";
-
-static const char NM_DEL_IFS_SQL[] = \
-    "DELETE FROM ifaces WHERE vm_name='%s'";
-
-static const char NM_DEL_USB_SQL[] = \
-    "DELETE FROM usb WHERE vm_name='%s'";
+    "DELETE FROM drives WHERE vm_name=?1 AND drive_name=?2";
 
 static const char NM_DEL_VM_SQL[] = \
-    "DELETE FROM vms WHERE name='%s'";
+    "DELETE FROM vms WHERE name=?1";
 
 static const char NM_USB_EXISTS_SQL[] = \
-    "SELECT id FROM usb WHERE vm_name='%s' AND dev_name='%s' " \
-    "AND vendor_id='%s' AND product_id='%s' AND serial='%s'";
+    "SELECT id FROM usb WHERE vm_name=?1 AND dev_name=?2 " \
+    "AND vendor_id=?3 AND product_id=?4 AND serial=?5";
 
 static const char NM_VM_GET_LIST_SQL[] = \
-    "SELECT * FROM vms WHERE name='%s'";
+    "SELECT * FROM vms WHERE name=?1";
 
 static const char NM_VM_GET_IFACES_SQL [] = \
     "SELECT if_name, mac_addr, if_drv, ipv4_addr, vhost, " \
     "macvtap, parent_eth, altname, netuser, hostfwd, smb FROM ifaces " \
-    "WHERE vm_name='%s' ORDER BY if_name ASC";
+    "WHERE vm_name=?1 ORDER BY if_name ASC";
 
 static const char NM_VM_GET_DRIVES_SQL[] = \
-    "SELECT drive_name, drive_drv, capacity, boot, discard " \
-    "FROM drives WHERE vm_name='%s' ORDER BY id ASC";
+    "SELECT drive_name, drive_drv, capacity, boot, discard, backing_vm " \
+    "FROM drives WHERE vm_name=?1 ORDER BY id ASC";
+
+static const char NM_VM_GET_CLONES_SQL[] = \
+    "SELECT DISTINCT vm_name FROM drives WHERE backing_vm=?1";
 
 static const char NM_VM_GET_ADDDRIVES_SQL[] = \
-    "SELECT drive_name, capacity FROM drives WHERE vm_name='%s' " \
+    "SELECT drive_name, capacity FROM drives WHERE vm_name=?1 " \
     "AND boot='0'";
 
 static const char NM_SNAP_GET_NAME_SQL[] = \
-    "SELECT * FROM vmsnapshots WHERE vm_name='%s' " \
-    "AND snap_name='%s'";
+    "SELECT * FROM vmsnapshots WHERE vm_name=?1 " \
+    "AND snap_name=?2";
 
 static const char NM_GET_SNAPS_ALL_SQL[] = \
-    "SELECT * FROM vmsnapshots WHERE vm_name='%s' " \
-    "ORDER BY timestamp ASC";
-
-static const char NM_GET_SNAPS_NAME_SQL[] = \
-    "SELECT snap_name FROM vmsnapshots WHERE vm_name='%s' " \
+    "SELECT * FROM vmsnapshots WHERE vm_name=?1 " \
     "ORDER BY timestamp ASC";
 
 static const char NM_SNAP_UPDATE_LOAD_SQL[] = \
     "UPDATE vmsnapshots SET load='1' " \
-    "WHERE vm_name='%s' AND snap_name='%s'";
+    "WHERE vm_name=?1 AND snap_name=?2";
 
 static const char NM_DELETE_SNAP_SQL[] = \
-    "DELETE FROM vmsnapshots WHERE vm_name='%s' " \
-    "AND snap_name='%s'";
+    "DELETE FROM vmsnapshots WHERE vm_name=?1 " \
+    "AND snap_name=?2";
 
 static const char NM_INSERT_SNAP_SQL[] = \
     "INSERT INTO vmsnapshots(vm_name, snap_name, load, timestamp) " \
-    "VALUES('%s', '%s', '%d', DATETIME('now','localtime'))";
+    "VALUES(?1, ?2, ?3, DATETIME('now','localtime'))";
 
 static const char NM_UPDATE_SNAP_SQL[] = \
-    "UPDATE vmsnapshots SET load='%d', " \
+    "UPDATE vmsnapshots SET load=?3, " \
     "timestamp=DATETIME('now','localtime') " \
-    "WHERE vm_name='%s' AND snap_name='%s'";
-
-static const char NM_CHECK_SNAP_SQL[] = \
-    "SELECT id FROM snapshots WHERE vm_name='%s'";
+    "WHERE vm_name=?1 AND snap_name=?2";
 
 static const char NM_GET_BOOT_DRIVE_SQL[] = \
     "SELECT drive_name FROM drives " \
-    "WHERE vm_name='%s' AND boot='1'";
+    "WHERE vm_name=?1 AND boot='1'";
 
 static const char NM_SELECT_DRIVE_NAMES_SQL[] = \
-    "SELECT drive_name FROM drives WHERE vm_name='%s'";
+    "SELECT drive_name FROM drives WHERE vm_name=?1";
 
 static const char NM_GET_VETH_SQL[] = \
     "SELECT l_name, r_name FROM veth";
@@ -159,18 +176,21 @@ static const char NM_LAN_VETH_DEP_SQL[] = \
     "WHERE parent_eth='%s' OR parent_eth='%s'";
 
 static const char NM_GET_VMSNAP_LOAD_SQL[] = \
-    "SELECT snap_name FROM vmsnapshots WHERE vm_name='%s' " \
+    "SELECT snap_name FROM vmsnapshots WHERE vm_name=?1 " \
     "AND load='1'";
 
 static const char NM_USB_UPDATE_STATE_SQL[] = \
-    "UPDATE vms SET usbid='%s' WHERE name='%s'";
+    "UPDATE vms SET usbid=?2 WHERE name=?1";
 
 static const char NM_VMCTL_GET_VNC_PORT_SQL[] = \
-    "SELECT vnc, spice FROM vms WHERE name='%s'";
+    "SELECT vnc, spice FROM vms WHERE name=?1";
 
 static const char NM_GET_DB_VERSION_SQL[] = \
     "PRAGMA user_version";
 
+static const char NM_GET_DATA_VERSION_SQL[] = \
+    "PRAGMA data_version";
+
 void nm_db_init(void);
 void nm_db_select(const char *query, nm_vect_t *v);
 void nm_db_edit(const char *query);
@@ -180,6 +200,154 @@ void nm_db_atomic(const char *query);
 void nm_db_commit();
 void nm_db_rollback();
 void nm_db_close(void);
+void nm_db_read_begin(void);
+void nm_db_read_end(void);
+uint64_t nm_db_generation(void);
+int nm_db_changed_outside(void);
+
+/*
+ * Prepared statements.
+ * Queries with ?N parameters are compiled once and kept
+ * until nm_db_close(). Values are bound, not formatted,
+ * so they do not need to be quoted.
+ */
+enum nm_db_stmt_id {
+    NM_STMT_VM_FILTER_LIST = 0,
+    NM_STMT_VM_FILTER_IFACES,
+    NM_STMT_VM_GET_LIST,
+    NM_STMT_VM_GET_IFACES,
+    NM_STMT_VM_GET_DRIVES,
+    NM_STMT_VM_GET_CLONES,
+    NM_STMT_USB_GET,
+    NM_STMT_USB_GET_BOUND,
+    NM_STMT_GET_VMSNAP_LOAD,
+    NM_STMT_VMCTL_GET_VNC_PORT,
+    NM_STMT_DATA_VERSION,
+    NM_STMT_CLONE_VMS,
+    NM_STMT_CLONE_IFACE,
+    NM_STMT_CLONE_DRIVE,
+    NM_STMT_RENAME_VM,
+    NM_STMT_RENAME_DRIVE,
+    NM_STMT_RENAME_IFACE,
+    NM_STMT_VM_SET_VNC,
+    NM_STMT_RESET_INSTALL,
+    NM_STMT_RESET_LOAD,
+    NM_STMT_DEL_VM,
+    NM_STMT_DEL_DRIVE,
+    NM_STMT_SELECT_DRIVE_NAMES,
+    NM_STMT_VM_GET_ADDDRIVES,
+    NM_STMT_GET_BOOT_DRIVE,
+    NM_STMT_USB_ADD,
+    NM_STMT_USB_DELETE,
+    NM_STMT_USB_EXISTS,
+    NM_STMT_USB_CHECK,
+    NM_STMT_USB_UPDATE_STATE,
+    NM_STMT_GET_SNAPS_ALL,
+    NM_STMT_SNAP_GET_NAME,
+    NM_STMT_SNAP_UPDATE_LOAD,
+    NM_STMT_INSERT_SNAP,
+    NM_STMT_UPDATE_SNAP,
+    NM_STMT_DELETE_SNAP,
+    NM_STMT_COUNT
+};
+
+typedef struct sqlite3_stmt nm_db_stmt_t;
+
+nm_db_stmt_t *nm_db_stmt(enum nm_db_stmt_id id);
+void nm_db_bind_text(nm_db_stmt_t *stmt, int idx, const char *text);
+void nm_db_bind_int(nm_db_stmt_t *stmt, int idx, int64_t val);
+int nm_db_step(nm_db_stmt_t *stmt);
+const char *nm_db_column_text(nm_db_stmt_t *stmt, int col);
+int64_t nm_db_column_int(nm_db_stmt_t *stmt, int col);
+void nm_db_stmt_done(nm_db_stmt_t *stmt);
+void nm_db_stmt_select(nm_db_stmt_t *stmt, nm_vect_t *v);
+void nm_db_stmt_exec(nm_db_stmt_t *stmt);
+
+/*
+ * Flat result set.
+ * All values are stored in one arena, cells are laid out
+ * row by row with the same indexing as nm_db_select() result:
+ * cell of row N is at index (N * cols + column).
+ * Integer value of every cell is converted once by SQLite.
+ * Cells must be treated as read-only.
+ */
+typedef struct {
+    size_t n_memb;      /* cells count */
+    size_t cols;
+    nm_str_t *cells;
+    int64_t *ints;
+    char *arena;
+    size_t n_alloc;
+    size_t arena_len;
+    size_t arena_alloc;
+} nm_db_result_t;
+
+#define NM_INIT_DB_RESULT (nm_db_result_t) { 0, 0, NULL, NULL, NULL, 0, 0, 0 }
+
+void nm_db_stmt_result(nm_db_stmt_t *stmt, nm_db_result_t *res);
+void nm_db_result_free(nm_db_result_t *res);
+void nm_db_res_bug(const nm_db_result_t *res, size_t index)
+    __attribute__((noreturn));
+
+/* Most of per-VM queries take VM name as the only parameter */
+static inline void nm_db_select_vm(enum nm_db_stmt_id id,
+        const char *name, nm_vect_t *v)
+{
+    nm_db_stmt_t *stmt = nm_db_stmt(id);
+
+    nm_db_bind_text(stmt, 1, name);
+    nm_db_stmt_select(stmt, v);
+}
+
+static inline void nm_db_edit_vm(enum nm_db_stmt_id id, const char *name)
+{
+    nm_db_stmt_t *stmt = nm_db_stmt(id);
+
+    nm_db_bind_text(stmt, 1, name);
+    nm_db_stmt_exec(stmt);
+}
+
+static inline void nm_db_result_vm(enum nm_db_stmt_id id,
+        const char *name, nm_db_result_t *res)
+{
+    nm_db_stmt_t *stmt = nm_db_stmt(id);
+
+    nm_db_bind_text(stmt, 1, name);
+    nm_db_stmt_result(stmt, res);
+}
+
+static inline size_t nm_db_res_rows(const nm_db_result_t *res)
+{
+    return res->cols ? res->n_memb / res->cols : 0;
+}
+/* Index out of the result is a bug, like nm_vect_at() */
+static inline const nm_str_t *nm_db_res_str(const nm_db_result_t *res, const size_t index)
+{
+    if (index >= res->n_memb)
+        nm_db_res_bug(res, index);
+
+    return &res->cells[index];
+}
+static inline const char *nm_db_res_cstr(const nm_db_result_t *res, const size_t index)
+{
+    return nm_db_res_str(res, index)->data;
+}
+static inline size_t nm_db_res_len(const nm_db_result_t *res, const size_t index)
+{
+    return nm_db_res_str(res, index)->len;
+}
+static inline int64_t nm_db_res_int(const nm_db_result_t *res, const size_t index)
+{
+    if (index >= res->n_memb)
+        nm_db_res_bug(res, index);
+
+    return res->ints[index];
+}
+/* NULL if index is out of the result, e.g. row may be missing */
+static inline const nm_str_t *nm_db_res_try_str(const nm_db_result_t *res, const size_t index)
+{
+    return (index < res->n_memb) ? &res->cells[index] : NULL;
+}
 
 enum select_main_idx {
     NM_SQL_ID = 0,
@@ -236,6 +404,7 @@ enum select_drive_idx {
     NM_SQL_DRV_SIZE,
     NM_SQL_DRV_BOOT,
     NM_SQL_DRV_DISC,
+    NM_SQL_DRV_BACK,
     NM_DRV_IDX_COUNT
 };
 
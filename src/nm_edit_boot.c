@@ -88,18 +88,18 @@ static void nm_edit_boot_field_setup(const nm_vmctl_data_t *cur)
     set_field_type(fields[NM_FLD_DEBP], TYPE_INTEGER, 1, 0, 65535);
     set_field_type(fields[NM_FLD_DEBF], TYPE_ENUM, nm_form_yes_no, false, false);
 
-    if (nm_str_cmp_st(nm_vect_str(&cur->main, NM_SQL_INST), NM_ENABLE) == NM_OK)
+    if (nm_str_cmp_st(nm_db_res_str(&cur->main, NM_SQL_INST), NM_ENABLE) == NM_OK)
         set_field_buffer(fields[NM_FLD_INST], 0, nm_form_yes_no[1]);
     else
         set_field_buffer(fields[NM_FLD_INST], 0, nm_form_yes_no[0]);
 
-    set_field_buffer(fields[NM_FLD_SRCP], 0, nm_vect_str_ctx(&cur->main, NM_SQL_ISO));
-    set_field_buffer(fields[NM_FLD_BIOS], 0, nm_vect_str_ctx(&cur->main, NM_SQL_BIOS));
-    set_field_buffer(fields[NM_FLD_KERN], 0, nm_vect_str_ctx(&cur->main, NM_SQL_KERN));
-    set_field_buffer(fields[NM_FLD_CMDL], 0, nm_vect_str_ctx(&cur->main, NM_SQL_KAPP));
-    set_field_buffer(fields[NM_FLD_INIT], 0, nm_vect_str_ctx(&cur->main, NM_SQL_INIT));
-    set_field_buffer(fields[NM_FLD_DEBP], 0, nm_vect_str_ctx(&cur->main, NM_SQL_DEBP));
-    if (nm_str_cmp_st(nm_vect_str(&cur->main, NM_SQL_DEBF), NM_ENABLE) == NM_OK)
+    set_field_buffer(fields[NM_FLD_SRCP], 0, nm_db_res_cstr(&cur->main, NM_SQL_ISO));
+    set_field_buffer(fields[NM_FLD_BIOS], 0, nm_db_res_cstr(&cur->main, NM_SQL_BIOS));
+    set_field_buffer(fields[NM_FLD_KERN], 0, nm_db_res_cstr(&cur->main, NM_SQL_KERN));
+    set_field_buffer(fields[NM_FLD_CMDL], 0, nm_db_res_cstr(&cur->main, NM_SQL_KAPP));
+    set_field_buffer(fields[NM_FLD_INIT], 0, nm_db_res_cstr(&cur->main, NM_SQL_INIT));
+    set_field_buffer(fields[NM_FLD_DEBP], 0, nm_db_res_cstr(&cur->main, NM_SQL_DEBP));
+    if (nm_str_cmp_st(nm_db_res_str(&cur->main, NM_SQL_DEBF), NM_ENABLE) == NM_OK)
         set_field_buffer(fields[NM_FLD_DEBF], 0, nm_form_yes_no[0]);
     else
         set_field_buffer(fields[NM_FLD_DEBF], 0, nm_form_yes_no[1]);
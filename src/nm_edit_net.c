@@ -127,8 +127,8 @@ void nm_edit_net(const nm_str_t *name)
     for (size_t n = 0; n < iface_count; n++) {
         size_t idx_shift = NM_IFS_IDX_COUNT * n;
         nm_vect_insert(&ifaces,
-                       nm_vect_str_ctx(&vm.ifs, NM_SQL_IF_NAME + idx_shift),
-                       nm_vect_str_len(&vm.ifs, NM_SQL_IF_NAME + idx_shift) + 1,
+                       nm_db_res_cstr(&vm.ifs, NM_SQL_IF_NAME + idx_shift),
+                       nm_db_res_len(&vm.ifs, NM_SQL_IF_NAME + idx_shift) + 1,
                        NULL);
     }
 
@@ -201,7 +201,7 @@ nm_edit_net_action(const nm_str_t *name, const nm_vmctl_data_t *vm, size_t if_id
     if_idx++; /* restore idx */
 
     nm_str_format(&iface_data.name, "%s",
-        nm_vect_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift)->data);
+        nm_db_res_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift)->data);
 
     if (!iface_data.name.len) {
         rc = NM_ERR;
@@ -276,39 +276,39 @@ static void nm_edit_net_field_setup(const nm_vmctl_data_t *vm, size_t if_idx)
 #endif
 
     set_field_buffer(fields[NM_FLD_NDRV], 0,
-        nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_DRV + idx_shift));
+        nm_db_res_cstr(&vm->ifs, NM_SQL_IF_DRV + idx_shift));
     set_field_buffer(fields[NM_FLD_MADR], 0,
-        nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_MAC + idx_shift));
-    if (nm_vect_str_len(&vm->ifs, NM_SQL_IF_IP4 + idx_shift) > 0) {
+        nm_db_res_cstr(&vm->ifs, NM_SQL_IF_MAC + idx_shift));
+    if (nm_db_res_len(&vm->ifs, NM_SQL_IF_IP4 + idx_shift) > 0) {
         set_field_buffer(fields[NM_FLD_IPV4], 0,
-            nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_IP4 + idx_shift));
+            nm_db_res_cstr(&vm->ifs, NM_SQL_IF_IP4 + idx_shift));
     }
 #if defined (NM_OS_LINUX)
     set_field_buffer(fields[NM_FLD_VHST], 0,
-        (nm_str_cmp_st(nm_vect_str(&vm->ifs, NM_SQL_IF_VHO + idx_shift),
+        (nm_str_cmp_st(nm_db_res_str(&vm->ifs, NM_SQL_IF_VHO + idx_shift),
             NM_ENABLE) == NM_OK) ? "yes" : "no");
 
-    mvtap_idx = nm_str_stoui(nm_vect_str(&vm->ifs, NM_SQL_IF_MVT + idx_shift), 10);
+    mvtap_idx = nm_db_res_int(&vm->ifs, NM_SQL_IF_MVT + idx_shift);
     if (mvtap_idx > NM_NET_MACVTAP_NUM)
         nm_bug("%s: invalid macvtap array index: %zu", __func__, mvtap_idx);
     set_field_buffer(fields[NM_FLD_MTAP], 0, nm_form_macvtap[mvtap_idx]);
-    if (nm_vect_str_len(&vm->ifs, NM_SQL_IF_PET + idx_shift) > 0) {
+    if (nm_db_res_len(&vm->ifs, NM_SQL_IF_PET + idx_shift) > 0) {
         set_field_buffer(fields[NM_FLD_PETH], 0,
-            nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_PET + idx_shift));
+            nm_db_res_cstr(&vm->ifs, NM_SQL_IF_PET + idx_shift));
     }
 #else
     (void) mvtap_idx;
 #endif
     set_field_buffer(fields[NM_FLD_USER], 0,
-        (nm_str_cmp_st(nm_vect_str(&vm->ifs, NM_SQL_IF_USR + idx_shift), NM_ENABLE) == NM_OK) ?
+        (nm_str_cmp_st(nm_db_res_str(&vm->ifs, NM_SQL_IF_USR + idx_shift), NM_ENABLE) == NM_OK) ?
         nm_form_yes_no[0] : nm_form_yes_no[1]);
-    if (nm_vect_str_len(&vm->ifs, NM_SQL_IF_FWD + idx_shift) > 0) {
+    if (nm_db_res_len(&vm->ifs, NM_SQL_IF_FWD + idx_shift) > 0) {
         set_field_buffer(fields[NM_FLD_FWD], 0,
-            nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_FWD + idx_shift));
+            nm_db_res_cstr(&vm->ifs, NM_SQL_IF_FWD + idx_shift));
     }
-    if (nm_vect_str_len(&vm->ifs, NM_SQL_IF_SMB + idx_shift) > 0) {
+    if (nm_db_res_len(&vm->ifs, NM_SQL_IF_SMB + idx_shift) > 0) {
         set_field_buffer(fields[NM_FLD_SMB], 0,
-            nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_SMB + idx_shift));
+            nm_db_res_cstr(&vm->ifs, NM_SQL_IF_SMB + idx_shift));
     }
 
     for (size_t n = 0; n < NM_NET_FIELDS_NUM; n++)
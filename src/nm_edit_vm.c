@@ -108,7 +108,7 @@ static void nm_edit_vm_field_setup(const nm_vmctl_data_t *cur)
 {
     nm_str_t buf = NM_INIT_STR;
 
-    const char **machs = nm_mach_get(nm_vect_str(&cur->main, NM_SQL_ARCH));
+    const char **machs = nm_mach_get(nm_db_res_str(&cur->main, NM_SQL_ARCH));
     field_opts_off(fields[NM_FLD_ARGS], O_STATIC);
 
     set_field_type(fields[NM_FLD_CPUNUM], TYPE_REGEXP, "^[0-9]{1}(:[0-9]{1})?(:[0-9]{1})? *$");
@@ -125,36 +125,36 @@ static void nm_edit_vm_field_setup(const nm_vmctl_data_t *cur)
         field_opts_off(fields[NM_FLD_MACH], O_ACTIVE);
 
 
-    set_field_buffer(fields[NM_FLD_CPUNUM], 0, nm_vect_str_ctx(&cur->main, NM_SQL_SMP));
-    set_field_buffer(fields[NM_FLD_RAMTOT], 0, nm_vect_str_ctx(&cur->main, NM_SQL_MEM));
+    set_field_buffer(fields[NM_FLD_CPUNUM], 0, nm_db_res_cstr(&cur->main, NM_SQL_SMP));
+    set_field_buffer(fields[NM_FLD_RAMTOT], 0, nm_db_res_cstr(&cur->main, NM_SQL_MEM));
 
-    if (nm_str_cmp_st(nm_vect_str(&cur->main, NM_SQL_KVM), NM_ENABLE) == NM_OK)
+    if (nm_str_cmp_st(nm_db_res_str(&cur->main, NM_SQL_KVM), NM_ENABLE) == NM_OK)
         set_field_buffer(fields[NM_FLD_KVMFLG], 0, nm_form_yes_no[0]);
     else
         set_field_buffer(fields[NM_FLD_KVMFLG], 0, nm_form_yes_no[1]);
 
-    if (nm_str_cmp_st(nm_vect_str(&cur->main, NM_SQL_HCPU), NM_ENABLE) == NM_OK)
+    if (nm_str_cmp_st(nm_db_res_str(&cur->main, NM_SQL_HCPU), NM_ENABLE) == NM_OK)
         set_field_buffer(fields[NM_FLD_HOSCPU], 0, nm_form_yes_no[0]);
     else
         set_field_buffer(fields[NM_FLD_HOSCPU], 0, nm_form_yes_no[1]);
 
     nm_str_format(&buf, "%zu", cur->ifs.n_memb / NM_IFS_IDX_COUNT);
     set_field_buffer(fields[NM_FLD_IFSCNT], 0, buf.data);
-    set_field_buffer(fields[NM_FLD_DISKIN], 0, nm_vect_str_ctx(&cur->drives, NM_SQL_DRV_TYPE));
-    if (nm_str_cmp_st(nm_vect_str(&cur->drives, NM_SQL_DRV_DISC), NM_ENABLE) == NM_OK)
+    set_field_buffer(fields[NM_FLD_DISKIN], 0, nm_db_res_cstr(&cur->drives, NM_SQL_DRV_TYPE));
+    if (nm_str_cmp_st(nm_db_res_str(&cur->drives, NM_SQL_DRV_DISC), NM_ENABLE) == NM_OK)
         set_field_buffer(fields[NM_FLD_DISCARD], 0, nm_form_yes_no[0]);
     else
         set_field_buffer(fields[NM_FLD_DISCARD], 0, nm_form_yes_no[1]);
 
-    if (nm_str_cmp_st(nm_vect_str(&cur->main, NM_SQL_USBF), NM_ENABLE) == NM_OK)
+    if (nm_str_cmp_st(nm_db_res_str(&cur->main, NM_SQL_USBF), NM_ENABLE) == NM_OK)
         set_field_buffer(fields[NM_FLD_USBUSE], 0, nm_form_yes_no[0]);
     else
         set_field_buffer(fields[NM_FLD_USBUSE], 0, nm_form_yes_no[1]);
 
-    set_field_buffer(fields[NM_FLD_USBTYP], 0, nm_vect_str_ctx(&cur->main, NM_SQL_USBT));
-    set_field_buffer(fields[NM_FLD_MACH], 0, nm_vect_str_ctx(&cur->main, NM_SQL_MACH));
-    set_field_buffer(fields[NM_FLD_ARGS], 0, nm_vect_str_ctx(&cur->main, NM_SQL_ARGS));
-    set_field_buffer(fields[NM_FLD_GROUP], 0, nm_vect_str_ctx(&cur->main, NM_SQL_GROUP));
+    set_field_buffer(fields[NM_FLD_USBTYP], 0, nm_db_res_cstr(&cur->main, NM_SQL_USBT));
+    set_field_buffer(fields[NM_FLD_MACH], 0, nm_db_res_cstr(&cur->main, NM_SQL_MACH));
+    set_field_buffer(fields[NM_FLD_ARGS], 0, nm_db_res_cstr(&cur->main, NM_SQL_ARGS));
+    set_field_buffer(fields[NM_FLD_GROUP], 0, nm_db_res_cstr(&cur->main, NM_SQL_GROUP));
 
     for (size_t n = 0; n < NM_FLD_COUNT; n++)
         set_field_status(fields[n], 0);
@@ -242,7 +242,7 @@ static int nm_edit_vm_get_data(nm_vm_t *vm, const nm_vmctl_data_t *cur)
             vm->kvm.enable = 1;
         } else {
             if (!field_status(fields[NM_FLD_HOSCPU]) &&
-                    (nm_str_cmp_st(nm_vect_str(&cur->main, NM_SQL_HCPU), NM_ENABLE) == NM_OK)) {
+                    (nm_str_cmp_st(nm_db_res_str(&cur->main, NM_SQL_HCPU), NM_ENABLE) == NM_OK)) {
                 rc = NM_ERR;
                 NM_FORM_RESET();
                 nm_warn(_(NM_MSG_HCPU_KVM));
@@ -269,7 +269,7 @@ static int nm_edit_vm_get_data(nm_vm_t *vm, const nm_vmctl_data_t *cur)
     if (field_status(fields[NM_FLD_HOSCPU])) {
         if (nm_str_cmp_st(&hcpu, "yes") == NM_OK) {
             if (((!vm->kvm.enable) && (field_status(fields[NM_FLD_KVMFLG]))) ||
-                    ((nm_str_cmp_st(nm_vect_str(&cur->main, NM_SQL_KVM), NM_DISABLE) == NM_OK) &&
+                    ((nm_str_cmp_st(nm_db_res_str(&cur->main, NM_SQL_KVM), NM_DISABLE) == NM_OK) &&
                      !field_status(fields[NM_FLD_KVMFLG]))) {
                 rc = NM_ERR;
                 NM_FORM_RESET();
@@ -305,27 +305,27 @@ static void nm_edit_vm_update_db(nm_vm_t *vm, const nm_vmctl_data_t *cur, uint64
 
     if (field_status(fields[NM_FLD_CPUNUM])) {
         nm_str_format(&query, "UPDATE vms SET smp='%s' WHERE name='%s'",
-            vm->cpus.data, nm_vect_str_ctx(&cur->main, NM_SQL_NAME));
+            vm->cpus.data, nm_db_res_cstr(&cur->main, NM_SQL_NAME));
         nm_db_edit(query.data);
     }
 
     if (field_status(fields[NM_FLD_RAMTOT])) {
         nm_str_format(&query, "UPDATE vms SET mem='%s' WHERE name='%s'",
-            vm->memo.data, nm_vect_str_ctx(&cur->main, NM_SQL_NAME));
+            vm->memo.data, nm_db_res_cstr(&cur->main, NM_SQL_NAME));
         nm_db_edit(query.data);
     }
 
     if (field_status(fields[NM_FLD_KVMFLG])) {
         nm_str_format(&query, "UPDATE vms SET kvm='%s' WHERE name='%s'",
             vm->kvm.enable ? NM_ENABLE : NM_DISABLE,
-            nm_vect_str_ctx(&cur->main, NM_SQL_NAME));
+            nm_db_res_cstr(&cur->main, NM_SQL_NAME));
         nm_db_edit(query.data);
     }
 
     if (field_status(fields[NM_FLD_HOSCPU])) {
         nm_str_format(&query, "UPDATE vms SET hcpu='%s' WHERE name='%s'",
             vm->kvm.hostcpu_enable ? NM_ENABLE : NM_DISABLE,
-            nm_vect_str_ctx(&cur->main, NM_SQL_NAME));
+            nm_db_res_cstr(&cur->main, NM_SQL_NAME));
         nm_db_edit(query.data);
     }
 
@@ -337,8 +337,8 @@ static void nm_edit_vm_update_db(nm_vm_t *vm, const nm_vmctl_data_t *cur, uint64
                 size_t idx_shift = NM_IFS_IDX_COUNT * (cur_count - 1);
 
                 nm_str_format(&query, NM_DEL_IFACE_SQL,
-                    nm_vect_str_ctx(&cur->main, NM_SQL_NAME),
-                    nm_vect_str_ctx(&cur->ifs, NM_SQL_IF_NAME + idx_shift));
+                    nm_db_res_cstr(&cur->main, NM_SQL_NAME),
+                    nm_db_res_cstr(&cur->ifs, NM_SQL_IF_NAME + idx_shift));
                 nm_db_edit(query.data);
             }
         }
@@ -353,7 +353,7 @@ static void nm_edit_vm_update_db(nm_vm_t *vm, const nm_vmctl_data_t *cur, uint64
 
                 nm_net_mac_n2s(mac, &maddr);
                 nm_str_format(&if_name, "%s_eth%zu",
-                    nm_vect_str_ctx(&cur->main, NM_SQL_NAME), n);
+                    nm_db_res_cstr(&cur->main, NM_SQL_NAME), n);
                 nm_str_copy(&if_name_copy, &if_name);
 
                 altname = nm_net_fix_tap_name(&if_name, &maddr);
@@ -361,7 +361,7 @@ static void nm_edit_vm_update_db(nm_vm_t *vm, const nm_vmctl_data_t *cur, uint64
                 nm_str_format(&query,
                     "INSERT INTO ifaces(vm_name, if_name, mac_addr, if_drv, vhost, macvtap, altname) "
                     "VALUES('%s', '%s', '%s', '%s', '%s', '%s', '%s')",
-                    nm_vect_str_ctx(&cur->main, NM_SQL_NAME),
+                    nm_db_res_cstr(&cur->main, NM_SQL_NAME),
                     if_name.data,
                     maddr.data,
                     NM_DEFAULT_NETDRV,
@@ -383,45 +383,45 @@ static void nm_edit_vm_update_db(nm_vm_t *vm, const nm_vmctl_data_t *cur, uint64
 
     if (field_status(fields[NM_FLD_DISKIN])) {
         nm_str_format(&query, "UPDATE drives SET drive_drv='%s' WHERE vm_name='%s'",
-            vm->drive.driver.data, nm_vect_str_ctx(&cur->main, NM_SQL_NAME));
+            vm->drive.driver.data, nm_db_res_cstr(&cur->main, NM_SQL_NAME));
         nm_db_edit(query.data);
     }
 
     if (field_status(fields[NM_FLD_DISCARD])) {
         nm_str_format(&query, "UPDATE drives SET discard='%s' WHERE vm_name='%s'",
             vm->drive.discard ? NM_ENABLE : NM_DISABLE,
-            nm_vect_str_ctx(&cur->main, NM_SQL_NAME));
+            nm_db_res_cstr(&cur->main, NM_SQL_NAME));
         nm_db_edit(query.data);
     }
 
     if (field_status(fields[NM_FLD_USBUSE])) {
         nm_str_format(&query, "UPDATE vms SET usb='%s' WHERE name='%s'",
             vm->usb_enable ? NM_ENABLE : NM_DISABLE,
-            nm_vect_str_ctx(&cur->main, NM_SQL_NAME));
+            nm_db_res_cstr(&cur->main, NM_SQL_NAME));
         nm_db_edit(query.data);
     }
 
     if (field_status(fields[NM_FLD_USBTYP])) {
         nm_str_format(&query, "UPDATE vms SET usb_type='%s' WHERE name='%s'",
-            vm->usb_type.data, nm_vect_str_ctx(&cur->main, NM_SQL_NAME));
+            vm->usb_type.data, nm_db_res_cstr(&cur->main, NM_SQL_NAME));
         nm_db_edit(query.data);
     }
 
     if (field_status(fields[NM_FLD_MACH])) {
         nm_str_format(&query, "UPDATE vms SET machine='%s' WHERE name='%s'",
-            vm->mach.data, nm_vect_str_ctx(&cur->main, NM_SQL_NAME));
+            vm->mach.data, nm_db_res_cstr(&cur->main, NM_SQL_NAME));
         nm_db_edit(query.data);
     }
 
     if (field_status(fields[NM_FLD_ARGS])) {
         nm_str_format(&query, "UPDATE vms SET cmdappend='%s' WHERE name='%s'",
-            vm->cmdappend.data, nm_vect_str_ctx(&cur->main, NM_SQL_NAME));
+            vm->cmdappend.data, nm_db_res_cstr(&cur->main, NM_SQL_NAME));
         nm_db_edit(query.data);
     }
 
     if (field_status(fields[NM_FLD_GROUP])) {
         nm_str_format(&query, "UPDATE vms SET team='%s' WHERE name='%s'",
-            vm->group.data, nm_vect_str_ctx(&cur->main, NM_SQL_NAME));
+            vm->group.data, nm_db_res_cstr(&cur->main, NM_SQL_NAME));
         nm_db_edit(query.data);
     }
 
@@ -1,5 +1,6 @@
 #include <nm_core.h>
 #include <nm_form.h>
+#include <nm_job.h>
 #include <nm_menu.h>
 #include <nm_utils.h>
 #include <nm_vector.h>
@@ -398,41 +399,42 @@ void *nm_file_progress(void *data)
     struct timespec ts;
     int cols = getmaxx(action_window);
     nm_spinner_data_t *dp = data;
-    const nm_vm_t *vm = dp->ctx;
-    nm_str_t dst = NM_INIT_STR;
-    struct stat img_info, dst_info;
+    const nm_file_progress_t *progress = dp->ctx;
 
     memset(&ts, 0x0, sizeof(ts));
     ts.tv_nsec = 1e+8;
 
-    stat(vm->srcp.data, &img_info);
-
-    nm_str_format(&dst, "%s/%s/%s_a.img",
-            nm_cfg_get()->vm_dir.data, vm->name.data, vm->name.data);
-
     curs_set(0);
 
     for (;;) {
-        int64_t perc;
-        memset(&dst_info, 0x0, sizeof(dst_info));
+        uint64_t done = progress->done, total = progress->total;
 
         if (*dp->stop)
             break;
 
-        stat(dst.data, &dst_info);
-        perc = (dst_info.st_size * 100) / img_info.st_size;
+        /* holes of sparse image are counted as copied */
         NM_ERASE_TITLE(action, cols);
-        mvwprintw(action_window, 1, 2, "%d%% %ldmb/%ldmb",
-                perc, dst_info.st_size / 1024, img_info.st_size / 1024);
+        mvwprintw(action_window, 1, 2, "%d%% %" PRIu64 "mb/%" PRIu64 "mb",
+                total ? (int) (done * 100 / total) : 0,
+                done >> 20, total >> 20);
         wrefresh(action_window);
 
         nanosleep(&ts, NULL);
     }
 
-    nm_str_free(&dst);
     pthread_exit(NULL);
 }
 
+int nm_file_progress_cb(uint64_t done, uint64_t total, void *ctx)
+{
+    nm_file_progress_t *progress = ctx;
+
+    progress->total = total;
+    progress->done = done;
+
+    return NM_OK;
+}
+
 #if 0
 void *nm_spinner(void *data)
 {
@@ -492,7 +494,8 @@ int nm_form_name_used(const nm_str_t *name)
     nm_str_add_char(&query, '\'');
 
     nm_db_select(query.data, &res);
-    if (res.n_memb > 0) {
+    /* VM with this name may be created by background job */
+    if (res.n_memb > 0 || nm_job_busy(name)) {
         rc = NM_ERR;
         curs_set(0);
         nm_warn(_(NM_MSG_NAME_BUSY));
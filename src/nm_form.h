@@ -98,6 +98,14 @@ typedef struct {
 
 #define NM_INIT_SPINNER (nm_spinner_data_t) { NULL, NULL }
 
+/* Context of nm_file_progress(), updated by nm_file_progress_cb() */
+typedef struct {
+    volatile uint64_t done;
+    volatile uint64_t total;
+} nm_file_progress_t;
+
+#define NM_INIT_FILE_PROGRESS (nm_file_progress_t) { 0, 0 }
+
 nm_form_t *nm_post_form(nm_window_t *w, nm_field_t **field,
                           int begin_x, int color);
 int nm_draw_form(nm_window_t *w, nm_form_t *form);
@@ -111,6 +119,7 @@ void nm_vm_free(nm_vm_t *vm);
 void nm_vm_free_boot(nm_vm_boot_t *vm);
 void *nm_progress_bar(void *data);
 void *nm_file_progress(void *data);
+int nm_file_progress_cb(uint64_t done, uint64_t total, void *ctx);
 int nm_form_calc_size(size_t max_msg, size_t f_num, nm_form_data_t *form);
 
 extern const char *nm_form_yes_no[];
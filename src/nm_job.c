@@ -0,0 +1,507 @@
+#include <nm_core.h>
+#include <nm_job.h>
+#include <nm_utils.h>
+#include <nm_string.h>
+#include <nm_vector.h>
+#include <nm_window.h>
+#include <nm_vm_control.h>
+
+#include <time.h>
+
+/*
+ * Background jobs of TUI.
+ * Long operations (copy of drives, qemu-img, QEMU start) run in their
+ * own threads, at most NM_JOB_PARALLEL at once, the rest is queued.
+ * Job thread touches only its own job: progress and result. Database
+ * and ncurses are used by done callback, it is called from UI thread
+ * by nm_job_poll(). VMs used by unfinished job are locked, main loop
+ * refuses to change them.
+ */
+
+enum {
+    NM_JOB_PARALLEL = 4,
+    NM_JOB_TICK = 500,  /* ms */
+    NM_JOB_BUF_LEN = 32,
+    NM_JOB_ROW_LEN = 61 /* columns and borders before ETA/ERROR */
+};
+
+static const char *nm_job_states[] = {
+    "queued", "running", "running", "done", "failed", "canceled"
+};
+
+static nm_job_t **nm_jobs = NULL;
+static size_t nm_jobs_count = 0;
+static size_t nm_jobs_alloc = 0;
+static pthread_mutex_t nm_job_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *nm_job_thread(void *data);
+static void nm_job_start_queued(void);
+static void nm_job_finish(nm_job_t *job);
+static int nm_job_state(const nm_job_t *job);
+static void nm_job_remove(size_t idx);
+static void nm_job_cancel(nm_job_t *job);
+static void nm_job_draw(size_t *first, size_t hl);
+static void nm_job_time(int64_t ms, char *buf, size_t len);
+
+nm_job_t *nm_job_new(const nm_str_t *title, nm_job_run_t run,
+        nm_job_done_t done, void *ctx, nm_job_free_t free)
+{
+    nm_job_t *job = nm_calloc(1, sizeof(nm_job_t));
+
+    nm_str_copy(&job->title, title);
+    job->run = run;
+    job->done = done;
+    job->free = free;
+    job->ctx = ctx;
+    job->state = NM_JOB_QUEUED;
+
+    return job;
+}
+
+void nm_job_add_vm(nm_job_t *job, const nm_str_t *name)
+{
+    nm_vect_insert(&job->vms, name, sizeof(nm_str_t), nm_str_vect_ins_cb);
+}
+
+void nm_job_submit(nm_job_t *job)
+{
+    if (nm_jobs_count == nm_jobs_alloc) {
+        nm_jobs_alloc = nm_jobs_alloc ? nm_jobs_alloc * 2 : 16;
+        nm_jobs = nm_realloc(nm_jobs, sizeof(nm_job_t *) * nm_jobs_alloc);
+    }
+
+    nm_jobs[nm_jobs_count++] = job;
+    nm_job_start_queued();
+}
+
+/*
+ * Call done of finished jobs, start queued ones.
+ * Returns number of jobs finished since the last call.
+ */
+size_t nm_job_poll(void)
+{
+    size_t finished = 0;
+
+    /* jobs canceled in queue become finished */
+    nm_job_start_queued();
+
+    for (size_t n = 0; n < nm_jobs_count; n++) {
+        nm_job_t *job = nm_jobs[n];
+
+        if (nm_job_state(job) != NM_JOB_FINISHED)
+            continue;
+
+        nm_job_finish(job);
+        finished++;
+    }
+
+    if (finished)
+        nm_job_start_queued();
+
+    return finished;
+}
+
+bool nm_job_busy(const nm_str_t *name)
+{
+    for (size_t n = 0; n < nm_jobs_count; n++) {
+        const nm_job_t *job = nm_jobs[n];
+
+        if (nm_job_state(job) >= NM_JOB_DONE)
+            continue;
+
+        for (size_t i = 0; i < job->vms.n_memb; i++) {
+            if (nm_str_cmp_ss(nm_vect_str(&job->vms, i), name) == NM_OK)
+                return true;
+        }
+    }
+
+    return false;
+}
+
+/* nm_copy_cb_t for nm_copy_file_cb(), ctx is the job */
+int nm_job_copy_cb(uint64_t done, uint64_t total, void *ctx)
+{
+    nm_job_t *job = ctx;
+
+    nm_job_set_progress(job, done, total);
+
+    return nm_job_canceled(job) ? NM_ERR : NM_OK;
+}
+
+/*
+ * Progress is written by job thread and read by UI thread,
+ * 64-bit values are not updated atomically on every platform.
+ */
+void nm_job_set_progress(nm_job_t *job, uint64_t done, uint64_t total)
+{
+    pthread_mutex_lock(&nm_job_lock);
+    job->progress.done = done;
+    job->progress.total = total;
+    pthread_mutex_unlock(&nm_job_lock);
+}
+
+void nm_job_add_progress(nm_job_t *job, uint64_t done, uint64_t total)
+{
+    pthread_mutex_lock(&nm_job_lock);
+    job->progress.done += done;
+    job->progress.total += total;
+    pthread_mutex_unlock(&nm_job_lock);
+}
+
+void nm_job_get_progress(const nm_job_t *job, uint64_t *done, uint64_t *total)
+{
+    pthread_mutex_lock(&nm_job_lock);
+    *done = job->progress.done;
+    *total = job->progress.total;
+    pthread_mutex_unlock(&nm_job_lock);
+}
+
+/*
+ * Runs command in job thread, it is killed on cancel. Output of
+ * failed command is kept in job->log, UI thread writes it to the log.
+ * Without job it is run like nm_spawn_process().
+ * fds (int, close-on-exec) are passed to the command, may be NULL.
+ */
+int nm_job_spawn(nm_job_t *job, const nm_vect_t *argv, const nm_vect_t *fds)
+{
+    nm_str_t out = NM_INIT_STR;
+    int rc, err;
+
+    rc = nm_spawn_process_cancel(argv, &out, job ? &job->cancel : NULL, fds);
+
+    if (rc != NM_OK && job && out.len) {
+        nm_str_copy(&job->log, &out);
+    } else if (rc != NM_OK && !job) {
+        if ((err = nm_vmctl_log_last(&out)) != 0)
+            nm_bug(_("%s: cannot write log: %s"), __func__, strerror(err));
+    }
+
+    nm_str_free(&out);
+
+    return rc;
+}
+
+/* Number of queued and running jobs */
+size_t nm_job_active(void)
+{
+    size_t active = 0;
+
+    for (size_t n = 0; n < nm_jobs_count; n++) {
+        if (nm_job_state(nm_jobs[n]) < NM_JOB_DONE)
+            active++;
+    }
+
+    return active;
+}
+
+/* Number of jobs at the bottom of VM list */
+void nm_job_print_status(void)
+{
+    size_t active = 0, failed = 0;
+    int rows, cols;
+
+    for (size_t n = 0; n < nm_jobs_count; n++) {
+        int state = nm_job_state(nm_jobs[n]);
+
+        if (state < NM_JOB_DONE)
+            active++;
+        else if (state == NM_JOB_FAILED)
+            failed++;
+    }
+
+    getmaxyx(side_window, rows, cols);
+    if (cols < 20)
+        return;
+
+    mvwhline(side_window, rows - 1, 1, ACS_HLINE, cols - 2);
+
+    if (!active && !failed)
+        return;
+
+    mvwprintw(side_window, rows - 1, 2, _(" jobs: %zu "), active);
+    if (failed) {
+        wattron(side_window, COLOR_PAIR(NM_COLOR_RED));
+        wprintw(side_window, _("failed: %zu "), failed);
+        wattroff(side_window, COLOR_PAIR(NM_COLOR_RED));
+    }
+}
+
+void nm_job_list(void)
+{
+    size_t first = 0, hl = 0;
+    int ch = 0;
+
+    werase(help_window);
+    nm_init_help_jobs();
+
+    do {
+        switch (ch) {
+        case KEY_UP:
+            if (hl)
+                hl--;
+            break;
+        case KEY_DOWN:
+            if (hl + 1 < nm_jobs_count)
+                hl++;
+            break;
+        case NM_KEY_C:
+            if (hl < nm_jobs_count && nm_job_state(nm_jobs[hl]) < NM_JOB_DONE)
+                nm_job_cancel(nm_jobs[hl]);
+            break;
+        case NM_KEY_X:
+            for (size_t n = nm_jobs_count; n > 0; n--) {
+                if (nm_job_state(nm_jobs[n - 1]) >= NM_JOB_DONE)
+                    nm_job_remove(n - 1);
+            }
+            hl = first = 0;
+            break;
+        }
+
+        if (redraw_window) {
+            nm_destroy_windows();
+            endwin();
+            refresh();
+            nm_create_windows();
+            nm_init_help_jobs();
+            nm_init_side();
+            redraw_window = 0;
+        }
+
+        nm_job_poll();
+        nm_job_draw(&first, hl);
+
+        wtimeout(action_window, NM_JOB_TICK);
+    } while ((ch = wgetch(action_window)) != NM_KEY_Q);
+
+    wtimeout(action_window, -1);
+    werase(action_window);
+    werase(help_window);
+    nm_init_help_main();
+}
+
+/* Cancel all jobs and wait for them, called on exit */
+void nm_job_free_all(void)
+{
+    for (size_t n = 0; n < nm_jobs_count; n++)
+        nm_job_cancel(nm_jobs[n]);
+
+    for (size_t n = 0; n < nm_jobs_count; n++) {
+        nm_job_t *job = nm_jobs[n];
+
+        if (job->thread && nm_job_state(job) < NM_JOB_DONE) {
+            pthread_join(job->tid, NULL);
+            job->thread = false;
+        }
+    }
+
+    /* cleanup of canceled jobs, e.g. removal of incomplete copies */
+    nm_job_poll();
+
+    while (nm_jobs_count)
+        nm_job_remove(nm_jobs_count - 1);
+
+    free(nm_jobs);
+    nm_jobs = NULL;
+    nm_jobs_alloc = 0;
+}
+
+static void *nm_job_thread(void *data)
+{
+    nm_job_t *job = data;
+    int rc = job->run(job);
+
+    pthread_mutex_lock(&nm_job_lock);
+    job->rc = rc;
+    job->state = NM_JOB_FINISHED;
+    pthread_mutex_unlock(&nm_job_lock);
+
+    pthread_exit(NULL);
+}
+
+static void nm_job_start_queued(void)
+{
+    size_t running = 0;
+
+    for (size_t n = 0; n < nm_jobs_count; n++) {
+        int state = nm_job_state(nm_jobs[n]);
+
+        if (state == NM_JOB_RUNNING || state == NM_JOB_FINISHED)
+            running++;
+    }
+
+    for (size_t n = 0; n < nm_jobs_count; n++) {
+        nm_job_t *job = nm_jobs[n];
+
+        if (job->state != NM_JOB_QUEUED)
+            continue;
+
+        /* canceled before start, done still cleans up */
+        if (nm_job_canceled(job)) {
+            job->started = nm_mono_ms();
+            job->rc = NM_ERR;
+            job->state = NM_JOB_FINISHED;
+            continue;
+        }
+
+        if (running == NM_JOB_PARALLEL)
+            continue;
+
+        job->started = nm_mono_ms();
+        job->state = NM_JOB_RUNNING;
+        if (pthread_create(&job->tid, NULL, nm_job_thread, job) != 0)
+            nm_bug(_("%s: cannot create thread"), __func__);
+
+        job->thread = true;
+        running++;
+    }
+}
+
+static void nm_job_finish(nm_job_t *job)
+{
+    int rc, err;
+
+    if (job->thread) {
+        if (pthread_join(job->tid, NULL) != 0)
+            nm_bug(_("%s: cannot join thread"), __func__);
+        job->thread = false;
+    }
+
+    /* run cannot use strerror() and log file, report its errors here */
+    if (job->err) {
+        if (job->error.len)
+            nm_str_append_format(&job->error, ": %s", strerror(job->err));
+        else
+            nm_str_format(&job->error, "%s", strerror(job->err));
+    }
+
+    if (job->log.len && (err = nm_vmctl_log_last(&job->log)) != 0) {
+        nm_str_append_format(&job->error, "%s" "cannot write log: %s",
+                job->error.len ? "; " : "", strerror(err));
+    }
+
+    rc = job->done ? job->done(job, job->rc) : job->rc;
+    job->finished = nm_mono_ms();
+
+    /* job may complete before it sees cancel */
+    if (rc == NM_OK)
+        job->state = NM_JOB_DONE;
+    else
+        job->state = nm_job_canceled(job) ? NM_JOB_CANCELED : NM_JOB_FAILED;
+
+    nm_debug("job: %s: %s %s\n", job->title.data, nm_job_states[job->state],
+            job->error.len ? job->error.data : "");
+}
+
+static int nm_job_state(const nm_job_t *job)
+{
+    int state;
+
+    pthread_mutex_lock(&nm_job_lock);
+    state = job->state;
+    pthread_mutex_unlock(&nm_job_lock);
+
+    return state;
+}
+
+static void nm_job_cancel(nm_job_t *job)
+{
+    __atomic_store_n(&job->cancel, 1, __ATOMIC_RELEASE);
+}
+
+static void nm_job_remove(size_t idx)
+{
+    nm_job_t *job = nm_jobs[idx];
+
+    if (job->free)
+        job->free(job->ctx);
+
+    nm_str_free(&job->title);
+    nm_str_free(&job->error);
+    nm_str_free(&job->log);
+    nm_vect_free(&job->vms, nm_str_vect_free_cb);
+    free(job);
+
+    memmove(&nm_jobs[idx], &nm_jobs[idx + 1],
+            sizeof(nm_job_t *) * (nm_jobs_count - idx - 1));
+    nm_jobs_count--;
+}
+
+static void nm_job_draw(size_t *first, size_t hl)
+{
+    size_t rows, cols, visible, tail;
+    int64_t now = nm_mono_ms();
+    int y = 4;
+
+    getmaxyx(action_window, rows, cols);
+
+    werase(action_window);
+    nm_init_action(_("Background jobs"));
+
+    if (!nm_jobs_count) {
+        mvwprintw(action_window, 3, 2, "%s", _("There are no jobs"));
+        goto out;
+    }
+
+    visible = (rows > 5) ? rows - 5 : 0;
+    tail = (cols > NM_JOB_ROW_LEN) ? cols - NM_JOB_ROW_LEN : 0;
+    if (hl < *first)
+        *first = hl;
+    else if (visible && hl >= *first + visible)
+        *first = hl - visible + 1;
+
+    wattron(action_window, A_BOLD);
+    mvwprintw(action_window, 3, 2, "%-30s %-8s %5s %8s  %s",
+            "JOB", "STATE", "DONE", "TIME", "ETA/ERROR");
+    wattroff(action_window, A_BOLD);
+
+    for (size_t n = *first; n < nm_jobs_count && n < *first + visible; n++) {
+        const nm_job_t *job = nm_jobs[n];
+        uint64_t done, total;
+        int state = nm_job_state(job);
+        char percent[NM_JOB_BUF_LEN] = "-";
+        char elapsed[NM_JOB_BUF_LEN] = "-";
+        char eta[NM_JOB_BUF_LEN] = "";
+
+        nm_job_get_progress(job, &done, &total);
+        if (total)
+            snprintf(percent, sizeof(percent), "%d%%", (int) (done * 100 / total));
+
+        if (state != NM_JOB_QUEUED) {
+            int64_t spent = ((state >= NM_JOB_DONE) ? job->finished : now) -
+                job->started;
+
+            nm_job_time(spent, elapsed, sizeof(elapsed));
+
+            /* remaining time at the average rate */
+            if (state == NM_JOB_RUNNING && total && done && done < total)
+                nm_job_time((int64_t) ((double) spent * (total - done) / done),
+                        eta, sizeof(eta));
+        }
+
+        if (n == hl)
+            wattron(action_window, A_REVERSE);
+        mvwprintw(action_window, y, 2, "%-30.30s %-8s %5s %8s  %-*.*s",
+                job->title.data, _(nm_job_states[state]), percent, elapsed,
+                (int) tail, (int) tail,
+                (state == NM_JOB_FAILED && job->error.len) ? job->error.data : eta);
+        if (n == hl)
+            wattroff(action_window, A_REVERSE);
+        y++;
+    }
+
+out:
+    wrefresh(action_window);
+}
+
+static void nm_job_time(int64_t ms, char *buf, size_t len)
+{
+    int64_t sec = ms / 1000;
+
+    if (sec >= 3600)
+        snprintf(buf, len, "%" PRId64 ":%02d:%02d",
+                sec / 3600, (int) (sec / 60 % 60), (int) (sec % 60));
+    else
+        snprintf(buf, len, "%02d:%02d", (int) (sec / 60), (int) (sec % 60));
+}
+
+/* vim:set ts=4 sw=4: */
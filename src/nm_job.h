@@ -0,0 +1,68 @@
+#ifndef NM_JOB_H_
+#define NM_JOB_H_
+
+#include <nm_string.h>
+#include <nm_vector.h>
+#include <nm_form.h>
+
+typedef struct nm_job nm_job_t;
+
+/* Runs in job thread, ncurses and database must not be used */
+typedef int (*nm_job_run_t)(nm_job_t *job);
+/* Runs in UI thread after run, gets its result, returns final result */
+typedef int (*nm_job_done_t)(nm_job_t *job, int rc);
+typedef void (*nm_job_free_t)(void *ctx);
+
+enum {
+    NM_JOB_QUEUED = 0,
+    NM_JOB_RUNNING,
+    NM_JOB_FINISHED,    /* run has returned, done is not called yet */
+    NM_JOB_DONE,
+    NM_JOB_FAILED,
+    NM_JOB_CANCELED
+};
+
+struct nm_job {
+    nm_str_t title;
+    nm_str_t error;             /* set by run or done on failure */
+    int err;                    /* errno of run, added to error by UI */
+    nm_str_t log;               /* output of failed command, logged by UI */
+    nm_vect_t vms;              /* VMs locked by the job */
+    nm_job_run_t run;
+    nm_job_done_t done;
+    nm_job_free_t free;
+    void *ctx;
+    nm_file_progress_t progress; /* under job lock, see nm_job_*_progress() */
+    int cancel;                 /* atomic, see nm_job_canceled() */
+    int state;
+    int rc;
+    bool thread;                /* thread was started */
+    int64_t started;            /* ms */
+    int64_t finished;
+    pthread_t tid;
+};
+
+nm_job_t *nm_job_new(const nm_str_t *title, nm_job_run_t run,
+        nm_job_done_t done, void *ctx, nm_job_free_t free);
+void nm_job_add_vm(nm_job_t *job, const nm_str_t *name);
+void nm_job_submit(nm_job_t *job);
+size_t nm_job_poll(void);
+bool nm_job_busy(const nm_str_t *name);
+size_t nm_job_active(void);
+int nm_job_copy_cb(uint64_t done, uint64_t total, void *ctx);
+void nm_job_set_progress(nm_job_t *job, uint64_t done, uint64_t total);
+void nm_job_add_progress(nm_job_t *job, uint64_t done, uint64_t total);
+void nm_job_get_progress(const nm_job_t *job, uint64_t *done, uint64_t *total);
+int nm_job_spawn(nm_job_t *job, const nm_vect_t *argv, const nm_vect_t *fds);
+void nm_job_print_status(void);
+void nm_job_list(void);
+void nm_job_free_all(void);
+
+/* Set by UI thread, polled by job thread */
+static inline bool nm_job_canceled(const nm_job_t *job)
+{
+    return __atomic_load_n(&job->cancel, __ATOMIC_ACQUIRE) != 0;
+}
+
+#endif /* NM_JOB_H_ */
+/* vim:set ts=4 sw=4: */
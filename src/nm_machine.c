@@ -5,8 +5,47 @@
 #include <nm_window.h>
 #include <nm_machine.h>
 #include <nm_cfg_file.h>
-
-#include <sys/wait.h>
+#include <nm_process.h>
+
+#include <json.h>
+
+/*
+ * QEMU capabilities: machine types, devices and accelerators of every
+ * target. Probing runs QEMU several times per target, so results are
+ * kept in NM_MACH_CACHE near the database and reused while path, size
+ * and mtime of QEMU binary are the same. Outdated targets are probed
+ * in parallel.
+ */
+
+static const char NM_MACH_CACHE[] = ".nemu-qemu.cache";
+
+enum {
+    NM_MACH_CACHE_VER = 1
+};
+
+enum {
+    NM_MACH_Q_MACH = 0,
+    NM_MACH_Q_DEV,
+    NM_MACH_Q_ACCEL,
+    NM_MACH_Q_VER,
+    NM_MACH_Q_COUNT
+};
+
+/* QEMU arguments, indexed by NM_MACH_Q_* */
+static const char *nm_mach_queries[NM_MACH_Q_COUNT][2] = {
+    { "-M",       "help" },
+    { "-device",  "help" },
+    { "-accel",   "help" },
+    { "-version", NULL   }
+};
+
+typedef struct {
+    const char *arch;
+    nm_str_t path;
+    struct stat info;
+    nm_proc_t proc[NM_MACH_Q_COUNT];
+    bool ok[NM_MACH_Q_COUNT];
+} nm_mach_probe_t;
 
 static inline nm_str_t *nm_mach_arch(const nm_mach_t *p)
 {
@@ -24,15 +63,94 @@ static inline nm_vect_t **nm_mach_list(const nm_mach_t *p)
 static nm_vect_t nm_machs = NM_INIT_VECT;
 
 static void nm_mach_init(void);
-static void nm_mach_get_data(const char *arch);
+static void nm_mach_cache_path(nm_str_t *path);
+static bool nm_mach_cache_valid(struct json_object *entry,
+        const nm_mach_probe_t *probe);
+static void nm_mach_load(const char *arch, struct json_object *entry);
+static void nm_mach_spawn(nm_mach_probe_t *probe);
+static void nm_mach_collect(nm_mach_probe_t *probes, size_t count);
+static struct json_object *nm_mach_store(nm_mach_probe_t *probe);
+static const nm_mach_t *nm_mach_find(const nm_str_t *arch);
 static nm_vect_t *nm_mach_parse(const nm_str_t *buf, nm_str_t *def);
+static nm_vect_t *nm_mach_parse_devs(const nm_str_t *buf);
+static nm_vect_t *nm_mach_parse_lines(const nm_str_t *buf);
+static nm_vect_t *nm_mach_from_json(struct json_object *arr);
+static struct json_object *nm_mach_to_json(const nm_vect_t *v);
 
 static void nm_mach_init(void)
 {
     const nm_vect_t *archs = &nm_cfg_get()->qemu_targets;
+    nm_mach_probe_t *probes = nm_calloc(archs->n_memb ? archs->n_memb : 1,
+            sizeof(nm_mach_probe_t));
+    struct json_object *cache, *targets, *ver;
+    nm_str_t cache_path = NM_INIT_STR;
+    size_t nprobe = 0;
+
+    nm_mach_cache_path(&cache_path);
+
+    cache = json_object_from_file(cache_path.data);
+    if (!cache || !json_object_is_type(cache, json_type_object) ||
+            !json_object_object_get_ex(cache, "version", &ver) ||
+            json_object_get_int(ver) != NM_MACH_CACHE_VER ||
+            !json_object_object_get_ex(cache, "targets", &targets)) {
+        json_object_put(cache);
+        cache = json_object_new_object();
+        targets = json_object_new_object();
+        json_object_object_add(cache, "version",
+                json_object_new_int(NM_MACH_CACHE_VER));
+        json_object_object_add(cache, "targets", targets);
+    }
+
+    for (size_t n = 0; n < archs->n_memb; n++) {
+        nm_mach_probe_t *probe = &probes[nprobe];
+        struct json_object *entry = NULL;
+
+        probe->arch = ((char **) archs->data)[n];
+        nm_str_format(&probe->path, "%s/qemu-system-%s",
+            nm_cfg_get()->qemu_bin_path.data, probe->arch);
+        if (stat(probe->path.data, &probe->info) == -1)
+            memset(&probe->info, 0, sizeof(probe->info));
+
+        if (json_object_object_get_ex(targets, probe->arch, &entry) &&
+                nm_mach_cache_valid(entry, probe)) {
+            nm_mach_load(probe->arch, entry);
+            nm_str_free(&probe->path);
+            continue;
+        }
+
+        nm_mach_spawn(probe);
+        nprobe++;
+    }
+
+    if (nprobe) {
+        nm_str_t tmp = NM_INIT_STR;
+
+        nm_mach_collect(probes, nprobe);
 
-    for (size_t n = 0; n < archs->n_memb; n++)
-        nm_mach_get_data(((char **) archs->data)[n]);
+        for (size_t n = 0; n < nprobe; n++) {
+            struct json_object *entry = nm_mach_store(&probes[n]);
+
+            if (entry)
+                json_object_object_add(targets, probes[n].arch, entry);
+
+            nm_str_free(&probes[n].path);
+            for (size_t q = 0; q < NM_MACH_Q_COUNT; q++)
+                nm_proc_free(&probes[n].proc[q]);
+        }
+
+        /* concurrent nemu may write the cache too, replace it atomically */
+        nm_str_format(&tmp, "%s.%d", cache_path.data, getpid());
+        if (json_object_to_file_ext(tmp.data, cache, JSON_C_TO_STRING_PLAIN) != 0 ||
+                rename(tmp.data, cache_path.data) == -1) {
+            nm_debug("%s: cannot save %s\n", __func__, cache_path.data);
+            unlink(tmp.data);
+        }
+        nm_str_free(&tmp);
+    }
+
+    json_object_put(cache);
+    nm_str_free(&cache_path);
+    free(probes);
 
     if (nm_cfg_get()->debug) {
         nm_debug("\n");
@@ -51,84 +169,216 @@ static void nm_mach_init(void)
 
 const char **nm_mach_get(const nm_str_t *arch)
 {
-    const char **v = NULL;
+    const nm_mach_t *mach = nm_mach_find(arch);
 
-    if (nm_machs.data == NULL)
-        nm_mach_init();
+    return mach ? (const char **) mach->list->data : NULL;
+}
+
+const char *nm_mach_get_default(const nm_str_t *arch)
+{
+    const nm_mach_t *mach = nm_mach_find(arch);
+
+    return mach ? mach->def.data : NULL;
+}
+
+const char **nm_mach_get_devices(const nm_str_t *arch)
+{
+    const nm_mach_t *mach = nm_mach_find(arch);
+
+    return mach ? (const char **) mach->devs->data : NULL;
+}
+
+const char **nm_mach_get_accels(const nm_str_t *arch)
+{
+    const nm_mach_t *mach = nm_mach_find(arch);
+
+    return mach ? (const char **) mach->accels->data : NULL;
+}
+
+const char *nm_mach_get_version(const nm_str_t *arch)
+{
+    const nm_mach_t *mach = nm_mach_find(arch);
+
+    return mach ? mach->version.data : NULL;
+}
 
+void nm_mach_free(void)
+{
     for (size_t n = 0; n < nm_machs.n_memb; n++) {
-        if (nm_str_cmp_ss(nm_machs.data[n], arch) == NM_OK) {
-            v = (const char **) (*nm_mach_list(nm_machs.data[n]))->data;
-            break;
-        }
+        const nm_mach_t *mach = nm_machs.data[n];
+
+        nm_vect_free(mach->list, NULL);
+        nm_vect_free(mach->devs, NULL);
+        nm_vect_free(mach->accels, NULL);
     }
 
-    return v;
+    nm_vect_free(&nm_machs, nm_mach_vect_free_mlist_cb);
 }
 
-const char *nm_mach_get_default(const nm_str_t *arch)
+static const nm_mach_t *nm_mach_find(const nm_str_t *arch)
 {
-    const char *def = NULL;
-
     if (nm_machs.data == NULL)
         nm_mach_init();
 
     for (size_t n = 0; n < nm_machs.n_memb; n++) {
-        if (nm_str_cmp_ss(nm_machs.data[n], arch) == NM_OK) {
-            def = nm_mach_def(nm_machs.data[n])->data;
-            break;
-        }
+        if (nm_str_cmp_ss(nm_machs.data[n], arch) == NM_OK)
+            return nm_machs.data[n];
     }
 
-    return def;
+    return NULL;
 }
 
-void nm_mach_free(void)
+/* Cache file is stored in database directory */
+static void nm_mach_cache_path(nm_str_t *path)
 {
-    for (size_t n = 0; n < nm_machs.n_memb; n++)
-        nm_vect_free(*nm_mach_list(nm_machs.data[n]), NULL);
+    nm_str_t dir = NM_INIT_STR;
 
-    nm_vect_free(&nm_machs, nm_mach_vect_free_mlist_cb);
+    nm_str_dirname(&nm_cfg_get()->db_path, &dir);
+    nm_str_format(path, "%s/%s", dir.data, NM_MACH_CACHE);
+    nm_str_free(&dir);
 }
 
-static void nm_mach_get_data(const char *arch)
+static bool nm_mach_cache_valid(struct json_object *entry,
+        const nm_mach_probe_t *probe)
+{
+    struct json_object *path, *size, *mtime;
+
+    if (!probe->info.st_size ||
+            !json_object_object_get_ex(entry, "path", &path) ||
+            !json_object_object_get_ex(entry, "size", &size) ||
+            !json_object_object_get_ex(entry, "mtime", &mtime))
+        return false;
+
+    return !strcmp(json_object_get_string(path), probe->path.data) &&
+        json_object_get_int64(size) == (int64_t) probe->info.st_size &&
+        json_object_get_int64(mtime) == (int64_t) probe->info.st_mtime;
+}
+
+static void nm_mach_load(const char *arch, struct json_object *entry)
 {
-    nm_str_t buf = NM_INIT_STR;
-    nm_vect_t argv = NM_INIT_VECT;
-    nm_str_t answer = NM_INIT_STR;
     nm_mach_t mach_list = NM_INIT_MLIST;
+    struct json_object *val;
 
     nm_str_alloc_text(&mach_list.arch, arch);
+    if (json_object_object_get_ex(entry, "default", &val))
+        nm_str_alloc_text(&mach_list.def, json_object_get_string(val));
+    if (json_object_object_get_ex(entry, "version", &val))
+        nm_str_alloc_text(&mach_list.version, json_object_get_string(val));
+
+    json_object_object_get_ex(entry, "machines", &val);
+    mach_list.list = nm_mach_from_json(val);
+    json_object_object_get_ex(entry, "devices", &val);
+    mach_list.devs = nm_mach_from_json(val);
+    json_object_object_get_ex(entry, "accels", &val);
+    mach_list.accels = nm_mach_from_json(val);
+
+    nm_vect_insert(&nm_machs, &mach_list,
+        sizeof(mach_list), nm_mach_vect_ins_mlist_cb);
 
-    nm_str_format(&buf, "%s/qemu-system-%s",
-        nm_cfg_get()->qemu_bin_path.data, arch);
-    nm_vect_insert(&argv, buf.data, buf.len + 1, NULL);
+    nm_str_free(&mach_list.arch);
+    nm_str_free(&mach_list.def);
+    nm_str_free(&mach_list.version);
+}
+
+/* Start all queries of the target, output is read by nm_mach_collect() */
+static void nm_mach_spawn(nm_mach_probe_t *probe)
+{
+    for (size_t q = 0; q < NM_MACH_Q_COUNT; q++) {
+        nm_vect_t argv = NM_INIT_VECT;
+
+        probe->proc[q] = NM_INIT_PROC;
+        probe->proc[q].flags = NM_PROC_NULL_ERR;
 
-    nm_vect_insert_cstr(&argv, "-M");
-    nm_vect_insert_cstr(&argv, "help");
+        nm_vect_insert_cstr(&argv, probe->path.data);
+        nm_vect_insert_cstr(&argv, nm_mach_queries[q][0]);
+        if (nm_mach_queries[q][1])
+            nm_vect_insert_cstr(&argv, nm_mach_queries[q][1]);
+        nm_vect_end_zero(&argv);
 
-    nm_vect_end_zero(&argv);
-    if (nm_spawn_process(&argv, &answer) != NM_OK) {
+        nm_proc_start(&probe->proc[q], &argv);
+        nm_vect_free(&argv, NULL);
+    }
+}
+
+static void nm_mach_collect(nm_mach_probe_t *probes, size_t count)
+{
+    nm_proc_t **procs = nm_calloc(count * NM_MACH_Q_COUNT, sizeof(nm_proc_t *));
+
+    for (size_t n = 0; n < count; n++) {
+        for (size_t q = 0; q < NM_MACH_Q_COUNT; q++)
+            procs[n * NM_MACH_Q_COUNT + q] = &probes[n].proc[q];
+    }
+
+    nm_proc_wait(procs, count * NM_MACH_Q_COUNT, NULL);
+    free(procs);
+
+    for (size_t n = 0; n < count; n++) {
+        for (size_t q = 0; q < NM_MACH_Q_COUNT; q++) {
+            probes[n].ok[q] = !nm_proc_exit_code(&probes[n].proc[q]) &&
+                probes[n].proc[q].out.len;
+        }
+    }
+}
+
+/*
+ * Parse probe results and add the target.
+ * Returns cache entry or NULL if machine types are unknown.
+ */
+static struct json_object *nm_mach_store(nm_mach_probe_t *probe)
+{
+    nm_mach_t mach_list = NM_INIT_MLIST;
+    struct json_object *entry;
+
+    if (!probe->ok[NM_MACH_Q_MACH]) {
         nm_str_t warn_msg = NM_INIT_STR;
         nm_str_format(&warn_msg,
-            _("Cannot get mach for %-6s  . Error was logged"), arch);
+            _("Cannot get mach for %-6s  . Error was logged"), probe->arch);
+        nm_debug("%s: %s -M help failed\n", __func__, probe->path.data);
         nm_warn(warn_msg.data);
         nm_str_free(&warn_msg);
-        goto out;
+        return NULL;
+    }
+
+    nm_str_alloc_text(&mach_list.arch, probe->arch);
+    mach_list.list = nm_mach_parse(&probe->proc[NM_MACH_Q_MACH].out,
+            &mach_list.def);
+
+    /* devices and accelerators are optional, -accel needs QEMU 4.0 */
+    mach_list.devs = probe->ok[NM_MACH_Q_DEV] ?
+        nm_mach_parse_devs(&probe->proc[NM_MACH_Q_DEV].out) : nm_mach_from_json(NULL);
+    mach_list.accels = probe->ok[NM_MACH_Q_ACCEL] ?
+        nm_mach_parse_lines(&probe->proc[NM_MACH_Q_ACCEL].out) : nm_mach_from_json(NULL);
+
+    /* QEMU emulator version 6.2.0 (...) */
+    if (probe->ok[NM_MACH_Q_VER]) {
+        const char *ver = strstr(probe->proc[NM_MACH_Q_VER].out.data, "version ");
+        size_t len;
+
+        ver = ver ? ver + 8 : probe->proc[NM_MACH_Q_VER].out.data;
+        len = strcspn(ver, " \n");
+        nm_str_add_text_part(&mach_list.version, ver, len);
     }
 
-    nm_str_trunc(&buf, 0);
-    mach_list.list = nm_mach_parse(&answer, &buf);
-    nm_str_copy(&mach_list.def, &buf);
+    entry = json_object_new_object();
+    json_object_object_add(entry, "path", json_object_new_string(probe->path.data));
+    json_object_object_add(entry, "size", json_object_new_int64(probe->info.st_size));
+    json_object_object_add(entry, "mtime", json_object_new_int64(probe->info.st_mtime));
+    json_object_object_add(entry, "version",
+            json_object_new_string(mach_list.version.len ? mach_list.version.data : ""));
+    json_object_object_add(entry, "default",
+            json_object_new_string(mach_list.def.len ? mach_list.def.data : ""));
+    json_object_object_add(entry, "machines", nm_mach_to_json(mach_list.list));
+    json_object_object_add(entry, "devices", nm_mach_to_json(mach_list.devs));
+    json_object_object_add(entry, "accels", nm_mach_to_json(mach_list.accels));
 
     nm_vect_insert(&nm_machs, &mach_list,
         sizeof(mach_list), nm_mach_vect_ins_mlist_cb);
-out:
-    nm_str_free(&buf);
-    nm_vect_free(&argv, NULL);
-    nm_str_free(&answer);
+
     nm_str_free(&mach_list.arch);
     nm_str_free(&mach_list.def);
+    nm_str_free(&mach_list.version);
+
+    return entry;
 }
 
 static nm_vect_t *nm_mach_parse(const nm_str_t *buf, nm_str_t *def)
@@ -191,18 +441,102 @@ static nm_vect_t *nm_mach_parse(const nm_str_t *buf, nm_str_t *def)
     return v;
 }
 
+/* name "virtio-net-pci", bus PCI, desc "..." */
+static nm_vect_t *nm_mach_parse_devs(const nm_str_t *buf)
+{
+    nm_vect_t *v = nm_calloc(1, sizeof(nm_vect_t));
+    const char *bufp = buf->data;
+
+    while ((bufp = strstr(bufp, "name \"")) != NULL) {
+        const char *end;
+
+        bufp += 6;
+        if ((end = strchr(bufp, '"')) == NULL)
+            break;
+
+        nm_vect_insert(v, bufp, end - bufp + 1, NULL);
+        ((char *) v->data[v->n_memb - 1])[end - bufp] = '\0';
+        bufp = end;
+    }
+
+    nm_vect_end_zero(v);
+
+    return v;
+}
+
+/* One item per line, the first line is a title */
+static nm_vect_t *nm_mach_parse_lines(const nm_str_t *buf)
+{
+    nm_vect_t *v = nm_calloc(1, sizeof(nm_vect_t));
+    const char *bufp = strchr(buf->data, '\n');
+
+    while (bufp && *bufp) {
+        size_t len;
+
+        bufp += strspn(bufp, " \t\n");
+        if ((len = strcspn(bufp, " \t\n")) == 0)
+            break;
+
+        nm_vect_insert(v, bufp, len + 1, NULL);
+        ((char *) v->data[v->n_memb - 1])[len] = '\0';
+        bufp += len;
+    }
+
+    nm_vect_end_zero(v);
+
+    return v;
+}
+
+/* Returns NULL terminated list, empty if arr is not an array */
+static nm_vect_t *nm_mach_from_json(struct json_object *arr)
+{
+    nm_vect_t *v = nm_calloc(1, sizeof(nm_vect_t));
+
+    if (arr && json_object_is_type(arr, json_type_array)) {
+        for (size_t n = 0; n < json_object_array_length(arr); n++) {
+            nm_vect_insert_cstr(v,
+                    json_object_get_string(json_object_array_get_idx(arr, n)));
+        }
+    }
+
+    nm_vect_end_zero(v);
+
+    return v;
+}
+
+static struct json_object *nm_mach_to_json(const nm_vect_t *v)
+{
+    struct json_object *arr = json_object_new_array();
+
+    for (size_t n = 0; v && n < v->n_memb; n++)
+        json_object_array_add(arr, json_object_new_string(v->data[n]));
+
+    return arr;
+}
+
 void nm_mach_vect_ins_mlist_cb(void *unit_p, const void *ctx)
 {
+    nm_mach_t *dst = unit_p;
+    const nm_mach_t *src = ctx;
+
     nm_str_copy(nm_mach_arch(unit_p), nm_mach_arch(ctx));
     nm_str_copy(nm_mach_def(unit_p), nm_mach_def(ctx));
     memcpy(nm_mach_list(unit_p), nm_mach_list(ctx), sizeof(nm_vect_t *));
+    nm_str_copy(&dst->version, &src->version);
+    dst->devs = src->devs;
+    dst->accels = src->accels;
 }
 
 void nm_mach_vect_free_mlist_cb(void *unit_p)
 {
+    nm_mach_t *mach = unit_p;
+
     nm_str_free(nm_mach_arch(unit_p));
     nm_str_free(nm_mach_def(unit_p));
+    nm_str_free(&mach->version);
     free(*nm_mach_list(unit_p));
+    free(mach->devs);
+    free(mach->accels);
 }
 
 /* vim:set ts=4 sw=4: */
@@ -8,15 +8,21 @@ typedef struct {
      nm_str_t arch;
      nm_str_t def;
      nm_vect_t *list;
+     nm_str_t version;
+     nm_vect_t *devs;
+     nm_vect_t *accels;
 } nm_mach_t;
 
-#define NM_INIT_MLIST { NM_INIT_STR, NM_INIT_STR, NULL }
+#define NM_INIT_MLIST { NM_INIT_STR, NM_INIT_STR, NULL, NM_INIT_STR, NULL, NULL }
 
 void nm_mach_free(void);
 void nm_mach_vect_ins_mlist_cb(void *unit_p, const void *ctx);
 void nm_mach_vect_free_mlist_cb(void *unit_p);
 const char **nm_mach_get(const nm_str_t *arch);
 const char *nm_mach_get_default(const nm_str_t *arch);
+const char **nm_mach_get_devices(const nm_str_t *arch);
+const char **nm_mach_get_accels(const nm_str_t *arch);
+const char *nm_mach_get_version(const nm_str_t *arch);
 
 #endif /* NM_MACHINE_H_ */
 /* vim:set ts=4 sw=4: */
@@ -9,14 +9,22 @@
 #include <nm_qmp_control.h>
 #include <nm_lan_settings.h>
 
+#include <sys/wait.h> /* waitpid(2) */
+
 #if defined (NM_OS_LINUX)
-    static const char NM_OPT_ARGS[] = "cs:p:f:z:k:i:vhld";
+    static const char NM_OPT_ARGS[] = "cs:p:f:z:k:i:j:vhld";
 #else
-    static const char NM_OPT_ARGS[] = "s:p:f:z:k:i:vhld";
+    static const char NM_OPT_ARGS[] = "s:p:f:z:k:i:j:vhld";
 #endif
 
+enum {
+    NM_CLI_JOBS_MAX = 64
+};
+
 static void signals_handler(int signal);
 static void nm_process_args(int argc, char **argv);
+static int nm_cli_run(int action, const nm_vect_t *vms, long jobs);
+static int nm_cli_exec(int action, const char *vm);
 static void nm_print_feset(void);
 
 volatile sig_atomic_t redraw_window = 0;
@@ -70,6 +78,9 @@ static void signals_handler(int signal)
 static void nm_process_args(int argc, char **argv)
 {
     int opt;
+    int action = 0;
+    long jobs = 1;
+    char *end;
     const char *optstr = NM_OPT_ARGS;
     nm_str_t vmname = NM_INIT_STR;
     nm_str_t vmnames = NM_INIT_STR;
@@ -85,6 +96,7 @@ static void nm_process_args(int argc, char **argv)
         { "reset",       required_argument, NULL, 'z' },
         { "kill",        required_argument, NULL, 'k' },
         { "info",        required_argument, NULL, 'i' },
+        { "jobs",        required_argument, NULL, 'j' },
         { "list",        no_argument,       NULL, 'l' },
         { "daemon",      no_argument,       NULL, 'd' },
         { "version",     no_argument,       NULL, 'v' },
@@ -101,98 +113,23 @@ static void nm_process_args(int argc, char **argv)
             nm_exit_core();
 #endif
         case 's':
-            nm_init_core();
-
-            nm_str_alloc_text(&vmnames, optarg);
-            nm_str_append_to_vect(&vmnames, &vm_list, ",");
-
-            for (size_t n = 0; n < vm_list.n_memb; n++) {
-                nm_str_alloc_text(&vmname, vm_list.data[n]);
-                if (nm_qmp_test_socket(&vmname) != NM_OK)
-                    nm_vmctl_start(&vmname, 0);
-            }
-
-            nm_str_free(&vmnames);
-            nm_vect_free(&vm_list, NULL);
-            nm_str_free(&vmname);
-            nm_exit_core();
         case 'p':
-            nm_init_core();
-
-            nm_str_alloc_text(&vmnames, optarg);
-            nm_str_append_to_vect(&vmnames, &vm_list, ",");
-
-            for (size_t n = 0; n < vm_list.n_memb; n++) {
-                nm_str_alloc_text(&vmname, vm_list.data[n]);
-                nm_qmp_vm_shut(&vmname);
-            }
-
-            nm_str_free(&vmnames);
-            nm_vect_free(&vm_list, NULL);
-            nm_str_free(&vmname);
-            nm_exit_core();
         case 'f':
-            nm_init_core();
-
-            nm_str_alloc_text(&vmnames, optarg);
-            nm_str_append_to_vect(&vmnames, &vm_list, ",");
-
-            for (size_t n = 0; n < vm_list.n_memb; n++) {
-                nm_str_alloc_text(&vmname, vm_list.data[n]);
-                nm_qmp_vm_stop(&vmname);
-            }
-
-            nm_str_free(&vmnames);
-            nm_vect_free(&vm_list, NULL);
-            nm_str_free(&vmname);
-            nm_exit_core();
         case 'z':
-            nm_init_core();
-
-            nm_str_alloc_text(&vmnames, optarg);
-            nm_str_append_to_vect(&vmnames, &vm_list, ",");
-
-            for (size_t n = 0; n < vm_list.n_memb; n++) {
-                nm_str_alloc_text(&vmname, vm_list.data[n]);
-                nm_qmp_vm_reset(&vmname);
-            }
-
-            nm_str_free(&vmnames);
-            nm_vect_free(&vm_list, NULL);
-            nm_str_free(&vmname);
-            nm_exit_core();
         case 'k':
-            nm_init_core();
-
-            nm_str_alloc_text(&vmnames, optarg);
-            nm_str_append_to_vect(&vmnames, &vm_list, ",");
-
-            for (size_t n = 0; n < vm_list.n_memb; n++) {
-                nm_str_alloc_text(&vmname, vm_list.data[n]);
-                nm_vmctl_kill(&vmname);
-            }
-
-            nm_str_free(&vmnames);
-            nm_vect_free(&vm_list, NULL);
-            nm_str_free(&vmname);
-            nm_exit_core();
         case 'i':
-            nm_init_core();
-
+            /* VM actions run after all options, -j may follow them */
+            action = opt;
             nm_str_alloc_text(&vmnames, optarg);
-            nm_str_append_to_vect(&vmnames, &vm_list, ",");
-
-            for (size_t n = 0; n < vm_list.n_memb; n++) {
-                nm_str_alloc_text(&vmname, vm_list.data[n]);
-                nm_str_t info = nm_vmctl_info(&vmname);
-                printf(n < vm_list.n_memb - 1 ? "%s\n" : "%s", info.data);
-                nm_str_free(&info);
+            break;
+        case 'j':
+            jobs = strtol(optarg, &end, 10);
+            if (*end || jobs < 1 || jobs > NM_CLI_JOBS_MAX) {
+                fprintf(stderr, _("%s: bad jobs number: %s\n"),
+                        NM_PROGNAME, optarg);
+                nm_exit(NM_ERR);
             }
-
-            nm_str_free(&vmnames);
-            nm_vect_free(&vm_list, NULL);
-            nm_str_free(&vmname);
-            nm_exit_core();
+            break;
         case 'd':
             nm_mon_loop();
             nm_cfg_free();
@@ -218,6 +155,7 @@ static void nm_process_args(int argc, char **argv)
             printf("%s\n", _("-z, --reset      <name> reset vm"));
             printf("%s\n", _("-k, --kill       <name> kill vm process"));
             printf("%s\n", _("-i, --info       <name> print vm info"));
+            printf("%s\n", _("-j, --jobs       <num>  run vm actions in parallel"));
             printf("%s\n", _("-l, --list              list vms"));
             printf("%s\n", _("-d, --daemon            vm monitoring daemon"));
 #if defined (NM_OS_LINUX)
@@ -230,6 +168,157 @@ static void nm_process_args(int argc, char **argv)
             nm_exit(NM_ERR);
         }
     }
+
+    if (!action)
+        return;
+
+    nm_str_append_to_vect(&vmnames, &vm_list, ",");
+    nm_str_free(&vmnames);
+
+    if (action == 'i') {
+        /* one /proc pass for all VMs, nothing to parallelize */
+        nm_init_core();
+        nm_vmctl_info_sample(&vm_list);
+
+        for (size_t n = 0; n < vm_list.n_memb; n++) {
+            nm_str_alloc_text(&vmname, vm_list.data[n]);
+            nm_str_t info = nm_vmctl_info(&vmname);
+            printf(n < vm_list.n_memb - 1 ? "%s\n" : "%s", info.data);
+            nm_str_free(&info);
+        }
+
+        nm_vect_free(&vm_list, NULL);
+        nm_str_free(&vmname);
+        nm_exit_core();
+    }
+
+    nm_cfg_init();
+    if (nm_cli_run(action, &vm_list, jobs) != NM_OK) {
+        nm_vect_free(&vm_list, NULL);
+        nm_cfg_free();
+        exit(EXIT_FAILURE);
+    }
+
+    nm_vect_free(&vm_list, NULL);
+    nm_cfg_free();
+    exit(EXIT_SUCCESS);
+}
+
+/*
+ * Run VM action for every VM, up to jobs at a time.
+ * Each VM is handled by forked process, so slow start of one VM
+ * does not delay others; children open database themselves,
+ * sqlite connection must not cross fork(2).
+ * Returns NM_ERR if action failed for any VM.
+ */
+static int nm_cli_run(int action, const nm_vect_t *vms, long jobs)
+{
+    pid_t *pids = nm_calloc(vms->n_memb ? vms->n_memb : 1, sizeof(pid_t));
+    size_t next = 0, running = 0, failed = 0;
+
+    if (action == 's') {
+        /* create or upgrade database once, before children race for it */
+        nm_db_init();
+        nm_db_close();
+    }
+
+    if (jobs == 1) {
+        for (size_t n = 0; n < vms->n_memb; n++) {
+            if (nm_cli_exec(action, vms->data[n]) != NM_OK)
+                failed++;
+        }
+        free(pids);
+
+        return failed ? NM_ERR : NM_OK;
+    }
+
+    fflush(NULL);
+
+    while (next < vms->n_memb || running) {
+        int wstatus = 0;
+        pid_t pid;
+
+        if (next < vms->n_memb && running < (size_t) jobs) {
+            if ((pid = fork()) == -1) {
+                fprintf(stderr, "%s: fork error: %s\n", __func__, strerror(errno));
+                if (!running) {
+                    /* nothing to wait for, the rest is failed */
+                    failed += vms->n_memb - next;
+                    break;
+                }
+            } else if (pid == 0) {
+                exit(nm_cli_exec(action, vms->data[next]) == NM_OK ?
+                        EXIT_SUCCESS : EXIT_FAILURE);
+            } else {
+                pids[next++] = pid;
+                running++;
+                continue;
+            }
+        }
+
+        if ((pid = waitpid(-1, &wstatus, 0)) == -1) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (size_t n = 0; n < next; n++) {
+            if (pids[n] != pid)
+                continue;
+
+            pids[n] = 0;
+            running--;
+            if (WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == EXIT_SUCCESS) {
+                printf("%s: %s\n", (char *) vms->data[n], _("done"));
+            } else {
+                printf("%s: %s\n", (char *) vms->data[n], _("failed"));
+                failed++;
+            }
+            break;
+        }
+    }
+
+    printf(_("%zu done, %zu failed\n"), vms->n_memb - failed, failed);
+    free(pids);
+
+    return failed ? NM_ERR : NM_OK;
+}
+
+static int nm_cli_exec(int action, const char *vm)
+{
+    nm_str_t name = NM_INIT_STR;
+    int rc = NM_ERR;
+
+    nm_str_alloc_text(&name, vm);
+
+    switch (action) {
+    case 's':
+        if (nm_qmp_test_socket(&name) == NM_OK) {
+            rc = NM_OK; /* already running */
+            break;
+        }
+        nm_db_init();
+        rc = nm_vmctl_start(&name, 0);
+        nm_vmctl_cache_free();
+        nm_db_close();
+        break;
+    case 'p':
+        rc = nm_qmp_vm_shut(&name);
+        break;
+    case 'f':
+        rc = nm_qmp_vm_stop(&name);
+        break;
+    case 'z':
+        rc = nm_qmp_vm_reset(&name);
+        break;
+    case 'k':
+        rc = nm_vmctl_kill(&name);
+        break;
+    }
+
+    nm_str_free(&name);
+
+    return rc;
 }
 
 static void nm_print_feset(void)
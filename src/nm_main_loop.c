@@ -1,4 +1,5 @@
 #include <nm_core.h>
+#include <nm_job.h>
 #include <nm_main_loop.h>
 #include <nm_menu.h>
 #include <nm_form.h>
@@ -19,6 +20,9 @@
 #include <nm_add_drive.h>
 #include <nm_edit_boot.h>
 #include <nm_ovf_import.h>
+#include <nm_vm_top.h>
+#include <nm_vm_status.h>
+#include <nm_vm_filter.h>
 #include <nm_vm_control.h>
 #include <nm_mon_daemon.h>
 #include <nm_vm_snapshot.h>
@@ -26,47 +30,32 @@
 #include <nm_lan_settings.h>
 
 static const char NM_SEARCH_STR[] = "Search:";
-
-typedef struct nm_filter {
-    nm_str_t query;
-    int type;
-    int flags;
-} nm_filter_t;
-
-enum {
-    NM_FILTER_NONE = -1,
-    NM_FILTER_GROUP
-};
-
-enum {
-    NM_FILTER_RESET =  (1 << 0),
-    NM_FILTER_UPDATE = (1 << 1)
-};
-
-#define NM_INIT_FILTER (nm_filter_t) { NM_INIT_STR, NM_FILTER_NONE, 0 }
-
-static size_t nm_search_vm(const nm_vect_t *list, int *err, nm_filter_t *filter);
-static int nm_filter_check(const nm_str_t *input, nm_filter_t *filter);
-static int nm_search_cmp_cb(const void *s1, const void *s2);
-
-static inline void nm_filter_clean(nm_filter_t *filter)
-{
-    nm_str_free(&filter->query);
-    filter->type = NM_FILTER_NONE;
-    filter->flags = 0;
-}
+/* old group filter syntax, resets filter */
+static const char NM_SEARCH_RESET[] = "g:all";
+
+static int nm_search_vm(nm_menu_data_t *vms, size_t *list_len,
+                        const nm_vect_t *items, nm_vect_t *view,
+                        nm_str_t *query);
+static void nm_search_print(const nm_str_t *input);
+static void nm_menu_fit(nm_menu_data_t *vms, size_t *list_len);
+static void nm_refilter_vm(nm_menu_data_t *vms, size_t *list_len,
+                           const nm_vect_t *items, nm_vect_t *view,
+                           const nm_str_t *query);
+static void nm_init_side_filter(const nm_str_t *query);
+static bool nm_key_changes_vm(int ch);
 
 void nm_start_main_loop(void)
 {
     int nemu = 0, regen_data = 1;
-    int clear_action = 1;
+    int clear_action = 1, redraw_menu = 1;
     size_t vm_list_len, old_hl = 0;
     nm_menu_data_t vms = NM_INIT_MENU_DATA;
-    nm_vmctl_data_t vm_props = NM_VMCTL_INIT_DATA;
-    nm_vect_t vms_v = NM_INIT_VECT;
+    const nm_vmctl_data_t *vm_props = NULL;
+    nm_vect_t vms_v = NM_INIT_VECT;     /* filtered view of vm_items */
+    nm_vect_t vm_items = NM_INIT_VECT;
     nm_vect_t vm_list = NM_INIT_VECT;
     const nm_cfg_t *cfg = nm_cfg_get();
-    nm_filter_t filter = NM_INIT_FILTER;
+    nm_str_t filter = NM_INIT_STR;
 
     init_pair(NM_COLOR_BLACK, COLOR_BLACK, COLOR_WHITE);
     init_pair(NM_COLOR_RED, COLOR_RED, COLOR_WHITE);
@@ -82,78 +71,101 @@ void nm_start_main_loop(void)
     nm_init_help_main();
     nm_init_side();
     nm_init_action(NULL);
+    nm_vm_status_init();
 
     for (;;) {
         int ch;
 
-        if (regen_data) {
-            nm_str_t query = NM_INIT_STR;
+        /* results of background jobs go to database */
+        if (nm_job_poll() > 0) {
+            regen_data = 1;
+            old_hl = vms.highlight;
+            clear_action = redraw_menu = 1;
+            nm_mon_ping();
+        }
 
+        if (regen_data) {
+            nm_vm_filter_view_free(&vms_v);
+            nm_vect_free(&vm_items, NULL);
             nm_vect_free(&vm_list, nm_str_vect_free_cb);
-            nm_vect_free(&vms_v, NULL);
 
-            switch (filter.type) {
-            case NM_FILTER_NONE:
-                nm_str_format(&query, "%s", NM_GET_VMS_SQL);
-                break;
-            case NM_FILTER_GROUP:
-                nm_str_format(&query, NM_GET_VMS_FILTER_GROUP_SQL, filter.query.data);
-                break;
+            nm_vm_filter_load(&vm_list);
+
+            for (size_t n = 0; n < vm_list.n_memb; n++) {
+                nm_menu_item_t vm = NM_INIT_MENU_ITEM;
+                vm.name = (nm_str_t *) nm_vect_at(&vm_list, n);
+                nm_vect_insert(&vm_items, &vm, sizeof(vm), NULL);
             }
 
-            nm_db_select(query.data, &vm_list);
-            nm_str_free(&query);
+            nm_vm_status_rebuild(&vm_list);
+            nm_vm_filter_apply(&filter, &vm_items, &vms_v);
 
             vm_list_len = (getmaxy(side_window) - 4);
 
             vms.highlight = 1;
 
             if (old_hl > 1) {
-                if (vm_list.n_memb < old_hl)
+                if (vms_v.n_memb < old_hl)
                     vms.highlight = (old_hl - 1);
                 else
                     vms.highlight = old_hl;
                 old_hl = 0;
             }
 
-            if (vm_list_len < vm_list.n_memb)
+            if (vm_list_len < vms_v.n_memb)
                 vms.item_last = vm_list_len;
             else
-                vms.item_last = vm_list_len = vm_list.n_memb;
-
-            for (size_t n = 0; n < vm_list.n_memb; n++) {
-                nm_menu_item_t vm = NM_INIT_MENU_ITEM;
-                vm.name = (nm_str_t *) nm_vect_at(&vm_list, n);
-                nm_vect_insert(&vms_v, &vm, sizeof(vm), NULL);
-            }
+                vms.item_last = vm_list_len = vms_v.n_memb;
 
             vms.v = &vms_v;
 
             regen_data = 0;
         }
 
-        if (vm_list.n_memb > 0) {
-            const nm_str_t *name = nm_vect_item_name_cur(&vms);
-            int status = nm_vect_item_status_cur(&vms);
+        /* VM may leave or join the list filtered by state: */
+        if (nm_vm_status_poll() > 0) {
+            if (filter.len) {
+                nm_refilter_vm(&vms, &vm_list_len, &vm_items, &vms_v, &filter);
+                clear_action = redraw_menu = 1;
+            } else if (vms_v.n_memb > 0 && !redraw_menu) {
+                if (nm_update_vm_menu(&vms) == NM_TRUE)
+                    clear_action = 1;
+            }
+        }
+
+        if (vms_v.n_memb > 0) {
+            const nm_str_t *name;
+            int status;
+
+            if (redraw_menu) {
+                nm_print_vm_menu(&vms);
+                redraw_menu = 0;
+            }
+
+            name = nm_vect_item_name_cur(&vms);
+            status = nm_vect_item_status_cur(&vms);
 
             if (clear_action) {
-                nm_vmctl_free_data(&vm_props);
-                nm_vmctl_get_data(name, &vm_props);
+                vm_props = nm_vmctl_get_cached(name);
                 werase(action_window);
                 nm_init_action(NULL);
                 clear_action = 0;
             }
 
-            nm_print_vm_menu(&vms);
-            nm_print_vm_info(name, &vm_props, status);
-            wrefresh(side_window);
-            wrefresh(action_window);
+            nm_print_vm_info(name, vm_props, status);
+            nm_job_print_status();
+            /* one terminal update for both windows */
+            wnoutrefresh(side_window);
+            wnoutrefresh(action_window);
+            doupdate();
         } else {
             if (clear_action) {
                 werase(action_window);
                 nm_init_action(NULL);
                 clear_action = 0;
             }
+            nm_job_print_status();
+            wrefresh(side_window);
         }
 
         ch = wgetch(side_window);
@@ -161,31 +173,48 @@ void nm_start_main_loop(void)
         /* Clear action window only if key pressed.
          * Otherwise text will be flicker in tty. */
         if (ch != ERR)
-            clear_action = 1;
+            clear_action = redraw_menu = 1;
+        else if (nm_db_changed_outside() == NM_OK) {
+            /* database was changed from CLI or other nemu instance */
+            regen_data = 1;
+            old_hl = vms.highlight;
+            clear_action = redraw_menu = 1;
+        }
 
-        if (vm_list.n_memb > 0)
+        if (vms_v.n_memb > 0)
             nm_menu_scroll(&vms, vm_list_len, ch);
 
         if (ch == NM_KEY_Q) {
+            if (nm_job_active() && nm_notify(_(NM_MSG_JOB_QUIT)) != 'y')
+                continue;
+
+            nm_job_free_all();
             nm_destroy_windows();
             nm_curses_deinit();
+            nm_vm_status_free();
             nm_db_close();
             nm_cfg_free();
             nm_mach_free();
+            nm_usb_registry_free();
             break;
         }
 
-        if (vm_list.n_memb > 0) {
+        if (vms_v.n_memb > 0) {
             const nm_str_t *name = nm_vect_item_name_cur(&vms);
             int vm_status = nm_vect_item_status_cur(&vms);
 
+            if (nm_key_changes_vm(ch) && nm_job_busy(name)) {
+                nm_warn(_(NM_MSG_JOB_BUSY));
+                ch = ERR;
+            }
+
             switch (ch) {
             case NM_KEY_R:
                 if (vm_status) {
                     nm_warn(_(NM_MSG_RUNNING));
                     break;
                 }
-                nm_vmctl_start(name, 0);
+                nm_vmctl_start_job(name, 0);
                 break;
 
             case NM_KEY_T:
@@ -193,7 +222,7 @@ void nm_start_main_loop(void)
                     nm_warn(_(NM_MSG_RUNNING));
                     break;
                 }
-                nm_vmctl_start(name, NM_VMCTL_TEMP);
+                nm_vmctl_start_job(name, NM_VMCTL_TEMP);
                 break;
 
             case NM_KEY_P:
@@ -248,11 +277,12 @@ void nm_start_main_loop(void)
                     nm_warn(_(NM_MSG_MUST_STOP));
                     break;
                 }
+                if (nm_vmctl_has_clones(name)) {
+                    nm_warn(_(NM_MSG_HAS_CLONES));
+                    break;
+                }
                 nm_del_drive(name);
-                if (filter.type == NM_FILTER_GROUP)
-                    nm_init_side_group(&filter.query);
-                else
-                    nm_init_side();
+                nm_init_side_filter(&filter);
                 break;
 
 #if defined (NM_OS_LINUX)
@@ -274,6 +304,10 @@ void nm_start_main_loop(void)
                     nm_warn(_(NM_MSG_MUST_STOP));
                     break;
                 }
+                if (nm_vmctl_has_clones(name)) {
+                    nm_warn(_(NM_MSG_HAS_CLONES));
+                    break;
+                }
                 nm_rename_vm(name);
                 regen_data = 1;
                 old_hl = vms.highlight;
@@ -341,6 +375,10 @@ void nm_start_main_loop(void)
                     nm_warn(_(NM_MSG_MUST_STOP));
                     break;
                 }
+                if (nm_vmctl_has_clones(name)) {
+                    nm_warn(_(NM_MSG_HAS_CLONES));
+                    break;
+                }
                 {
                     int ans = nm_notify(_(NM_MSG_DELETE));
                     if (ans == 'y') {
@@ -362,64 +400,29 @@ void nm_start_main_loop(void)
 
             case NM_KEY_I:
                 nm_edit_net(name);
-                if (filter.type == NM_FILTER_GROUP)
-                    nm_init_side_group(&filter.query);
-                else
-                    nm_init_side();
+                nm_init_side_filter(&filter);
                 break;
 
 #if defined (NM_OS_LINUX)
             case NM_KEY_N_UP:
                 nm_lan_settings();
-                if (filter.type == NM_FILTER_GROUP)
-                    nm_init_side_group(&filter.query);
-                else
-                    nm_init_side();
+                nm_init_side_filter(&filter);
                 break;
 #endif
             }
         }
 
         if (ch == NM_KEY_SLASH) {
-            int err = NM_FALSE;
-            size_t pos = nm_search_vm(&vm_list, &err, &filter);
-            int cols = getmaxx(side_window);
-
-            if (err == NM_TRUE) {
+            if (nm_search_vm(&vms, &vm_list_len, &vm_items,
+                        &vms_v, &filter) != NM_OK) {
                 nm_warn(_(NM_MSG_SMALL_WIN));
-                break;
-            }
-
-            if (pos > vm_list_len) {
-                vms.highlight = vm_list_len;
-                vms.item_first = pos - vm_list_len;
-                vms.item_last = pos;
-            } else if (pos != 0) {
-                vms.item_first = 0;
-                vms.item_last = vm_list_len;
-                vms.highlight = pos;
-            }
-
-            if (filter.flags & NM_FILTER_UPDATE) {
-                regen_data = 1;
-                werase(side_window);
-                werase(action_window);
-                nm_init_action(NULL);
-                filter.flags &= ~NM_FILTER_UPDATE;
-            } else if (filter.flags & NM_FILTER_RESET) {
-                nm_filter_clean(&filter);
-                regen_data = 1;
-                werase(side_window);
+            } else {
                 werase(action_window);
                 nm_init_action(NULL);
-                filter.flags &= ~NM_FILTER_RESET;
             }
 
-            NM_ERASE_TITLE(side, cols);
-            if (filter.type == NM_FILTER_GROUP)
-                nm_init_side_group(&filter.query);
-            else
-                nm_init_side();
+            NM_ERASE_TITLE(side, getmaxx(side_window));
+            nm_init_side_filter(&filter);
         }
 
         if (ch == NM_KEY_I_UP) {
@@ -439,6 +442,18 @@ void nm_start_main_loop(void)
         if (ch == NM_KEY_U) {
             nm_vmctl_clear_all_tap();
         }
+
+        if (ch == NM_KEY_O) {
+            nm_vm_top();
+            nm_init_side_filter(&filter);
+        }
+
+        if (ch == NM_KEY_J) {
+            nm_job_list();
+            regen_data = 1;
+            old_hl = vms.highlight;
+            nm_init_side_filter(&filter);
+        }
 #if defined (NM_WITH_OVF_SUPPORT)
         if (ch == NM_KEY_O_UP) {
             nm_ovf_import();
@@ -483,143 +498,201 @@ void nm_start_main_loop(void)
             refresh();
             nm_create_windows();
             nm_init_help_main();
-            if (filter.type == NM_FILTER_GROUP)
-                nm_init_side_group(&filter.query);
-            else
-                nm_init_side();
+            nm_init_side_filter(&filter);
             nm_init_action(NULL);
 
             vm_list_len = (getmaxy(side_window) - 4);
             /* TODO save last pos */
-            if (vm_list_len < vm_list.n_memb) {
+            if (vm_list_len < vms_v.n_memb) {
                 vms.item_last = vm_list_len;
                 vms.item_first = 0;
                 vms.highlight = 1;
             }
             else
-                vms.item_last = vm_list_len = vm_list.n_memb;
+                vms.item_last = vm_list_len = vms_v.n_memb;
 
             redraw_window = 0;
         }
     }
 
-    nm_filter_clean(&filter);
-    nm_vmctl_free_data(&vm_props);
-    nm_vect_free(&vms_v, NULL);
+    nm_str_free(&filter);
+    nm_vmctl_cache_free();
+    nm_vm_filter_view_free(&vms_v);
+    nm_vm_filter_free();
+    nm_vect_free(&vm_items, NULL);
     nm_vect_free(&vm_list, nm_str_vect_free_cb);
 }
 
-static size_t nm_search_vm(const nm_vect_t *list, int *err, nm_filter_t *filter)
+/*
+ * Live search: VM list is filtered on every key press, without
+ * database queries. Enter keeps the query, Esc restores the previous one.
+ */
+static int nm_search_vm(nm_menu_data_t *vms, size_t *list_len,
+                        const nm_vect_t *items, nm_vect_t *view,
+                        nm_str_t *query)
 {
-    if (!err)
-        return 0;
-
-    size_t pos = 0;
-    void *match = NULL;
-    nm_form_t *form = NULL;
-    nm_field_t *fields[2];
     nm_str_t input = NM_INIT_STR;
     int cols = getmaxx(side_window);
     size_t msg_len = mbstowcs(NULL, _(NM_SEARCH_STR), strlen(NM_SEARCH_STR));
-    int req_len = msg_len + 9;
-    nm_form_data_t form_data = NM_INIT_FORM_DATA;
 
-    if (req_len > cols) {
-        *err = NM_TRUE;
-        return 0;
-    }
-
-    wattroff(side_window, COLOR_PAIR(NM_COLOR_HIGHLIGHT));
+    if ((int) msg_len + 9 > cols)
+        return NM_ERR;
 
-    form_data.form_len = cols - (5 + msg_len);
-    form_data.w_start_x = msg_len + 2;
+    nm_str_alloc_text(&input, query->len ? query->data : "");
+    werase(help_window);
+    nm_init_help_search();
+    curs_set(1);
 
-    fields[0] = new_field(1, form_data.form_len, 0, 1, 0, 0);
-    fields[1] = NULL;
-    set_field_back(fields[0], A_UNDERLINE);
-    field_opts_off(fields[0], O_STATIC);
-    NM_ERASE_TITLE(side, cols);
-    mvwaddstr(side_window, 1, 2, _(NM_SEARCH_STR));
-    wrefresh(side_window);
+    for (;;) {
+        int ch;
 
-    form = nm_post_form(side_window, fields, form_data.w_start_x, NM_FALSE);
-    if (nm_draw_form(side_window, form) != NM_OK)
-        goto out;
+        nm_search_print(&input);
 
-    nm_get_field_buf(fields[0], &input);
-    if (!input.len)
-        goto out;
+        if ((ch = wgetch(side_window)) == ERR)
+            continue;
 
-    if (nm_filter_check(&input, filter) == NM_OK)
-        goto out;
+        if (ch == NM_KEY_ENTER) {
+            if (nm_str_cmp_st(&input, NM_SEARCH_RESET) != NM_OK)
+                break;
+            nm_str_trunc(&input, 0);
+        } else if (ch == NM_KEY_ESC) {
+            nm_str_alloc_text(&input, query->len ? query->data : "");
+        } else if (ch == KEY_BACKSPACE || ch == 127) {
+            size_t len;
+
+            if (!input.len)
+                continue;
+            /* whole UTF-8 character */
+            len = input.len - 1;
+            while (len && (input.data[len] & 0xc0) == 0x80)
+                len--;
+            nm_str_trunc(&input, len);
+        } else if (ch == NM_KEY_CTRL_U) {
+            nm_str_trunc(&input, 0);
+        } else if (ch >= 0x20 && ch <= 0xff) {
+            nm_str_add_char_opt(&input, ch);
+        } else {
+            continue;
+        }
 
-    match = bsearch(&input, list->data, list->n_memb, sizeof(void *), nm_search_cmp_cb);
+        nm_vm_filter_apply(&input, items, view);
+        vms->item_first = 0;
+        vms->highlight = 1;
+        nm_menu_fit(vms, list_len);
+        nm_print_vm_menu(vms);
 
-    if (match != NULL) {
-        pos = (((unsigned char *)match - (unsigned char *)list->data) / sizeof(void *));
-        pos++;
+        if (ch == NM_KEY_ENTER || ch == NM_KEY_ESC)
+            break;
     }
 
-    /* An incomplete match can happen not at the
-     * beginning of the list with the same prefixes
-     * in nm_search_cmp_cb.
-     * So use backward linear search to fix it */
-    if (pos <= 1)
-        goto out;
+    nm_str_copy(query, &input);
+    curs_set(0);
+    werase(help_window);
+    nm_init_help_main();
+    nm_str_free(&input);
 
-    for (uint32_t n = pos - 1; n != 0; n--) {
-        char *fo = strstr(nm_vect_str_ctx(list, n - 1), input.data);
+    return NM_OK;
+}
 
-        if (fo != NULL && fo == nm_vect_str_ctx(list, n - 1))
-            pos--;
-        else
-            break;
+/* Query is printed in place of window title, long one is cut from the left */
+static void nm_search_print(const nm_str_t *input)
+{
+    int cols = getmaxx(side_window);
+    size_t msg_len = mbstowcs(NULL, _(NM_SEARCH_STR), strlen(NM_SEARCH_STR));
+    size_t width = cols - msg_len - 5;
+    const char *text = input->data;
+
+    if (input->len > width) {
+        text += input->len - width;
+        while ((*text & 0xc0) == 0x80)
+            text++;
     }
 
-out:
-    nm_form_free(form, fields);
-    nm_str_free(&input);
+    wattroff(side_window, COLOR_PAIR(NM_COLOR_HIGHLIGHT));
+    NM_ERASE_TITLE(side, cols);
+    mvwprintw(side_window, 1, 2, "%s %s", _(NM_SEARCH_STR), text);
+    wrefresh(side_window);
+}
 
-    return pos;
+static void nm_menu_fit(nm_menu_data_t *vms, size_t *list_len)
+{
+    *list_len = (getmaxy(side_window) - 4);
+
+    if (*list_len < vms->v->n_memb)
+        vms->item_last = *list_len;
+    else
+        vms->item_last = *list_len = vms->v->n_memb;
 }
 
-static int nm_filter_check(const nm_str_t *input, nm_filter_t *filter)
+/*
+ * Filter is applied again after VM status is changed. Highlighted VM
+ * stays highlighted if it still matches, the first VM is otherwise.
+ */
+static void nm_refilter_vm(nm_menu_data_t *vms, size_t *list_len,
+                           const nm_vect_t *items, nm_vect_t *view,
+                           const nm_str_t *query)
 {
-    if (input->len <= 2)
-        return NM_ERR;
+    const nm_str_t *cur = view->n_memb ? nm_vect_item_name_cur(vms) : NULL;
+    size_t pos = 0;
 
-    if (input->data[1] != ':')
-        return NM_ERR;
+    nm_vm_filter_invalidate();
+    nm_vm_filter_apply(query, items, view);
 
-    if (input->data[0] == 'g') {
-        nm_str_format(&filter->query, "%s", input->data + 2);
-        if (nm_str_cmp_st(&filter->query, "all") == NM_OK) {
-            filter->flags |= NM_FILTER_RESET;
-            return NM_OK;
+    for (size_t n = 0; cur && n < view->n_memb; n++) {
+        if (nm_vect_item_name(view, n) == cur) {
+            pos = n;
+            break;
         }
-
-        filter->type = NM_FILTER_GROUP;
     }
 
-    filter->flags |= NM_FILTER_UPDATE;
+    nm_menu_fit(vms, list_len);
+    vms->item_first = 0;
+    vms->highlight = pos + 1;
+    if (pos >= *list_len) {
+        vms->item_first = pos + 1 - *list_len;
+        vms->item_last = pos + 1;
+        vms->highlight = *list_len;
+    }
 
-    return NM_OK;
+    /* rows of VMs that left the list are erased here, list may be empty */
+    nm_print_vm_menu(vms);
 }
 
-static int nm_search_cmp_cb(const void *s1, const void *s2)
+/* Search query is shown in place of the title as it was typed */
+static void nm_init_side_filter(const nm_str_t *query)
 {
-    int rc;
-    const nm_str_t *str1 = s1;
-    const nm_str_t **str2 = (const nm_str_t **) s2;
+    size_t msg_len = mbstowcs(NULL, _(NM_SEARCH_STR), strlen(NM_SEARCH_STR));
 
-    rc = strcmp(str1->data, (*str2)->data);
+    nm_init_side();
+    if (query->len && (int) msg_len + 9 <= getmaxx(side_window))
+        nm_search_print(query);
+}
 
-    if (rc != 0) {
-        char *fo = strstr((*str2)->data, str1->data);
-        if (fo != NULL && fo == (*str2)->data)
-            rc = 0;
+/* Keys that change VM, refused while VM is used by background job */
+static bool nm_key_changes_vm(int ch)
+{
+    switch (ch) {
+    case NM_KEY_R:
+    case NM_KEY_T:
+    case NM_KEY_A:
+    case NM_KEY_V:
+    case NM_KEY_PLUS:
+    case NM_KEY_MINUS:
+    case NM_KEY_H:
+    case NM_KEY_Y:
+    case NM_KEY_E:
+    case NM_KEY_B:
+    case NM_KEY_C_UP:
+    case NM_KEY_S_UP:
+    case NM_KEY_X_UP:
+    case NM_KEY_D_UP:
+    case NM_KEY_L:
+    case NM_KEY_D:
+    case NM_KEY_I:
+        return true;
     }
 
-    return rc;
+    return false;
 }
+
 /* vim:set ts=4 sw=4: */
@@ -6,8 +6,8 @@
 #include <nm_window.h>
 #include <nm_network.h>
 #include <nm_cfg_file.h>
+#include <nm_vm_status.h>
 #include <nm_stat_usage.h>
-#include <nm_qmp_control.h>
 #include <nm_lan_settings.h>
 
 void nm_print_dropdown_menu(nm_menu_data_t *values, nm_window_t *w)
@@ -71,61 +71,105 @@ void nm_print_base_menu(nm_menu_data_t *ifs)
         }
 
         y++;
-        wrefresh(side_window);
         nm_str_free(&if_name);
     }
+
+    wrefresh(side_window);
 }
 
+/* Row is printed only if its text or attributes have been changed */
+static void nm_print_vm_row(nm_menu_data_t *vm, size_t n, size_t i, size_t screen_x)
+{
+    int space_num;
+    chtype attr = 0;
+    nm_str_t vm_name = NM_INIT_STR;
+
+    if (n >= vm->v->n_memb)
+        nm_bug(_("%s: invalid index: %zu"), __func__, n);
+
+    nm_str_alloc_text(&vm_name, nm_vect_item_name_ctx(vm->v, n));
+    nm_align2line(&vm_name, screen_x);
+
+    space_num = (screen_x - vm_name.len - 4);
+    if (space_num > 0) {
+        for (int s = 0; s < space_num; s++)
+            nm_str_add_char_opt(&vm_name, ' ');
+    }
+
+    if (nm_vect_item_status(vm->v, n))
+        attr |= COLOR_PAIR(NM_COLOR_HIGHLIGHT);
+    if (vm->highlight == i + 1)
+        attr |= A_REVERSE;
+
+    if (nm_row_changed(side_window, i + 3, vm_name.data, attr)) {
+        wattrset(side_window, attr);
+        mvwprintw(side_window, i + 3, 2, "%s", vm_name.data);
+        wattrset(side_window, A_NORMAL);
+    }
+
+    nm_str_free(&vm_name);
+}
+
+/*
+ * VM list is drawn by the main loop only, window is not refreshed
+ * here: main loop updates the screen at once by doupdate().
+ */
 void nm_print_vm_menu(nm_menu_data_t *vm)
 {
-    int x = 2, y = 3;
     size_t screen_x;
 
     screen_x = getmaxx(side_window);
     if (screen_x < 20) { /* window to small */
         mvwaddstr(side_window, 3, 1, "...");
-        wrefresh(side_window);
+        wnoutrefresh(side_window);
         return;
     }
 
-    wattroff(side_window, COLOR_PAIR(NM_COLOR_HIGHLIGHT));
-
     for (size_t n = vm->item_first, i = 0; n < vm->item_last; n++, i++) {
-        int space_num;
-        nm_str_t vm_name = NM_INIT_STR;
+        nm_vect_set_item_status(vm->v, n,
+                nm_vm_status_get(nm_vect_item_name(vm->v, n)));
+        nm_print_vm_row(vm, n, i, screen_x);
+    }
 
-        if (n >= vm->v->n_memb)
-            nm_bug(_("%s: invalid index: %zu"), __func__, n);
+    /* list may be shorter than before, e.g. while searching */
+    for (int y = vm->item_last - vm->item_first + 3;
+            y < getmaxy(side_window) - 1; y++) {
+        if (nm_row_changed(side_window, y, "", A_NORMAL))
+            mvwhline(side_window, y, 2, ' ', screen_x - 4);
+    }
 
-        nm_str_alloc_text(&vm_name, nm_vect_item_name_ctx(vm->v, n));
-        nm_align2line(&vm_name, screen_x);
+    wnoutrefresh(side_window);
+}
 
-        space_num = (screen_x - vm_name.len - 4);
-        if (space_num > 0) {
-            for (int s = 0; s < space_num; s++)
-                nm_str_add_char_opt(&vm_name, ' ');
-        }
+/*
+ * Redraw only rows which status differs from the status cache.
+ * Returns NM_TRUE if status of the highlighted VM has been changed.
+ */
+int nm_update_vm_menu(nm_menu_data_t *vm)
+{
+    size_t screen_x;
+    int hl_changed = NM_FALSE;
 
-        if (nm_qmp_test_socket(nm_vect_item_name(vm->v, n)) == NM_OK) {
-            nm_vect_set_item_status(vm->v, n, 1);
-            wattron(side_window, COLOR_PAIR(NM_COLOR_HIGHLIGHT));
-        } else {
-            nm_vect_set_item_status(vm->v, n, 0);
-            wattroff(side_window, COLOR_PAIR(NM_COLOR_HIGHLIGHT));
-        }
+    screen_x = getmaxx(side_window);
+    if (screen_x < 20)
+        return NM_FALSE;
 
-        if (vm->highlight == i + 1) {
-            wattron(side_window, A_REVERSE);
-            mvwprintw(side_window, y, x, "%s", vm_name.data);
-            wattroff(side_window, A_REVERSE);
-        } else {
-            mvwprintw(side_window, y, x, "%s", vm_name.data);
-        }
+    for (size_t n = vm->item_first, i = 0; n < vm->item_last; n++, i++) {
+        int status = nm_vm_status_get(nm_vect_item_name(vm->v, n));
 
-        y++;
-        wrefresh(side_window);
-        nm_str_free(&vm_name);
+        if (status == nm_vect_item_status(vm->v, n))
+            continue;
+
+        nm_vect_set_item_status(vm->v, n, status);
+        nm_print_vm_row(vm, n, i, screen_x);
+
+        if (vm->highlight == i + 1)
+            hl_changed = NM_TRUE;
     }
+
+    wnoutrefresh(side_window);
+
+    return hl_changed;
 }
 
 void nm_menu_scroll(nm_menu_data_t *menu, size_t list_len, int ch)
@@ -169,7 +213,7 @@ void nm_menu_scroll(nm_menu_data_t *menu, size_t list_len, int ch)
     }
 
     if (ch == KEY_UP || ch == KEY_DOWN || ch == KEY_HOME || ch == KEY_END)
-        NM_STAT_CLEAN();
+        nm_stat_clean();
 }
 
 #if defined (NM_OS_LINUX)
@@ -229,7 +273,6 @@ void nm_print_veth_menu(nm_menu_data_t *veth, int get_status)
         }
 
         y++;
-        wrefresh(side_window);
 
         nm_str_trunc(&veth_name, 0);
         nm_str_trunc(&veth_copy, 0);
@@ -237,6 +280,8 @@ void nm_print_veth_menu(nm_menu_data_t *veth, int get_status)
         nm_str_trunc(&veth_rname, 0);
     }
 
+    wrefresh(side_window);
+
     nm_str_free(&veth_name);
     nm_str_free(&veth_copy);
     nm_str_free(&veth_lname);
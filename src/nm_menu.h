@@ -23,6 +23,7 @@ typedef struct {
 
 void nm_print_base_menu(nm_menu_data_t *ifs);
 void nm_print_vm_menu(nm_menu_data_t *vm);
+int nm_update_vm_menu(nm_menu_data_t *vm);
 void nm_print_veth_menu(nm_menu_data_t *veth, int get_status);
 void nm_menu_scroll(nm_menu_data_t *menu, size_t list_len, int ch);
 void nm_print_dropdown_menu(nm_menu_data_t *values, nm_window_t *w);
@@ -6,34 +6,199 @@
 #include <nm_utils.h>
 #include <nm_cfg_file.h>
 #include <nm_qmp_control.h>
+#include <nm_qmp_pool.h>
+#include <nm_vm_control.h>
+#include <nm_stat_usage.h>
+#include <nm_mon_metrics.h>
+#include <nm_usb_devices.h>
 
 #include <sys/wait.h> /* waitpid(2) */
-#include <time.h> /* nanosleep(2) */
+#include <time.h>
 #include <pthread.h>
 #include <mqueue.h>
+#include <poll.h>
+
+#if defined (NM_OS_LINUX)
+#include <sys/inotify.h>
+#endif
 
 #include <json.h>
 
+/*
+ * VM state tracking.
+ * Daemon holds pooled QMP connection to every running VM and reacts
+ * to QMP events, QEMU exit is seen as closed connection. Events come
+ * from pool I/O thread through pipe, so the main loop sleeps in poll(2)
+ * until something happens. Start of VM is detected by inotify: qmp.sock
+ * created in VM directory, new VM directories are seen in vm_dir.
+ * Stopped VMs cost nothing. Without inotify stopped VMs are probed
+ * every daemon_sleep ms.
+ * If metrics address is set, VM usage and QMP latency are served
+ * to Prometheus, /proc is sampled only when metrics are scraped.
+ * USB devices bound to running VMs are attached again when they are
+ * plugged in, udev events are read in the main loop.
+ */
+
+enum {
+    NM_MON_STOPPED = 0,
+    NM_MON_RUNNING,
+    NM_MON_PAUSED
+};
+
+enum {
+    NM_MON_ATTACH_TRIES = 20, /* QEMU creates socket before listen(2) */
+    NM_MON_ATTACH_DELAY = 50, /* ms */
+    NM_MON_EVBUF = 4096
+};
+
+enum {
+    NM_MON_M_UP = 0,
+    NM_MON_M_CPU,
+    NM_MON_M_RSS,
+    NM_MON_M_RD,
+    NM_MON_M_WR,
+    NM_MON_M_RX,
+    NM_MON_M_TX,
+    NM_MON_M_START,
+    NM_MON_M_COUNT
+};
+
+typedef struct nm_mon_metric {
+    const char *name;
+    const char *type;
+    const char *help;
+} nm_mon_metric_t;
+
+/* indexed by NM_MON_M_*, network is seen from the guest side */
+static const nm_mon_metric_t nm_mon_metrics[] = {
+    { "nemu_vm_up", "gauge", "VM is running" },
+    { "nemu_vm_cpu_seconds_total", "counter",
+        "CPU time used by QEMU process" },
+    { "nemu_vm_memory_rss_bytes", "gauge",
+        "Resident memory of QEMU process" },
+    { "nemu_vm_block_read_bytes_total", "counter",
+        "Bytes read from storage by QEMU process" },
+    { "nemu_vm_block_write_bytes_total", "counter",
+        "Bytes written to storage by QEMU process" },
+    { "nemu_vm_net_receive_bytes_total", "counter",
+        "Bytes received by VM through tap interfaces" },
+    { "nemu_vm_net_transmit_bytes_total", "counter",
+        "Bytes sent by VM through tap interfaces" },
+    { "nemu_vm_start_seconds", "gauge",
+        "Time from QEMU process start to QMP connection" }
+};
+
+typedef struct nm_mon_event {
+    const char *event;
+    const char *msg;
+    int8_t state; /* -1 - not changed */
+} nm_mon_event_t;
+
+static const nm_mon_event_t nm_mon_events[] = {
+    { "SHUTDOWN",            "%s shutdown",                 -1 },
+    { "RESET",               "%s reset",                    -1 },
+    { "STOP",                "%s paused",                   NM_MON_PAUSED },
+    { "RESUME",              "%s resumed",                  NM_MON_RUNNING },
+    { "SUSPEND",             "%s suspended",                -1 },
+    { "WAKEUP",              "%s woke up",                  -1 },
+    { "BLOCK_JOB_COMPLETED", "%s: block job completed",     -1 },
+    { "BLOCK_JOB_ERROR",     "%s: block job failed",        -1 },
+    { NM_QMP_POOL_EV_CLOSED, NULL,                          -1 },
+    { NULL, NULL, -1 }
+};
+
 static volatile sig_atomic_t nm_mon_rebuild = 0;
+static volatile sig_atomic_t nm_mon_stop = 0; /* SIGINT or SIGTERM */
+static int nm_mon_ev_pipe[2] = { -1, -1 };
+static int nm_mon_metrics_sd = -1;
+#if defined (NM_OS_LINUX)
+static int nm_mon_ino_fd = -1;
+static int nm_mon_root_wd = -1;
+#endif
 
-static void nm_mon_check_vms(const nm_vect_t *mon_list);
+static int nm_mon_attach_vms(const nm_vect_t *mon_list);
+static void nm_mon_set_state(const nm_vect_t *mon_list, size_t idx, int8_t state);
 static void nm_mon_build_list(nm_vect_t *list, nm_vect_t *vms);
+static void nm_mon_events_init(void);
+static void nm_mon_qmp_event(const nm_str_t *name, const char *event,
+        struct json_object *data);
+static const nm_mon_event_t *nm_mon_event_find(const char *event);
+static void nm_mon_read_events(const nm_vect_t *mon_list,
+        nm_qmp_reader_t *reader);
+static void nm_mon_handle_event(const nm_vect_t *mon_list,
+        struct json_object *ev);
+static ssize_t nm_mon_find(const nm_vect_t *mon_list, const char *name);
+static void nm_mon_collect(nm_str_t *body, void *ctx);
+static uint64_t nm_mon_net_bytes(const nm_db_result_t *ifs, const char *counter);
+static void nm_mon_usb_event(const nm_usb_data_t *usb, bool added, void *ctx);
+#if defined (NM_OS_LINUX)
+static void nm_mon_watch(const nm_vect_t *mon_list, size_t idx);
+static void nm_mon_read_inotify(const nm_vect_t *mon_list);
+#endif
 static void nm_mon_signals_handler(int signal);
+static void nm_mon_wakeup(void);
 static int nm_mon_store_pid(void);
 
 typedef struct nm_mon_item {
     nm_str_t *name;
     int8_t state;
+    uint8_t attach; /* connect attempts left */
+    int wd;
+    int pid;        /* QEMU process, 0 if not known */
+    double start;   /* seconds to QMP connection, -1 if not seen */
+    nm_db_result_t ifs; /* interfaces as of the last start */
 } nm_mon_item_t;
 
 typedef struct nm_qmp_data {
     bool stop;
 } nm_qmp_data_t;
 
-typedef struct nm_qmp_w_data {
-    nm_str_t *cmd;
-    pthread_barrier_t *barrier;
-} nm_qmp_w_data_t;
+/*
+ * Asynchronous QMP jobs (savevm, loadvm, delvm) from /nemu-qmp queue
+ * are executed by fixed set of workers. Only one job per VM runs at
+ * a time, the next job of the same VM waits in the queue. When the
+ * queue is full, dispatcher stops reading mqueue, so it fills up and
+ * senders get EAGAIN.
+ * USB hotplug of bound devices is queued by the main loop as well,
+ * device_add would fail anyway while snapshot job of the VM runs.
+ */
+enum {
+    NM_QMP_WORKERS = 4,
+    NM_QMP_QUEUE_MAX = 32
+};
+
+enum nm_qmp_job_type {
+    NM_QMP_JOB_EXEC,
+    NM_QMP_JOB_USB_ADD,
+    NM_QMP_JOB_USB_DEL
+};
+
+typedef struct nm_qmp_job {
+    int type;
+    nm_str_t vm;
+    nm_str_t cmd;
+    nm_str_t jobid;
+    nm_usb_dev_t dev;   /* copy of hotplugged device */
+    nm_usb_data_t usb;  /* usb.dev points to dev */
+    struct nm_qmp_job *next;
+} nm_qmp_job_t;
+
+#define NM_QMP_JOB_INIT (nm_qmp_job_t) { NM_QMP_JOB_EXEC, NM_INIT_STR, \
+    NM_INIT_STR, NM_INIT_STR, NM_INIT_USB, NM_INIT_USB_DATA, NULL }
+
+static pthread_mutex_t nm_qmp_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t nm_qmp_queue_cond = PTHREAD_COND_INITIALIZER;
+static nm_qmp_job_t *nm_qmp_queue_head = NULL;
+static size_t nm_qmp_queue_len = 0;
+static bool nm_qmp_queue_stop = false;
+/* VM of the job running by worker, NULL if worker is idle */
+static const nm_str_t *nm_qmp_running[NM_QMP_WORKERS];
+
+static int nm_qmp_job_parse(const char *cmd, nm_qmp_job_t *job);
+static void nm_qmp_job_usb(const nm_qmp_job_t *job);
+static void nm_qmp_job_free(nm_qmp_job_t *job);
+static void nm_qmp_queue_put(nm_qmp_job_t *job);
+static nm_qmp_job_t *nm_qmp_queue_take(void);
 
 typedef struct nm_clean_data {
     nm_vect_t *mon_list;
@@ -42,9 +207,8 @@ typedef struct nm_clean_data {
     nm_qmp_data_t qmp_data;
 } nm_clean_data_t;
 
-#define NM_ITEM_INIT (nm_mon_item_t) { NULL, -1 }
+#define NM_ITEM_INIT (nm_mon_item_t) { NULL, -1, 0, -1, 0, -1, NM_INIT_DB_RESULT }
 #define NM_QMP_INIT (nm_qmp_data_t) { false }
-#define NM_QMP_W_INIT (nm_qmp_w_data_t) { NULL, NULL }
 #define NM_CLEAN_INIT (nm_clean_data_t) { NULL, NULL, NULL, NM_QMP_INIT }
 
 static inline int8_t nm_mon_item_get_status(const nm_vect_t *v, const size_t idx)
@@ -62,11 +226,23 @@ static inline nm_str_t *nm_mon_item_get_name(const nm_vect_t *v, const size_t id
     return ((nm_mon_item_t *) nm_vect_at(v, idx))->name;
 }
 
+static inline nm_mon_item_t *nm_mon_item_at(const nm_vect_t *v, const size_t idx)
+{
+    return (nm_mon_item_t *) nm_vect_at(v, idx);
+}
+
 static inline char *nm_mon_item_get_name_cstr(const nm_vect_t *v, const size_t idx)
 {
     return ((nm_mon_item_t *) nm_vect_at(v, idx))->name->data;
 }
 
+static inline void nm_mon_item_free_cb(void *unit_p)
+{
+    nm_db_result_free(&((nm_mon_item_t *) unit_p)->ifs);
+}
+
+static void nm_mon_load_ifs(nm_mon_item_t *item);
+
 #if defined (NM_OS_LINUX)
 static void nm_mon_cleanup(int rc, void *arg)
 {
@@ -74,15 +250,21 @@ static void nm_mon_cleanup(int rc, void *arg)
 
     nm_debug("mon daemon exited: %d\n", rc);
 
-    nm_vect_free(data->mon_list, NULL);
+    /* workers use USB registry and QMP pool, they are joined first */
+    data->qmp_data.stop = true;
+    pthread_join(*data->qmp_worker, NULL);
+
+    nm_vect_free(data->mon_list, nm_mon_item_free_cb);
     nm_vect_free(data->vm_list, nm_str_vect_free_cb);
+    nm_mon_metrics_close(nm_mon_metrics_sd, &nm_cfg_get()->daemon_metrics);
+    nm_stat_clean();
+    nm_usb_registry_free();
 
 #if defined (NM_WITH_DBUS)
     nm_dbus_disconnect();
 #endif
 
-    data->qmp_data.stop = true;
-    pthread_join(*data->qmp_worker, NULL);
+    nm_qmp_pool_free();
 
     unlink(nm_cfg_get()->daemon_pid.data);
     nm_exit_core();
@@ -91,78 +273,37 @@ static void nm_mon_cleanup(int rc, void *arg)
 
 void *nm_qmp_worker(void *data)
 {
-    struct json_object *parsed, *args, *jobid;
-    nm_str_t jobid_copy = NM_INIT_STR;
-    nm_str_t vmname = NM_INIT_STR;
-    nm_qmp_w_data_t *arg = data;
-    nm_str_t cmd = NM_INIT_STR;
-    const char *jobid_str;
-    char *name_start;
-
-    nm_str_copy(&cmd, arg->cmd);
-    pthread_barrier_wait(arg->barrier);
-
-    pthread_detach(pthread_self());
+    const nm_str_t **slot = data;
 
-    parsed = json_tokener_parse(cmd.data);
-
-    if (!parsed) {
-        nm_debug("%s: cannot parse json\n", __func__);
-        pthread_exit(NULL);
-    }
-    json_object_object_get_ex(parsed, "arguments", &args);
-    json_object_object_get_ex(args, "job-id", &jobid);
-
-    if (!args || !jobid) {
-        nm_debug("%s: malformed json\n", __func__);
-        pthread_exit(NULL);
-    }
-    jobid_str = json_object_get_string(jobid);
+    for (;;) {
+        nm_qmp_job_t *job = NULL;
 
-    /*
-     *  Get VM name from job-id
-     *  input string example: vmdel-vmname-2021-05-27-15-14-12-tVusSMWY
-     */
-    nm_str_format(&jobid_copy, "%s", jobid_str);
+        /* on stop the current job is finished, queued ones are dropped */
+        pthread_mutex_lock(&nm_qmp_queue_lock);
+        while (!nm_qmp_queue_stop && (job = nm_qmp_queue_take()) == NULL)
+            pthread_cond_wait(&nm_qmp_queue_cond, &nm_qmp_queue_lock);
 
-    /*
-     *  Cut job-id, we have 7 dashes in UID.
-     *  input:  vmdel-vmname-2021-05-27-15-14-12-tVusSMWY
-     *                      <----<--<--<--<--<--<--------
-     *                      7    6  5  4  3  2  1
-     *  result: vmdel-vmname
-     */
-    for (size_t sep = 0; sep < 7; sep++) {
-        char *dash = strrchr(jobid_copy.data, '-');
-        if (dash) {
-            *dash = '\0';
-        } else {
+        if (nm_qmp_queue_stop) {
+            pthread_mutex_unlock(&nm_qmp_queue_lock);
             break;
         }
-    }
-
-    /*
-     *  Cut VM name:
-     *  input:  vmdel-vmname
-     *          ----->
-     *  result: -vmname
-     */
-    name_start = strchr(jobid_copy.data, '-');
-    if (!name_start) {
-        nm_debug("%s: error get VM name from job-id\n", __func__);
-        pthread_exit(NULL);
-    }
 
-    name_start++; /* skip dash */
-    nm_str_format(&vmname, "%s", name_start);
+        *slot = &job->vm;
+        pthread_mutex_unlock(&nm_qmp_queue_lock);
 
-    nm_qmp_vm_exec_async(&vmname, cmd.data, jobid_str);
+        if (job->type == NM_QMP_JOB_EXEC)
+            nm_qmp_vm_exec_async(&job->vm, job->cmd.data, job->jobid.data);
+        else
+            nm_qmp_job_usb(job);
 
-    json_object_put(parsed);
+        pthread_mutex_lock(&nm_qmp_queue_lock);
+        *slot = NULL;
+        /* next job of this VM and dispatcher may wait for it */
+        pthread_cond_broadcast(&nm_qmp_queue_cond);
+        pthread_mutex_unlock(&nm_qmp_queue_lock);
 
-    nm_str_free(&cmd);
-    nm_str_free(&vmname);
-    nm_str_free(&jobid_copy);
+        nm_qmp_job_free(job);
+    }
 
     pthread_exit(NULL);
 }
@@ -171,7 +312,9 @@ void *nm_qmp_dispatcher(void *thr)
 {
     const nm_cfg_t *cfg = nm_cfg_get();
     nm_qmp_data_t *args = thr;
+    pthread_t workers[NM_QMP_WORKERS];
     struct mq_attr mq_attr;
+    nm_qmp_job_t *job;
     char *msg = NULL;
     ssize_t rcv_len;
     FILE *log;
@@ -196,6 +339,16 @@ void *nm_qmp_dispatcher(void *thr)
         goto out;
     }
 
+    for (size_t n = 0; n < NM_QMP_WORKERS; n++) {
+        if (pthread_create(&workers[n], NULL, nm_qmp_worker,
+                    &nm_qmp_running[n]) != 0) {
+            nm_exit(EXIT_FAILURE);
+        }
+#if defined (NM_OS_LINUX)
+        pthread_setname_np(workers[n], "nemu-qmp-worker");
+#endif
+    }
+
     msg = nm_calloc(1, mq_attr.mq_msgsize + 1);
 
     while (!args->stop) {
@@ -206,35 +359,45 @@ void *nm_qmp_dispatcher(void *thr)
         clock_gettime(CLOCK_REALTIME, &ts);
         ts.tv_sec += 1;
 
+        /* backpressure: do not take new messages while queue is full */
+        pthread_mutex_lock(&nm_qmp_queue_lock);
+        if (nm_qmp_queue_len >= NM_QMP_QUEUE_MAX) {
+            pthread_cond_timedwait(&nm_qmp_queue_cond, &nm_qmp_queue_lock, &ts);
+            pthread_mutex_unlock(&nm_qmp_queue_lock);
+            continue;
+        }
+        pthread_mutex_unlock(&nm_qmp_queue_lock);
+
         rcv_len = mq_timedreceive(mq, msg, mq_attr.mq_msgsize, NULL, &ts);
         if (rcv_len > 0) {
-            nm_qmp_w_data_t data = NM_QMP_W_INIT;
-            nm_str_t cmd = NM_INIT_STR;
-            pthread_barrier_t barr;
-            pthread_t thr;
+            job = nm_calloc(1, sizeof(nm_qmp_job_t));
+            *job = NM_QMP_JOB_INIT;
 
-            if (pthread_barrier_init(&barr, NULL, 2) != 0) {
-                fprintf(log, "%s:cannot init barrier\n", __func__);
+            if (nm_qmp_job_parse(msg, job) != NM_OK) {
+                fprintf(log, "%s:malformed job: %s\n", __func__, msg);
                 fflush(log);
+                nm_qmp_job_free(job);
+                continue;
             }
 
-            data.barrier = &barr;
-            data.cmd = &cmd;
-
-            nm_str_format(&cmd, "%s", msg);
-
-            if (pthread_create(&thr, NULL, nm_qmp_worker, &data) != 0) {
-                nm_exit(EXIT_FAILURE);
-            }
-#if defined (NM_OS_LINUX)
-            pthread_setname_np(thr, "nemu-qmp-worker");
-#endif
-            pthread_barrier_wait(&barr);
-            pthread_barrier_destroy(&barr);
-            nm_str_free(&cmd);
+            nm_qmp_queue_put(job);
         }
     }
 
+    pthread_mutex_lock(&nm_qmp_queue_lock);
+    nm_qmp_queue_stop = true;
+    pthread_cond_broadcast(&nm_qmp_queue_cond);
+    pthread_mutex_unlock(&nm_qmp_queue_lock);
+
+    /* QMP exchange of running job is not cut in the middle */
+    for (size_t n = 0; n < NM_QMP_WORKERS; n++)
+        pthread_join(workers[n], NULL);
+
+    pthread_mutex_lock(&nm_qmp_queue_lock);
+    while ((job = nm_qmp_queue_take()) != NULL)
+        nm_qmp_job_free(job);
+    pthread_mutex_unlock(&nm_qmp_queue_lock);
+
 out:
     free(msg);
     fclose(log);
@@ -242,6 +405,148 @@ out:
     pthread_exit(NULL);
 }
 
+static int nm_qmp_job_parse(const char *cmd, nm_qmp_job_t *job)
+{
+    struct json_object *parsed, *args, *jobid;
+    nm_str_t jobid_copy = NM_INIT_STR;
+    char *name_start;
+    int rc = NM_ERR;
+
+    if ((parsed = json_tokener_parse(cmd)) == NULL) {
+        nm_debug("%s: cannot parse json\n", __func__);
+        return NM_ERR;
+    }
+
+    if (!json_object_object_get_ex(parsed, "arguments", &args) ||
+            !json_object_object_get_ex(args, "job-id", &jobid)) {
+        nm_debug("%s: malformed json\n", __func__);
+        goto out;
+    }
+
+    nm_str_alloc_text(&job->jobid, json_object_get_string(jobid));
+    nm_str_alloc_text(&job->cmd, cmd);
+
+    /*
+     *  Get VM name from job-id
+     *  input string example: vmdel-vmname-2021-05-27-15-14-12-tVusSMWY
+     */
+    nm_str_copy(&jobid_copy, &job->jobid);
+
+    /*
+     *  Cut job-id, we have 7 dashes in UID.
+     *  input:  vmdel-vmname-2021-05-27-15-14-12-tVusSMWY
+     *                      <----<--<--<--<--<--<--------
+     *                      7    6  5  4  3  2  1
+     *  result: vmdel-vmname
+     */
+    for (size_t sep = 0; sep < 7; sep++) {
+        char *dash = strrchr(jobid_copy.data, '-');
+        if (dash) {
+            *dash = '\0';
+        } else {
+            break;
+        }
+    }
+
+    /*
+     *  Cut VM name:
+     *  input:  vmdel-vmname
+     *          ----->
+     *  result: -vmname
+     */
+    name_start = strchr(jobid_copy.data, '-');
+    if (!name_start) {
+        nm_debug("%s: error get VM name from job-id\n", __func__);
+        goto out;
+    }
+
+    name_start++; /* skip dash */
+    nm_str_alloc_text(&job->vm, name_start);
+    rc = NM_OK;
+
+out:
+    json_object_put(parsed);
+    nm_str_free(&jobid_copy);
+
+    return rc;
+}
+
+static void nm_qmp_job_usb(const nm_qmp_job_t *job)
+{
+    bool added = (job->type == NM_QMP_JOB_USB_ADD);
+    nm_str_t body = NM_INIT_STR;
+    int rc;
+
+    rc = added ? nm_qmp_usb_attach(&job->vm, &job->usb) :
+        nm_qmp_usb_detach(&job->vm, &job->usb);
+
+    nm_str_format(&body, "%s: USB %s:%s %s%s", job->vm.data,
+            job->dev.vendor_id.data, job->dev.product_id.data,
+            added ? "attached" : "detached",
+            (rc == NM_OK) ? "" : " with error");
+    nm_debug("%s: %s\n", __func__, body.data);
+#if defined (NM_WITH_DBUS)
+    if (added)
+        nm_dbus_send_notify("USB device attached:", body.data);
+#endif
+    nm_str_free(&body);
+}
+
+static void nm_qmp_job_free(nm_qmp_job_t *job)
+{
+    nm_str_free(&job->vm);
+    nm_str_free(&job->cmd);
+    nm_str_free(&job->jobid);
+    if (job->usb.dev)
+        nm_usb_data_free(&job->usb);
+    free(job);
+}
+
+static void nm_qmp_queue_put(nm_qmp_job_t *job)
+{
+    nm_qmp_job_t **pp = &nm_qmp_queue_head;
+
+    pthread_mutex_lock(&nm_qmp_queue_lock);
+    while (*pp)
+        pp = &(*pp)->next;
+
+    *pp = job;
+    nm_qmp_queue_len++;
+    pthread_cond_broadcast(&nm_qmp_queue_cond);
+    pthread_mutex_unlock(&nm_qmp_queue_lock);
+}
+
+/*
+ * Must be called with nm_qmp_queue_lock held.
+ * Returns the oldest job of VM that has no running job.
+ */
+static nm_qmp_job_t *nm_qmp_queue_take(void)
+{
+    for (nm_qmp_job_t **pp = &nm_qmp_queue_head; *pp; pp = &(*pp)->next) {
+        nm_qmp_job_t *job = *pp;
+        bool busy = false;
+
+        for (size_t n = 0; n < NM_QMP_WORKERS; n++) {
+            if (nm_qmp_running[n] &&
+                    nm_str_cmp_ss(nm_qmp_running[n], &job->vm) == NM_OK) {
+                busy = true;
+                break;
+            }
+        }
+
+        if (busy)
+            continue;
+
+        *pp = job->next;
+        job->next = NULL;
+        nm_qmp_queue_len--;
+
+        return job;
+    }
+
+    return NULL;
+}
+
 void nm_mon_start(void)
 {
     const nm_cfg_t *cfg = nm_cfg_get();
@@ -321,10 +626,11 @@ void nm_mon_loop(void)
     nm_clean_data_t clean = NM_CLEAN_INIT;
     nm_vect_t mon_list = NM_INIT_VECT;
     nm_vect_t vm_list = NM_INIT_VECT;
+    nm_qmp_reader_t reader;
     const nm_cfg_t *cfg;
     struct sigaction sa;
-    struct timespec ts;
     pthread_t qmp_thr;
+    int usb_fd;
     pid_t pid;
 
     nm_cfg_init();
@@ -371,6 +677,8 @@ void nm_mon_loop(void)
     close(STDOUT_FILENO);
     close(STDERR_FILENO);
 
+    nm_mon_events_init();
+
     sigemptyset(&sa.sa_mask);
     sa.sa_flags = 0;
     sa.sa_handler = nm_mon_signals_handler;
@@ -378,15 +686,15 @@ void nm_mon_loop(void)
     sigaction(SIGINT, &sa, NULL);
     sigaction(SIGTERM, &sa, NULL);
 
-    ts.tv_sec = cfg->daemon_sleep / 1000;
-    ts.tv_nsec = (cfg->daemon_sleep % 1000) * 1e+6;
-
     if (nm_mon_store_pid() != NM_OK) {
         nm_exit(EXIT_FAILURE);
     }
 
     nm_db_init();
+    nm_qmp_pool_init();
+    nm_qmp_pool_set_event_cb(nm_mon_qmp_event);
     nm_mon_build_list(&mon_list, &vm_list);
+    nm_mon_metrics_sd = nm_mon_metrics_listen(&cfg->daemon_metrics);
 #if defined (NM_WITH_DBUS)
     if (nm_dbus_connect() != NM_OK) {
         nm_exit(EXIT_FAILURE);
@@ -399,70 +707,597 @@ void nm_mon_loop(void)
     pthread_setname_np(qmp_thr, "nemu-qmp-dsp");
 #endif
 
+    nm_qmp_reader_init(&reader);
+    usb_fd = nm_usb_monitor_fd();
+
     for (;;) {
+        struct pollfd fds[4 + NM_MON_METRICS_CLIENTS];
+        nfds_t nfds = 1;
+        ssize_t ino = -1, metrics = -1, usb = -1;
+        nfds_t scrapes = 0;
+        int timeout = -1;
+
+        /* cleanup is not async-signal-safe, exit here, not in handler */
+        if (nm_mon_stop)
+            nm_exit((nm_mon_stop == SIGINT) ? EXIT_SUCCESS : EXIT_FAILURE);
+
         if (nm_mon_rebuild) {
-            nm_mon_build_list(&mon_list, &vm_list);
             nm_mon_rebuild = 0;
+            nm_mon_build_list(&mon_list, &vm_list);
         }
-        nm_mon_check_vms(&mon_list);
-        nanosleep(&ts, NULL);
+
+        if (nm_mon_attach_vms(&mon_list))
+            timeout = NM_MON_ATTACH_DELAY;
+
+        fds[0].fd = nm_mon_ev_pipe[0];
+        fds[0].events = POLLIN;
+#if defined (NM_OS_LINUX)
+        if (nm_mon_ino_fd != -1) {
+            ino = nfds++;
+            fds[ino].fd = nm_mon_ino_fd;
+            fds[ino].events = POLLIN;
+        }
+#endif
+        if (nm_mon_metrics_sd != -1) {
+            metrics = nfds++;
+            fds[metrics].fd = nm_mon_metrics_sd;
+            fds[metrics].events = POLLIN;
+        }
+        if (usb_fd != -1) {
+            usb = nfds++;
+            fds[usb].fd = usb_fd;
+            fds[usb].events = POLLIN;
+        }
+        if (ino == -1 && timeout == -1)
+            timeout = cfg->daemon_sleep;
+        if (metrics != -1) {
+            scrapes = nm_mon_metrics_pollfd(fds + nfds, &timeout);
+            nfds += scrapes;
+        }
+
+        switch (poll(fds, nfds, timeout)) {
+        case -1: /* EINTR: signal, stop and rebuild flags are checked */
+            continue;
+        case 0:
+            nm_mon_metrics_serve(fds + nfds - scrapes, scrapes,
+                    nm_mon_collect, &mon_list);
+            if (ino == -1) {
+                /* no inotify, probe stopped VMs */
+                for (size_t n = 0; n < mon_list.n_memb; n++) {
+                    if (nm_mon_item_get_status(&mon_list, n) <= NM_MON_STOPPED)
+                        nm_mon_item_at(&mon_list, n)->attach = 1;
+                }
+            }
+            continue;
+        }
+
+        if (fds[0].revents & POLLIN)
+            nm_mon_read_events(&mon_list, &reader);
+#if defined (NM_OS_LINUX)
+        if (ino != -1 && (fds[ino].revents & POLLIN))
+            nm_mon_read_inotify(&mon_list);
+#endif
+        nm_mon_metrics_serve(fds + nfds - scrapes, scrapes,
+                nm_mon_collect, &mon_list);
+        if (metrics != -1 && (fds[metrics].revents & POLLIN))
+            nm_mon_metrics_accept(nm_mon_metrics_sd);
+        if (usb != -1 && (fds[usb].revents & POLLIN))
+            nm_usb_registry_update(nm_mon_usb_event, &mon_list);
     }
 }
 
-static void nm_mon_check_vms(const nm_vect_t *mon_list)
+/*
+ * Try to connect to VMs that are expected to start.
+ * Returns the number of VMs still waiting for connection.
+ */
+static int nm_mon_attach_vms(const nm_vect_t *mon_list)
 {
-    nm_str_t body = NM_INIT_STR;
+    int pending = 0;
 
     for (size_t n = 0; n < mon_list->n_memb; n++) {
-        char *name = nm_mon_item_get_name_cstr(mon_list, n);
-        int8_t status = nm_mon_item_get_status(mon_list, n);
+        nm_mon_item_t *item = nm_mon_item_at(mon_list, n);
 
-        if (nm_qmp_test_socket(nm_mon_item_get_name(mon_list, n)) == NM_OK) {
-            if (!status) {
-                nm_str_format(&body, "%s started", name);
-#if defined (NM_WITH_DBUS)
-                nm_dbus_send_notify("VM status changed:", body.data);
+        if (!item->attach)
+            continue;
+
+        if (nm_qmp_pool_attach(item->name) == NM_OK) {
+            int pid = nm_vmctl_get_pid(item->name);
+
+            item->attach = 0;
+            if (pid != item->pid) {
+                nm_stat_unwatch(item->pid);
+                item->pid = (pid > 0) ? pid : 0;
+                nm_stat_watch(item->pid);
+                nm_mon_load_ifs(item);
+#if defined (NM_OS_LINUX)
+                /* start is timed only if it was seen by inotify */
+                if (item->state == NM_MON_STOPPED && nm_mon_ino_fd != -1)
+                    item->start = nm_stat_age(item->pid);
 #endif
             }
-            nm_mon_item_set_status(mon_list, n, NM_TRUE);
-        } else {
-            if (status == 1) {
-                nm_str_format(&body, "%s stopped", name);
+            if (item->state != NM_MON_PAUSED)
+                nm_mon_set_state(mon_list, n, NM_MON_RUNNING);
+            continue;
+        }
+
+        if (--item->attach == 0)
+            nm_mon_set_state(mon_list, n, NM_MON_STOPPED);
+        else
+            pending++;
+    }
+
+    return pending;
+}
+
+static void nm_mon_set_state(const nm_vect_t *mon_list, size_t idx, int8_t state)
+{
+    int8_t status = nm_mon_item_get_status(mon_list, idx);
+    nm_str_t body = NM_INIT_STR;
+
+    if (status == state)
+        return;
+
+    /* first check after (re)start of daemon is not reported */
+    if (status != -1) {
+        if (state == NM_MON_STOPPED) {
+            nm_str_format(&body, "%s stopped",
+                    nm_mon_item_get_name_cstr(mon_list, idx));
+        } else if (status == NM_MON_STOPPED) {
+            nm_str_format(&body, "%s started",
+                    nm_mon_item_get_name_cstr(mon_list, idx));
+        }
+    }
+
+    if (body.len) {
+        nm_debug("%s: %s\n", __func__, body.data);
 #if defined (NM_WITH_DBUS)
-                nm_dbus_send_notify("VM status changed:", body.data);
+        nm_dbus_send_notify("VM status changed:", body.data);
 #endif
-            }
-            nm_mon_item_set_status(mon_list, n, NM_FALSE);
-        }
-        nm_str_free(&body);
     }
+
+    if (state == NM_MON_STOPPED) {
+        nm_mon_item_t *item = nm_mon_item_at(mon_list, idx);
+
+        nm_stat_unwatch(item->pid);
+        item->pid = 0;
+    }
+
+    nm_mon_item_set_status(mon_list, idx, state);
+    nm_str_free(&body);
 }
 
 static void nm_mon_build_list(nm_vect_t *list, nm_vect_t *vms)
 {
-    nm_vect_free(list, NULL);
-    nm_vect_free(vms, nm_str_vect_free_cb);
+    nm_vect_t new_list = NM_INIT_VECT;
+    nm_vect_t new_vms = NM_INIT_VECT;
 
-    nm_db_select(NM_GET_VMS_SQL, vms);
+    nm_db_select(NM_GET_VMS_SQL, &new_vms);
 
-    for (size_t n = 0; n < vms->n_memb; n++) {
+    for (size_t n = 0; n < new_vms.n_memb; n++) {
         nm_mon_item_t item = NM_ITEM_INIT;
+        ssize_t idx;
+
+        item.name = nm_vect_str(&new_vms, n);
+        item.attach = 1;
+
+        /* keep known state and watch, VM is not reported as started again */
+        if ((idx = nm_mon_find(list, item.name->data)) != -1) {
+            item.state = nm_mon_item_get_status(list, idx);
+            item.wd = nm_mon_item_at(list, idx)->wd;
+            item.pid = nm_mon_item_at(list, idx)->pid;
+            item.start = nm_mon_item_at(list, idx)->start;
+            item.ifs = nm_mon_item_at(list, idx)->ifs;
+            nm_mon_item_at(list, idx)->wd = -1;
+            nm_mon_item_at(list, idx)->pid = 0;
+            nm_mon_item_at(list, idx)->ifs = NM_INIT_DB_RESULT;
+        }
+
+        nm_vect_insert(&new_list, &item, sizeof(nm_mon_item_t), NULL);
+    }
+
+#if defined (NM_OS_LINUX)
+    for (size_t n = 0; n < list->n_memb; n++) {
+        if (nm_mon_item_at(list, n)->wd != -1)
+            inotify_rm_watch(nm_mon_ino_fd, nm_mon_item_at(list, n)->wd);
+    }
+#endif
+    /* VMs removed from database */
+    for (size_t n = 0; n < list->n_memb; n++)
+        nm_stat_unwatch(nm_mon_item_at(list, n)->pid);
+
+    nm_vect_free(list, nm_mon_item_free_cb);
+    nm_vect_free(vms, nm_str_vect_free_cb);
+    *list = new_list;
+    *vms = new_vms;
+
+#if defined (NM_OS_LINUX)
+    for (size_t n = 0; n < list->n_memb; n++) {
+        if (nm_mon_item_at(list, n)->wd == -1)
+            nm_mon_watch(list, n);
+    }
+#endif
+}
+
+static void nm_mon_events_init(void)
+{
+    if (pipe(nm_mon_ev_pipe) == -1)
+        nm_bug("%s: pipe error: %s", __func__, strerror(errno));
+
+    fcntl(nm_mon_ev_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(nm_mon_ev_pipe[1], F_SETFL, O_NONBLOCK);
+
+#if defined (NM_OS_LINUX)
+    if ((nm_mon_ino_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1) {
+        nm_debug("%s: inotify_init1: %s\n", __func__, strerror(errno));
+        return;
+    }
+
+    nm_mon_root_wd = inotify_add_watch(nm_mon_ino_fd,
+            nm_cfg_get()->vm_dir.data, IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+    if (nm_mon_root_wd == -1) {
+        nm_debug("%s: cannot watch %s: %s\n", __func__,
+                nm_cfg_get()->vm_dir.data, strerror(errno));
+    }
+#endif
+}
+
+/*
+ * Called by QMP pool I/O thread. Event is passed to the main loop
+ * as one JSON line, pipe writes up to PIPE_BUF are atomic.
+ */
+static void nm_mon_qmp_event(const nm_str_t *name, const char *event,
+        struct json_object *data)
+{
+    struct json_object *rec, *dev;
+    nm_str_t buf = NM_INIT_STR;
+
+    if (!nm_mon_event_find(event))
+        return;
+
+    rec = json_object_new_object();
+    json_object_object_add(rec, "vm", json_object_new_string(name->data));
+    json_object_object_add(rec, "event", json_object_new_string(event));
+    if (data && json_object_object_get_ex(data, "device", &dev)) {
+        json_object_object_add(rec, "device",
+                json_object_new_string(json_object_get_string(dev)));
+    }
+
+    nm_str_format(&buf, "%s\n",
+            json_object_to_json_string_ext(rec, JSON_C_TO_STRING_PLAIN));
+    json_object_put(rec);
+
+    if (write(nm_mon_ev_pipe[1], buf.data, buf.len) != (ssize_t) buf.len)
+        nm_debug("%s: event %s of %s is lost\n", __func__, event, name->data);
+
+    nm_str_free(&buf);
+}
+
+static const nm_mon_event_t *nm_mon_event_find(const char *event)
+{
+    for (const nm_mon_event_t *ev = nm_mon_events; ev->event; ev++) {
+        if (!strcmp(ev->event, event))
+            return ev;
+    }
+
+    return NULL;
+}
+
+static void nm_mon_read_events(const nm_vect_t *mon_list,
+        nm_qmp_reader_t *reader)
+{
+    char buf[NM_MON_EVBUF];
+    struct json_object *ev;
+    ssize_t nread;
+
+    while ((nread = read(nm_mon_ev_pipe[0], buf, sizeof(buf))) > 0)
+        nm_qmp_reader_feed(reader, buf, nread);
+
+    while ((ev = nm_qmp_reader_next(reader)) != NULL) {
+        nm_mon_handle_event(mon_list, ev);
+        json_object_put(ev);
+    }
+}
+
+static void nm_mon_handle_event(const nm_vect_t *mon_list,
+        struct json_object *ev)
+{
+    struct json_object *vm, *event, *dev;
+    const nm_mon_event_t *desc;
+    nm_str_t body = NM_INIT_STR;
+    nm_mon_item_t *item;
+    ssize_t idx;
 
-        item.name = nm_vect_str(vms, n);
-        nm_vect_insert(list, &item, sizeof(nm_mon_item_t), NULL);
+    if (!json_object_object_get_ex(ev, "vm", &vm) ||
+            !json_object_object_get_ex(ev, "event", &event))
+        return;
+
+    if ((desc = nm_mon_event_find(json_object_get_string(event))) == NULL)
+        return;
+
+    if ((idx = nm_mon_find(mon_list, json_object_get_string(vm))) == -1)
+        return;
+
+    item = nm_mon_item_at(mon_list, idx);
+
+    if (!strcmp(desc->event, NM_QMP_POOL_EV_CLOSED)) {
+        /* QEMU exited or connection was dropped, check it */
+        item->attach = 1;
+        return;
+    }
+
+    nm_str_format(&body, desc->msg, item->name->data);
+    if (json_object_object_get_ex(ev, "device", &dev))
+        nm_str_append_format(&body, " (%s)", json_object_get_string(dev));
+
+    nm_debug("%s: %s\n", __func__, body.data);
+#if defined (NM_WITH_DBUS)
+    nm_dbus_send_notify("VM status changed:", body.data);
+#endif
+
+    if (desc->state != -1)
+        nm_mon_item_set_status(mon_list, idx, desc->state);
+
+    nm_str_free(&body);
+}
+
+static ssize_t nm_mon_find(const nm_vect_t *mon_list, const char *name)
+{
+    for (size_t n = 0; n < mon_list->n_memb; n++) {
+        if (!strcmp(nm_mon_item_get_name_cstr(mon_list, n), name))
+            return n;
+    }
+
+    return -1;
+}
+
+/*
+ * USB device is plugged in or removed. Device is attached to every
+ * running VM it is bound to. On removal device_del frees the QMP id
+ * so the device can be added again, QEMU does not follow new
+ * bus address of usb-host device itself.
+ * QMP commands may take seconds, they are queued to QMP workers.
+ */
+static void nm_mon_usb_event(const nm_usb_data_t *usb, bool added, void *ctx)
+{
+    const nm_vect_t *mon_list = ctx;
+    nm_vect_t vms = NM_INIT_VECT;
+    nm_db_stmt_t *stmt;
+
+    stmt = nm_db_stmt(NM_STMT_USB_GET_BOUND);
+    nm_db_bind_text(stmt, 1, usb->dev->vendor_id.data);
+    nm_db_bind_text(stmt, 2, usb->dev->product_id.data);
+    /* serial is stored as "NULL" if device has none */
+    nm_db_bind_text(stmt, 3, usb->serial.len ? usb->serial.data : "NULL");
+    nm_db_stmt_select(stmt, &vms);
+
+    for (size_t n = 0; n < vms.n_memb; n++) {
+        const nm_str_t *vm = nm_vect_str(&vms, n);
+        ssize_t idx = nm_mon_find(mon_list, vm->data);
+        nm_qmp_job_t *job;
+
+        if (idx == -1 || nm_mon_item_get_status(mon_list, idx) <= NM_MON_STOPPED)
+            continue;
+
+        job = nm_calloc(1, sizeof(nm_qmp_job_t));
+        *job = NM_QMP_JOB_INIT;
+        job->type = added ? NM_QMP_JOB_USB_ADD : NM_QMP_JOB_USB_DEL;
+        nm_str_copy(&job->vm, vm);
+        nm_str_copy(&job->dev.vendor_id, &usb->dev->vendor_id);
+        nm_str_copy(&job->dev.product_id, &usb->dev->product_id);
+        job->dev.bus_num = usb->dev->bus_num;
+        job->dev.dev_addr = usb->dev->dev_addr;
+        if (usb->serial.len)
+            nm_str_copy(&job->usb.serial, &usb->serial);
+        job->usb.dev = &job->dev;
+
+        nm_qmp_queue_put(job);
     }
+
+    nm_vect_free(&vms, nm_str_vect_free_cb);
+}
+
+/*
+ * Interface names are read when VM starts, tap devices are created
+ * by QEMU then. Scrapes use them without database queries.
+ */
+static void nm_mon_load_ifs(nm_mon_item_t *item)
+{
+    nm_db_result_free(&item->ifs);
+    nm_db_result_vm(NM_STMT_VM_GET_IFACES, item->name->data, &item->ifs);
 }
 
+static void nm_mon_collect(nm_str_t *body, void *ctx)
+{
+    const nm_vect_t *mon_list = ctx;
+    double (*val)[NM_MON_M_COUNT];
+    nm_qmp_pool_stats_t qmp;
+
+    nm_stat_sample();
+
+    val = nm_calloc(mon_list->n_memb ? mon_list->n_memb : 1, sizeof(*val));
+
+    for (size_t n = 0; n < mon_list->n_memb; n++) {
+        const nm_mon_item_t *item = nm_mon_item_at(mon_list, n);
+        nm_stat_t stat = NM_INIT_STAT;
+
+        for (size_t m = 0; m < NM_MON_M_COUNT; m++)
+            val[n][m] = -1; /* no sample */
+
+        val[n][NM_MON_M_UP] = (item->state > NM_MON_STOPPED);
+        val[n][NM_MON_M_START] = item->start;
+
+        if (!item->pid || nm_stat_get(item->pid, &stat) != NM_OK)
+            continue;
+
+        val[n][NM_MON_M_CPU] = stat.cpu_time;
+        val[n][NM_MON_M_RSS] = stat.rss;
+        val[n][NM_MON_M_RD] = stat.rd_bytes;
+        val[n][NM_MON_M_WR] = stat.wr_bytes;
+        /* host side of tap: tx goes to the guest */
+        val[n][NM_MON_M_RX] = nm_mon_net_bytes(&item->ifs, "tx_bytes");
+        val[n][NM_MON_M_TX] = nm_mon_net_bytes(&item->ifs, "rx_bytes");
+    }
+
+    for (size_t m = 0; m < NM_MON_M_COUNT; m++) {
+        nm_mon_metrics_head(body, nm_mon_metrics[m].name,
+                nm_mon_metrics[m].type, nm_mon_metrics[m].help);
+
+        for (size_t n = 0; n < mon_list->n_memb; n++) {
+            if (val[n][m] < 0)
+                continue;
+            nm_mon_metrics_add(body, nm_mon_metrics[m].name,
+                    nm_mon_item_get_name_cstr(mon_list, n), val[n][m]);
+        }
+    }
+
+    free(val);
+
+    nm_qmp_pool_get_stats(&qmp);
+    nm_mon_metrics_head(body, "nemu_qmp_command_seconds", "histogram",
+            "Latency of QMP commands executed by monitor daemon");
+    for (size_t n = 0; n < NM_QMP_POOL_BUCKETS; n++) {
+        nm_str_append_format(body,
+                "nemu_qmp_command_seconds_bucket{le=\"%g\"} %" PRIu64 "\n",
+                nm_qmp_pool_bounds[n], qmp.bucket[n]);
+    }
+    nm_str_append_format(body,
+            "nemu_qmp_command_seconds_bucket{le=\"+Inf\"} %" PRIu64 "\n",
+            qmp.count);
+    nm_mon_metrics_add(body, "nemu_qmp_command_seconds_sum", NULL, qmp.sum);
+    nm_mon_metrics_add(body, "nemu_qmp_command_seconds_count", NULL, qmp.count);
+
+    nm_mon_metrics_head(body, "nemu_qmp_command_errors_total", "counter",
+            "QMP commands failed or timed out");
+    nm_mon_metrics_add(body, "nemu_qmp_command_errors_total", NULL, qmp.errors);
+}
+
+/* Sum of tap interface counter, user mode network has no tap */
+static uint64_t nm_mon_net_bytes(const nm_db_result_t *ifs, const char *counter)
+{
+    nm_str_t path = NM_INIT_STR;
+    uint64_t total = 0;
+
+    for (size_t n = 0; n < ifs->n_memb / NM_IFS_IDX_COUNT; n++) {
+        char buf[32];
+        ssize_t nread;
+        int fd;
+
+        nm_str_format(&path, "/sys/class/net/%s/statistics/%s",
+                nm_db_res_cstr(ifs, NM_SQL_IF_NAME + n * NM_IFS_IDX_COUNT),
+                counter);
+        if ((fd = open(path.data, O_RDONLY | O_CLOEXEC)) == -1)
+            continue;
+
+        if ((nread = read(fd, buf, sizeof(buf) - 1)) > 0) {
+            buf[nread] = '\0';
+            total += strtoull(buf, NULL, 10);
+        }
+        close(fd);
+    }
+
+    nm_str_free(&path);
+
+    return total;
+}
+
+#if defined (NM_OS_LINUX)
+static void nm_mon_watch(const nm_vect_t *mon_list, size_t idx)
+{
+    nm_mon_item_t *item = nm_mon_item_at(mon_list, idx);
+    nm_str_t path = NM_INIT_STR;
+
+    if (nm_mon_ino_fd == -1)
+        return;
+
+    nm_str_format(&path, "%s/%s", nm_cfg_get()->vm_dir.data, item->name->data);
+    item->wd = inotify_add_watch(nm_mon_ino_fd, path.data,
+            IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+    nm_str_free(&path);
+}
+
+static void nm_mon_read_inotify(const nm_vect_t *mon_list)
+{
+    char buf[NM_MON_EVBUF]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t nread;
+
+    while ((nread = read(nm_mon_ino_fd, buf, sizeof(buf))) > 0) {
+        const struct inotify_event *ev;
+
+        for (char *ptr = buf; ptr < buf + nread;
+                ptr += sizeof(struct inotify_event) + ev->len) {
+            ssize_t idx = -1;
+
+            ev = (const struct inotify_event *) ptr;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                /* events were lost, recheck everything */
+                for (size_t n = 0; n < mon_list->n_memb; n++)
+                    nm_mon_item_at(mon_list, n)->attach = 1;
+                continue;
+            }
+
+            if (ev->wd == nm_mon_root_wd) {
+                if (!ev->len)
+                    continue;
+                /* new VM directory */
+                if ((idx = nm_mon_find(mon_list, ev->name)) == -1)
+                    nm_mon_rebuild = 1;
+                else if (nm_mon_item_at(mon_list, idx)->wd == -1)
+                    nm_mon_watch(mon_list, idx);
+                continue;
+            }
+
+            for (size_t n = 0; n < mon_list->n_memb; n++) {
+                if (nm_mon_item_at(mon_list, n)->wd == ev->wd) {
+                    idx = n;
+                    break;
+                }
+            }
+
+            if (idx == -1)
+                continue;
+
+            if (ev->mask & IN_IGNORED) {
+                /* VM directory was removed */
+                nm_mon_item_at(mon_list, idx)->wd = -1;
+                continue;
+            }
+
+            if (ev->len && !strcmp(ev->name, NM_VM_QMP_FILE))
+                nm_mon_item_at(mon_list, idx)->attach = NM_MON_ATTACH_TRIES;
+        }
+    }
+}
+#endif /* NM_OS_LINUX */
+
 static void nm_mon_signals_handler(int signal)
 {
     switch (signal) {
     case SIGUSR1:
         nm_mon_rebuild = 1;
+        nm_mon_wakeup();
         break;
     case SIGINT:
-        nm_exit(EXIT_SUCCESS);
     case SIGTERM:
-        nm_exit(EXIT_FAILURE);
+        nm_mon_stop = signal;
+        nm_mon_wakeup();
+        break;
+    }
+}
+
+/*
+ * Called from signal handler: wake up the main loop,
+ * if pipe is full it is awake anyway.
+ */
+static void nm_mon_wakeup(void)
+{
+    if (nm_mon_ev_pipe[1] != -1) {
+        int err = errno;
+        ssize_t rc = write(nm_mon_ev_pipe[1], "\n", 1);
+
+        (void) rc;
+        errno = err;
     }
 }
 
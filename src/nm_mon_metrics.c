@@ -0,0 +1,365 @@
+#if defined (NM_OS_LINUX)
+# define _GNU_SOURCE
+#endif
+#include <nm_core.h>
+#include <nm_utils.h>
+#include <nm_string.h>
+#include <nm_mon_metrics.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <time.h>
+
+/*
+ * Metrics exporter of monitor daemon.
+ * Prometheus text format over HTTP/1.0, one scrape per connection.
+ * Listen address (metrics in [nemu-monitor]) is a unix socket path
+ * or [ipv4:]port, default host is 127.0.0.1. The request is read
+ * only to be polite, any request gets the metrics.
+ * Scrape clients are non-blocking and served from daemon poll loop,
+ * slow client is dropped after NM_METRICS_TMO.
+ */
+
+enum {
+    NM_METRICS_BACKLOG = 4,
+    NM_METRICS_TMO = 1000, /* ms, reading request and writing reply */
+    NM_METRICS_REQLEN = 4096
+};
+
+typedef struct nm_metrics_client {
+    int fd;
+    bool reply;       /* request is read, reply is being sent */
+    size_t sent;
+    int64_t deadline; /* ms, CLOCK_MONOTONIC */
+    nm_str_t buf;     /* request, then reply */
+} nm_metrics_client_t;
+
+static const char NM_METRICS_HOST[] = "127.0.0.1";
+
+static nm_metrics_client_t nm_metrics_clients[NM_MON_METRICS_CLIENTS];
+
+static nm_metrics_client_t *nm_mon_metrics_client(int fd);
+static int nm_mon_metrics_read(nm_metrics_client_t *cl);
+static void nm_mon_metrics_write(nm_metrics_client_t *cl);
+static void nm_mon_metrics_drop(nm_metrics_client_t *cl);
+static void nm_mon_metrics_label(nm_str_t *body, const char *value);
+static void nm_mon_metrics_unlink(const char *path);
+
+/* Returns listening socket or -1 */
+int nm_mon_metrics_listen(const nm_str_t *addr)
+{
+    int sd = -1;
+
+    for (size_t n = 0; n < NM_MON_METRICS_CLIENTS; n++) {
+        nm_metrics_clients[n].fd = -1;
+        nm_metrics_clients[n].buf = NM_INIT_STR;
+    }
+
+    if (!addr->len)
+        return -1;
+
+    if (strchr(addr->data, '/')) {
+        struct sockaddr_un un;
+        mode_t mask;
+
+        memset(&un, 0, sizeof(un));
+        un.sun_family = AF_UNIX;
+        if (addr->len >= sizeof(un.sun_path)) {
+            nm_debug("%s: path is too long: %s\n", __func__, addr->data);
+            return -1;
+        }
+        nm_strlcpy(un.sun_path, addr->data, sizeof(un.sun_path));
+
+        if ((sd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1)
+            goto err;
+
+        /* socket is left by killed daemon, pid file check passed already */
+        nm_mon_metrics_unlink(addr->data);
+
+        mask = umask(0077);
+        if (bind(sd, (struct sockaddr *) &un, sizeof(un)) == -1) {
+            umask(mask);
+            goto err;
+        }
+        umask(mask);
+    } else {
+        struct sockaddr_in in;
+        const char *host = NM_METRICS_HOST;
+        nm_str_t buf = NM_INIT_STR;
+        char *port, *end;
+        unsigned long num;
+        int on = 1;
+
+        nm_str_copy(&buf, addr);
+        if ((port = strrchr(buf.data, ':')) != NULL) {
+            *port++ = '\0';
+            host = buf.data;
+        } else {
+            port = buf.data;
+        }
+
+        memset(&in, 0, sizeof(in));
+        in.sin_family = AF_INET;
+        num = strtoul(port, &end, 10);
+        if (*end || end == port || !num || num > 65535 ||
+                inet_pton(AF_INET, host, &in.sin_addr) != 1) {
+            nm_debug("%s: bad address: %s\n", __func__, addr->data);
+            nm_str_free(&buf);
+            return -1;
+        }
+        in.sin_port = htons(num);
+        nm_str_free(&buf);
+
+        if ((sd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1)
+            goto err;
+
+        setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        if (bind(sd, (struct sockaddr *) &in, sizeof(in)) == -1)
+            goto err;
+    }
+
+    if (listen(sd, NM_METRICS_BACKLOG) == -1)
+        goto err;
+
+    return sd;
+
+err:
+    nm_debug("%s: cannot listen on %s: %s\n",
+            __func__, addr->data, strerror(errno));
+    if (sd != -1)
+        close(sd);
+
+    return -1;
+}
+
+void nm_mon_metrics_close(int sd, const nm_str_t *addr)
+{
+    if (sd == -1)
+        return;
+
+    for (size_t n = 0; n < NM_MON_METRICS_CLIENTS; n++)
+        nm_mon_metrics_drop(&nm_metrics_clients[n]);
+
+    close(sd);
+    if (strchr(addr->data, '/'))
+        nm_mon_metrics_unlink(addr->data);
+}
+
+/* Mistyped path must not remove a regular file, only sockets go */
+static void nm_mon_metrics_unlink(const char *path)
+{
+    struct stat info;
+
+    if (lstat(path, &info) == 0 && S_ISSOCK(info.st_mode))
+        unlink(path);
+}
+
+/* Accept scrape connection, it is dropped if all slots are busy */
+void nm_mon_metrics_accept(int sd)
+{
+    nm_metrics_client_t *cl;
+    int cd;
+
+    if ((cd = accept4(sd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) == -1)
+        return;
+
+    if ((cl = nm_mon_metrics_client(-1)) == NULL) {
+        nm_debug("%s: too many scrapes, dropped\n", __func__);
+        close(cd);
+        return;
+    }
+
+    cl->fd = cd;
+    cl->reply = false;
+    cl->sent = 0;
+    cl->deadline = nm_mono_ms() + NM_METRICS_TMO;
+    nm_str_trunc(&cl->buf, 0);
+}
+
+/*
+ * Fill poll set with scrape clients, timeout is shortened
+ * to the nearest client deadline. Returns number of fds.
+ */
+nfds_t nm_mon_metrics_pollfd(struct pollfd *fds, int *timeout)
+{
+    int64_t now = nm_mono_ms();
+    nfds_t nfds = 0;
+
+    for (size_t n = 0; n < NM_MON_METRICS_CLIENTS; n++) {
+        const nm_metrics_client_t *cl = &nm_metrics_clients[n];
+        int left;
+
+        if (cl->fd == -1)
+            continue;
+
+        fds[nfds].fd = cl->fd;
+        fds[nfds].events = cl->reply ? POLLOUT : POLLIN;
+        fds[nfds].revents = 0;
+        nfds++;
+
+        left = (cl->deadline > now) ? (int) (cl->deadline - now) : 0;
+        if (*timeout == -1 || left < *timeout)
+            *timeout = left;
+    }
+
+    return nfds;
+}
+
+/*
+ * Continue scrapes that are ready after poll. Metrics are collected
+ * once the request is read, expired clients are dropped.
+ */
+void nm_mon_metrics_serve(const struct pollfd *fds, nfds_t nfds,
+        nm_mon_metrics_collect_t collect, void *ctx)
+{
+    int64_t now = nm_mono_ms();
+
+    for (nfds_t n = 0; n < nfds; n++) {
+        nm_metrics_client_t *cl = nm_mon_metrics_client(fds[n].fd);
+
+        if (!cl)
+            continue;
+
+        if (fds[n].revents && !cl->reply &&
+                nm_mon_metrics_read(cl) == NM_OK) {
+            nm_str_t body = NM_INIT_STR;
+
+            collect(&body, ctx);
+            nm_str_format(&cl->buf, "HTTP/1.0 200 OK\r\n"
+                    "Content-Type: text/plain; version=0.0.4\r\n"
+                    "Content-Length: %zu\r\n"
+                    "Connection: close\r\n\r\n%s",
+                    body.len, body.len ? body.data : "");
+            cl->reply = true;
+            nm_str_free(&body);
+        }
+
+        /* reply is tried right away, socket is usually writable */
+        if (cl->fd != -1 && cl->reply)
+            nm_mon_metrics_write(cl);
+
+        if (cl->fd != -1 && now >= cl->deadline) {
+            nm_debug("%s: scrape timed out\n", __func__);
+            nm_mon_metrics_drop(cl);
+        }
+    }
+}
+
+void nm_mon_metrics_head(nm_str_t *body, const char *name,
+        const char *type, const char *help)
+{
+    nm_str_append_format(body, "# HELP %s %s\n# TYPE %s %s\n",
+            name, help, name, type);
+}
+
+/* Sample of metric, vm label is omitted if NULL */
+void nm_mon_metrics_add(nm_str_t *body, const char *name,
+        const char *vm, double value)
+{
+    nm_str_add_text(body, name);
+
+    if (vm) {
+        nm_str_add_text(body, "{vm=\"");
+        nm_mon_metrics_label(body, vm);
+        nm_str_add_text(body, "\"}");
+    }
+
+    nm_str_append_format(body, " %.15g\n", value);
+}
+
+/* Client by socket, fd -1 gives a free slot */
+static nm_metrics_client_t *nm_mon_metrics_client(int fd)
+{
+    for (size_t n = 0; n < NM_MON_METRICS_CLIENTS; n++) {
+        if (nm_metrics_clients[n].fd == fd)
+            return &nm_metrics_clients[n];
+    }
+
+    return NULL;
+}
+
+/*
+ * Returns NM_OK when the request is read (headers end with empty line),
+ * NM_ERR if more data is expected or client is dropped.
+ */
+static int nm_mon_metrics_read(nm_metrics_client_t *cl)
+{
+    char buf[512];
+    ssize_t nread;
+
+    while ((nread = read(cl->fd, buf, sizeof(buf))) > 0) {
+        nm_str_add_text_part(&cl->buf, buf, nread);
+
+        if (strstr(cl->buf.data, "\r\n\r\n") || strstr(cl->buf.data, "\n\n") ||
+                cl->buf.len >= NM_METRICS_REQLEN)
+            return NM_OK;
+    }
+
+    /* client has shut down writing, it gets the reply anyway */
+    if (nread == 0)
+        return NM_OK;
+
+    if (errno != EAGAIN && errno != EINTR) {
+        nm_debug("%s: read error: %s\n", __func__, strerror(errno));
+        nm_mon_metrics_drop(cl);
+    }
+
+    return NM_ERR;
+}
+
+/* Send as much of reply as socket takes, client is closed when done */
+static void nm_mon_metrics_write(nm_metrics_client_t *cl)
+{
+    while (cl->sent < cl->buf.len) {
+        ssize_t nwrite = send(cl->fd, cl->buf.data + cl->sent,
+                cl->buf.len - cl->sent, MSG_NOSIGNAL);
+
+        if (nwrite > 0) {
+            cl->sent += nwrite;
+            continue;
+        }
+
+        if (nwrite == -1 && errno == EINTR)
+            continue;
+        if (nwrite == -1 && errno == EAGAIN)
+            return;
+
+        nm_debug("%s: scrape is not sent: %s\n", __func__, strerror(errno));
+        break;
+    }
+
+    nm_mon_metrics_drop(cl);
+}
+
+static void nm_mon_metrics_drop(nm_metrics_client_t *cl)
+{
+    if (cl->fd != -1)
+        close(cl->fd);
+
+    cl->fd = -1;
+    nm_str_free(&cl->buf);
+}
+
+static void nm_mon_metrics_label(nm_str_t *body, const char *value)
+{
+    for (const char *ptr = value; *ptr; ptr++) {
+        switch (*ptr) {
+        case '\\':
+            nm_str_add_text(body, "\\\\");
+            break;
+        case '"':
+            nm_str_add_text(body, "\\\"");
+            break;
+        case '\n':
+            nm_str_add_text(body, "\\n");
+            break;
+        default:
+            nm_str_add_char_opt(body, *ptr);
+        }
+    }
+}
+
+/* vim:set ts=4 sw=4: */
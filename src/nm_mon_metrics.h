@@ -0,0 +1,26 @@
+#ifndef NM_MON_METRICS_H_
+#define NM_MON_METRICS_H_
+
+#include <nm_string.h>
+
+#include <poll.h>
+
+enum {
+    NM_MON_METRICS_CLIENTS = 4 /* scrapes served at once */
+};
+
+typedef void (*nm_mon_metrics_collect_t)(nm_str_t *body, void *ctx);
+
+int nm_mon_metrics_listen(const nm_str_t *addr);
+void nm_mon_metrics_close(int sd, const nm_str_t *addr);
+void nm_mon_metrics_accept(int sd);
+nfds_t nm_mon_metrics_pollfd(struct pollfd *fds, int *timeout);
+void nm_mon_metrics_serve(const struct pollfd *fds, nfds_t nfds,
+        nm_mon_metrics_collect_t collect, void *ctx);
+void nm_mon_metrics_head(nm_str_t *body, const char *name,
+        const char *type, const char *help);
+void nm_mon_metrics_add(nm_str_t *body, const char *name,
+        const char *vm, double value);
+
+#endif /* NM_MON_METRICS_H_ */
+/* vim:set ts=4 sw=4: */
@@ -37,6 +37,12 @@ inline void nm_curses_deinit(void)
     _nc_freeall();
 }
 
+/* false in CLI mode, messages go to stderr then */
+bool nm_curses_active(void)
+{
+    return stdscr != NULL && !isendwin();
+}
+
 nm_window_t *nm_init_window(const nm_cord_t *pos)
 {
     nm_window_t *w;
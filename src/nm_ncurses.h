@@ -27,6 +27,7 @@ typedef struct {
 
 void nm_ncurses_init(void);
 void nm_curses_deinit(void);
+bool nm_curses_active(void);
 nm_window_t *nm_init_window(const nm_cord_t *pos);
 void nm_clear_screen(void);
 
@@ -1,6 +1,7 @@
 #include <nm_core.h>
 
 #if defined (NM_WITH_OVF_SUPPORT)
+#include <nm_job.h>
 #include <nm_form.h>
 #include <nm_utils.h>
 #include <nm_string.h>
@@ -9,12 +10,11 @@
 #include <nm_add_vm.h>
 #include <nm_cfg_file.h>
 #include <nm_ovf_import.h>
+#include <nm_process.h>
 
 #include <limits.h>
 
-/* libarchive */
-#include <archive.h>
-#include <archive_entry.h>
+#include <json.h>
 
 /* libxml2 */
 #include <libxml/tree.h>
@@ -28,8 +28,69 @@ const char *nm_ovf_version[] = {
     NULL
 };
 
-enum {NM_BLOCK_SIZE = 10240};
-static const char NM_OVA_DIR_TEMPL[] = "/tmp/ova_extract_XXXXXX";
+/*
+ * OVA is read in place, nothing is extracted.
+ * OVA is ustar archive (DSP0243), tar headers are scanned once to get
+ * offset and size of every file. OVF descriptor is parsed from memory,
+ * disks are converted by qemu-img directly from their offsets in OVA
+ * (raw driver with offset/size under image format driver), all disks
+ * at the same time. Progress is parsed from "qemu-img convert -p"
+ * output of every disk and weighted by disk size. Conversion runs
+ * as background job, VM is added to database when it is finished.
+ */
+enum {
+    NM_TAR_BLOCK = 512,
+    NM_TAR_NAME = 0,
+    NM_TAR_NAME_LEN = 100,
+    NM_TAR_SIZE = 124,
+    NM_TAR_SIZE_LEN = 12,
+    NM_TAR_TYPE = 156,
+    NM_TAR_MAGIC = 257,
+    NM_TAR_PREFIX = 345,
+    NM_TAR_PREFIX_LEN = 155,
+    NM_OVF_MAX_SIZE = 16777216, /* 16MiB */
+    NM_OVA_MAGIC_LEN = 8
+};
+
+static const char NM_OVA_CONVERT_COROUTINES[] = "16"; /* qemu-img maximum */
+
+/* Running qemu-img convert */
+typedef struct {
+    nm_proc_t proc;
+    uint64_t size;
+    double percent;
+    nm_job_t *job;
+} nm_ova_conv_t;
+
+/* Context of import job */
+typedef struct {
+    nm_vm_t vm;
+    nm_vect_t drives;
+    nm_vect_t files;
+    int fd;
+    nm_job_t *job;
+} nm_ova_import_t;
+
+typedef struct {
+    nm_str_t name;
+    uint64_t offset;
+    uint64_t size;
+} nm_ova_file_t;
+
+#define NM_INIT_OVA_FILE (nm_ova_file_t) { NM_INIT_STR, 0, 0 }
+
+/* image format is detected by magic, like qemu-img does */
+static const struct {
+    const char *magic;
+    size_t len;
+    const char *fmt;
+} nm_ova_img_fmt[] = {
+    { "KDMV", 4, "vmdk" },
+    { "QFI\xfb", 4, "qcow2" },
+    { "conectix", 8, "vpc" },
+    { "vhdxfile", 8, "vhdx" },
+    { NULL, 0, NULL }
+};
 
 static const char NM_OVF_FORM_PATH[] = "Path to OVA";
 static const char NM_OVF_FORM_ARCH[] = "Architecture";
@@ -99,9 +160,6 @@ static const char *nm_form_msg[] = {
     NM_OVF_FORM_NAME, NM_OVF_FORM_VER, NULL
 };
 
-typedef struct archive nm_archive_t;
-typedef struct archive_entry nm_archive_entry_t;
-
 typedef xmlChar nm_xml_char_t;
 typedef xmlDocPtr nm_xml_doc_pt;
 typedef xmlNodePtr nm_xml_node_pt;
@@ -112,12 +170,17 @@ typedef xmlXPathContextPtr nm_xml_xpath_ctx_pt;
 void nm_drive_vect_ins_cb(void *unit_p, const void *ctx);
 void nm_drive_vect_free_cb(void *unit_p);
 
-static int nm_clean_temp_dir(const char *tmp_dir, const nm_vect_t *files);
-static void nm_archive_copy_data(nm_archive_t *in, nm_archive_t *out);
-static void nm_ovf_extract(const nm_str_t *ova_path, const char *tmp_dir,
-                           nm_vect_t *files);
-static const char *nm_find_ovf(const nm_vect_t *files);
-static nm_xml_doc_pt nm_ovf_open(const char *tmp_dir, const char *ovf_file);
+static int nm_ova_index(int fd, nm_vect_t *files);
+static uint64_t nm_tar_size(const char *hdr);
+static void nm_tar_pax(const char *data, size_t len, nm_str_t *path,
+                       uint64_t *size);
+static int nm_ova_read(int fd, char *buf, size_t len, uint64_t offset);
+static void nm_ova_file_ins_cb(void *unit_p, const void *ctx);
+static void nm_ova_file_free_cb(void *unit_p);
+static const nm_ova_file_t *nm_find_ovf(const nm_vect_t *files);
+static const nm_ova_file_t *nm_ova_find(const nm_vect_t *files,
+                                        const nm_str_t *name);
+static nm_xml_doc_pt nm_ovf_open(int fd, const nm_ova_file_t *ovf);
 static int nm_register_xml_ns(nm_xml_xpath_ctx_pt ctx, int version);
 static int __nm_register_xml_ns(nm_xml_xpath_ctx_pt ctx, const char *ns,
                                 const char *href);
@@ -133,8 +196,13 @@ static uint32_t nm_ovf_get_usb(nm_xml_xpath_ctx_pt ctx);
 static void nm_ovf_get_text(nm_str_t *res, nm_xml_xpath_ctx_pt ctx,
                             const char *xpath, const char *param);
 static inline void nm_drive_free(nm_drive_t *d);
-static void nm_ovf_convert_drives(const nm_vect_t *drives, const nm_str_t *name,
-                                  const char *templ_path);
+static int nm_ova_import_run(nm_job_t *job);
+static int nm_ova_import_done(nm_job_t *job, int rc);
+static void nm_ova_import_free(void *ctx);
+static int nm_ovf_convert_drives(nm_ova_import_t *imp);
+static void nm_ovf_drive_spec(nm_str_t *spec, const nm_str_t *ova, int fd,
+                              const nm_ova_file_t *file);
+static void nm_ovf_progress_cb(const char *line, void *ctx);
 static void nm_ovf_to_db(nm_vm_t *vm, const nm_vect_t *drives);
 static int nm_ova_get_data(nm_vm_t *vm, int *version);
 
@@ -142,21 +210,15 @@ static nm_field_t *fields[NM_OVA_FLD_COUNT + 1];
 
 void nm_ovf_import(void)
 {
-    char templ_path[sizeof(NM_OVA_DIR_TEMPL)];
-    const char *ovf_file;
-    nm_vect_t files = NM_INIT_VECT;
-    nm_vect_t drives = NM_INIT_VECT;
-    nm_vm_t vm = NM_INIT_VM;
+    const nm_ova_file_t *ovf_file;
+    nm_ova_import_t *imp;
     nm_xml_doc_pt doc = NULL;
     nm_xml_xpath_ctx_pt xpath_ctx = NULL;
     nm_form_t *form = NULL;
-    nm_spinner_data_t sp_data = NM_INIT_SPINNER;
     nm_form_data_t form_data = NM_INIT_FORM_DATA;
+    nm_str_t title = NM_INIT_STR;
     size_t msg_len;
-    pthread_t spin_th;
-    int done = 0, version = 0;
-
-    strncpy(templ_path, NM_OVA_DIR_TEMPL, sizeof(templ_path));
+    int version = 0;
 
     msg_len = nm_max_msg_len(nm_form_msg);
 
@@ -190,31 +252,31 @@ void nm_ovf_import(void)
         y += 2;
     }
 
+    imp = nm_calloc(1, sizeof(nm_ova_import_t));
+    imp->vm = NM_INIT_VM;
+    imp->fd = -1;
+
     form = nm_post_form(form_data.form_window, fields, msg_len + 4, NM_TRUE);
     if (nm_draw_form(action_window, form) != NM_OK)
-        goto cancel;
-
-    if (nm_ova_get_data(&vm, &version) != NM_OK)
-        goto cancel;
-
-    sp_data.stop = &done;
-
-    if (pthread_create(&spin_th, NULL, nm_progress_bar, (void *) &sp_data) != 0)
-        nm_bug(_("%s: cannot create thread"), __func__);
+        goto out;
 
-    if (mkdtemp(templ_path) == NULL)
-        nm_bug("%s: mkdtemp error: %s", __func__, strerror(errno));
+    if (nm_ova_get_data(&imp->vm, &version) != NM_OK)
+        goto out;
 
-    nm_ovf_extract(&vm.srcp, templ_path, &files);
+    if ((imp->fd = open(imp->vm.srcp.data, O_RDONLY | O_CLOEXEC)) == -1 ||
+            nm_ova_index(imp->fd, &imp->files) != NM_OK) {
+        nm_warn(_(NM_MSG_OVA_EFMT));
+        goto out;
+    }
 
-    if ((ovf_file = nm_find_ovf(&files)) == NULL) {
+    if ((ovf_file = nm_find_ovf(&imp->files)) == NULL) {
         nm_warn(_(NM_MSG_OVF_MISS));
         goto out;
     }
 
-    nm_debug("ova: ovf file found: %s\n", ovf_file);
+    nm_debug("ova: ovf file found: %s\n", ovf_file->name.data);
 
-    if ((doc = nm_ovf_open(templ_path, ovf_file)) == NULL) {
+    if ((doc = nm_ovf_open(imp->fd, ovf_file)) == NULL) {
         nm_warn(_(NM_MSG_OVF_EPAR));
         goto out;
     }
@@ -229,175 +291,282 @@ void nm_ovf_import(void)
         goto out;
     }
 
-    if (vm.name.len == 0)
-        nm_ovf_get_name(&vm.name, xpath_ctx);
-    nm_ovf_get_ncpu(&vm.cpus, xpath_ctx);
-    nm_ovf_get_mem(&vm.memo, xpath_ctx);
-    nm_ovf_get_drives(&drives, xpath_ctx, version);
-    vm.ifs.count = nm_ovf_get_neth(xpath_ctx);
+    if (imp->vm.name.len == 0)
+        nm_ovf_get_name(&imp->vm.name, xpath_ctx);
+    nm_ovf_get_ncpu(&imp->vm.cpus, xpath_ctx);
+    nm_ovf_get_mem(&imp->vm.memo, xpath_ctx);
+    nm_ovf_get_drives(&imp->drives, xpath_ctx, version);
+    imp->vm.ifs.count = nm_ovf_get_neth(xpath_ctx);
     if (nm_ovf_get_usb(xpath_ctx))
-        vm.usb_enable = 1;
+        imp->vm.usb_enable = 1;
 
-    if (nm_form_name_used(&vm.name) != NM_OK)
+    if (nm_form_name_used(&imp->vm.name) != NM_OK)
         goto out;
 
-    nm_ovf_convert_drives(&drives, &vm.name, templ_path);
-    nm_ovf_to_db(&vm, &drives);
+    nm_str_format(&title, "import %s", imp->vm.name.data);
+    imp->job = nm_job_new(&title, nm_ova_import_run, nm_ova_import_done,
+            imp, nm_ova_import_free);
+    nm_job_add_vm(imp->job, &imp->vm.name);
+    nm_job_submit(imp->job);
+    imp = NULL;
 
 out:
-    done = 1;
-    if (pthread_join(spin_th, NULL) != 0)
-        nm_bug(_("%s: cannot join thread"), __func__);
-
-    if (nm_clean_temp_dir(templ_path, &files) != NM_OK)
-        nm_warn(_(NM_MSG_INC_DEL));
-
     xmlXPathFreeContext(xpath_ctx);
     xmlFreeDoc(doc);
     xmlCleanupParser();
 
-    nm_vect_free(&files, NULL);
-    nm_vect_free(&drives, nm_drive_vect_free_cb);
+    if (imp)
+        nm_ova_import_free(imp);
 
-cancel:
     NM_FORM_EXIT();
     nm_form_free(form, fields);
-    nm_vm_free(&vm);
+    nm_str_free(&title);
     delwin(form_data.form_window);
 }
 
-static void nm_ovf_extract(const nm_str_t *ova_path, const char *tmp_dir,
-                           nm_vect_t *files)
+/* Runs in job thread */
+static int nm_ova_import_run(nm_job_t *job)
 {
-    nm_archive_t *in, *out;
-    nm_archive_entry_t *ar_entry;
-    char cwd[PATH_MAX] = {0};
+    return nm_ovf_convert_drives(job->ctx);
+}
 
-    in = archive_read_new();
-    out = archive_write_disk_new();
+static int nm_ova_import_done(nm_job_t *job, int rc)
+{
+    nm_ova_import_t *imp = job->ctx;
 
-    archive_write_disk_set_options(out, 0);
-    archive_read_support_format_tar(in);
+    if (rc == NM_OK)
+        nm_ovf_to_db(&imp->vm, &imp->drives);
 
-    if (archive_read_open_filename(in, ova_path->data, NM_BLOCK_SIZE) != 0)
-        nm_bug("%s: ovf read error: %s", __func__, archive_error_string(in));
+    return rc;
+}
 
-    /* save current working directory */
-    if (getcwd(cwd, sizeof(cwd)) == NULL)
-        nm_bug("%s: getcwd error: %s", __func__, strerror(errno));
+static void nm_ova_import_free(void *ctx)
+{
+    nm_ova_import_t *imp = ctx;
+
+    if (imp->fd != -1)
+        close(imp->fd);
+
+    nm_vect_free(&imp->files, nm_ova_file_free_cb);
+    nm_vect_free(&imp->drives, nm_drive_vect_free_cb);
+    nm_vm_free(&imp->vm);
+    free(imp);
+}
 
-    /* change current working directory to temporary */
-    if (chdir(tmp_dir) == -1)
-        nm_bug("%s: chdir error: %s", __func__, strerror(errno));
+/*
+ * Scan tar headers, data is skipped. GNU long names and pax
+ * path/size records are supported, other special entries are ignored.
+ */
+static int nm_ova_index(int fd, nm_vect_t *files)
+{
+    char hdr[NM_TAR_BLOCK];
+    nm_ova_file_t file = NM_INIT_OVA_FILE;
+    nm_str_t long_name = NM_INIT_STR;
+    uint64_t offset = 0, pax_size = 0;
+    int rc = NM_ERR;
 
     for (;;) {
-        const char *file;
-        int rc = archive_read_next_header(in, &ar_entry);
+        uint64_t size;
+        char type;
 
-        if (rc == ARCHIVE_EOF)
-            break;
+        if (nm_ova_read(fd, hdr, sizeof(hdr), offset) != NM_OK)
+            goto out;
 
-        if (rc != ARCHIVE_OK)
-            nm_bug("%s: bad archive: %s", __func__, archive_error_string(in));
+        /* end of archive is marked by zero block */
+        if (!hdr[0]) {
+            rc = files->n_memb ? NM_OK : NM_ERR;
+            goto out;
+        }
+
+        if (memcmp(hdr + NM_TAR_MAGIC, "ustar", 5) != 0)
+            goto out;
 
-        file = archive_entry_pathname(ar_entry);
+        size = pax_size ? pax_size : nm_tar_size(hdr);
+        type = hdr[NM_TAR_TYPE];
+        offset += NM_TAR_BLOCK;
+        pax_size = 0;
 
-        nm_vect_insert(files, file, strlen(file) + 1, NULL);
-        nm_debug("ova: extract file: %s\n", file);
+        if (type == 'L' || type == 'x') {
+            char *data;
 
-        rc = archive_write_header(out, ar_entry);
-        if (rc != ARCHIVE_OK) {
-            nm_bug("%s: bad archive: %s", __func__, archive_error_string(in));
-        } else {
-            nm_archive_copy_data(in, out);
-            if (archive_write_finish_entry(out) != ARCHIVE_OK) {
-                nm_bug("%s: archive_write_finish_entry: %s",
-                       __func__, archive_error_string(out));
+            if (size > NM_OVF_MAX_SIZE)
+                goto out;
+
+            data = nm_alloc(size + 1);
+            if (nm_ova_read(fd, data, size, offset) != NM_OK) {
+                free(data);
+                goto out;
+            }
+            data[size] = '\0';
+
+            if (type == 'L')
+                nm_str_alloc_text(&long_name, data);
+            else
+                nm_tar_pax(data, size, &long_name, &pax_size);
+
+            free(data);
+        } else if (type == '0' || type == '\0') {
+            if (long_name.len) {
+                nm_str_copy(&file.name, &long_name);
+                nm_str_free(&long_name);
+            } else {
+                nm_str_free(&file.name);
+                /* prefix is used by POSIX ustar only */
+                if (!memcmp(hdr + NM_TAR_MAGIC, "ustar", 6) &&
+                        hdr[NM_TAR_PREFIX]) {
+                    nm_str_add_text_part(&file.name, hdr + NM_TAR_PREFIX,
+                            strnlen(hdr + NM_TAR_PREFIX, NM_TAR_PREFIX_LEN));
+                    nm_str_add_char(&file.name, '/');
+                }
+                nm_str_add_text_part(&file.name, hdr + NM_TAR_NAME,
+                        strnlen(hdr + NM_TAR_NAME, NM_TAR_NAME_LEN));
             }
+
+            file.offset = offset;
+            file.size = size;
+            nm_vect_insert(files, &file, sizeof(file), nm_ova_file_ins_cb);
+            nm_debug("ova: file: %s, offset: %" PRIu64 ", size: %" PRIu64 "\n",
+                    file.name.data, file.offset, file.size);
         }
+
+        offset += (size + NM_TAR_BLOCK - 1) / NM_TAR_BLOCK * NM_TAR_BLOCK;
     }
 
-    archive_read_free(in);
-    archive_write_free(out);
+out:
+    nm_str_free(&file.name);
+    nm_str_free(&long_name);
 
-    /* restore current working directory */
-    if (chdir(cwd) == -1)
-        nm_bug("%s: chdir error: %s", __func__, strerror(errno));
+    return rc;
 }
 
-static void nm_archive_copy_data(nm_archive_t *in, nm_archive_t *out)
+/* octal, or base-256 for files larger than 8GiB (GNU, star) */
+static uint64_t nm_tar_size(const char *hdr)
 {
-    const void *buf;
-    size_t size;
-#if ARCHIVE_VERSION_NUMBER >= 3000000
-    int64_t offset;
-#else
-    off_t offset;
-#endif
-
-    for (;;) {
-        int rc = archive_read_data_block(in, &buf, &size, &offset);
+    const unsigned char *ptr = (const unsigned char *) hdr + NM_TAR_SIZE;
+    char buf[NM_TAR_SIZE_LEN + 1];
+    uint64_t size = 0;
 
-        if (rc == ARCHIVE_EOF)
-            break;
-        if (rc != ARCHIVE_OK)
-            nm_bug("%s: error read archive: %s", __func__, archive_error_string(in));
+    if (*ptr & 0x80) {
+        for (size_t n = 1; n < NM_TAR_SIZE_LEN; n++)
+            size = (size << 8) | ptr[n];
 
-        if (archive_write_data_block(out, buf, size, offset) != ARCHIVE_OK)
-            nm_bug("%s: error write archive: %s", __func__, archive_error_string(out));
+        return size;
     }
+
+    memcpy(buf, ptr, NM_TAR_SIZE_LEN);
+    buf[NM_TAR_SIZE_LEN] = '\0';
+
+    return strtoull(buf, NULL, 8);
 }
 
-static int nm_clean_temp_dir(const char *tmp_dir, const nm_vect_t *files)
+/* records are "len key=value\n" */
+static void nm_tar_pax(const char *data, size_t len, nm_str_t *path,
+                       uint64_t *size)
 {
-    nm_str_t path = NM_INIT_STR;
-    int rc = NM_OK;
+    const char *ptr = data, *end = data + len;
 
-    for (size_t n = 0; n < files->n_memb; n++) {
-        nm_str_format(&path, "%s/%s", tmp_dir, (char *) nm_vect_at(files, n));
+    while (ptr < end) {
+        char *key;
+        unsigned long rec_len = strtoul(ptr, &key, 10);
+        const char *val;
+
+        if (!rec_len || rec_len > (size_t) (end - ptr) || *key != ' ')
+            break;
+
+        key++;
+        if ((val = memchr(key, '=', ptr + rec_len - key)) != NULL) {
+            size_t val_len = ptr + rec_len - 1 - (val + 1);
 
-        if (unlink(path.data) == -1)
-            rc = NM_ERR;
+            if (!strncmp(key, "path=", 5)) {
+                nm_str_free(path);
+                nm_str_add_text_part(path, val + 1, val_len);
+            } else if (!strncmp(key, "size=", 5)) {
+                *size = strtoull(val + 1, NULL, 10);
+            }
+        }
 
-        nm_debug("ova: clean file: %s\n", path.data);
+        ptr += rec_len;
     }
+}
+
+static int nm_ova_read(int fd, char *buf, size_t len, uint64_t offset)
+{
+    while (len) {
+        ssize_t nread = pread(fd, buf, len, offset);
 
-    if (rc == NM_OK) {
-        if (rmdir(tmp_dir) == -1)
-            rc = NM_ERR;
+        if (nread == -1 && errno == EINTR)
+            continue;
+        if (nread <= 0)
+            return NM_ERR;
+
+        buf += nread;
+        len -= nread;
+        offset += nread;
     }
 
-    nm_str_free(&path);
+    return NM_OK;
+}
 
-    return rc;
+static void nm_ova_file_ins_cb(void *unit_p, const void *ctx)
+{
+    nm_ova_file_t *dst = unit_p;
+    const nm_ova_file_t *src = ctx;
+
+    nm_str_copy(&dst->name, &src->name);
+    dst->offset = src->offset;
+    dst->size = src->size;
 }
 
-static const char *nm_find_ovf(const nm_vect_t *files)
+static void nm_ova_file_free_cb(void *unit_p)
+{
+    nm_str_free(&((nm_ova_file_t *) unit_p)->name);
+}
+
+static const nm_ova_file_t *nm_find_ovf(const nm_vect_t *files)
 {
     for (size_t n = 0; n < files->n_memb; n++) {
-        const char *file = nm_vect_at(files, n);
-        size_t len = strlen(file);
+        const nm_ova_file_t *file = nm_vect_at(files, n);
 
-        if (len < 4)
+        if (file->name.len < 4)
             continue;
 
-        if (nm_str_cmp_tt(file + (len - 4), ".ovf") == NM_OK)
+        if (nm_str_cmp_tt(file->name.data + (file->name.len - 4), ".ovf") == NM_OK)
             return file;
     }
 
     return NULL;
 }
 
-static nm_xml_doc_pt nm_ovf_open(const char *tmp_dir, const char *ovf_file)
+/* href is relative to OVF, files are stored in the root of OVA */
+static const nm_ova_file_t *nm_ova_find(const nm_vect_t *files,
+                                        const nm_str_t *name)
+{
+    for (size_t n = 0; n < files->n_memb; n++) {
+        const nm_ova_file_t *file = nm_vect_at(files, n);
+        const char *base = strrchr(file->name.data, '/');
+
+        if (nm_str_cmp_ss(&file->name, name) == NM_OK ||
+                (base && nm_str_cmp_st(name, base + 1) == NM_OK))
+            return file;
+    }
+
+    return NULL;
+}
+
+static nm_xml_doc_pt nm_ovf_open(int fd, const nm_ova_file_t *ovf)
 {
     nm_xml_doc_pt doc = NULL;
-    nm_str_t ovf_path = NM_INIT_STR;
+    char *buf;
+
+    if (ovf->size > NM_OVF_MAX_SIZE)
+        return NULL;
 
-    nm_str_format(&ovf_path, "%s/%s", tmp_dir, ovf_file);
+    buf = nm_alloc(ovf->size);
 
-    doc = xmlParseFile(ovf_path.data);
+    if (nm_ova_read(fd, buf, ovf->size, ovf->offset) == NM_OK)
+        doc = xmlReadMemory(buf, ovf->size, ovf->name.data, NULL, 0);
 
-    nm_str_free(&ovf_path);
+    free(buf);
 
     return doc;
 }
@@ -613,50 +782,161 @@ static inline void nm_drive_free(nm_drive_t *d)
     nm_str_free(&d->capacity);
 }
 
-static void nm_ovf_convert_drives(const nm_vect_t *drives, const nm_str_t *name,
-                                  const char *templ_path)
+/* Returns NM_ERR if import is failed or canceled, VM directory is removed */
+static int nm_ovf_convert_drives(nm_ova_import_t *imp)
 {
+    const nm_vect_t *drives = &imp->drives;
     nm_str_t vm_dir = NM_INIT_STR;
     nm_str_t buf = NM_INIT_STR;
     nm_vect_t argv = NM_INIT_VECT;
+    nm_ova_conv_t *convs = nm_calloc(drives->n_memb, sizeof(nm_ova_conv_t));
+    nm_proc_t **procs = nm_calloc(drives->n_memb, sizeof(nm_proc_t *));
+    size_t count = 0;
+    int failed = 0;
 
-    nm_str_format(&vm_dir, "%s/%s", nm_cfg_get()->vm_dir.data, name->data);
+    nm_str_format(&vm_dir, "%s/%s", nm_cfg_get()->vm_dir.data, imp->vm.name.data);
 
     if (mkdir(vm_dir.data, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) != 0) {
-        nm_bug(_("%s: cannot create VM directory %s: %s"),
-               __func__, vm_dir.data, strerror(errno));
+        imp->job->err = errno;
+        nm_str_format(&imp->job->error, _("cannot create %s"), vm_dir.data);
+        free(convs);
+        free(procs);
+        nm_str_free(&vm_dir);
+        return NM_ERR;
     }
 
     for (size_t n = 0; n < drives->n_memb; n++) {
+        const nm_str_t *drive = nm_drive_file(drives->data[n]);
+        const nm_ova_file_t *file;
+
+        if ((file = nm_ova_find(&imp->files, drive)) == NULL) {
+            nm_str_format(&imp->job->error, _("drive %s is not found"),
+                    drive->data);
+            failed++;
+            break;
+        }
+
         nm_str_format(&buf, "%s/qemu-img", nm_cfg_get()->qemu_bin_path.data);
         nm_vect_insert(&argv, buf.data, buf.len + 1, NULL);
 
+        /* -W: out-of-order writes, qcow2 target allows it */
         nm_vect_insert_cstr(&argv, "convert");
+        nm_vect_insert_cstr(&argv, "-p");
+        nm_vect_insert_cstr(&argv, "-m");
+        nm_vect_insert_cstr(&argv, NM_OVA_CONVERT_COROUTINES);
+        nm_vect_insert_cstr(&argv, "-W");
         nm_vect_insert_cstr(&argv, "-O");
         nm_vect_insert_cstr(&argv, "qcow2");
 
-        nm_str_format(&buf, "%s/%s",
-            templ_path, (nm_drive_file(drives->data[n]))->data);
+        nm_ovf_drive_spec(&buf, &imp->vm.srcp, imp->fd, file);
         nm_vect_insert(&argv, buf.data, buf.len + 1, NULL);
 
-        nm_str_format(&buf, "%s/%s",
-            vm_dir.data, (nm_drive_file(drives->data[n]))->data);
+        nm_str_format(&buf, "%s/%s", vm_dir.data, drive->data);
         nm_vect_insert(&argv, buf.data, buf.len + 1, NULL);
 
         nm_cmd_str(&buf, &argv);
         nm_debug("ova: exec: %s\n", buf.data);
 
         nm_vect_end_zero(&argv);
-        if (nm_spawn_process(&argv, NULL) != NM_OK) {
-            rmdir(vm_dir.data);
-            nm_bug(_("%s: cannot create image file"), __func__);
-        }
+        convs[count].proc = NM_INIT_PROC;
+        /* keep ncurses screen clean */
+        convs[count].proc.flags = NM_PROC_NULL_ERR;
+        convs[count].proc.line_cb = nm_ovf_progress_cb;
+        convs[count].proc.ctx = &convs[count];
+        convs[count].size = file->size;
+        convs[count].job = imp->job;
+        nm_proc_start(&convs[count].proc, &argv);
+        procs[count] = &convs[count].proc;
+        nm_job_add_progress(imp->job, 0, file->size);
+        count++;
 
         nm_vect_free(&argv, NULL);
     }
 
+    nm_proc_wait(procs, count, &imp->job->cancel);
+
+    for (size_t n = 0; n < count; n++) {
+        if (nm_proc_exit_code(&convs[n].proc) != 0) {
+            nm_debug("ova: convert of %s failed: %d\n",
+                    nm_drive_file(drives->data[n])->data, convs[n].proc.status);
+            if (!nm_job_canceled(imp->job) && !imp->job->error.len)
+                nm_str_format(&imp->job->error, _("cannot convert %s"),
+                        nm_drive_file(drives->data[n])->data);
+            failed++;
+        }
+        nm_proc_free(&convs[n].proc);
+    }
+
+    if (failed) {
+        for (size_t n = 0; n < drives->n_memb; n++) {
+            nm_str_format(&buf, "%s/%s",
+                    vm_dir.data, nm_drive_file(drives->data[n])->data);
+            unlink(buf.data);
+        }
+        rmdir(vm_dir.data);
+    }
+
+    free(convs);
+    free(procs);
     nm_str_free(&vm_dir);
     nm_str_free(&buf);
+
+    return failed ? NM_ERR : NM_OK;
+}
+
+/* qemu-img -p prints "    (12.34/100%)\r" */
+static void nm_ovf_progress_cb(const char *line, void *ctx)
+{
+    nm_ova_conv_t *conv = ctx;
+    double percent;
+
+    if (sscanf(line, " (%lf/100%%)", &percent) != 1 || percent <= conv->percent)
+        return;
+
+    /* drives share progress, add bytes converted since the last line */
+    nm_job_add_progress(conv->job, (uint64_t) (percent * conv->size / 100) -
+        (uint64_t) (conv->percent * conv->size / 100), 0);
+    conv->percent = percent;
+}
+
+/*
+ * json:{"driver":"vmdk","file":{"driver":"raw","offset":N,"size":N,
+ *       "file":{"driver":"file","filename":"path.ova"}}}
+ */
+static void nm_ovf_drive_spec(nm_str_t *spec, const nm_str_t *ova, int fd,
+                              const nm_ova_file_t *file)
+{
+    struct json_object *root, *raw, *proto;
+    char magic[NM_OVA_MAGIC_LEN] = {0};
+    const char *fmt = "raw";
+
+    if (file->size >= sizeof(magic) &&
+            nm_ova_read(fd, magic, sizeof(magic), file->offset) == NM_OK) {
+        for (size_t n = 0; nm_ova_img_fmt[n].magic; n++) {
+            if (!memcmp(magic, nm_ova_img_fmt[n].magic, nm_ova_img_fmt[n].len)) {
+                fmt = nm_ova_img_fmt[n].fmt;
+                break;
+            }
+        }
+    }
+
+    proto = json_object_new_object();
+    json_object_object_add(proto, "driver", json_object_new_string("file"));
+    json_object_object_add(proto, "filename", json_object_new_string(ova->data));
+
+    raw = json_object_new_object();
+    json_object_object_add(raw, "driver", json_object_new_string("raw"));
+    json_object_object_add(raw, "offset", json_object_new_int64(file->offset));
+    json_object_object_add(raw, "size", json_object_new_int64(file->size));
+    json_object_object_add(raw, "file", proto);
+
+    root = json_object_new_object();
+    json_object_object_add(root, "driver", json_object_new_string(fmt));
+    json_object_object_add(root, "file", raw);
+
+    nm_str_format(spec, "json:%s",
+            json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN));
+    json_object_put(root);
 }
 
 static void nm_ovf_to_db(nm_vm_t *vm, const nm_vect_t *drives)
@@ -0,0 +1,382 @@
+#if defined (NM_OS_LINUX)
+# define _GNU_SOURCE
+#endif
+#include <nm_core.h>
+#include <nm_utils.h>
+#include <nm_string.h>
+#include <nm_vector.h>
+#include <nm_process.h>
+
+#include <sys/wait.h>
+#include <signal.h>
+#include <stdint.h>
+#include <poll.h>
+#include <time.h>
+
+#if defined (NM_OS_LINUX)
+#include <sys/syscall.h>
+#endif
+
+/*
+ * Child process runner.
+ * stdout and stderr are read while children run, so output of any
+ * size cannot block them. Any number of children is supervised by one
+ * poll(2) loop over their pipes and pidfds (Linux 5.3+), pidfd becomes
+ * readable when the child exits. Without pidfd children are checked
+ * with waitpid(WNOHANG) every NM_PROC_TICK. Deadline and cancel send
+ * SIGTERM, SIGKILL follows after NM_PROC_KILL_DELAY.
+ */
+
+enum {
+    NM_PROC_READLEN = 4096,
+    NM_PROC_TICK = 100,         /* ms */
+    NM_PROC_KILL_DELAY = 3000,  /* ms */
+    NM_PROC_FDS = 3,            /* stdout, stderr, pidfd */
+    NM_PROC_ERRLEN = 128
+};
+
+static const int64_t NM_PROC_KILLED = INT64_MAX;
+
+static int nm_proc_pidfd(pid_t pid);
+static ssize_t nm_proc_read(nm_proc_t *proc, int *fd, nm_str_t *buf);
+static void nm_proc_lines(nm_proc_t *proc, const char *buf, size_t len);
+static void nm_proc_reap(nm_proc_t *proc, int flags);
+static void nm_proc_close(int *fd);
+static void nm_proc_wake(int *timeout, int64_t at, int64_t now);
+
+int nm_proc_start(nm_proc_t *proc, const nm_vect_t *argv)
+{
+    const char *cmd = ((char **) argv->data)[0];
+    int out[2] = { -1, -1 };
+    int err[2] = { -1, -1 };
+    int saved_errno;
+    char buf[NM_PROC_ERRLEN];
+
+    /*
+     * Pipes are close-on-exec from the start, other threads may
+     * fork and exec at the same time. dup2() clears the flag on
+     * stdout and stderr of the child.
+     */
+    if (pipe2(out, O_CLOEXEC) == -1)
+        goto err;
+
+    if (!(proc->flags & (NM_PROC_MERGE_ERR | NM_PROC_NULL_ERR)) &&
+            pipe2(err, O_CLOEXEC) == -1)
+        goto err;
+
+    switch (proc->pid = fork()) {
+    case (-1):
+        goto err;
+
+    case (0):
+        dup2(out[1], STDOUT_FILENO);
+
+        if (proc->flags & NM_PROC_MERGE_ERR) {
+            dup2(out[1], STDERR_FILENO);
+        } else if (proc->flags & NM_PROC_NULL_ERR) {
+            int null = open("/dev/null", O_WRONLY);
+
+            if (null != -1)
+                dup2(null, STDERR_FILENO);
+        } else {
+            dup2(err[1], STDERR_FILENO);
+        }
+
+        /* fds are opened close-on-exec, only this child keeps them */
+        for (size_t n = 0; proc->fds && n < proc->fds->n_memb; n++)
+            fcntl(*((int *) proc->fds->data[n]), F_SETFD, 0);
+
+        execvp(cmd, (char *const *) argv->data);
+        _exit(127);
+    }
+
+    close(out[1]);
+    proc->fd_out = out[0];
+    fcntl(proc->fd_out, F_SETFL, O_NONBLOCK);
+
+    if (err[1] != -1) {
+        close(err[1]);
+        proc->fd_err = err[0];
+        fcntl(proc->fd_err, F_SETFL, O_NONBLOCK);
+    }
+
+    proc->pidfd = nm_proc_pidfd(proc->pid);
+    proc->deadline = proc->timeout ? nm_mono_ms() + proc->timeout : 0;
+    proc->kill_at = 0;
+    proc->status = 0;
+    proc->running = true;
+
+    return NM_OK;
+
+err:
+    saved_errno = errno;
+    for (size_t n = 0; n < 2; n++) {
+        nm_proc_close(&out[n]);
+        nm_proc_close(&err[n]);
+    }
+    proc->pid = -1;
+    nm_debug("%s: cannot start %s: %s\n", __func__, cmd,
+            nm_strerror_r(saved_errno, buf, sizeof(buf)));
+
+    return NM_ERR;
+}
+
+/*
+ * Wait for all processes, reading their output.
+ * If cancel is not NULL, processes are killed when it becomes non zero,
+ * it is read atomically. Runs in job threads: errors are returned.
+ * Returns NM_OK if every process exited with 0.
+ */
+int nm_proc_wait(nm_proc_t **procs, size_t count, const int *cancel)
+{
+    struct pollfd *fds = nm_calloc(count * NM_PROC_FDS, sizeof(struct pollfd));
+    int rc = NM_OK;
+
+    for (size_t n = 0; n < count * NM_PROC_FDS; n++)
+        fds[n].events = POLLIN;
+
+    for (;;) {
+        int64_t now = nm_mono_ms();
+        int timeout = cancel ? NM_PROC_TICK : -1;
+        size_t active = 0;
+
+        for (size_t n = 0; n < count; n++) {
+            nm_proc_t *proc = procs[n];
+            struct pollfd *pfd = &fds[n * NM_PROC_FDS];
+
+            if (proc->running && proc->pidfd == -1)
+                nm_proc_reap(proc, WNOHANG);
+
+            if (!proc->running) {
+                pfd[0].fd = pfd[1].fd = pfd[2].fd = -1;
+                continue;
+            }
+
+            if ((proc->deadline && now >= proc->deadline) ||
+                    (cancel && __atomic_load_n(cancel, __ATOMIC_ACQUIRE))) {
+                nm_proc_kill(proc);
+            }
+
+            if (proc->kill_at != NM_PROC_KILLED && proc->kill_at &&
+                    now >= proc->kill_at) {
+                nm_debug("%s: kill %d\n", __func__, proc->pid);
+                kill(proc->pid, SIGKILL);
+                proc->kill_at = NM_PROC_KILLED;
+            }
+
+            if (proc->kill_at != NM_PROC_KILLED)
+                nm_proc_wake(&timeout, proc->kill_at ? proc->kill_at :
+                        proc->deadline, now);
+            if (proc->pidfd == -1)
+                nm_proc_wake(&timeout, now + NM_PROC_TICK, now);
+
+            pfd[0].fd = proc->fd_out;
+            pfd[1].fd = proc->fd_err;
+            pfd[2].fd = proc->pidfd;
+            active++;
+        }
+
+        if (!active)
+            break;
+
+        if (poll(fds, count * NM_PROC_FDS, timeout) == -1) {
+            char buf[NM_PROC_ERRLEN];
+
+            if (errno == EINTR)
+                continue;
+            nm_debug("%s: poll: %s\n", __func__,
+                    nm_strerror_r(errno, buf, sizeof(buf)));
+
+            /* processes are not left behind */
+            for (size_t n = 0; n < count; n++) {
+                if (!procs[n]->running)
+                    continue;
+                kill(procs[n]->pid, SIGKILL);
+                nm_proc_reap(procs[n], 0);
+            }
+            rc = NM_ERR;
+            break;
+        }
+
+        for (size_t n = 0; n < count; n++) {
+            nm_proc_t *proc = procs[n];
+            struct pollfd *pfd = &fds[n * NM_PROC_FDS];
+
+            if (!proc->running)
+                continue;
+
+            if (pfd[0].fd != -1 && pfd[0].revents)
+                nm_proc_read(proc, &proc->fd_out, &proc->out);
+            if (pfd[1].fd != -1 && pfd[1].revents)
+                nm_proc_read(proc, &proc->fd_err, &proc->err);
+            if (pfd[2].fd != -1 && pfd[2].revents)
+                nm_proc_reap(proc, 0);
+        }
+    }
+
+    free(fds);
+
+    for (size_t n = 0; n < count; n++) {
+        if (nm_proc_exit_code(procs[n]) != 0)
+            rc = NM_ERR;
+    }
+
+    return rc;
+}
+
+/* SIGTERM, nm_proc_wait() sends SIGKILL if process is still alive later */
+void nm_proc_kill(nm_proc_t *proc)
+{
+    if (!proc->running || proc->kill_at)
+        return;
+
+    nm_debug("%s: terminate %d\n", __func__, proc->pid);
+    kill(proc->pid, SIGTERM);
+    proc->kill_at = nm_mono_ms() + NM_PROC_KILL_DELAY;
+}
+
+int nm_proc_exit_code(const nm_proc_t *proc)
+{
+    if (proc->pid == -1 || proc->running || !WIFEXITED(proc->status))
+        return -1;
+
+    return WEXITSTATUS(proc->status);
+}
+
+void nm_proc_free(nm_proc_t *proc)
+{
+    if (proc->running) {
+        kill(proc->pid, SIGKILL);
+        nm_proc_reap(proc, 0);
+    }
+
+    nm_proc_close(&proc->fd_out);
+    nm_proc_close(&proc->fd_err);
+    nm_proc_close(&proc->pidfd);
+    nm_str_free(&proc->out);
+    nm_str_free(&proc->err);
+    nm_str_free(&proc->line);
+}
+
+static int nm_proc_pidfd(pid_t pid)
+{
+#if defined (NM_OS_LINUX) && defined (SYS_pidfd_open)
+    /* close-on-exec is set by kernel, ENOSYS before Linux 5.3 */
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void) pid;
+    return -1;
+#endif
+}
+
+/* Returns number of bytes read, 0 at EOF, -1 if there is no data now */
+static ssize_t nm_proc_read(nm_proc_t *proc, int *fd, nm_str_t *buf)
+{
+    char data[NM_PROC_READLEN];
+    ssize_t nread;
+
+    while ((nread = read(*fd, data, sizeof(data))) == -1 && errno == EINTR)
+        ;
+
+    if (nread > 0) {
+        if (fd == &proc->fd_out && proc->line_cb)
+            nm_proc_lines(proc, data, nread);
+        else
+            nm_str_add_text_part(buf, data, nread);
+
+        return nread;
+    }
+
+    if (nread == -1 && errno == EAGAIN)
+        return -1;
+
+    nm_proc_close(fd);
+
+    /* last line may have no line end */
+    if (fd == &proc->fd_out && proc->line_cb && proc->line.len) {
+        proc->line_cb(proc->line.data, proc->ctx);
+        nm_str_trunc(&proc->line, 0);
+    }
+
+    return 0;
+}
+
+static void nm_proc_lines(nm_proc_t *proc, const char *buf, size_t len)
+{
+    for (size_t n = 0; n < len; n++) {
+        if (buf[n] != '\n' && buf[n] != '\r') {
+            nm_str_add_char_opt(&proc->line, buf[n]);
+            continue;
+        }
+
+        if (proc->line.len) {
+            proc->line_cb(proc->line.data, proc->ctx);
+            nm_str_trunc(&proc->line, 0);
+        }
+    }
+}
+
+static void nm_proc_reap(nm_proc_t *proc, int flags)
+{
+    pid_t rc;
+
+    while ((rc = waitpid(proc->pid, &proc->status, flags)) == -1 &&
+            errno == EINTR)
+        ;
+
+    if (rc == 0)
+        return; /* still running */
+
+    if (rc == -1) {
+        char buf[NM_PROC_ERRLEN];
+
+        nm_debug("%s: waitpid %d: %s\n", __func__, proc->pid,
+                nm_strerror_r(errno, buf, sizeof(buf)));
+        proc->status = -1; /* not an exit status */
+    }
+
+    /*
+     * Read the rest of output. Pipes are closed without waiting
+     * for EOF: a daemonized child of the process may hold them.
+     */
+    while (proc->fd_out != -1 && nm_proc_read(proc, &proc->fd_out, &proc->out) > 0)
+        ;
+    while (proc->fd_err != -1 && nm_proc_read(proc, &proc->fd_err, &proc->err) > 0)
+        ;
+
+    if (proc->fd_out != -1) {
+        nm_proc_close(&proc->fd_out);
+        if (proc->line_cb && proc->line.len) {
+            proc->line_cb(proc->line.data, proc->ctx);
+            nm_str_trunc(&proc->line, 0);
+        }
+    }
+    nm_proc_close(&proc->fd_err);
+    nm_proc_close(&proc->pidfd);
+
+    proc->running = false;
+}
+
+static void nm_proc_close(int *fd)
+{
+    if (*fd == -1)
+        return;
+
+    close(*fd);
+    *fd = -1;
+}
+
+/* Shorten poll(2) timeout to wake up at "at", 0 means never */
+static void nm_proc_wake(int *timeout, int64_t at, int64_t now)
+{
+    int64_t ms;
+
+    if (!at)
+        return;
+
+    ms = (at > now) ? at - now : 0;
+    if (*timeout == -1 || ms < *timeout)
+        *timeout = (int) ms;
+}
+
+/* vim:set ts=4 sw=4: */
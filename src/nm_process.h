@@ -0,0 +1,46 @@
+#ifndef NM_PROCESS_H_
+#define NM_PROCESS_H_
+
+#include <nm_string.h>
+#include <nm_vector.h>
+
+/* Line of stdout without line end, '\n' and '\r' both end a line */
+typedef void (*nm_proc_line_cb_t)(const char *line, void *ctx);
+
+enum {
+    NM_PROC_MERGE_ERR = (1 << 0), /* stderr goes to stdout */
+    NM_PROC_NULL_ERR  = (1 << 1)  /* stderr goes to /dev/null */
+};
+
+typedef struct {
+    pid_t pid;                  /* -1 if not started */
+    int pidfd;                  /* -1 if pidfd is not supported */
+    int fd_out;                 /* -1 at EOF */
+    int fd_err;
+    int flags;                  /* NM_PROC_* */
+    int timeout;                /* ms, 0 - no limit */
+    nm_proc_line_cb_t line_cb;  /* stdout is not stored if set */
+    void *ctx;
+    const nm_vect_t *fds;       /* int fds inherited by child, or NULL */
+    nm_str_t out;
+    nm_str_t err;
+    nm_str_t line;              /* incomplete line for line_cb */
+    int64_t deadline;
+    int64_t kill_at;            /* SIGKILL time after SIGTERM */
+    int status;                 /* waitpid(2) status */
+    bool running;
+} nm_proc_t;
+
+#define NM_INIT_PROC (nm_proc_t) { -1, -1, -1, -1, 0, 0, NULL, NULL, NULL, \
+                                   NM_INIT_STR, NM_INIT_STR, NM_INIT_STR, \
+                                   0, 0, 0, false }
+
+int nm_proc_start(nm_proc_t *proc, const nm_vect_t *argv);
+int nm_proc_wait(nm_proc_t **procs, size_t count, const int *cancel);
+void nm_proc_kill(nm_proc_t *proc);
+/* Exit code, -1 if killed by signal or not finished */
+int nm_proc_exit_code(const nm_proc_t *proc);
+void nm_proc_free(nm_proc_t *proc);
+
+#endif /* NM_PROCESS_H_ */
+/* vim:set ts=4 sw=4: */
@@ -6,28 +6,22 @@
 #include <nm_cfg_file.h>
 #include <nm_usb_devices.h>
 #include <nm_qmp_control.h>
+#include <nm_qmp_pool.h>
 
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <mqueue.h>
+#include <time.h>
+#include <poll.h>
 
 #include <json.h>
 
-enum {
-    NM_QMP_STATE_DONE = 0,
-    NM_QMP_STATE_MORE,
-    NM_QMP_STATE_NEXT,
-    NM_QMP_STATE_REPEAT,
-    NM_QMP_STATE_UNDEF
-};
-
 static const char NM_QMP_CMD_INIT[]     = "{\"execute\":\"qmp_capabilities\"}";
 static const char NM_QMP_CMD_VM_SHUT[]  = "{\"execute\":\"system_powerdown\"}";
 static const char NM_QMP_CMD_VM_QUIT[]  = "{\"execute\":\"quit\"}";
 static const char NM_QMP_CMD_VM_RESET[] = "{\"execute\":\"system_reset\"}";
 static const char NM_QMP_CMD_VM_STOP[]  = "{\"execute\":\"stop\"}";
 static const char NM_QMP_CMD_VM_CONT[]  = "{\"execute\":\"cont\"}";
-static const char NM_QMP_CMD_JOBS[]     = "{\"execute\":\"query-jobs\"}";
 
 static const char NM_QMP_CMD_SAVEVM[]   = \
     "{\"execute\":\"snapshot-save\",\"arguments\":{\"job-id\":" \
@@ -60,7 +54,20 @@ static const char NM_QMP_CMD_USB_DEL[]  = \
         {"name": "dev2", "type": "child<usb-host>"}]}
 */
 
-enum {NM_QMP_READLEN = 1024};
+enum {NM_QMP_READLEN = 4096};
+
+/* ids of commands on private (not pooled) connection */
+enum {
+    NM_QMP_ID_INIT = 1,
+    NM_QMP_ID_CMD
+};
+
+enum {NM_QMP_INIT_TMO = 100}; /* ms */
+
+enum {
+    NM_QMP_JOB_CMD_TMO = 5000,   /* ms */
+    NM_QMP_JOB_TMO = 300000      /* ms */
+};
 
 typedef struct {
     int sd;
@@ -73,34 +80,29 @@ static int nm_qmp_vm_exec(const nm_str_t *name, const char *cmd,
                           struct timeval *tv);
 static int nm_qmp_init_cmd(nm_qmp_handle_t *h);
 static void nm_qmp_sock_path(const nm_str_t *name, nm_str_t *path);
-static int nm_qmp_talk(int sd, const char *cmd,
-                       size_t len, struct timeval *tv);
-static void nm_qmp_talk_async(int sd, const char *cmd,
-        size_t len, const char *jobid);
+static int nm_qmp_talk(int sd, const char *cmd, int64_t id, int timeout);
 static int nm_qmp_send(const nm_str_t *cmd);
-static int nm_qmp_check_answer(const nm_str_t *answer);
-static int nm_qmp_parse(const char *jobid, const nm_str_t *answer);
-static int nm_qmp_check_job(const char *jobid, const nm_str_t *answer);
+static void nm_qmp_reader_cut(nm_qmp_reader_t *r, size_t len);
 
-void nm_qmp_vm_shut(const nm_str_t *name)
+int nm_qmp_vm_shut(const nm_str_t *name)
 {
     struct timeval tv = { .tv_sec = 0, .tv_usec = 100000 }; /* 0.1s */
 
-    nm_qmp_vm_exec(name, NM_QMP_CMD_VM_SHUT, &tv);
+    return nm_qmp_vm_exec(name, NM_QMP_CMD_VM_SHUT, &tv);
 }
 
-void nm_qmp_vm_stop(const nm_str_t *name)
+int nm_qmp_vm_stop(const nm_str_t *name)
 {
     struct timeval tv = { .tv_sec = 0, .tv_usec = 100000 }; /* 0.1s */
 
-    nm_qmp_vm_exec(name, NM_QMP_CMD_VM_QUIT, &tv);
+    return nm_qmp_vm_exec(name, NM_QMP_CMD_VM_QUIT, &tv);
 }
 
-void nm_qmp_vm_reset(const nm_str_t *name)
+int nm_qmp_vm_reset(const nm_str_t *name)
 {
     struct timeval tv = { .tv_sec = 0, .tv_usec = 100000 }; /* 0.1s */
 
-    nm_qmp_vm_exec(name, NM_QMP_CMD_VM_RESET, &tv);
+    return nm_qmp_vm_exec(name, NM_QMP_CMD_VM_RESET, &tv);
 }
 
 void nm_qmp_vm_pause(const nm_str_t *name)
@@ -120,15 +122,13 @@ void nm_qmp_vm_resume(const nm_str_t *name)
 int nm_qmp_savevm(const nm_str_t *name, const nm_str_t *snap)
 {
     nm_vect_t drives = NM_INIT_VECT;
-    nm_str_t query = NM_INIT_STR;
     nm_str_t devs = NM_INIT_STR;
     nm_str_t uid = NM_INIT_STR;
     nm_str_t cmd = NM_INIT_STR;
     size_t drives_count;
     int rc;
 
-    nm_str_format(&query, NM_VM_GET_DRIVES_SQL, name->data);
-    nm_db_select(query.data, &drives);
+    nm_db_select_vm(NM_STMT_VM_GET_DRIVES, name->data, &drives);
     drives_count = drives.n_memb / NM_DRV_IDX_COUNT;
 
     for (size_t n = 0; n < drives_count; n++) {
@@ -144,7 +144,6 @@ int nm_qmp_savevm(const nm_str_t *name, const nm_str_t *snap)
     nm_vect_free(&drives, nm_str_vect_free_cb);
     nm_str_free(&devs);
     nm_str_free(&cmd);
-    nm_str_free(&query);
     nm_str_free(&uid);
 
     return rc;
@@ -153,15 +152,13 @@ int nm_qmp_savevm(const nm_str_t *name, const nm_str_t *snap)
 int nm_qmp_loadvm(const nm_str_t *name, const nm_str_t *snap)
 {
     nm_vect_t drives = NM_INIT_VECT;
-    nm_str_t query = NM_INIT_STR;
     nm_str_t devs = NM_INIT_STR;
     nm_str_t uid = NM_INIT_STR;
     nm_str_t cmd = NM_INIT_STR;
     size_t drives_count;
     int rc;
 
-    nm_str_format(&query, NM_VM_GET_DRIVES_SQL, name->data);
-    nm_db_select(query.data, &drives);
+    nm_db_select_vm(NM_STMT_VM_GET_DRIVES, name->data, &drives);
     drives_count = drives.n_memb / NM_DRV_IDX_COUNT;
 
     for (size_t n = 0; n < drives_count; n++) {
@@ -177,7 +174,6 @@ int nm_qmp_loadvm(const nm_str_t *name, const nm_str_t *snap)
     nm_vect_free(&drives, nm_str_vect_free_cb);
     nm_str_free(&devs);
     nm_str_free(&cmd);
-    nm_str_free(&query);
     nm_str_free(&uid);
 
     return rc;
@@ -186,15 +182,13 @@ int nm_qmp_loadvm(const nm_str_t *name, const nm_str_t *snap)
 int nm_qmp_delvm(const nm_str_t *name, const nm_str_t *snap)
 {
     nm_vect_t drives = NM_INIT_VECT;
-    nm_str_t query = NM_INIT_STR;
     nm_str_t devs = NM_INIT_STR;
     nm_str_t uid = NM_INIT_STR;
     nm_str_t cmd = NM_INIT_STR;
     size_t drives_count;
     int rc;
 
-    nm_str_format(&query, NM_VM_GET_DRIVES_SQL, name->data);
-    nm_db_select(query.data, &drives);
+    nm_db_select_vm(NM_STMT_VM_GET_DRIVES, name->data, &drives);
     drives_count = drives.n_memb / NM_DRV_IDX_COUNT;
 
     for (size_t n = 0; n < drives_count; n++) {
@@ -210,7 +204,6 @@ int nm_qmp_delvm(const nm_str_t *name, const nm_str_t *snap)
     nm_vect_free(&drives, nm_str_vect_free_cb);
     nm_str_free(&devs);
     nm_str_free(&cmd);
-    nm_str_free(&query);
     nm_str_free(&uid);
 
     return rc;
@@ -299,7 +292,13 @@ static int nm_qmp_send(const nm_str_t *cmd)
         return NM_ERR;
     }
 
-    if (mq_send(mq, cmd->data, cmd->len, 0) == EAGAIN) {
+    if (mq_send(mq, cmd->data, cmd->len, 0) == -1) {
+        /* queue is full: daemon has too many jobs in progress */
+        if (errno == EAGAIN)
+            nm_warn(_(NM_MSG_Q_BUSY));
+        else
+            nm_debug("%s: mq_send: %s\n", __func__, strerror(errno));
+        mq_close(mq);
         return NM_ERR;
     }
 
@@ -308,13 +307,28 @@ static int nm_qmp_send(const nm_str_t *cmd)
     return NM_OK;
 }
 
+/*
+ * Monitor daemon keeps QMP connections open, commands are passed to it.
+ * Direct connection is used only if the daemon is not running.
+ */
 static int nm_qmp_vm_exec(const nm_str_t *name, const char *cmd,
                           struct timeval *tv)
 {
     nm_str_t sock_path = NM_INIT_STR;
     nm_qmp_handle_t qmp = NM_INIT_QMP;
-    int rc = NM_ERR;
+    int timeout = tv->tv_sec * 1000 + tv->tv_usec / 1000;
+    int rc;
+
+    if (nm_qmp_pool_active())
+        return nm_qmp_pool_exec(name, cmd, timeout, NULL);
+
+    if ((rc = nm_qmp_pool_request(name, cmd, timeout, NULL)) != NM_QMP_POOL_NOCONN) {
+        if (rc != NM_OK)
+            nm_warn(_(NM_MSG_Q_EXEC_E));
+        return rc;
+    }
 
+    rc = NM_ERR;
     nm_qmp_sock_path(name, &sock_path);
 
     qmp.sock.sun_family = AF_UNIX;
@@ -323,7 +337,7 @@ static int nm_qmp_vm_exec(const nm_str_t *name, const char *cmd,
     if (nm_qmp_init_cmd(&qmp) == NM_ERR)
         goto out;
 
-    rc = nm_qmp_talk(qmp.sd, cmd, strlen(cmd), tv);
+    rc = nm_qmp_talk(qmp.sd, cmd, NM_QMP_ID_CMD, timeout);
     close(qmp.sd);
 
 out:
@@ -331,34 +345,43 @@ out:
     return rc;
 }
 
+/*
+ * Runs in monitor daemon: start the job and wait until it is
+ * concluded, completion is reported by QMP events.
+ */
 void nm_qmp_vm_exec_async(const nm_str_t *name, const char *cmd,
         const char *jobid)
 {
-    nm_str_t sock_path = NM_INIT_STR;
-    nm_qmp_handle_t qmp = NM_INIT_QMP;
-
-    nm_qmp_sock_path(name, &sock_path);
-
-    qmp.sock.sun_family = AF_UNIX;
-    nm_strlcpy(qmp.sock.sun_path, sock_path.data, sizeof(qmp.sock.sun_path));
-
-    if (nm_qmp_init_cmd(&qmp) == NM_ERR)
-        goto out;
+    nm_str_t error = NM_INIT_STR;
+#if defined (NM_WITH_DBUS)
+    nm_str_t body = NM_INIT_STR;
+#endif
 
-    nm_qmp_talk_async(qmp.sd, cmd, strlen(cmd), jobid);
-    close(qmp.sd);
+    if (nm_qmp_pool_exec_job(name, cmd, jobid, NM_QMP_JOB_CMD_TMO,
+                NM_QMP_JOB_TMO, &error) != NM_OK) {
+        nm_debug("%s: job %s executed with error: %s\n",
+                __func__, jobid, error.data);
+#if defined (NM_WITH_DBUS)
+        nm_str_format(&body, "%s - %s", jobid, error.data);
+        nm_dbus_send_notify("Job finished with error:", body.data);
+#endif
+    } else {
+        nm_debug("%s: job %s executed successfully\n", __func__, jobid);
+#if defined (NM_WITH_DBUS)
+        nm_str_format(&body, "%s", jobid);
+        nm_dbus_send_notify("Job finished successfully:", body.data);
+#endif
+    }
 
-out:
-    nm_str_free(&sock_path);
+#if defined (NM_WITH_DBUS)
+    nm_str_free(&body);
+#endif
+    nm_str_free(&error);
 }
 
 static int nm_qmp_init_cmd(nm_qmp_handle_t *h)
 {
     socklen_t len = sizeof(h->sock);
-    struct timeval tv;
-
-    tv.tv_sec = 0;
-    tv.tv_usec = 100000; /* 0.1 s */
 
     if ((h->sd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
         nm_warn(_(NM_MSG_Q_CR_ERR));
@@ -377,281 +400,187 @@ static int nm_qmp_init_cmd(nm_qmp_handle_t *h)
         return NM_ERR;
     }
 
-    return nm_qmp_talk(h->sd, NM_QMP_CMD_INIT, strlen(NM_QMP_CMD_INIT), &tv);
-}
-
-static int nm_qmp_check_answer(const nm_str_t *answer)
-{
-    /* {"return": {}} from answer means OK
-     * TODO: use JSON parser instead, e.g: json-c */
-    const char *regex = ".*\\{\"return\":[[:space:]]\\{\\}\\}.*";
-    regex_t reg;
-    int rc = NM_OK;
-
-    if (regcomp(&reg, regex, REG_NOSUB | REG_EXTENDED) != 0) {
-        nm_bug("%s: regcomp failed", __func__);
-    }
-
-    if (regexec(&reg, answer->data, 0, NULL, 0) != 0) {
-        rc = NM_ERR;
+    if (nm_qmp_talk(h->sd, NM_QMP_CMD_INIT, NM_QMP_ID_INIT,
+                NM_QMP_INIT_TMO) != NM_OK) {
+        close(h->sd);
+        return NM_ERR;
     }
 
-    regfree(&reg);
-
-    return rc;
+    return NM_OK;
 }
 
-static int nm_qmp_parse(const char *jobid, const nm_str_t *answer)
+/* Add "id" member to QMP command, reply will have the same id */
+int nm_qmp_cmd_id(const char *cmd, int64_t id, nm_str_t *res)
 {
-    int state = NM_QMP_STATE_UNDEF;
-    nm_vect_t json = NM_INIT_VECT;
-    char *saveptr;
-    char *token;
-
-    saveptr = answer->data;
-
-    while ((token = strtok_r(saveptr, "\n", &saveptr))) {
-        nm_str_t js = NM_INIT_STR;
-        nm_str_format(&js, "%s", token);
-        nm_vect_insert(&json, &js, sizeof(nm_str_t), nm_str_vect_ins_cb);
-        nm_str_free(&js);
-    }
-
-    if (json.n_memb == 1) {
-        nm_debug("%s: single json\n", __func__);
-        state = nm_qmp_check_job(jobid, nm_vect_at(&json, 0));
-        goto out;
-    }
+    struct json_object *obj;
 
-    nm_debug("%s: multiple json: %zu\n", __func__, json.n_memb);
-    for (size_t n = 0; n < json.n_memb; n++) {
-        if ((state = nm_qmp_check_job(jobid, nm_vect_at(&json, n)))
-                == NM_QMP_STATE_DONE) {
-            break;
-        }
+    if ((obj = json_tokener_parse(cmd)) == NULL) {
+        nm_debug("%s: malformed command: %s\n", __func__, cmd);
+        return NM_ERR;
     }
 
-out:
-    nm_vect_free(&json, nm_str_vect_free_cb);
+    json_object_object_add(obj, "id", json_object_new_int64(id));
+    nm_str_format(res, "%s\n",
+            json_object_to_json_string_ext(obj, JSON_C_TO_STRING_PLAIN));
+    json_object_put(obj);
 
-    return state;
+    return NM_OK;
 }
 
-static int nm_qmp_check_job(const char *jobid, const nm_str_t *answer)
+/*
+ * Incremental reader of QMP stream.
+ * Data is fed as it is read from socket, complete messages are
+ * taken out one by one. Unfinished message is kept by tokener,
+ * so partial reads and several messages in one read are handled.
+ */
+void nm_qmp_reader_init(nm_qmp_reader_t *r)
 {
-    struct json_object *parsed, *ret, *job, *id, *err, *status;
-    int state = NM_QMP_STATE_DONE;
-    nm_str_t body = NM_INIT_STR;
-    int jobs = 0;
-
-    nm_debug("%s: checking job: %s\n", __func__, jobid);
-    nm_debug("%s: answer: %s\n", __func__, answer->data);
-
-    parsed = json_tokener_parse(answer->data);
-    if (!parsed) {
-        nm_debug("%s: [more] need more data\n", __func__);
-        return NM_QMP_STATE_MORE;
-    }
-
-    json_object_object_get_ex(parsed, "return", &ret);
-    if (ret == NULL) {
-        nm_debug("%s: [next] need more data\n", __func__);
-        return NM_QMP_STATE_NEXT;
-    }
+    *r = NM_INIT_QMP_READER;
 
-    /* skip {"return": {}} */
-    if (json_object_get_type(ret) != json_type_array) {
-        nm_debug("%s: [ret next] need more data\n", __func__);
-        state = NM_QMP_STATE_NEXT;
-        goto out;
-    }
+    if ((r->tok = json_tokener_new()) == NULL)
+        nm_bug(_("%s: cannot create JSON tokener"), __func__);
+}
 
-    jobs = json_object_array_length(ret);
-    if (!jobs) {
-        nm_debug("%s: [ret next] need more data\n", __func__);
-        state = NM_QMP_STATE_REPEAT;
-        goto out;
-    }
+void nm_qmp_reader_feed(nm_qmp_reader_t *r, const char *data, size_t len)
+{
+    nm_str_add_text_part(&r->buf, data, len);
+}
 
-    nm_debug("%s: got %d jobs\n", __func__, jobs);
-    for (int i = 0; i < jobs; i++) {
-        const char *id_str;
+/* Returns next message or NULL if more data is needed */
+struct json_object *nm_qmp_reader_next(nm_qmp_reader_t *r)
+{
+    for (;;) {
+        struct json_object *obj;
+        enum json_tokener_error err;
+        size_t skip = 0, used;
+
+        /* whitespace between messages, not inside unfinished one */
+        if (!r->partial) {
+            while (skip < r->buf.len && isspace((unsigned char) r->buf.data[skip]))
+                skip++;
+        }
 
-        job = json_object_array_get_idx(ret, i);
-        json_object_object_get_ex(job, "id", &id);
-        id_str = json_object_get_string(id);
+        if (skip == r->buf.len) {
+            nm_qmp_reader_cut(r, r->buf.len);
+            return NULL;
+        }
 
-        if (nm_str_cmp_tt(id_str, jobid) == NM_OK) {
-            const char *status_str;
-            nm_debug("%s: job found: %s, checking status\n", __func__, id_str);
+        obj = json_tokener_parse_ex(r->tok, r->buf.data + skip, r->buf.len - skip);
+        err = json_tokener_get_error(r->tok);
 
-            json_object_object_get_ex(job, "status", &status);
-            status_str = json_object_get_string(status);
-            if (nm_str_cmp_tt(status_str, "concluded") != NM_OK) {
-                nm_debug("%s: job %s is not finished yet\n", __func__, id_str);
-                state = NM_QMP_STATE_REPEAT;
-                break;
-            }
+        if (err == json_tokener_continue) {
+            /* all data is taken by tokener */
+            r->partial = true;
+            nm_qmp_reader_cut(r, r->buf.len);
+            return NULL;
+        }
 
-            json_object_object_get_ex(job, "error", &err);
-            if (err) { /* job executed with errors */
-                const char *err_str;
-                err_str = json_object_get_string(err);
-                nm_debug("%s: job %s executed with error: %s\n",
-                        __func__, id_str, err_str);
-#if defined (NM_WITH_DBUS)
-                nm_str_format(&body, "%s - %s", id_str, err_str);
-                nm_dbus_send_notify("Job finished with error:", body.data);
+#if JSON_C_VERSION_NUM >= ((0 << 16) | (15 << 8))
+        used = skip + json_tokener_get_parse_end(r->tok);
+#else
+        used = skip + r->tok->char_offset;
 #endif
-                break;
-            }
+        json_tokener_reset(r->tok);
+        r->partial = false;
 
-            /*job finished successfully */
-            nm_debug("%s: job %s executed successfully\n", __func__, id_str);
-#if defined (NM_WITH_DBUS)
-            nm_str_format(&body, "%s", id_str);
-            nm_dbus_send_notify("Job finished successfully:", body.data);
-#endif
-            break;
+        if (err == json_tokener_success && obj) {
+            nm_qmp_reader_cut(r, used);
+            return obj;
         }
+
+        /* skip broken message up to the end of line */
+        nm_debug("%s: %s\n", __func__, json_tokener_error_desc(err));
+        if (obj)
+            json_object_put(obj);
+
+        while (used < r->buf.len && r->buf.data[used] != '\n')
+            used++;
+        nm_qmp_reader_cut(r, (used < r->buf.len) ? used + 1 : used);
     }
-out:
-    json_object_put(parsed);
-    nm_str_free(&body);
+}
 
-    return state;
+void nm_qmp_reader_free(nm_qmp_reader_t *r)
+{
+    if (r->tok)
+        json_tokener_free(r->tok);
+
+    nm_str_free(&r->buf);
+    *r = NM_INIT_QMP_READER;
 }
 
-static int nm_qmp_talk(int sd, const char *cmd,
-                       size_t len, struct timeval *tv)
+/*
+ * Send command and wait for reply with the same id.
+ * Greeting and events that come before it are skipped.
+ */
+static int nm_qmp_talk(int sd, const char *cmd, int64_t id, int timeout)
 {
-    nm_str_t answer = NM_INIT_STR;
+    nm_qmp_reader_t reader;
+    nm_str_t msg = NM_INIT_STR;
     char buf[NM_QMP_READLEN];
-    ssize_t nread;
-    fd_set readset;
-    int ret, read_done = 0;
-    int rc = NM_OK;
+    int64_t deadline = nm_mono_ms() + timeout;
+    struct json_object *obj, *val;
+    bool answered = false;
+    int rc = NM_ERR;
 
-    FD_ZERO(&readset);
-    FD_SET(sd, &readset);
+    if (nm_qmp_cmd_id(cmd, id, &msg) != NM_OK)
+        return NM_ERR;
 
-    if (write(sd, cmd, len) == -1) {
-        close(sd);
+    if (write(sd, msg.data, msg.len) == -1) {
+        nm_str_free(&msg);
         nm_warn(_(NM_MSG_Q_SE_ERR));
         return NM_ERR;
     }
 
-    while (!read_done) {
-        ret = select(sd + 1, &readset, NULL, NULL, tv);
-        if (ret == -1) {
-            nm_bug("%s: select error: %s", __func__, strerror(errno));
-        } else if (ret && FD_ISSET(sd, &readset)) { /* data is available */
-            memset(buf, 0, NM_QMP_READLEN);
-            nread = read(sd, buf, NM_QMP_READLEN);
-            if (nread > 1) {
-                buf[nread - 2] = '\0';
-                nm_str_add_text(&answer, buf);
-                /* check for command successfully executed here
-                 * and return if it done */
-                if ((rc = nm_qmp_check_answer(&answer)) == NM_OK)
-                    goto out;
-            } else if (nread == 0) { /* socket closed */
-                read_done = 1;
+    nm_str_free(&msg);
+    nm_qmp_reader_init(&reader);
+
+    while (!answered) {
+        struct pollfd pfd = { .fd = sd, .events = POLLIN };
+        int64_t left = deadline - nm_mono_ms();
+        ssize_t nread;
+
+        if (left <= 0 || poll(&pfd, 1, left) <= 0)
+            break; /* timeout, nothing happens */
+
+        if ((nread = read(sd, buf, sizeof(buf))) <= 0) {
+            if (nread == -1 && (errno == EAGAIN || errno == EINTR))
+                continue;
+            break; /* socket closed */
+        }
+
+        nm_qmp_reader_feed(&reader, buf, nread);
+
+        while (!answered && (obj = nm_qmp_reader_next(&reader)) != NULL) {
+            nm_debug("QMP: %s\n", json_object_to_json_string(obj));
+
+            if (json_object_object_get_ex(obj, "id", &val) &&
+                    json_object_get_int64(val) == id) {
+                answered = true;
+                if (json_object_object_get_ex(obj, "return", NULL))
+                    rc = NM_OK;
             }
-        } else { /* timeout, nothing happens */
-            read_done = 1;
+            json_object_put(obj);
         }
     }
 
-    if (answer.len == 0) {
-        nm_warn(_(NM_MSG_Q_NO_ANS));
-        rc = NM_ERR;
-        goto err;
-    }
+    nm_qmp_reader_free(&reader);
 
-out:
-    nm_debug("QMP: %s\n", answer.data);
-    if (rc != NM_OK)
+    if (!answered)
+        nm_warn(_(NM_MSG_Q_NO_ANS));
+    else if (rc != NM_OK)
         nm_warn(_(NM_MSG_Q_EXEC_E));
-err:
-    nm_str_free(&answer);
 
     return rc;
 }
 
-static void nm_qmp_talk_async(int sd, const char *cmd,
-                       size_t len, const char *jobid)
+static void nm_qmp_reader_cut(nm_qmp_reader_t *r, size_t len)
 {
-    char buf[NM_QMP_READLEN + 1] = {0};
-    nm_str_t answer = NM_INIT_STR;
-    int ret, read_done = 0;
-    struct timeval tv;
-    int state = NM_QMP_STATE_UNDEF;
-    fd_set readset;
-    ssize_t nread;
-
-    tv.tv_sec = 300;
-    tv.tv_usec = 0;
-
-    FD_ZERO(&readset);
-    FD_SET(sd, &readset);
-
-    if (write(sd, cmd, len) == -1) {
-        close(sd);
-        //nm_warn(_(NM_MSG_Q_SE_ERR));
+    if (!r->buf.data)
         return;
-    }
-
-    if (write(sd, NM_QMP_CMD_JOBS, sizeof(NM_QMP_CMD_JOBS) - 1) == -1) {
-        close(sd);
-        //nm_warn(_(NM_MSG_Q_SE_ERR));
-        return;
-    }
-
-    while (!read_done) {
-        /* query jobs */
-        if (state == NM_QMP_STATE_REPEAT) {
-            if (write(sd, NM_QMP_CMD_JOBS, sizeof(NM_QMP_CMD_JOBS) - 1) == -1) {
-                close(sd);
-                //nm_warn(_(NM_MSG_Q_SE_ERR));
-                return;
-            }
-            state = NM_QMP_STATE_UNDEF;
-        }
 
-        ret = select(sd + 1, &readset, NULL, NULL, &tv);
-        if (ret == -1) {
-            nm_bug("%s: select error: %s", __func__, strerror(errno));
-        } else if (ret && FD_ISSET(sd, &readset)) { /* data is available */
-            memset(buf, 0, NM_QMP_READLEN);
-            nread = read(sd, buf, NM_QMP_READLEN);
-            if (nread > 1) {
-                if (buf[nread - 2] == '\r') {
-                    buf[nread - 2] = '\0';
-                }
-                if (state == NM_QMP_STATE_MORE) {
-                    nm_str_add_text(&answer, buf);
-                } else {
-                    nm_str_format(&answer, "%s", buf);
-                }
-                /* check for job successfully finished
-                 * and return if it done */
-                if ((state = nm_qmp_parse(jobid, &answer)) == NM_QMP_STATE_DONE)
-                    goto out;
-            } else if (nread == 0) { /* socket closed */
-                read_done = 1;
-            }
-        } else { /* timeout, nothing happens */
-            read_done = 1;
-        }
-    }
-
-    if (answer.len == 0) {
-        //nm_warn(_(NM_MSG_Q_NO_ANS));
-    }
-
-out:
-    nm_str_free(&answer);
+    memmove(r->buf.data, r->buf.data + len, r->buf.len - len);
+    r->buf.len -= len;
+    r->buf.data[r->buf.len] = '\0';
 }
 
 static void nm_qmp_sock_path(const nm_str_t *name, nm_str_t *path)
@@ -4,9 +4,20 @@
 #include <nm_string.h>
 #include <nm_usb_devices.h>
 
-void nm_qmp_vm_shut(const nm_str_t *name);
-void nm_qmp_vm_stop(const nm_str_t *name);
-void nm_qmp_vm_reset(const nm_str_t *name);
+struct json_object;
+struct json_tokener;
+
+typedef struct {
+    struct json_tokener *tok;
+    nm_str_t buf;
+    bool partial;
+} nm_qmp_reader_t;
+
+#define NM_INIT_QMP_READER (nm_qmp_reader_t) { NULL, NM_INIT_STR, false }
+
+int nm_qmp_vm_shut(const nm_str_t *name);
+int nm_qmp_vm_stop(const nm_str_t *name);
+int nm_qmp_vm_reset(const nm_str_t *name);
 void nm_qmp_vm_pause(const nm_str_t *name);
 void nm_qmp_vm_resume(const nm_str_t *name);
 int nm_qmp_savevm(const nm_str_t *name, const nm_str_t *snap);
@@ -17,6 +28,11 @@ int nm_qmp_usb_detach(const nm_str_t *name, const nm_usb_data_t *usb);
 int nm_qmp_test_socket(const nm_str_t *name);
 void nm_qmp_vm_exec_async(const nm_str_t *name, const char *cmd,
         const char *jobid);
+int nm_qmp_cmd_id(const char *cmd, int64_t id, nm_str_t *res);
+void nm_qmp_reader_init(nm_qmp_reader_t *r);
+void nm_qmp_reader_feed(nm_qmp_reader_t *r, const char *data, size_t len);
+struct json_object *nm_qmp_reader_next(nm_qmp_reader_t *r);
+void nm_qmp_reader_free(nm_qmp_reader_t *r);
 
 #endif /* NM_QMP_CONTROL_H_ */
 /* vim:set ts=4 sw=4: */
@@ -0,0 +1,1056 @@
+#if defined (NM_OS_LINUX)
+# define _GNU_SOURCE
+#endif
+#include <nm_core.h>
+#include <nm_utils.h>
+#include <nm_string.h>
+#include <nm_cfg_file.h>
+#include <nm_qmp_pool.h>
+#include <nm_qmp_control.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+
+#include <json.h>
+
+/*
+ * QMP connection pool.
+ * Monitor daemon keeps one negotiated QMP connection per running VM.
+ * Commands from several threads share the connection, replies are
+ * matched by QMP "id". One I/O thread reads all connections,
+ * messages are split by incremental JSON parser, not by lines.
+ * TUI and CLI pass commands to the daemon through unix socket
+ * (daemon_sock in config), one request per connection, requests are
+ * served by NM_QMP_POOL_WORKERS threads:
+ *   -> {"vm":"name","timeout":ms,"cmd":{"execute":...}}\n
+ *   <- {"return":...} or {"error":...}\n
+ * If the daemon is not running, callers talk to QEMU directly.
+ * QMP events of pooled connections are passed to event callback,
+ * monitor daemon uses it to track VM state. Completion of QEMU jobs
+ * is taken from the same events, jobs are not polled.
+ */
+
+enum {
+    NM_QMP_POOL_TICK = 1000,     /* ms, stop flag check interval */
+    NM_QMP_POOL_INIT_TMO = 1000, /* ms, greeting and capabilities */
+    NM_QMP_POOL_REQ_TMO = 1000,  /* ms, reading client request */
+    NM_QMP_POOL_READLEN = 4096,
+    NM_QMP_POOL_BACKLOG = 16,
+    NM_QMP_POOL_WORKERS = 4,
+    NM_QMP_POOL_QUEUE = 32       /* accepted clients waiting for worker */
+};
+
+enum {
+    NM_QMP_REQ_WAIT = 0,
+    NM_QMP_REQ_DONE,
+    NM_QMP_REQ_FAIL
+};
+
+static const char NM_QMP_POOL_CMD_INIT[] = "{\"execute\":\"qmp_capabilities\"}\n";
+
+typedef struct nm_qmp_conn nm_qmp_conn_t;
+
+typedef struct nm_qmp_req {
+    int64_t id;
+    int state;
+    nm_str_t *reply;
+    nm_qmp_conn_t *conn;
+    struct nm_qmp_req *next;
+} nm_qmp_req_t;
+
+/*
+ * pool_lock protects the list, requests and reader, wlock serializes
+ * writes of one connection, so a slow VM does not block the others.
+ * Connection is freed when the last reference is dropped, the list
+ * holds one reference.
+ */
+struct nm_qmp_conn {
+    nm_str_t name;
+    nm_qmp_reader_t reader;
+    int sd;
+    int refs;
+    bool dead;
+    bool closed;                /* removed from the list */
+    pthread_mutex_t wlock;
+    nm_qmp_req_t *pending;
+    nm_qmp_conn_t *next;
+};
+
+/* QEMU job (snapshot-*, block jobs) waiting for completion event */
+typedef struct nm_qmp_job_wait {
+    const nm_str_t *name;
+    const char *id;
+    int state;
+    nm_str_t *error;
+    struct nm_qmp_job_wait *next;
+} nm_qmp_job_wait_t;
+
+#define NM_QMP_REQ_INIT (nm_qmp_req_t) { 0, NM_QMP_REQ_WAIT, NULL, NULL, NULL }
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+static nm_qmp_conn_t *pool_conns = NULL;
+static nm_qmp_job_wait_t *pool_jobs = NULL;
+static int64_t pool_next_id = 1;
+static int pool_wake[2] = { -1, -1 };
+static int pool_srv_sd = -1;
+static volatile bool pool_stop = false;
+static bool pool_active = false;
+static pthread_t pool_io_thr;
+static pthread_t pool_srv_thr;
+static nm_qmp_pool_event_cb_t pool_event_cb = NULL;
+static nm_qmp_pool_stats_t pool_stats;
+static pthread_mutex_t pool_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_queue_cond = PTHREAD_COND_INITIALIZER;
+static int pool_queue[NM_QMP_POOL_QUEUE];
+static size_t pool_queue_head = 0;
+static size_t pool_queue_len = 0;
+
+static void *nm_qmp_pool_io(void *unused);
+static void *nm_qmp_pool_server(void *unused);
+static void nm_qmp_pool_accept(void);
+static void *nm_qmp_pool_worker(void *unused);
+static void nm_qmp_pool_client(int sd);
+static nm_qmp_conn_t *nm_qmp_pool_get(const nm_str_t *name);
+static nm_qmp_conn_t *nm_qmp_pool_find(const nm_str_t *name);
+static nm_qmp_conn_t *nm_qmp_pool_connect(const nm_str_t *name);
+static void nm_qmp_pool_close(nm_qmp_conn_t *conn);
+static void nm_qmp_pool_put(nm_qmp_conn_t *conn);
+static void nm_qmp_pool_dispatch(nm_qmp_conn_t *conn);
+static void nm_qmp_pool_message(nm_qmp_conn_t *conn, struct json_object *msg);
+static void nm_qmp_pool_unlink(nm_qmp_req_t *req);
+static void nm_qmp_pool_job_event(const nm_qmp_conn_t *conn, const char *event,
+        struct json_object *data);
+static void nm_qmp_pool_job_set(const nm_str_t *name, const char *id,
+        int state, const char *error);
+static struct json_object *nm_qmp_pool_recv(int sd, nm_qmp_reader_t *r,
+        int timeout);
+static int nm_qmp_pool_write(int sd, const char *data, size_t len, int timeout);
+static int nm_qmp_pool_wait(int sd, short events, int timeout);
+static void nm_qmp_pool_deadline(struct timespec *ts, int timeout);
+static void nm_qmp_pool_account(const struct timespec *start, int rc);
+
+/* Called by monitor daemon. Commands of this process go through the pool. */
+void nm_qmp_pool_init(void)
+{
+    if (pool_active)
+        return;
+
+    if (pipe(pool_wake) == -1)
+        nm_bug("%s: pipe error: %s", __func__, strerror(errno));
+
+    fcntl(pool_wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(pool_wake[1], F_SETFL, O_NONBLOCK);
+
+    pool_stop = false;
+
+    if (pthread_create(&pool_io_thr, NULL, nm_qmp_pool_io, NULL) != 0)
+        nm_bug("%s: cannot create thread", __func__);
+#if defined (NM_OS_LINUX)
+    pthread_setname_np(pool_io_thr, "nemu-qmp-io");
+#endif
+
+    if (pthread_create(&pool_srv_thr, NULL, nm_qmp_pool_server, NULL) != 0)
+        nm_bug("%s: cannot create thread", __func__);
+#if defined (NM_OS_LINUX)
+    pthread_setname_np(pool_srv_thr, "nemu-qmp-srv");
+#endif
+
+    pool_active = true;
+}
+
+void nm_qmp_pool_free(void)
+{
+    if (!pool_active)
+        return;
+
+    pool_stop = true;
+    pthread_join(pool_srv_thr, NULL);
+    pthread_join(pool_io_thr, NULL);
+
+    pthread_mutex_lock(&pool_lock);
+    pool_event_cb = NULL;
+    while (pool_conns)
+        nm_qmp_pool_close(pool_conns);
+    pthread_mutex_unlock(&pool_lock);
+
+    close(pool_wake[0]);
+    close(pool_wake[1]);
+    pool_wake[0] = pool_wake[1] = -1;
+    pool_active = false;
+}
+
+int nm_qmp_pool_active(void)
+{
+    return pool_active;
+}
+
+/*
+ * Open pooled connection to VM if it is not opened yet.
+ * Returns NM_OK if VM is running and QMP session is established.
+ */
+int nm_qmp_pool_attach(const nm_str_t *name)
+{
+    nm_qmp_conn_t *conn;
+
+    if (!pool_active)
+        return NM_ERR;
+
+    pthread_mutex_lock(&pool_lock);
+    conn = nm_qmp_pool_get(name);
+    pthread_mutex_unlock(&pool_lock);
+
+    return conn ? NM_OK : NM_ERR;
+}
+
+void nm_qmp_pool_get_stats(nm_qmp_pool_stats_t *stats)
+{
+    pthread_mutex_lock(&pool_lock);
+    *stats = pool_stats;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+void nm_qmp_pool_set_event_cb(nm_qmp_pool_event_cb_t cb)
+{
+    pthread_mutex_lock(&pool_lock);
+    pool_event_cb = cb;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/*
+ * Execute QMP command on pooled connection.
+ * timeout - time to wait for reply in ms.
+ * Returns NM_OK if QEMU replied with "return", reply (if not NULL)
+ * is set to the whole answer.
+ */
+int nm_qmp_pool_exec(const nm_str_t *name, const char *cmd,
+        int timeout, nm_str_t *reply)
+{
+    nm_qmp_req_t req = NM_QMP_REQ_INIT;
+    nm_qmp_conn_t *conn;
+    struct timespec ts, start;
+    int rc = NM_ERR;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_mutex_lock(&pool_lock);
+
+    /* stale connection (VM was restarted) is found on write, retry once */
+    for (int attempt = 0; attempt < 2; attempt++) {
+        nm_str_t buf = NM_INIT_STR;
+
+        if ((conn = nm_qmp_pool_get(name)) == NULL)
+            goto out;
+
+        req.id = pool_next_id++;
+        req.reply = reply;
+        req.conn = conn;
+        req.next = conn->pending;
+        conn->pending = &req;
+
+        if (nm_qmp_cmd_id(cmd, req.id, &buf) != NM_OK) {
+            nm_qmp_pool_unlink(&req);
+            goto out;
+        }
+
+        nm_debug("%s: %s: %s", __func__, name->data, buf.data);
+
+        /* write without pool_lock, other VMs are not blocked */
+        conn->refs++;
+        pthread_mutex_unlock(&pool_lock);
+        pthread_mutex_lock(&conn->wlock);
+        rc = nm_qmp_pool_write(conn->sd, buf.data, buf.len, timeout);
+        pthread_mutex_unlock(&conn->wlock);
+        pthread_mutex_lock(&pool_lock);
+        nm_str_free(&buf);
+
+        if (rc != NM_OK && !conn->closed) {
+            conn->dead = true;
+            shutdown(conn->sd, SHUT_RDWR);
+        }
+        nm_qmp_pool_put(conn);
+
+        if (rc == NM_OK)
+            break;
+
+        /* request was failed already if connection was closed */
+        if (req.state == NM_QMP_REQ_WAIT)
+            nm_qmp_pool_unlink(&req);
+        req = NM_QMP_REQ_INIT;
+    }
+
+    if (rc != NM_OK)
+        goto out;
+
+    nm_qmp_pool_deadline(&ts, timeout);
+
+    while (req.state == NM_QMP_REQ_WAIT) {
+        if (pthread_cond_timedwait(&pool_cond, &pool_lock, &ts) == ETIMEDOUT)
+            break;
+    }
+
+    if (req.state == NM_QMP_REQ_WAIT) {
+        nm_debug("%s: %s: no answer for id %" PRId64 "\n",
+                __func__, name->data, req.id);
+        nm_qmp_pool_unlink(&req);
+    }
+
+    rc = (req.state == NM_QMP_REQ_DONE) ? NM_OK : NM_ERR;
+    nm_qmp_pool_account(&start, rc);
+
+out:
+    pthread_mutex_unlock(&pool_lock);
+
+    return rc;
+}
+
+/*
+ * Start QEMU job and wait until it is concluded.
+ * timeout - time to wait for reply to cmd, job_timeout - for the job.
+ * Returns NM_OK if the job is concluded without known error,
+ * error (if not NULL) is set otherwise.
+ */
+int nm_qmp_pool_exec_job(const nm_str_t *name, const char *cmd,
+        const char *jobid, int timeout, int job_timeout, nm_str_t *error)
+{
+    nm_qmp_job_wait_t wait = { name, jobid, NM_QMP_REQ_WAIT, error, NULL };
+    nm_str_t reply = NM_INIT_STR;
+    struct timespec ts;
+    int rc;
+
+    /* job may be concluded before the reply is read */
+    pthread_mutex_lock(&pool_lock);
+    wait.next = pool_jobs;
+    pool_jobs = &wait;
+    pthread_mutex_unlock(&pool_lock);
+
+    rc = nm_qmp_pool_exec(name, cmd, timeout, &reply);
+
+    pthread_mutex_lock(&pool_lock);
+    if (rc != NM_OK) {
+        if (error)
+            nm_str_format(error, "%s", reply.len ? reply.data : "no answer");
+        goto out;
+    }
+
+    nm_qmp_pool_deadline(&ts, job_timeout);
+
+    while (wait.state == NM_QMP_REQ_WAIT) {
+        if (pthread_cond_timedwait(&pool_cond, &pool_lock, &ts) == ETIMEDOUT)
+            break;
+    }
+
+    if (wait.state == NM_QMP_REQ_WAIT && error)
+        nm_str_format(error, "no result");
+
+    rc = (wait.state == NM_QMP_REQ_DONE) ? NM_OK : NM_ERR;
+
+out:
+    for (nm_qmp_job_wait_t **pp = &pool_jobs; *pp; pp = &(*pp)->next) {
+        if (*pp == &wait) {
+            *pp = wait.next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+    nm_str_free(&reply);
+
+    return rc;
+}
+
+/*
+ * Pass QMP command to the monitor daemon.
+ * Returns NM_QMP_POOL_NOCONN if the daemon is not available,
+ * the command was not sent then.
+ */
+int nm_qmp_pool_request(const nm_str_t *name, const char *cmd,
+        int timeout, nm_str_t *reply)
+{
+    struct json_object *req, *obj;
+    struct sockaddr_un addr;
+    nm_qmp_reader_t reader;
+    nm_str_t buf = NM_INIT_STR;
+    const nm_cfg_t *cfg = nm_cfg_get();
+    int rc = NM_ERR;
+    int sd;
+
+    if (!cfg->daemon_sock.len)
+        return NM_QMP_POOL_NOCONN;
+
+    if ((obj = json_tokener_parse(cmd)) == NULL)
+        return NM_ERR;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    nm_strlcpy(addr.sun_path, cfg->daemon_sock.data, sizeof(addr.sun_path));
+
+    if ((sd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        json_object_put(obj);
+        return NM_QMP_POOL_NOCONN;
+    }
+
+    if (connect(sd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        close(sd);
+        json_object_put(obj);
+        return NM_QMP_POOL_NOCONN;
+    }
+
+    req = json_object_new_object();
+    json_object_object_add(req, "vm", json_object_new_string(name->data));
+    json_object_object_add(req, "timeout", json_object_new_int64(timeout));
+    json_object_object_add(req, "cmd", obj);
+    nm_str_format(&buf, "%s\n",
+            json_object_to_json_string_ext(req, JSON_C_TO_STRING_PLAIN));
+    json_object_put(req);
+
+    if (nm_qmp_pool_write(sd, buf.data, buf.len, timeout) != NM_OK)
+        goto out;
+
+    /* daemon may need to connect to QEMU first */
+    nm_qmp_reader_init(&reader);
+    obj = nm_qmp_pool_recv(sd, &reader, timeout + NM_QMP_POOL_INIT_TMO);
+    nm_qmp_reader_free(&reader);
+
+    if (obj) {
+        if (reply) {
+            nm_str_alloc_text(reply,
+                json_object_to_json_string_ext(obj, JSON_C_TO_STRING_PLAIN));
+        }
+        if (json_object_object_get_ex(obj, "return", NULL))
+            rc = NM_OK;
+        json_object_put(obj);
+    }
+
+out:
+    close(sd);
+    nm_str_free(&buf);
+
+    return rc;
+}
+
+/* Must be called with pool_lock held */
+static nm_qmp_conn_t *nm_qmp_pool_get(const nm_str_t *name)
+{
+    nm_qmp_conn_t *conn;
+
+    if ((conn = nm_qmp_pool_find(name)) != NULL)
+        return conn;
+
+    /* handshake may take a while, do not block other VMs */
+    pthread_mutex_unlock(&pool_lock);
+    conn = nm_qmp_pool_connect(name);
+    pthread_mutex_lock(&pool_lock);
+
+    if (!conn)
+        return NULL;
+
+    /* other thread could connect meanwhile */
+    if (nm_qmp_pool_find(name) != NULL) {
+        nm_qmp_conn_t *dup = conn;
+
+        conn = nm_qmp_pool_find(name);
+        nm_qmp_pool_put(dup);
+
+        return conn;
+    }
+
+    conn->next = pool_conns;
+    pool_conns = conn;
+
+    /* I/O thread must rebuild poll set */
+    if (write(pool_wake[1], "", 1) == -1 && errno != EAGAIN)
+        nm_debug("%s: cannot wake I/O thread: %s\n", __func__, strerror(errno));
+
+    return conn;
+}
+
+static nm_qmp_conn_t *nm_qmp_pool_find(const nm_str_t *name)
+{
+    for (nm_qmp_conn_t *conn = pool_conns; conn; conn = conn->next) {
+        if (!conn->dead && nm_str_cmp_ss(&conn->name, name) == NM_OK)
+            return conn;
+    }
+
+    return NULL;
+}
+
+static nm_qmp_conn_t *nm_qmp_pool_connect(const nm_str_t *name)
+{
+    struct sockaddr_un addr;
+    nm_qmp_conn_t *conn = NULL;
+    nm_str_t path = NM_INIT_STR;
+    nm_qmp_reader_t reader;
+    struct json_object *obj = NULL;
+    int sd;
+
+    nm_str_format(&path, "%s/%s/%s",
+            nm_cfg_get()->vm_dir.data, name->data, NM_VM_QMP_FILE);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    nm_strlcpy(addr.sun_path, path.data, sizeof(addr.sun_path));
+
+    if ((sd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        nm_debug("%s: socket: %s\n", __func__, strerror(errno));
+        nm_str_free(&path);
+        return NULL;
+    }
+
+    nm_qmp_reader_init(&reader);
+
+    if (connect(sd, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+            fcntl(sd, F_SETFL, O_NONBLOCK) == -1) {
+        nm_debug("%s: cannot connect to %s: %s\n",
+                __func__, path.data, strerror(errno));
+        goto err;
+    }
+
+    /* greeting: {"QMP": {"version": ...}} */
+    if ((obj = nm_qmp_pool_recv(sd, &reader, NM_QMP_POOL_INIT_TMO)) == NULL)
+        goto err;
+
+    json_object_put(obj);
+    obj = NULL;
+
+    if (nm_qmp_pool_write(sd, NM_QMP_POOL_CMD_INIT,
+                sizeof(NM_QMP_POOL_CMD_INIT) - 1, NM_QMP_POOL_INIT_TMO) != NM_OK) {
+        goto err;
+    }
+
+    /* events may come before the answer */
+    for (;;) {
+        if ((obj = nm_qmp_pool_recv(sd, &reader, NM_QMP_POOL_INIT_TMO)) == NULL)
+            goto err;
+
+        if (json_object_object_get_ex(obj, "return", NULL))
+            break;
+
+        if (json_object_object_get_ex(obj, "error", NULL)) {
+            nm_debug("%s: %s: %s\n", __func__, name->data,
+                    json_object_to_json_string(obj));
+            goto err;
+        }
+
+        json_object_put(obj);
+        obj = NULL;
+    }
+
+    nm_debug("%s: %s: connected\n", __func__, name->data);
+
+    conn = nm_calloc(1, sizeof(nm_qmp_conn_t));
+    nm_str_copy(&conn->name, name);
+    conn->reader = reader; /* data after the answer stays in reader */
+    conn->sd = sd;
+    conn->refs = 1;
+    pthread_mutex_init(&conn->wlock, NULL);
+    goto out;
+
+err:
+    nm_qmp_reader_free(&reader);
+    close(sd);
+out:
+    if (obj)
+        json_object_put(obj);
+    nm_str_free(&path);
+
+    return conn;
+}
+
+/* Must be called with pool_lock held, by I/O thread only or at exit */
+static void nm_qmp_pool_close(nm_qmp_conn_t *conn)
+{
+    nm_qmp_conn_t **pp = &pool_conns;
+
+    while (*pp && *pp != conn)
+        pp = &(*pp)->next;
+
+    if (*pp)
+        *pp = conn->next;
+
+    for (nm_qmp_req_t *req = conn->pending; req; req = req->next)
+        req->state = NM_QMP_REQ_FAIL;
+    conn->pending = NULL;
+    nm_qmp_pool_job_set(&conn->name, NULL, NM_QMP_REQ_FAIL, "QEMU exited");
+
+    nm_debug("%s: %s: disconnected\n", __func__, conn->name.data);
+
+    if (pool_event_cb)
+        pool_event_cb(&conn->name, NM_QMP_POOL_EV_CLOSED, NULL);
+
+    /* writer may still use the socket, it is closed by the last put */
+    shutdown(conn->sd, SHUT_RDWR);
+    conn->closed = true;
+    nm_qmp_pool_put(conn);
+
+    pthread_cond_broadcast(&pool_cond);
+}
+
+/* Must be called with pool_lock held or before conn is published */
+static void nm_qmp_pool_put(nm_qmp_conn_t *conn)
+{
+    if (--conn->refs > 0)
+        return;
+
+    close(conn->sd);
+    pthread_mutex_destroy(&conn->wlock);
+    nm_str_free(&conn->name);
+    nm_qmp_reader_free(&conn->reader);
+    free(conn);
+}
+
+static void *nm_qmp_pool_io(void *unused NM_UNUSED)
+{
+    nm_qmp_conn_t **conns = NULL;
+    struct pollfd *fds = NULL;
+    size_t nalloc = 0;
+    char buf[NM_QMP_POOL_READLEN];
+
+    while (!pool_stop) {
+        size_t nfds = 1;
+
+        pthread_mutex_lock(&pool_lock);
+        for (nm_qmp_conn_t *conn = pool_conns; conn; conn = conn->next)
+            nfds++;
+
+        if (nfds > nalloc) {
+            nalloc = nfds * 2;
+            fds = nm_realloc(fds, sizeof(struct pollfd) * nalloc);
+            conns = nm_realloc(conns, sizeof(nm_qmp_conn_t *) * nalloc);
+        }
+
+        fds[0].fd = pool_wake[0];
+        fds[0].events = POLLIN;
+        nfds = 1;
+        for (nm_qmp_conn_t *conn = pool_conns; conn; conn = conn->next, nfds++) {
+            fds[nfds].fd = conn->sd;
+            fds[nfds].events = POLLIN;
+            conns[nfds] = conn;
+        }
+        pthread_mutex_unlock(&pool_lock);
+
+        if (poll(fds, nfds, NM_QMP_POOL_TICK) <= 0)
+            continue;
+
+        if (fds[0].revents & POLLIN) {
+            while (read(pool_wake[0], buf, sizeof(buf)) > 0)
+                ;
+        }
+
+        /* connections are freed only by this thread, pointers are valid */
+        for (size_t n = 1; n < nfds; n++) {
+            ssize_t nread = 0;
+
+            if (!fds[n].revents)
+                continue;
+
+            if (fds[n].revents & POLLIN)
+                nread = read(fds[n].fd, buf, sizeof(buf));
+
+            pthread_mutex_lock(&pool_lock);
+            if (nread > 0) {
+                nm_qmp_reader_feed(&conns[n]->reader, buf, nread);
+                nm_qmp_pool_dispatch(conns[n]);
+            } else if (nread == 0 || (errno != EAGAIN && errno != EINTR)) {
+                /* VM is stopped or connection was dropped */
+                nm_qmp_pool_close(conns[n]);
+            }
+            pthread_mutex_unlock(&pool_lock);
+        }
+    }
+
+    free(fds);
+    free(conns);
+
+    return NULL;
+}
+
+static void nm_qmp_pool_dispatch(nm_qmp_conn_t *conn)
+{
+    struct json_object *msg;
+
+    while ((msg = nm_qmp_reader_next(&conn->reader)) != NULL) {
+        nm_qmp_pool_message(conn, msg);
+        json_object_put(msg);
+    }
+}
+
+static void nm_qmp_pool_message(nm_qmp_conn_t *conn, struct json_object *msg)
+{
+    struct json_object *id, *event, *data = NULL;
+
+    if (json_object_object_get_ex(msg, "event", &event)) {
+        nm_debug("%s: %s: %s\n", __func__, conn->name.data,
+                json_object_to_json_string(msg));
+        json_object_object_get_ex(msg, "data", &data);
+        nm_qmp_pool_job_event(conn, json_object_get_string(event), data);
+        if (pool_event_cb)
+            pool_event_cb(&conn->name, json_object_get_string(event), data);
+        return;
+    }
+
+    if (!json_object_object_get_ex(msg, "id", &id)) {
+        nm_debug("%s: %s: %s\n", __func__, conn->name.data,
+                json_object_to_json_string(msg));
+        return;
+    }
+
+    for (nm_qmp_req_t *req = conn->pending; req; req = req->next) {
+        if (req->id != json_object_get_int64(id))
+            continue;
+
+        if (req->reply) {
+            nm_str_alloc_text(req->reply,
+                json_object_to_json_string_ext(msg, JSON_C_TO_STRING_PLAIN));
+        }
+
+        req->state = json_object_object_get_ex(msg, "return", NULL) ?
+            NM_QMP_REQ_DONE : NM_QMP_REQ_FAIL;
+        nm_qmp_pool_unlink(req);
+        pthread_cond_broadcast(&pool_cond);
+        break;
+    }
+}
+
+static void nm_qmp_pool_unlink(nm_qmp_req_t *req)
+{
+    nm_qmp_req_t **pp = &req->conn->pending;
+
+    while (*pp && *pp != req)
+        pp = &(*pp)->next;
+
+    if (*pp)
+        *pp = req->next;
+}
+
+/*
+ * Generic jobs report JOB_STATUS_CHANGE, block jobs also report
+ * BLOCK_JOB_COMPLETED with error, if any. Job id is in "id" or "device".
+ */
+static void nm_qmp_pool_job_event(const nm_qmp_conn_t *conn, const char *event,
+        struct json_object *data)
+{
+    struct json_object *id, *val;
+
+    if (!data || !pool_jobs)
+        return;
+
+    if (!strcmp(event, "JOB_STATUS_CHANGE")) {
+        const char *status;
+
+        if (!json_object_object_get_ex(data, "id", &id) ||
+                !json_object_object_get_ex(data, "status", &val)) {
+            return;
+        }
+
+        /* auto-dismissed job goes from "concluded" to "null" at once */
+        status = json_object_get_string(val);
+        if (!strcmp(status, "concluded") || !strcmp(status, "null")) {
+            nm_qmp_pool_job_set(&conn->name, json_object_get_string(id),
+                    NM_QMP_REQ_DONE, NULL);
+        }
+    } else if (!strcmp(event, "BLOCK_JOB_COMPLETED")) {
+        if (!json_object_object_get_ex(data, "device", &id))
+            return;
+
+        if (json_object_object_get_ex(data, "error", &val)) {
+            nm_qmp_pool_job_set(&conn->name, json_object_get_string(id),
+                    NM_QMP_REQ_FAIL, json_object_get_string(val));
+        } else {
+            nm_qmp_pool_job_set(&conn->name, json_object_get_string(id),
+                    NM_QMP_REQ_DONE, NULL);
+        }
+    }
+}
+
+/*
+ * Must be called with pool_lock held.
+ * Set state of waiting jobs of VM, id NULL matches all of them.
+ */
+static void nm_qmp_pool_job_set(const nm_str_t *name, const char *id,
+        int state, const char *error)
+{
+    bool found = false;
+
+    for (nm_qmp_job_wait_t *wait = pool_jobs; wait; wait = wait->next) {
+        if (wait->state != NM_QMP_REQ_WAIT ||
+                nm_str_cmp_ss(wait->name, name) != NM_OK ||
+                (id && strcmp(wait->id, id) != 0)) {
+            continue;
+        }
+
+        wait->state = state;
+        if (error && wait->error)
+            nm_str_format(wait->error, "%s", error);
+        found = true;
+    }
+
+    if (found)
+        pthread_cond_broadcast(&pool_cond);
+}
+
+static void *nm_qmp_pool_server(void *unused NM_UNUSED)
+{
+    const nm_cfg_t *cfg = nm_cfg_get();
+    pthread_t workers[NM_QMP_POOL_WORKERS];
+    struct sockaddr_un addr;
+    struct pollfd pfd;
+    mode_t mask;
+
+    if (!cfg->daemon_sock.len)
+        return NULL;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    nm_strlcpy(addr.sun_path, cfg->daemon_sock.data, sizeof(addr.sun_path));
+
+    if ((pool_srv_sd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        nm_debug("%s: socket: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+
+    /* socket is left by killed daemon, pid file check passed already */
+    unlink(cfg->daemon_sock.data);
+
+    mask = umask(0077);
+    if (bind(pool_srv_sd, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+            listen(pool_srv_sd, NM_QMP_POOL_BACKLOG) == -1) {
+        nm_debug("%s: cannot listen on %s: %s\n",
+                __func__, cfg->daemon_sock.data, strerror(errno));
+        umask(mask);
+        goto out;
+    }
+    umask(mask);
+
+    for (size_t n = 0; n < NM_QMP_POOL_WORKERS; n++) {
+        if (pthread_create(&workers[n], NULL, nm_qmp_pool_worker, NULL) != 0)
+            nm_bug("%s: cannot create thread", __func__);
+#if defined (NM_OS_LINUX)
+        pthread_setname_np(workers[n], "nemu-qmp-cln");
+#endif
+    }
+
+    pfd.fd = pool_srv_sd;
+    pfd.events = POLLIN;
+
+    while (!pool_stop) {
+        if (poll(&pfd, 1, NM_QMP_POOL_TICK) <= 0)
+            continue;
+
+        nm_qmp_pool_accept();
+    }
+
+    pthread_mutex_lock(&pool_queue_lock);
+    pthread_cond_broadcast(&pool_queue_cond);
+    pthread_mutex_unlock(&pool_queue_lock);
+
+    for (size_t n = 0; n < NM_QMP_POOL_WORKERS; n++)
+        pthread_join(workers[n], NULL);
+
+    /* clients that were not served */
+    for (; pool_queue_len; pool_queue_len--) {
+        close(pool_queue[pool_queue_head]);
+        pool_queue_head = (pool_queue_head + 1) % NM_QMP_POOL_QUEUE;
+    }
+
+    unlink(cfg->daemon_sock.data);
+out:
+    close(pool_srv_sd);
+    pool_srv_sd = -1;
+
+    return NULL;
+}
+
+/* Queue accepted client, wait for a free slot if all workers are busy */
+static void nm_qmp_pool_accept(void)
+{
+    int sd;
+
+    if ((sd = accept(pool_srv_sd, NULL, NULL)) == -1)
+        return;
+
+    pthread_mutex_lock(&pool_queue_lock);
+    while (pool_queue_len == NM_QMP_POOL_QUEUE && !pool_stop) {
+        struct timespec ts;
+
+        nm_qmp_pool_deadline(&ts, NM_QMP_POOL_TICK);
+        pthread_cond_timedwait(&pool_queue_cond, &pool_queue_lock, &ts);
+    }
+
+    if (pool_queue_len < NM_QMP_POOL_QUEUE) {
+        pool_queue[(pool_queue_head + pool_queue_len) % NM_QMP_POOL_QUEUE] = sd;
+        pool_queue_len++;
+        pthread_cond_broadcast(&pool_queue_cond);
+    } else {
+        close(sd);
+    }
+    pthread_mutex_unlock(&pool_queue_lock);
+}
+
+static void *nm_qmp_pool_worker(void *unused NM_UNUSED)
+{
+    for (;;) {
+        int sd;
+
+        pthread_mutex_lock(&pool_queue_lock);
+        while (!pool_queue_len && !pool_stop) {
+            struct timespec ts;
+
+            nm_qmp_pool_deadline(&ts, NM_QMP_POOL_TICK);
+            pthread_cond_timedwait(&pool_queue_cond, &pool_queue_lock, &ts);
+        }
+
+        if (pool_stop) {
+            pthread_mutex_unlock(&pool_queue_lock);
+            break;
+        }
+
+        sd = pool_queue[pool_queue_head];
+        pool_queue_head = (pool_queue_head + 1) % NM_QMP_POOL_QUEUE;
+        pool_queue_len--;
+        /* server may wait for a free slot */
+        pthread_cond_broadcast(&pool_queue_cond);
+        pthread_mutex_unlock(&pool_queue_lock);
+
+        nm_qmp_pool_client(sd);
+    }
+
+    return NULL;
+}
+
+static void nm_qmp_pool_client(int sd)
+{
+    struct json_object *req, *vm, *tmo, *cmd;
+    nm_qmp_reader_t reader;
+    nm_str_t reply = NM_INIT_STR;
+    nm_str_t name = NM_INIT_STR;
+
+    nm_qmp_reader_init(&reader);
+
+    if ((req = nm_qmp_pool_recv(sd, &reader, NM_QMP_POOL_REQ_TMO)) == NULL)
+        goto out;
+
+    if (!json_object_object_get_ex(req, "vm", &vm) ||
+            !json_object_object_get_ex(req, "timeout", &tmo) ||
+            !json_object_object_get_ex(req, "cmd", &cmd)) {
+        nm_debug("%s: malformed request: %s\n", __func__,
+                json_object_to_json_string(req));
+        goto out;
+    }
+
+    nm_str_alloc_text(&name, json_object_get_string(vm));
+
+    if (nm_qmp_pool_exec(&name, json_object_to_json_string_ext(cmd,
+                    JSON_C_TO_STRING_PLAIN),
+                json_object_get_int(tmo), &reply) != NM_OK && !reply.len) {
+        nm_str_format(&reply, "{\"error\":{\"class\":\"GenericError\","
+                "\"desc\":\"no answer from %s\"}}", name.data);
+    }
+
+    nm_str_add_char(&reply, '\n');
+    nm_qmp_pool_write(sd, reply.data, reply.len, NM_QMP_POOL_REQ_TMO);
+
+out:
+    if (req)
+        json_object_put(req);
+    close(sd);
+    nm_qmp_reader_free(&reader);
+    nm_str_free(&reply);
+    nm_str_free(&name);
+}
+
+/*
+ * Read one complete JSON message.
+ * Data after it is left in reader for the next call.
+ */
+static struct json_object *nm_qmp_pool_recv(int sd, nm_qmp_reader_t *r,
+        int timeout)
+{
+    char chunk[NM_QMP_POOL_READLEN];
+    struct json_object *obj;
+
+    while ((obj = nm_qmp_reader_next(r)) == NULL) {
+        ssize_t nread;
+
+        if (nm_qmp_pool_wait(sd, POLLIN, timeout) != NM_OK)
+            return NULL;
+
+        if ((nread = read(sd, chunk, sizeof(chunk))) <= 0) {
+            if (nread == -1 && (errno == EAGAIN || errno == EINTR))
+                continue;
+            return NULL;
+        }
+
+        nm_qmp_reader_feed(r, chunk, nread);
+    }
+
+    return obj;
+}
+
+static int nm_qmp_pool_write(int sd, const char *data, size_t len, int timeout)
+{
+    while (len) {
+        ssize_t nwrite = send(sd, data, len, MSG_NOSIGNAL);
+
+        if (nwrite == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN || nm_qmp_pool_wait(sd, POLLOUT, timeout) != NM_OK)
+                return NM_ERR;
+            continue;
+        }
+
+        data += nwrite;
+        len -= nwrite;
+    }
+
+    return NM_OK;
+}
+
+static int nm_qmp_pool_wait(int sd, short events, int timeout)
+{
+    struct pollfd pfd = { .fd = sd, .events = events };
+    int rc;
+
+    while ((rc = poll(&pfd, 1, timeout)) == -1 && errno == EINTR)
+        ;
+
+    return (rc > 0) ? NM_OK : NM_ERR;
+}
+
+/* Must be called with pool_lock held */
+static void nm_qmp_pool_account(const struct timespec *start, int rc)
+{
+    struct timespec now;
+    double elapsed;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - start->tv_sec) +
+        (now.tv_nsec - start->tv_nsec) / 1e9;
+
+    pool_stats.count++;
+    pool_stats.sum += elapsed;
+    if (rc != NM_OK)
+        pool_stats.errors++;
+
+    for (size_t n = 0; n < NM_QMP_POOL_BUCKETS; n++) {
+        if (elapsed <= nm_qmp_pool_bounds[n])
+            pool_stats.bucket[n]++;
+    }
+}
+
+static void nm_qmp_pool_deadline(struct timespec *ts, int timeout)
+{
+    clock_gettime(CLOCK_REALTIME, ts);
+
+    ts->tv_sec += timeout / 1000;
+    ts->tv_nsec += (long) (timeout % 1000) * 1000000L;
+
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+/* vim:set ts=4 sw=4: */
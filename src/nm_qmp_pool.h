@@ -0,0 +1,52 @@
+#ifndef NM_QMP_POOL_H_
+#define NM_QMP_POOL_H_
+
+#include <nm_string.h>
+
+struct json_object;
+
+enum {
+    NM_QMP_POOL_NOCONN = 1 /* monitor daemon is not available */
+};
+
+enum {
+    NM_QMP_POOL_BUCKETS = 7
+};
+
+/* upper bounds of command latency histogram, seconds */
+static const double nm_qmp_pool_bounds[NM_QMP_POOL_BUCKETS] = {
+    0.001, 0.005, 0.025, 0.1, 0.5, 2.5, 10
+};
+
+typedef struct {
+    uint64_t count;   /* executed commands */
+    uint64_t errors;  /* error replies and timeouts */
+    double sum;       /* seconds */
+    uint64_t bucket[NM_QMP_POOL_BUCKETS]; /* cumulative, as in Prometheus */
+} nm_qmp_pool_stats_t;
+
+/* pseudo event, QMP connection is closed (QEMU exited) */
+static const char NM_QMP_POOL_EV_CLOSED[] = "NEMU_CLOSED";
+
+/*
+ * QMP event handler. Called by pool I/O thread with pool locked,
+ * must not call nm_qmp_pool_* functions. data may be NULL.
+ */
+typedef void (*nm_qmp_pool_event_cb_t)(const nm_str_t *name,
+        const char *event, struct json_object *data);
+
+void nm_qmp_pool_init(void);
+void nm_qmp_pool_free(void);
+int nm_qmp_pool_active(void);
+int nm_qmp_pool_exec(const nm_str_t *name, const char *cmd,
+        int timeout, nm_str_t *reply);
+int nm_qmp_pool_request(const nm_str_t *name, const char *cmd,
+        int timeout, nm_str_t *reply);
+int nm_qmp_pool_exec_job(const nm_str_t *name, const char *cmd,
+        const char *jobid, int timeout, int job_timeout, nm_str_t *error);
+int nm_qmp_pool_attach(const nm_str_t *name);
+void nm_qmp_pool_set_event_cb(nm_qmp_pool_event_cb_t cb);
+void nm_qmp_pool_get_stats(nm_qmp_pool_stats_t *stats);
+
+#endif /* NM_QMP_POOL_H_ */
+/* vim:set ts=4 sw=4: */
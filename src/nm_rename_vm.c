@@ -93,76 +93,56 @@ out:
 
 static void nm_rename_vm_in_db(const nm_vmctl_data_t *vm, const nm_str_t *new_name)
 {
-    nm_str_t query = NM_INIT_STR;
     nm_str_t buf_1 = NM_INIT_STR;
     nm_str_t buf_2 = NM_INIT_STR;
-    nm_str_t *old_name = nm_vect_str(&vm->main, NM_SQL_NAME);
+    const nm_str_t *old_name = nm_db_res_str(&vm->main, NM_SQL_NAME);
+    nm_db_stmt_t *stmt;
 
     size_t count = 0;
 
+    // Update vms, vm_name in other tables follows by ON UPDATE CASCADE
+    stmt = nm_db_stmt(NM_STMT_RENAME_VM);
+    nm_db_bind_text(stmt, 1, old_name->data);
+    nm_db_bind_text(stmt, 2, new_name->data);
+    nm_db_stmt_exec(stmt);
+
     // Update drives
     count = vm->drives.n_memb / NM_DRV_IDX_COUNT;
     for (size_t i = 0; i < count; i++) {
         size_t idx_shift = NM_DRV_IDX_COUNT * i;
-        nm_str_t *old_drive_name = nm_vect_str(&vm->drives, NM_SQL_DRV_NAME + idx_shift);
+        const nm_str_t *old_drive_name = nm_db_res_str(&vm->drives, NM_SQL_DRV_NAME + idx_shift);
 
         nm_str_copy(&buf_1, old_drive_name);
         nm_str_replace_text(&buf_1, old_name->data, new_name->data);
 
-        nm_str_format(&query,
-            "UPDATE drives SET vm_name = '%s', drive_name = '%s' "
-                "WHERE vm_name = '%s' AND drive_name = '%s'",
-            new_name->data, buf_1.data,
-            old_name->data, old_drive_name->data);
-        nm_db_atomic(query.data);
+        stmt = nm_db_stmt(NM_STMT_RENAME_DRIVE);
+        nm_db_bind_text(stmt, 1, new_name->data);
+        nm_db_bind_text(stmt, 2, old_drive_name->data);
+        nm_db_bind_text(stmt, 3, buf_1.data);
+        nm_db_stmt_exec(stmt);
     }
 
     // Update ifaces
     count = vm->ifs.n_memb / NM_IFS_IDX_COUNT;
     for (size_t i = 0; i < count; i++) {
         size_t idx_shift = NM_IFS_IDX_COUNT * i;
-        nm_str_t *old_iface_name = nm_vect_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift);
-        nm_str_t *old_iface_altname = nm_vect_str(&vm->ifs, NM_SQL_IF_ALT + idx_shift);
+        const nm_str_t *old_iface_name = nm_db_res_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift);
+        const nm_str_t *old_iface_altname = nm_db_res_str(&vm->ifs, NM_SQL_IF_ALT + idx_shift);
 
         nm_str_copy(&buf_1, old_iface_name);
         nm_str_replace_text(&buf_1, old_name->data, new_name->data);
         nm_str_copy(&buf_2, old_iface_altname);
         nm_str_replace_text(&buf_2, old_name->data, new_name->data);
 
-        nm_str_format(&query,
-            "UPDATE ifaces SET vm_name = '%s', if_name = '%s', altname = '%s' "
-                "WHERE if_name = '%s'",
-            new_name->data,
-            buf_1.data,
-            buf_2.data,
-            old_iface_name->data);
-        nm_db_atomic(query.data);
+        stmt = nm_db_stmt(NM_STMT_RENAME_IFACE);
+        nm_db_bind_text(stmt, 1, old_iface_name->data);
+        nm_db_bind_text(stmt, 2, buf_1.data);
+        nm_db_bind_text(stmt, 3, buf_2.data);
+        nm_db_stmt_exec(stmt);
     }
 
-    // Update usb
-    nm_str_format(&query,
-        "UPDATE usb SET vm_name = '%s' WHERE vm_name = '%s'",
-        new_name->data,
-        old_name->data);
-    nm_db_atomic(query.data);
-
-    // Update vmsnapshots
-    nm_str_format(&query,
-        "UPDATE vmsnapshots SET vm_name = '%s' WHERE vm_name = '%s'",
-        new_name->data,
-        old_name->data);
-    nm_db_atomic(query.data);
-
-    // Update vms
-    nm_str_format(&query,
-        "UPDATE vms SET name = '%s' WHERE name = '%s'",
-        new_name->data,
-        old_name->data);
-    nm_db_atomic(query.data);
-
     nm_str_free(&buf_1);
     nm_str_free(&buf_2);
-    nm_str_free(&query);
 }
 
 //@TODO Make atomic? (copy on rename/track changes and undo on fail)
@@ -176,7 +156,7 @@ static void nm_rename_vm_in_fs(const nm_vmctl_data_t *vm, const nm_str_t *new_na
     size_t drives_count;
     struct stat stats;
 
-    const nm_str_t *old_name = nm_vect_str(&vm->main, NM_SQL_NAME);
+    const nm_str_t *old_name = nm_db_res_str(&vm->main, NM_SQL_NAME);
 
     nm_str_format(&old_vm_dir, "%s/%s",
         nm_cfg_get()->vm_dir.data, old_name->data);
@@ -195,7 +175,7 @@ static void nm_rename_vm_in_fs(const nm_vmctl_data_t *vm, const nm_str_t *new_na
     for (size_t i = 0; i < drives_count; i++)
     {
         size_t idx_shift = NM_DRV_IDX_COUNT * i;
-        nm_str_t *old_drive_name = nm_vect_str(&vm->drives, NM_SQL_DRV_NAME + idx_shift);
+        const nm_str_t *old_drive_name = nm_db_res_str(&vm->drives, NM_SQL_DRV_NAME + idx_shift);
 
         nm_str_format(&old_path, "%s/%s", new_vm_dir.data, old_drive_name->data);
 
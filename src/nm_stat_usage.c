@@ -1,145 +1,351 @@
 #include <nm_core.h>
+#include <nm_utils.h>
 #include <nm_string.h>
 #include <nm_stat_usage.h>
 
+#include <time.h>
+
+/*
+ * Resource usage sampler.
+ * /proc/stat and /proc/<pid>/{stat,statm,io} of every watched process
+ * are kept open and reread with one pread(2) per file, previous values
+ * are stored per process. One nm_stat_sample() call updates all
+ * watched processes, /proc/stat is read once per sample.
+ */
 
 enum {
-    NM_STAT_BUF_LEN = 512,
-    NM_STAT_RES_LEN = 12,
+    NM_STAT_BUF_LEN = 1024,
+    NM_STAT_UTIME_FIELD = 14, /* see proc(5) */
+    NM_STAT_START_FIELD = 22,
+    NM_STAT_CPU_FIELDS = 8    /* user nice system idle iowait irq softirq steal */
 };
 
 static const char NM_STAT_PATH[] = "/proc/stat";
 
-uint64_t nm_total_cpu_before;
-uint64_t nm_total_cpu_after;
-uint64_t nm_proc_cpu_before;
-uint64_t nm_proc_cpu_after;
-uint8_t  nm_cpu_iter;
-double   nm_cpu_usage;
-
-static void nm_stat_cpu_total_time(void)
+typedef struct {
+    int pid;
+    int fd_stat;
+    int fd_statm;
+    int fd_io;
+    uint64_t proc_ticks;  /* previous sample */
+    uint64_t total_ticks;
+    int64_t time_ms;
+    bool sampled;
+    nm_stat_t stat;
+} nm_stat_proc_t;
+
+static nm_stat_proc_t *nm_stat_list = NULL;
+static size_t nm_stat_count = 0;
+static size_t nm_stat_alloc = 0;
+static int nm_stat_fd = -1;
+static long nm_stat_ncpu = 1;
+static long nm_stat_pagesize = 4096;
+static long nm_stat_hz = 100;
+
+static nm_stat_proc_t *nm_stat_find(int pid);
+static void nm_stat_remove(nm_stat_proc_t *proc);
+static ssize_t nm_stat_read(int fd, char *buf, size_t len);
+static char *nm_stat_field(char *buf, int field);
+static int nm_stat_total_ticks(uint64_t *ticks);
+static int nm_stat_update(nm_stat_proc_t *proc, uint64_t total, int64_t now);
+
+void nm_stat_watch(int pid)
 {
-    int fd, space_num = 0;
-    char buf[NM_STAT_BUF_LEN] = {0};
-    char buf_time[NM_STAT_RES_LEN] = {0};
-    size_t nread = 0;
-    char ch;
-    char *token_b = NULL, *token_e = NULL;
-    uint64_t res = 0;
-
-    if ((fd = open(NM_STAT_PATH, O_RDONLY)) == -1)
+    nm_str_t path = NM_INIT_STR;
+    nm_stat_proc_t *proc;
+
+    if (pid <= 0 || nm_stat_find(pid))
         return;
 
-    while ((read(fd, &ch, 1) > 0) && ch != '\n') {
-        buf[nread] = ch;
-        nread++;
+    if (nm_stat_fd == -1) {
+        if ((nm_stat_fd = open(NM_STAT_PATH, O_RDONLY | O_CLOEXEC)) == -1) {
+            nm_debug("%s: cannot open %s: %s\n",
+                    __func__, NM_STAT_PATH, strerror(errno));
+            return;
+        }
+        if ((nm_stat_ncpu = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+            nm_stat_ncpu = 1;
+        if ((nm_stat_pagesize = sysconf(_SC_PAGESIZE)) < 1)
+            nm_stat_pagesize = 4096;
+        if ((nm_stat_hz = sysconf(_SC_CLK_TCK)) < 1)
+            nm_stat_hz = 100;
     }
 
-    for (size_t n = 0; n < nread; n++) {
-        if (buf[n] == 0x20)
-            space_num++;
-        else
-            continue;
+    if (nm_stat_count == nm_stat_alloc) {
+        nm_stat_alloc = nm_stat_alloc ? nm_stat_alloc * 2 : 16;
+        nm_stat_list = nm_realloc(nm_stat_list,
+                sizeof(nm_stat_proc_t) * nm_stat_alloc);
+    }
 
-        if (space_num == 2) {
-            token_b = buf + n + 1;
-        }
+    proc = &nm_stat_list[nm_stat_count];
+    memset(proc, 0, sizeof(*proc));
+    proc->pid = pid;
+    proc->stat = NM_INIT_STAT;
 
-        if (space_num > 2) {
-            token_e = buf + n;
-            memcpy(buf_time, token_b, token_e - token_b);
-            res += nm_str_ttoul(buf_time, 10);
-            token_b = token_e + 1;
-            memset(buf_time, 0, sizeof(buf_time));
-        }
+    nm_str_format(&path, "/proc/%d/stat", pid);
+    proc->fd_stat = open(path.data, O_RDONLY | O_CLOEXEC);
+    nm_str_format(&path, "/proc/%d/statm", pid);
+    proc->fd_statm = open(path.data, O_RDONLY | O_CLOEXEC);
+    /* io is readable only for processes of the same user */
+    nm_str_format(&path, "/proc/%d/io", pid);
+    proc->fd_io = open(path.data, O_RDONLY | O_CLOEXEC);
+    nm_str_free(&path);
 
-        if (space_num == 6)
-            break;
+    if (proc->fd_stat == -1) {
+        if (proc->fd_statm != -1)
+            close(proc->fd_statm);
+        if (proc->fd_io != -1)
+            close(proc->fd_io);
+        return;
     }
 
-    if (nm_cpu_iter)
-        nm_total_cpu_after = res;
-    else
-        nm_total_cpu_before = res;
+    nm_stat_count++;
+}
 
-    close(fd);
+void nm_stat_unwatch(int pid)
+{
+    nm_stat_proc_t *proc;
+
+    if ((proc = nm_stat_find(pid)) != NULL)
+        nm_stat_remove(proc);
 }
 
-static void nm_stat_cpu_proc_time(int pid)
+/* Refresh all watched processes. Exited processes are removed. */
+void nm_stat_sample(void)
 {
-    int fd, space_num = 0;
-    ssize_t nread;
-    char buf[NM_STAT_BUF_LEN] = {0};
-    char buf_time[NM_STAT_RES_LEN] = {0};
-    char *token_b = NULL, *token_e = NULL;
-    uint64_t utime = 0, stime = 0;
+    uint64_t total;
+    int64_t now;
+
+    if (!nm_stat_count || nm_stat_total_ticks(&total) != NM_OK)
+        return;
+
+    now = nm_mono_ms();
+
+    for (size_t n = 0; n < nm_stat_count;) {
+        if (nm_stat_update(&nm_stat_list[n], total, now) != NM_OK) {
+            nm_stat_remove(&nm_stat_list[n]);
+            continue; /* last entry was moved here */
+        }
+        n++;
+    }
+}
+
+/* Get result of the last sample. Returns NM_ERR if pid is not watched. */
+int nm_stat_get(int pid, nm_stat_t *stat)
+{
+    nm_stat_proc_t *proc;
+
+    if ((proc = nm_stat_find(pid)) == NULL)
+        return NM_ERR;
+
+    *stat = proc->stat;
+
+    return NM_OK;
+}
+
+/*
+ * CPU usage of one process since the previous call for it.
+ * The first call starts watching the process and returns 0.
+ */
+double nm_stat_get_usage(int pid)
+{
+    nm_stat_proc_t *proc;
+    uint64_t total;
+
+    nm_stat_watch(pid);
+
+    if ((proc = nm_stat_find(pid)) == NULL ||
+            nm_stat_total_ticks(&total) != NM_OK)
+        return 0;
+
+    if (nm_stat_update(proc, total, nm_mono_ms()) != NM_OK) {
+        nm_stat_remove(proc);
+        return 0;
+    }
+
+    return proc->stat.cpu;
+}
+
+/*
+ * Seconds since start of the process, -1 on error.
+ * starttime in /proc/<pid>/stat is counted from boot.
+ */
+double nm_stat_age(int pid)
+{
+    char buf[NM_STAT_BUF_LEN];
     nm_str_t path = NM_INIT_STR;
+    struct timespec ts;
+    double age = -1;
+    long hz;
+    char *ptr;
+    int fd;
 
     nm_str_format(&path, "/proc/%d/stat", pid);
+    fd = open(path.data, O_RDONLY | O_CLOEXEC);
+    nm_str_free(&path);
+
+    if (fd == -1)
+        return -1;
+
+    if (nm_stat_read(fd, buf, sizeof(buf)) > 0 &&
+            (ptr = nm_stat_field(buf, NM_STAT_START_FIELD)) != NULL &&
+            clock_gettime(CLOCK_BOOTTIME, &ts) == 0) {
+        if ((hz = sysconf(_SC_CLK_TCK)) < 1)
+            hz = 100;
+        age = ts.tv_sec + ts.tv_nsec / 1e9 -
+            (double) strtoull(ptr, NULL, 10) / hz;
+    }
 
-    if ((fd = open(path.data, O_RDONLY)) == -1)
-        goto out;
+    close(fd);
 
-    if ((nread = read(fd, buf, sizeof(buf))) <= 0)
-        goto out;
+    return age;
+}
 
-    buf[nread - 1] = '\0';
+void nm_stat_clean(void)
+{
+    while (nm_stat_count)
+        nm_stat_remove(&nm_stat_list[nm_stat_count - 1]);
 
-    for (ssize_t n = 0; n < nread; n++) {
-        if (buf[n] == 0x20)
-            space_num++;
-        else
-            continue;
+    free(nm_stat_list);
+    nm_stat_list = NULL;
+    nm_stat_alloc = 0;
 
-        if (space_num == 13) {
-            token_b = buf + n + 1;
-        }
+    if (nm_stat_fd != -1) {
+        close(nm_stat_fd);
+        nm_stat_fd = -1;
+    }
+}
 
-        if (space_num == 14) {
-            token_e = buf + n;
-            memcpy(buf_time, token_b, token_e - token_b);
-            utime = nm_str_ttoul(buf_time, 10);
-            token_b = token_e + 1;
-            memset(buf_time, 0, sizeof(buf_time));
-        }
+static nm_stat_proc_t *nm_stat_find(int pid)
+{
+    for (size_t n = 0; n < nm_stat_count; n++) {
+        if (nm_stat_list[n].pid == pid)
+            return &nm_stat_list[n];
+    }
 
-        if (space_num == 15) {
-            token_e = buf + n;
-            memcpy(buf_time, token_b, token_e - token_b);
-            stime = nm_str_ttoul(buf_time, 10);
-            break;
-        }
+    return NULL;
+}
+
+static void nm_stat_remove(nm_stat_proc_t *proc)
+{
+    close(proc->fd_stat);
+    if (proc->fd_statm != -1)
+        close(proc->fd_statm);
+    if (proc->fd_io != -1)
+        close(proc->fd_io);
+
+    *proc = nm_stat_list[--nm_stat_count];
+}
+
+static ssize_t nm_stat_read(int fd, char *buf, size_t len)
+{
+    ssize_t nread;
+
+    while ((nread = pread(fd, buf, len - 1, 0)) == -1 && errno == EINTR)
+        ;
+
+    buf[(nread > 0) ? nread : 0] = '\0';
+
+    return nread;
+}
+
+/* Field of /proc/<pid>/stat, numbered from 1 as in proc(5) */
+static char *nm_stat_field(char *buf, int field)
+{
+    char *ptr;
+
+    /* command name may contain spaces, fields are counted after it */
+    if ((ptr = strrchr(buf, ')')) == NULL)
+        return NULL;
+
+    ptr++;
+    for (int n = 3; n < field; n++) {
+        if ((ptr = strchr(ptr + 1, ' ')) == NULL)
+            return NULL;
     }
 
-    close(fd);
+    return ptr;
+}
 
-    if (nm_cpu_iter)
-        nm_proc_cpu_after = utime + stime;
-    else
-        nm_proc_cpu_before = utime + stime;
+/* Sum of the first line of /proc/stat: "cpu  user nice system idle ..." */
+static int nm_stat_total_ticks(uint64_t *ticks)
+{
+    char buf[NM_STAT_BUF_LEN];
+    char *ptr = buf + 3;
 
-out:
-    nm_str_free(&path);
+    if (nm_stat_fd == -1 || nm_stat_read(nm_stat_fd, buf, sizeof(buf)) <= 3)
+        return NM_ERR;
+
+    *ticks = 0;
+    for (size_t n = 0; n < NM_STAT_CPU_FIELDS; n++) {
+        char *end;
+        uint64_t val = strtoull(ptr, &end, 10);
+
+        if (end == ptr)
+            break;
+
+        *ticks += val;
+        ptr = end;
+    }
+
+    return NM_OK;
 }
 
-double nm_stat_get_usage(int pid)
+static int nm_stat_update(nm_stat_proc_t *proc, uint64_t total, int64_t now)
 {
-    double pa, pb, ta, tb;
+    char buf[NM_STAT_BUF_LEN];
+    uint64_t utime, stime, ticks, rd = 0, wr = 0;
+    char *ptr;
+
+    if (nm_stat_read(proc->fd_stat, buf, sizeof(buf)) <= 0)
+        return NM_ERR; /* process has exited */
+
+    if ((ptr = nm_stat_field(buf, NM_STAT_UTIME_FIELD)) == NULL)
+        return NM_ERR;
+
+    utime = strtoull(ptr, &ptr, 10);
+    stime = strtoull(ptr, NULL, 10);
+    ticks = utime + stime;
+    proc->stat.cpu_time = (double) ticks / nm_stat_hz;
+
+    if (proc->fd_statm != -1 &&
+            nm_stat_read(proc->fd_statm, buf, sizeof(buf)) > 0) {
+        /* size resident shared ... in pages */
+        strtoull(buf, &ptr, 10);
+        proc->stat.rss = strtoull(ptr, NULL, 10) * nm_stat_pagesize;
+    }
 
-    nm_stat_cpu_total_time();
-    nm_stat_cpu_proc_time(pid);
+    if (proc->fd_io != -1 && nm_stat_read(proc->fd_io, buf, sizeof(buf)) > 0) {
+        if ((ptr = strstr(buf, "\nread_bytes: ")) != NULL)
+            rd = strtoull(ptr + 13, NULL, 10);
+        if ((ptr = strstr(buf, "\nwrite_bytes: ")) != NULL)
+            wr = strtoull(ptr + 14, NULL, 10);
+    }
 
-    pa = (double)nm_proc_cpu_after;
-    pb = (double)nm_proc_cpu_before;
-    ta = (double)nm_total_cpu_after;
-    tb = (double)nm_total_cpu_before;
+    if (proc->sampled) {
+        int64_t dt = now - proc->time_ms;
 
-    if (nm_cpu_iter)
-        nm_cpu_usage = ((pa - pb) / (ta - tb)) * 100.0 * (double)sysconf(_SC_NPROCESSORS_ONLN);
+        if (total > proc->total_ticks) {
+            proc->stat.cpu = (double) (ticks - proc->proc_ticks) /
+                (double) (total - proc->total_ticks) * 100.0 * nm_stat_ncpu;
+        }
+
+        if (dt > 0) {
+            proc->stat.rd_rate = (double) (rd - proc->stat.rd_bytes) * 1000 / dt;
+            proc->stat.wr_rate = (double) (wr - proc->stat.wr_bytes) * 1000 / dt;
+        }
+
+        proc->stat.ready = true;
+    }
 
-    nm_cpu_iter ^= 1;
+    proc->proc_ticks = ticks;
+    proc->total_ticks = total;
+    proc->time_ms = now;
+    proc->stat.rd_bytes = rd;
+    proc->stat.wr_bytes = wr;
+    proc->sampled = true;
 
-    return nm_cpu_usage;
+    return NM_OK;
 }
 
 /* vim:set ts=4 sw=4: */
@@ -2,18 +2,28 @@
 #define NM_STAT_USAGE_H_
 
 #include <stdint.h>
+#include <stdbool.h>
 
-extern uint64_t nm_total_cpu_before;
-extern uint64_t nm_total_cpu_after;
-extern uint64_t nm_proc_cpu_before;
-extern uint64_t nm_proc_cpu_after;
-extern uint8_t  nm_cpu_iter;
-extern double   nm_cpu_usage;
+typedef struct {
+    double cpu;         /* percent, 100% per host CPU */
+    double cpu_time;    /* user + system seconds since start */
+    uint64_t rss;       /* bytes */
+    uint64_t rd_bytes;  /* bytes read from storage since start */
+    uint64_t wr_bytes;  /* bytes written to storage since start */
+    double rd_rate;     /* bytes per second */
+    double wr_rate;     /* bytes per second */
+    bool ready;         /* cpu and rates are known after second sample */
+} nm_stat_t;
 
-#define NM_STAT_CLEAN() nm_total_cpu_before = nm_total_cpu_after = \
-    nm_proc_cpu_before = nm_proc_cpu_after = nm_cpu_iter = nm_cpu_usage = 0;
+#define NM_INIT_STAT (nm_stat_t) { 0, 0, 0, 0, 0, 0, 0, false }
 
+void nm_stat_watch(int pid);
+void nm_stat_unwatch(int pid);
+void nm_stat_sample(void);
+int nm_stat_get(int pid, nm_stat_t *stat);
 double nm_stat_get_usage(int pid);
+double nm_stat_age(int pid);
+void nm_stat_clean(void);
 
 #endif /* NM_STAT_USAGE_H_ */
 /* vim:set ts=4 sw=4: */
@@ -5,81 +5,55 @@
 /* Disable USB on FreeBSD while libudev-devd
  * will not supports calls udev_hwdb_* */
 
-enum {NM_USB_SERIAL_LEN = 127};
+/*
+ * USB device registry.
+ * Devices are enumerated through udev once, then the list is kept
+ * up to date by udev monitor events, which are read on every request.
+ * Names, ids and serials come from udev database and sysfs, devices
+ * are never opened. Entries are keyed by sysfs name (bus-port path,
+ * e.g. 1-1.2), the serial is read once per entry.
+ */
 
 static inline void nm_usb_dev_free(nm_usb_dev_t *dev);
 
 #if defined (NM_OS_LINUX)
 #include <libudev.h>
-#include <libusb.h>
 
+typedef struct {
+    nm_str_t sysname;
+    nm_str_t serial;
+    nm_usb_dev_t dev;
+} nm_usb_entry_t;
+
+static void nm_usb_reg_init(void);
+static void nm_usb_reg_scan(void);
+static nm_usb_entry_t *nm_usb_reg_find(const char *sysname);
+static nm_usb_entry_t *nm_usb_reg_add(struct udev_device *device);
+static void nm_usb_reg_notify(const nm_usb_entry_t *entry, bool added,
+        nm_usb_event_cb_t cb, void *ctx);
+static void nm_usb_reg_remove(const char *sysname);
+static void nm_usb_reg_clear(void);
 static const char *nm_usb_hwdb_get(const char *modalias, const char *key);
 static const char *nm_usb_get_vendor(uint16_t vid);
 static const char *nm_usb_get_product(uint16_t vid, uint16_t pid);
 static int nm_usb_get_vendor_str(char *buf, size_t size, uint16_t vid);
 static int nm_usb_get_product_str(char *buf, size_t size, uint16_t vid, uint16_t pid);
 
+static struct udev *udev = NULL;
 static struct udev_hwdb *hwdb = NULL;
+static struct udev_monitor *usb_mon = NULL;
+static nm_usb_entry_t *usb_reg = NULL;
+static size_t usb_reg_count = 0;
+static size_t usb_reg_alloc = 0;
 #endif /* NM_OS_LINUX */
 
 void nm_usb_get_devs(nm_vect_t *v)
 {
 #if defined (NM_OS_LINUX)
-    libusb_context *ctx = NULL;
-    libusb_device **list = NULL;
-    struct udev *udev = NULL;
-    int rc;
-    ssize_t dev_count, n;
-    char vendor[128], product[128];
-
-    if ((udev = udev_new()) == NULL)
-        nm_bug(_("%s: udev_new failed"), __func__);
-
-    if ((hwdb = udev_hwdb_new(udev)) == NULL)
-        nm_bug(_("%s: udev_hwdb_new failed"), __func__);
-
-    if ((rc = libusb_init(&ctx)) != 0)
-        nm_bug("%s: %s", __func__, libusb_strerror(rc));
-
-    if ((dev_count = libusb_get_device_list(ctx, &list)) < 1)
-        nm_bug(_("%s: libusb_get_device_list failed"), __func__);
-
-    //@TODO Some of variables may be moved outside, and freed only once
-    for (n = 0; n < dev_count; n++) {
-        nm_usb_dev_t dev = NM_INIT_USB;
-        libusb_device *device = list[n];
-        struct libusb_device_descriptor desc;
-
-        memset(&desc, 0, sizeof(desc));
-
-        if (libusb_get_device_descriptor(device, &desc) != 0)
-            continue;
-
-        if (nm_usb_get_vendor_str(vendor, sizeof(vendor), desc.idVendor) == 0)
-            nm_str_alloc_text(&dev.name, "vendor-unknown");
-        else
-            nm_str_alloc_text(&dev.name, vendor);
+    nm_usb_registry_update(NULL, NULL);
 
-        if (nm_usb_get_product_str(product, sizeof(product), desc.idVendor, desc.idProduct) == 0)
-            nm_str_add_text(&dev.name, " product-unknown");
-        else
-            nm_str_add_text(&dev.name, product);
-
-        dev.bus_num = libusb_get_bus_number(device);
-        dev.dev_addr = libusb_get_device_address(device);
-
-        nm_str_format(&dev.vendor_id, "%04x", desc.idVendor);
-        nm_str_format(&dev.product_id, "%04x", desc.idProduct);
-
-        nm_vect_insert(v, &dev, sizeof(dev), nm_usb_vect_ins_cb);
-        nm_usb_dev_free(&dev);
-    }
-
-    /* cleanup */
-    libusb_free_device_list(list, 1);
-    udev_hwdb_unref(hwdb);
-    udev_unref(udev);
-    libusb_exit(ctx);
+    for (size_t n = 0; n < usb_reg_count; n++)
+        nm_vect_insert(v, &usb_reg[n].dev, sizeof(nm_usb_dev_t), nm_usb_vect_ins_cb);
 #else
     (void) v;
 #endif /* NM_OS_LINUX */
@@ -89,62 +63,109 @@ int nm_usb_get_serial(const nm_usb_dev_t *dev, nm_str_t *serial)
 {
     int rc = NM_ERR;
 #if defined (NM_OS_LINUX)
-    libusb_context *ctx = NULL;
-    libusb_device **list = NULL;
-    int usb_rc;
-    ssize_t dev_count;
-
     if (dev == NULL)
         nm_bug(_("%s: null nm_usb_dev_t pointer"), __func__);
 
-    if ((usb_rc = libusb_init(&ctx)) != 0)
-        nm_bug("%s: %s", __func__, libusb_strerror(usb_rc));
-
-    if ((dev_count = libusb_get_device_list(ctx, &list)) < 1)
-        nm_bug(_("%s: libusb_get_device_list failed"), __func__);
+    nm_usb_registry_update(NULL, NULL);
 
-    for (ssize_t n = 0; n < dev_count; n++) {
-        uint8_t bus_num, dev_addr;
-        libusb_device *device = list[n];
+    for (size_t n = 0; n < usb_reg_count; n++) {
+        const nm_usb_entry_t *entry = &usb_reg[n];
 
-        bus_num = libusb_get_bus_number(device);
-        dev_addr = libusb_get_device_address(device);
+        if ((entry->dev.bus_num == dev->bus_num) &&
+            (entry->dev.dev_addr == dev->dev_addr)) {
+            if (entry->serial.len) {
+                nm_str_alloc_text(serial, entry->serial.data);
+                rc = NM_OK;
+            }
+            break;
+        }
+    }
+#else
+    (void) dev;
+    (void) serial;
+#endif /* NM_OS_LINUX */
 
-        if ((bus_num == dev->bus_num) &&
-            (dev_addr == dev->dev_addr)) {
-            libusb_device_handle *handle;
-            char serial_buf[NM_USB_SERIAL_LEN] = {0};
-            struct libusb_device_descriptor desc;
+    return rc;
+}
 
-            memset(&desc, 0, sizeof(desc));
+/* udev monitor socket, readable when devices are plugged or removed */
+int nm_usb_monitor_fd(void)
+{
+#if defined (NM_OS_LINUX)
+    nm_usb_reg_init();
 
-            if (libusb_get_device_descriptor(device, &desc) != 0)
-                break;
+    return usb_mon ? udev_monitor_get_fd(usb_mon) : -1;
+#else
+    return -1;
+#endif /* NM_OS_LINUX */
+}
 
-            if ((usb_rc = libusb_open(device, &handle)) != 0)
-                nm_bug("%s: %s", __func__, libusb_strerror(usb_rc));
+/*
+ * Apply pending hotplug events, cb (may be NULL) is called for each
+ * added and removed device. Without monitor the bus is rescanned,
+ * events are not reported then.
+ */
+void nm_usb_registry_update(nm_usb_event_cb_t cb, void *ctx)
+{
+#if defined (NM_OS_LINUX)
+    struct udev_device *device;
 
-            if (libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber,
-                        (uint8_t *) serial_buf, NM_USB_SERIAL_LEN) > 0) {
-                nm_str_alloc_text(serial, serial_buf);
-                rc = NM_OK;
-            }
+    if (!udev) {
+        nm_usb_reg_init();
+        return;
+    }
 
-            libusb_close(handle);
+    if (!usb_mon) {
+        nm_usb_reg_scan();
+        return;
+    }
 
-            break;
+    /* monitor socket is non-blocking */
+    errno = 0;
+    while ((device = udev_monitor_receive_device(usb_mon)) != NULL) {
+        const char *action = udev_device_get_action(device);
+        const char *sysname = udev_device_get_sysname(device);
+
+        if (action && sysname && !strcmp(action, "remove")) {
+            nm_usb_reg_notify(nm_usb_reg_find(sysname), false, cb, ctx);
+            nm_usb_reg_remove(sysname);
+        } else if (action && !strcmp(action, "add")) {
+            nm_usb_reg_notify(nm_usb_reg_add(device), true, cb, ctx);
         }
+
+        udev_device_unref(device);
     }
 
-    /* cleanup */
-    libusb_free_device_list(list, 1);
-    libusb_exit(ctx);
+    if (errno == ENOBUFS) {
+        /* events were lost */
+        nm_debug("%s: udev monitor overrun, rescan\n", __func__);
+        nm_usb_reg_scan();
+    }
 #else
-    (void) dev;
-    (void) serial;
+    (void) cb;
+    (void) ctx;
 #endif /* NM_OS_LINUX */
+}
 
-    return rc;
+void nm_usb_registry_free(void)
+{
+#if defined (NM_OS_LINUX)
+    nm_usb_reg_clear();
+    free(usb_reg);
+    usb_reg = NULL;
+    usb_reg_alloc = 0;
+
+    if (usb_mon)
+        udev_monitor_unref(usb_mon);
+    if (hwdb)
+        udev_hwdb_unref(hwdb);
+    if (udev)
+        udev_unref(udev);
+
+    usb_mon = NULL;
+    hwdb = NULL;
+    udev = NULL;
+#endif /* NM_OS_LINUX */
 }
 
 void nm_usb_vect_ins_cb(void *unit_p, const void *ctx)
@@ -188,6 +209,159 @@ static inline void nm_usb_dev_free(nm_usb_dev_t *dev)
 }
 
 #if defined (NM_OS_LINUX)
+static void nm_usb_reg_init(void)
+{
+    if (udev)
+        return;
+
+    if ((udev = udev_new()) == NULL)
+        nm_bug(_("%s: udev_new failed"), __func__);
+
+    if ((hwdb = udev_hwdb_new(udev)) == NULL)
+        nm_bug(_("%s: udev_hwdb_new failed"), __func__);
+
+    /* monitor is enabled before scan, so no event is missed */
+    if ((usb_mon = udev_monitor_new_from_netlink(udev, "udev")) != NULL) {
+        if (udev_monitor_filter_add_match_subsystem_devtype(usb_mon,
+                    "usb", "usb_device") < 0 ||
+                udev_monitor_enable_receiving(usb_mon) < 0) {
+            nm_debug("%s: udev monitor is not available\n", __func__);
+            udev_monitor_unref(usb_mon);
+            usb_mon = NULL;
+        }
+    }
+
+    nm_usb_reg_scan();
+}
+
+static void nm_usb_reg_scan(void)
+{
+    struct udev_enumerate *en;
+    struct udev_list_entry *item;
+
+    nm_usb_reg_clear();
+
+    if ((en = udev_enumerate_new(udev)) == NULL)
+        nm_bug(_("%s: udev_enumerate_new failed"), __func__);
+
+    udev_enumerate_add_match_subsystem(en, "usb");
+    udev_enumerate_add_match_property(en, "DEVTYPE", "usb_device");
+    udev_enumerate_scan_devices(en);
+
+    udev_list_entry_foreach(item, udev_enumerate_get_list_entry(en)) {
+        struct udev_device *device = udev_device_new_from_syspath(udev,
+                udev_list_entry_get_name(item));
+
+        if (!device)
+            continue;
+
+        nm_usb_reg_add(device);
+        udev_device_unref(device);
+    }
+
+    udev_enumerate_unref(en);
+}
+
+static nm_usb_entry_t *nm_usb_reg_find(const char *sysname)
+{
+    for (size_t n = 0; n < usb_reg_count; n++) {
+        if (nm_str_cmp_st(&usb_reg[n].sysname, sysname) == NM_OK)
+            return &usb_reg[n];
+    }
+
+    return NULL;
+}
+
+static void nm_usb_reg_notify(const nm_usb_entry_t *entry, bool added,
+        nm_usb_event_cb_t cb, void *ctx)
+{
+    nm_usb_data_t usb = NM_INIT_USB_DATA;
+
+    if (!cb || !entry)
+        return;
+
+    usb.serial = entry->serial;
+    usb.dev = (nm_usb_dev_t *) &entry->dev;
+    cb(&usb, added, ctx);
+}
+
+/* Returns the new entry or NULL if device has no ids */
+static nm_usb_entry_t *nm_usb_reg_add(struct udev_device *device)
+{
+    const char *sysname = udev_device_get_sysname(device);
+    const char *vid = udev_device_get_sysattr_value(device, "idVendor");
+    const char *pid = udev_device_get_sysattr_value(device, "idProduct");
+    const char *bus = udev_device_get_sysattr_value(device, "busnum");
+    const char *addr = udev_device_get_sysattr_value(device, "devnum");
+    const char *serial = udev_device_get_sysattr_value(device, "serial");
+    char vendor[128], product[128];
+    nm_usb_entry_t *entry;
+    uint16_t vid_num, pid_num;
+
+    if (!sysname || !vid || !pid || !bus || !addr)
+        return NULL;
+
+    /* re-enumerated device gets new address */
+    nm_usb_reg_remove(sysname);
+
+    if (usb_reg_count == usb_reg_alloc) {
+        usb_reg_alloc = usb_reg_alloc ? usb_reg_alloc * 2 : 16;
+        usb_reg = nm_realloc(usb_reg, sizeof(nm_usb_entry_t) * usb_reg_alloc);
+    }
+
+    entry = &usb_reg[usb_reg_count++];
+    entry->sysname = NM_INIT_STR;
+    entry->serial = NM_INIT_STR;
+    entry->dev = NM_INIT_USB;
+
+    vid_num = strtoul(vid, NULL, 16);
+    pid_num = strtoul(pid, NULL, 16);
+
+    if (nm_usb_get_vendor_str(vendor, sizeof(vendor), vid_num) == 0)
+        nm_str_alloc_text(&entry->dev.name, "vendor-unknown");
+    else
+        nm_str_alloc_text(&entry->dev.name, vendor);
+
+    if (nm_usb_get_product_str(product, sizeof(product), vid_num, pid_num) == 0)
+        nm_str_add_text(&entry->dev.name, " product-unknown");
+    else
+        nm_str_add_text(&entry->dev.name, product);
+
+    nm_str_alloc_text(&entry->sysname, sysname);
+    nm_str_format(&entry->dev.vendor_id, "%04x", vid_num);
+    nm_str_format(&entry->dev.product_id, "%04x", pid_num);
+    entry->dev.bus_num = strtoul(bus, NULL, 10);
+    entry->dev.dev_addr = strtoul(addr, NULL, 10);
+    if (serial && *serial)
+        nm_str_alloc_text(&entry->serial, serial);
+
+    return entry;
+}
+
+static void nm_usb_reg_remove(const char *sysname)
+{
+    nm_usb_entry_t *entry;
+
+    if (!sysname || (entry = nm_usb_reg_find(sysname)) == NULL)
+        return;
+
+    nm_str_free(&entry->sysname);
+    nm_str_free(&entry->serial);
+    nm_usb_dev_free(&entry->dev);
+    *entry = usb_reg[--usb_reg_count];
+}
+
+static void nm_usb_reg_clear(void)
+{
+    for (size_t n = 0; n < usb_reg_count; n++) {
+        nm_str_free(&usb_reg[n].sysname);
+        nm_str_free(&usb_reg[n].serial);
+        nm_usb_dev_free(&usb_reg[n].dev);
+    }
+
+    usb_reg_count = 0;
+}
+
 static const char *nm_usb_hwdb_get(const char *modalias, const char *key)
 {
     struct udev_list_entry *entry = NULL;
@@ -21,6 +21,9 @@ typedef struct {
 
 #define NM_INIT_USB_DATA (nm_usb_data_t) { NM_INIT_STR, NULL }
 
+/* Hotplug event handler, usb is valid only during the call */
+typedef void (*nm_usb_event_cb_t)(const nm_usb_data_t *usb, bool added, void *ctx);
+
 void nm_usb_get_devs(nm_vect_t *v);
 void nm_usb_vect_ins_cb(void *unit_p, const void *ctx);
 void nm_usb_vect_free_cb(void *unit_p);
@@ -28,6 +31,9 @@ void nm_usb_data_vect_ins_cb(void *unit_p, const void *ctx);
 void nm_usb_data_vect_free_cb(void *unit_p);
 int nm_usb_get_serial(const nm_usb_dev_t *dev, nm_str_t *serial);
 void nm_usb_data_free(nm_usb_data_t *dev);
+int nm_usb_monitor_fd(void);
+void nm_usb_registry_update(nm_usb_event_cb_t cb, void *ctx);
+void nm_usb_registry_free(void);
 
 static inline nm_str_t *nm_usb_name(const nm_usb_dev_t *p)
 {
@@ -14,7 +14,7 @@ static const char NM_USB_FORM_MSG[] = "Device";
 static void nm_usb_plug_list(nm_vect_t *devs, nm_vect_t *names);
 static int nm_usb_plug_get_data(const nm_str_t *name, nm_usb_data_t *usb,
         const nm_vect_t *usb_list);
-static int nm_usb_unplug_get_data(nm_usb_data_t *usb, const nm_vect_t *db_list);
+static int nm_usb_unplug_get_data(nm_usb_data_t *usb, const nm_db_result_t *db_list);
 static void nm_usb_plug_update_db(const nm_str_t *name, const nm_usb_data_t *usb);
 
 static nm_field_t *fields[2];
@@ -22,7 +22,6 @@ static nm_field_t *fields[2];
 void nm_usb_plug(const nm_str_t *name, int vm_status)
 {
     nm_form_t *form = NULL;
-    nm_str_t buf = NM_INIT_STR;
     nm_vect_t usb_devs = NM_INIT_VECT;
     nm_vect_t usb_names = NM_INIT_VECT;
     nm_vect_t db_result = NM_INIT_VECT;
@@ -34,8 +33,7 @@ void nm_usb_plug(const nm_str_t *name, int vm_status)
         return;
 
     /* check for usb enabled first */
-    nm_str_format(&buf, NM_USB_CHECK_SQL, name->data);
-    nm_db_select(buf.data, &db_result);
+    nm_db_select_vm(NM_STMT_USB_CHECK, name->data, &db_result);
 
     if (vm_status && nm_str_cmp_st(nm_vect_str(&db_result, 0), NM_DISABLE) == NM_OK) {
         nm_warn(_(NM_MSG_USB_DIS));
@@ -88,18 +86,17 @@ out:
     nm_vect_free(&db_result, nm_str_vect_free_cb);
 
     nm_form_free(form, fields);
-    nm_str_free(&buf);
     nm_str_free(&usb.serial);
 }
 
 void nm_usb_unplug(const nm_str_t *name, int vm_status)
 {
     nm_form_t *form = NULL;
-    nm_str_t buf = NM_INIT_STR;
+    nm_db_stmt_t *stmt;
     nm_usb_data_t usb_data = NM_INIT_USB_DATA;
     nm_usb_dev_t usb_dev = NM_INIT_USB;
     nm_vect_t usb_names = NM_INIT_VECT;
-    nm_vect_t db_result = NM_INIT_VECT;
+    nm_db_result_t db_result = NM_INIT_DB_RESULT;
     nm_form_data_t form_data = NM_INIT_FORM_DATA;
     size_t msg_len = mbstowcs(NULL, NM_USB_FORM_MSG, strlen(NM_USB_FORM_MSG));
 
@@ -108,8 +105,7 @@ void nm_usb_unplug(const nm_str_t *name, int vm_status)
 
     usb_data.dev = &usb_dev;
 
-    nm_str_format(&buf, NM_USB_GET_SQL, name->data);
-    nm_db_select(buf.data, &db_result);
+    nm_db_result_vm(NM_STMT_USB_GET, name->data, &db_result);
 
     if (!db_result.n_memb) {
         nm_warn(_(NM_MSG_USB_NONE));
@@ -142,13 +138,13 @@ void nm_usb_unplug(const nm_str_t *name, int vm_status)
     if (vm_status)
         (void) nm_qmp_usb_detach(name, &usb_data);
 
-    nm_str_format(&buf, NM_USB_DELETE_SQL,
-            name->data,
-            usb_dev.name.data,
-            usb_dev.vendor_id.data,
-            usb_dev.product_id.data,
-            usb_data.serial.data);
-    nm_db_edit(buf.data);
+    stmt = nm_db_stmt(NM_STMT_USB_DELETE);
+    nm_db_bind_text(stmt, 1, name->data);
+    nm_db_bind_text(stmt, 2, usb_dev.name.data);
+    nm_db_bind_text(stmt, 3, usb_dev.vendor_id.data);
+    nm_db_bind_text(stmt, 4, usb_dev.product_id.data);
+    nm_db_bind_text(stmt, 5, usb_data.serial.data);
+    nm_db_stmt_exec(stmt);
 
 clean_and_out:
     werase(help_window);
@@ -158,34 +154,30 @@ out:
     wtimeout(action_window, -1);
     delwin(form_data.form_window);
     nm_vect_free(&usb_names, NULL);
-    nm_vect_free(&db_result, nm_str_vect_free_cb);
+    nm_db_result_free(&db_result);
     nm_form_free(form, fields);
     nm_usb_data_free(&usb_data);
-    nm_str_free(&buf);
 }
 
 int nm_usb_check_plugged(const nm_str_t *name)
 {
     int rc = NM_ERR;
     nm_vect_t db_result = NM_INIT_VECT;
-    nm_str_t query = NM_INIT_STR;
 
-    nm_str_format(&query, NM_USB_GET_SQL, name->data);
-    nm_db_select(query.data, &db_result);
+    nm_db_select_vm(NM_STMT_USB_GET, name->data, &db_result);
 
     if (!db_result.n_memb) {
         rc = NM_OK;
     }
 
     nm_vect_free(&db_result, nm_str_vect_free_cb);
-    nm_str_free(&query);
 
     return rc;
 }
 
-void nm_usb_unplug_list(const nm_vect_t *db_list, nm_vect_t *names, bool num)
+void nm_usb_unplug_list(const nm_db_result_t *db_list, nm_vect_t *names, bool num)
 {
-    size_t dev_count = db_list->n_memb / NM_USB_IDX_COUNT;
+    size_t dev_count = nm_db_res_rows(db_list);
     nm_str_t buf = NM_INIT_STR;
 
     for (size_t n = 0; n < dev_count; n++) {
@@ -193,12 +185,12 @@ void nm_usb_unplug_list(const nm_vect_t *db_list, nm_vect_t *names, bool num)
 
         if (num) {
             nm_str_format(&buf, "%zu:%s [serial:%s]", n + 1,
-                    nm_vect_str_ctx(db_list, NM_SQL_USB_NAME + idx_shift),
-                    nm_vect_str_ctx(db_list, NM_SQL_USB_SERIAL + idx_shift));
+                    nm_db_res_cstr(db_list, NM_SQL_USB_NAME + idx_shift),
+                    nm_db_res_cstr(db_list, NM_SQL_USB_SERIAL + idx_shift));
         } else {
             nm_str_format(&buf, "%s [serial:%s]",
-                    nm_vect_str_ctx(db_list, NM_SQL_USB_NAME + idx_shift),
-                    nm_vect_str_ctx(db_list, NM_SQL_USB_SERIAL + idx_shift));
+                    nm_db_res_cstr(db_list, NM_SQL_USB_NAME + idx_shift),
+                    nm_db_res_cstr(db_list, NM_SQL_USB_SERIAL + idx_shift));
         }
         nm_vect_insert(names, buf.data, buf.len + 1, NULL);
     }
@@ -234,6 +226,7 @@ static int nm_usb_plug_get_data(const nm_str_t *name, nm_usb_data_t *usb,
     nm_str_t buf = NM_INIT_STR;
     nm_str_t input = NM_INIT_STR;
     nm_vect_t db_list = NM_INIT_VECT;
+    nm_db_stmt_t *stmt;
     uint32_t idx;
     char *fo;
 
@@ -259,14 +252,13 @@ static int nm_usb_plug_get_data(const nm_str_t *name, nm_usb_data_t *usb,
 
     nm_usb_get_serial(usb->dev, &usb->serial);
 
-    nm_str_format(&buf, NM_USB_EXISTS_SQL,
-            name->data,
-            usb->dev->name.data,
-            usb->dev->vendor_id.data,
-            usb->dev->product_id.data,
-            (usb->serial.data) ? usb->serial.data : "NULL");
-
-    nm_db_select(buf.data, &db_list);
+    stmt = nm_db_stmt(NM_STMT_USB_EXISTS);
+    nm_db_bind_text(stmt, 1, name->data);
+    nm_db_bind_text(stmt, 2, usb->dev->name.data);
+    nm_db_bind_text(stmt, 3, usb->dev->vendor_id.data);
+    nm_db_bind_text(stmt, 4, usb->dev->product_id.data);
+    nm_db_bind_text(stmt, 5, (usb->serial.data) ? usb->serial.data : "NULL");
+    nm_db_stmt_select(stmt, &db_list);
 
     if (db_list.n_memb) {
         nm_warn(_(NM_MSG_USB_ATTAC));
@@ -282,7 +274,7 @@ out:
     return rc;
 }
 
-static int nm_usb_unplug_get_data(nm_usb_data_t *usb, const nm_vect_t *db_list)
+static int nm_usb_unplug_get_data(nm_usb_data_t *usb, const nm_db_result_t *db_list)
 {
     int rc = NM_ERR;
     nm_str_t buf = NM_INIT_STR;
@@ -309,13 +301,13 @@ static int nm_usb_unplug_get_data(nm_usb_data_t *usb, const nm_vect_t *db_list)
     nm_debug("s:%s, idx=%u\n", buf.data, idx);
 
     nm_str_copy(&usb->dev->name,
-            nm_vect_str(db_list, NM_SQL_USB_NAME + idx_shift));
+            nm_db_res_str(db_list, NM_SQL_USB_NAME + idx_shift));
     nm_str_copy(&usb->dev->vendor_id,
-            nm_vect_str(db_list, NM_SQL_USB_VID + idx_shift));
+            nm_db_res_str(db_list, NM_SQL_USB_VID + idx_shift));
     nm_str_copy(&usb->dev->product_id,
-            nm_vect_str(db_list, NM_SQL_USB_PID + idx_shift));
+            nm_db_res_str(db_list, NM_SQL_USB_PID + idx_shift));
     nm_str_copy(&usb->serial,
-            nm_vect_str(db_list, NM_SQL_USB_SERIAL + idx_shift));
+            nm_db_res_str(db_list, NM_SQL_USB_SERIAL + idx_shift));
 
     rc = NM_OK;
 out:
@@ -327,17 +319,14 @@ out:
 
 static void nm_usb_plug_update_db(const nm_str_t *name, const nm_usb_data_t *usb)
 {
-    nm_str_t query = NM_INIT_STR;
-
-    nm_str_format(&query, NM_USB_ADD_SQL,
-            name->data,
-            usb->dev->name.data,
-            usb->dev->vendor_id.data,
-            usb->dev->product_id.data,
-            (usb->serial.data) ? usb->serial.data : "NULL");
-
-    nm_db_edit(query.data);
-
-    nm_str_free(&query);
+    nm_db_stmt_t *stmt = nm_db_stmt(NM_STMT_USB_ADD);
+
+    /* missing serial is stored as "NULL" string, lookups expect it */
+    nm_db_bind_text(stmt, 1, name->data);
+    nm_db_bind_text(stmt, 2, usb->dev->name.data);
+    nm_db_bind_text(stmt, 3, usb->dev->vendor_id.data);
+    nm_db_bind_text(stmt, 4, usb->dev->product_id.data);
+    nm_db_bind_text(stmt, 5, (usb->serial.data) ? usb->serial.data : "NULL");
+    nm_db_stmt_exec(stmt);
 }
 /* vim:set ts=4 sw=4: */
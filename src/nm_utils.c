@@ -1,13 +1,16 @@
+#if defined (NM_OS_LINUX)
+# define _GNU_SOURCE
+#endif
 #include <nm_core.h>
 #include <nm_utils.h>
 #include <nm_string.h>
 #include <nm_vector.h>
 #include <nm_ncurses.h>
 #include <nm_vm_control.h>
+#include <nm_process.h>
 
-#include <sys/socket.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
-#include <sys/wait.h>
 #include <stdlib.h>
 #include <limits.h>
 #include <libgen.h>
@@ -16,19 +19,30 @@
 #include <time.h>
 
 enum {
-    NM_BLKSIZE      = 131072, /* 128KiB */
-    NM_SOCK_READLEN = 1024,
+    NM_BLKSIZE      = 1048576,  /* 1MiB, multiple of any block size */
+    NM_BLKALIGN     = 4096,
+    NM_COPY_CHUNK   = 67108864, /* 64MiB per offloaded call */
 };
 
-#if defined (NM_OS_LINUX) && defined (NM_WITH_SENDFILE)
-#include <sys/sendfile.h>
+#if defined (NM_OS_LINUX)
+#include <linux/fs.h> /* FICLONE */
 #endif
 
-#if defined (NM_OS_LINUX) && defined (NM_WITH_SENDFILE)
-static void nm_copy_file_sendfile(int in_fd, int out_fd);
-#else
-static void nm_copy_file_default(int in_fd, int out_fd);
-#endif
+typedef struct {
+    int in_fd;
+    int out_fd;
+    bool offload;   /* copy_file_range(2) is usable */
+    char *buf;      /* allocated on first buffered copy */
+    uint64_t done;
+    uint64_t total;
+    nm_copy_cb_t cb;
+    void *ctx;
+    int err;        /* errno of failure, ECANCELED if callback stopped */
+} nm_copy_t;
+
+static void nm_copy_range(nm_copy_t *cp, off_t off, off_t len);
+static void nm_copy_range_buf(nm_copy_t *cp, off_t off, off_t len);
+static void nm_copy_advance(nm_copy_t *cp, uint64_t bytes);
 
 void nm_bug(const char *fmt, ...)
 {
@@ -107,141 +121,268 @@ void nm_unmap_file(const nm_file_map_t *file)
 
 void nm_copy_file(const nm_str_t *src, const nm_str_t *dst)
 {
-    int in_fd, out_fd;
+    int err;
+
+    if ((err = nm_copy_file_cb(src, dst, NULL, NULL)) != 0) {
+        nm_bug(_("%s: cannot copy %s to %s: %s"),
+            __func__, src->data, dst->data, strerror(err));
+    }
+}
+
+/*
+ * Copy file, holes of sparse source are kept.
+ * Clone on btrfs/xfs is tried first. Data extents found with
+ * SEEK_DATA/SEEK_HOLE are copied by copy_file_range(2) in kernel,
+ * if it is not supported (other filesystem, old kernel) buffered
+ * pread/pwrite is used. Callback gets the number of processed
+ * bytes, skipped holes are counted.
+ * Errors are not reported here, function is used by job threads.
+ * Returns 0 or errno value, ECANCELED if callback stopped copying.
+ * Destination is left incomplete on error.
+ */
+int nm_copy_file_cb(const nm_str_t *src, const nm_str_t *dst,
+        nm_copy_cb_t cb, void *ctx)
+{
+    nm_copy_t cp = { -1, -1, false, NULL, 0, 0, cb, ctx, 0 };
+    struct stat file_info;
+    off_t off = 0, size;
+    bool sparse = true;
 
-    if ((in_fd = open(src->data, O_RDONLY)) == -1) {
-        nm_bug("%s: cannot open file %s: %s",
-            __func__, src->data, strerror(errno));
+    if ((cp.in_fd = open(src->data, O_RDONLY | O_CLOEXEC)) == -1)
+        return errno;
+
+    if ((cp.out_fd = open(dst->data,
+                    O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644)) == -1) {
+        cp.err = errno;
+        close(cp.in_fd);
+        return cp.err;
     }
 
-    if ((out_fd = open(dst->data, O_WRONLY | O_CREAT | O_EXCL, 0644)) == -1) {
-        close(in_fd);
-        nm_bug("%s: cannot open file %s: %s",
-            __func__, dst->data, strerror(errno));
+    if (fstat(cp.in_fd, &file_info) != 0) {
+        cp.err = errno;
+        goto out;
     }
 
-#if defined (NM_OS_LINUX) && defined (NM_WITH_SENDFILE)
-    nm_copy_file_sendfile(in_fd, out_fd);
+    size = file_info.st_size;
+    cp.total = size;
+
+#if defined (FICLONE)
+    /* btrfs and xfs share extents, nothing is copied */
+    if (ioctl(cp.out_fd, FICLONE, cp.in_fd) == 0) {
+        nm_copy_advance(&cp, size);
+        goto out;
+    }
+#endif
+#if defined (NM_WITH_COPY_FILE_RANGE)
+    cp.offload = true;
+#endif
+
+    posix_fadvise(cp.in_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    while (off < size && !cp.err) {
+        off_t data = off, hole = size;
+
+#if defined (SEEK_DATA)
+        if (sparse) {
+            if ((data = lseek(cp.in_fd, off, SEEK_DATA)) == -1) {
+                if (errno == ENXIO)
+                    break; /* only hole is left */
+                /* not supported by filesystem */
+                sparse = false;
+                data = off;
+            } else if ((hole = lseek(cp.in_fd, data, SEEK_HOLE)) == -1) {
+                hole = size;
+            }
+        }
 #else
-    nm_copy_file_default(in_fd, out_fd);
+        (void) sparse;
 #endif
+        if (hole > size)
+            hole = size;
+
+        nm_copy_advance(&cp, data - off);
+        nm_copy_range(&cp, data, hole - data);
+        off = hole;
+    }
+
+    if (cp.err)
+        goto out;
+
+    /* size of file with hole at the end */
+    if (ftruncate(cp.out_fd, size) != 0) {
+        cp.err = errno;
+        goto out;
+    }
+
+    nm_copy_advance(&cp, cp.total - cp.done);
 
-    close(in_fd);
-    close(out_fd);
+out:
+    free(cp.buf);
+    close(cp.in_fd);
+    close(cp.out_fd);
+
+    return cp.err;
 }
 
-#if defined (NM_OS_LINUX) && defined (NM_WITH_SENDFILE)
-static void nm_copy_file_sendfile(int in_fd, int out_fd)
+static void nm_copy_range(nm_copy_t *cp, off_t off, off_t len)
 {
-    off_t offset = 0;
-    struct stat file_info;
-
-    memset(&file_info, 0, sizeof(file_info));
+#if defined (NM_WITH_COPY_FILE_RANGE)
+    while (cp->offload && len > 0 && !cp->err) {
+        loff_t in_off = off, out_off = off;
+        size_t chunk = (len > NM_COPY_CHUNK) ? NM_COPY_CHUNK : (size_t) len;
+        ssize_t ncopy;
+
+        ncopy = copy_file_range(cp->in_fd, &in_off, cp->out_fd, &out_off, chunk, 0);
+
+        if (ncopy > 0) {
+            off += ncopy;
+            len -= ncopy;
+            nm_copy_advance(cp, ncopy);
+            continue;
+        }
 
-    if (fstat(in_fd, &file_info) != 0)
-        nm_bug("%s: cannot get file info %d: %s", __func__, in_fd, strerror(errno));
+        if (ncopy == 0) {
+            cp->err = EIO; /* source file was truncated */
+            return;
+        }
 
-    while (offset < file_info.st_size) {
-        int rc;
+        if (errno == EINTR)
+            continue;
 
-        if ((rc = sendfile(out_fd, in_fd, &offset, file_info.st_size)) == -1)
-            nm_bug("%s: cannot copy file: %s", __func__, strerror(errno));
+        if (errno != EXDEV && errno != ENOSYS && errno != EINVAL &&
+                errno != EOPNOTSUPP && errno != EBADF) {
+            cp->err = errno;
+            return;
+        }
 
-        if (rc == 0)
-            break;
+        nm_debug("%s: copy_file_range: %s, using buffered copy\n",
+                __func__, strerror(errno));
+        cp->offload = false;
     }
-
-    if (offset != file_info.st_size)
-            nm_bug("%s: incomplete transfer from sendfile", __func__);
+#endif
+    if (len > 0 && !cp->err)
+        nm_copy_range_buf(cp, off, len);
 }
-#else
-static void nm_copy_file_default(int in_fd, int out_fd)
+
+static void nm_copy_range_buf(nm_copy_t *cp, off_t off, off_t len)
 {
-    char *buf = nm_alloc(NM_BLKSIZE);
-    ssize_t nread;
+    if (!cp->buf &&
+            (cp->err = posix_memalign((void **) &cp->buf,
+                                      NM_BLKALIGN, NM_BLKSIZE)) != 0) {
+        cp->buf = NULL;
+        return;
+    }
 
-    posix_fadvise(in_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    while (len > 0 && !cp->err) {
+        size_t chunk = (len > NM_BLKSIZE) ? NM_BLKSIZE : (size_t) len;
+        ssize_t nread = pread(cp->in_fd, cp->buf, chunk, off);
+        char *bufsp = cp->buf;
+
+        if (nread == -1 && errno == EINTR)
+            continue;
+        if (nread <= 0) {
+            /* zero means source file was truncated */
+            cp->err = nread ? errno : EIO;
+            return;
+        }
 
-    while ((nread = read(in_fd, buf, NM_BLKSIZE)) > 0) {
-        char *bufsp = buf;
+        nm_copy_advance(cp, nread);
+        len -= nread;
 
-        do {
-            ssize_t nwrite = write(out_fd, bufsp, NM_BLKSIZE);
+        while (nread > 0) {
+            ssize_t nwrite = pwrite(cp->out_fd, bufsp, nread, off);
 
             if (nwrite >= 0) {
                 nread -= nwrite;
                 bufsp += nwrite;
+                off += nwrite;
             } else if (errno != EINTR) {
-                nm_bug("%s: copy file failed: %s", __func__, strerror(errno));
+                cp->err = errno;
+                return;
             }
-
-        } while (nread > 0);
+        }
     }
+}
 
-    if (nread != 0)
-        nm_bug("%s: copy was not complete.", __func__);
+static void nm_copy_advance(nm_copy_t *cp, uint64_t bytes)
+{
+    cp->done += bytes;
 
-    free(buf);
+    if (cp->cb && bytes && cp->cb(cp->done, cp->total, cp->ctx) != NM_OK)
+        cp->err = ECANCELED;
 }
-#endif
 
 int nm_spawn_process(const nm_vect_t *argv, nm_str_t *answer)
 {
-    int rc = NM_OK;
-    int fd[2];
-    pid_t child_pid = 0;
-
-    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) == -1)
-        nm_bug("%s: error create socketpair: %s", __func__, strerror(errno));
-
-    switch (child_pid = fork()) {
-    case (-1):  /* error*/
-        nm_bug("%s: fork: %s", __func__, strerror(errno));
-        break;
-
-    case (0):   /* child */
-        close(fd[0]);
-        dup2(fd[1], STDOUT_FILENO);
-        dup2(fd[1], STDERR_FILENO);
-
-        execvp(((char *const *) argv->data)[0], (char *const *) argv->data);
-        nm_bug("%s: unreachable reached", __func__);
-        break;
-
-    default:    /* parent */
-        {
-            int wstatus = 0;
-            pid_t w_rc;
-            char buf[NM_SOCK_READLEN] = {0};
-
-            close(fd[1]);
-            w_rc = waitpid(child_pid, &wstatus, 0);
-
-            if ((w_rc == child_pid) && (WEXITSTATUS(wstatus) != 0)) {
-                nm_str_t err_msg = NM_INIT_STR;
-
-                while (read(fd[0], buf, sizeof(buf) - 1) > 0) {
-                    nm_str_add_text(&err_msg, buf);
-                    memset(&buf, 0, sizeof(buf));
-                }
-                nm_vmctl_log_last(&err_msg);
-                nm_debug("exec_error: %s", err_msg.data);
-                nm_str_free(&err_msg);
-                rc = NM_ERR;
-            } else if (answer && (w_rc == child_pid) && (WEXITSTATUS(wstatus) == 0)) {
-                while (read(fd[0], buf, sizeof(buf) - 1) > 0) {
-                    nm_str_add_text(answer, buf);
-                    memset(buf, 0, sizeof(buf));
-                }
-            }
+    nm_str_t out = NM_INIT_STR;
+    int rc, err;
 
-            close(fd[0]);
-        }
-    }
+    rc = nm_spawn_process_cancel(argv, &out, NULL, NULL);
+
+    if (rc != NM_OK) {
+        if ((err = nm_vmctl_log_last(&out)) != 0)
+            nm_bug(_("%s: cannot write log: %s"), __func__, strerror(err));
+    } else if (answer && out.len)
+        nm_str_add_str(answer, &out);
+
+    nm_str_free(&out);
 
     return rc;
 }
 
+/*
+ * Process is killed when cancel becomes non zero.
+ * fds (int, close-on-exec) are passed to the process, may be NULL.
+ * Output is added to answer on failure too, it is not logged here:
+ * function is used by job threads.
+ */
+int nm_spawn_process_cancel(const nm_vect_t *argv, nm_str_t *answer,
+        const int *cancel, const nm_vect_t *fds)
+{
+    nm_proc_t proc = NM_INIT_PROC;
+    nm_proc_t *procs[] = { &proc };
+    int rc = NM_ERR;
+
+    proc.flags = NM_PROC_MERGE_ERR;
+    proc.fds = fds;
+
+    if (nm_proc_start(&proc, argv) == NM_OK)
+        rc = nm_proc_wait(procs, 1, cancel);
+
+    if (rc != NM_OK)
+        nm_debug("exec_error: %s", proc.out.len ? proc.out.data : "");
+
+    if (answer && proc.out.len)
+        nm_str_add_str(answer, &proc.out);
+
+    nm_proc_free(&proc);
+
+    return rc;
+}
+
+/* strerror() for job threads, message is in buf or static */
+const char *nm_strerror_r(int err, char *buf, size_t len)
+{
+#if defined (__GLIBC__) && defined (_GNU_SOURCE)
+    return strerror_r(err, buf, len);
+#else
+    if (strerror_r(err, buf, len) != 0)
+        snprintf(buf, len, "error %d", err);
+
+    return buf;
+#endif
+}
+
+/* Milliseconds of CLOCK_MONOTONIC, for timeouts and rates */
+int64_t nm_mono_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 void nm_debug(const char *fmt, ...)
 {
     const nm_cfg_t *cfg = nm_cfg_get();
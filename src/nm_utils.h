@@ -21,14 +21,21 @@ typedef struct {
 #define NM_INIT_FILE (nm_file_map_t) { NULL, -1, 0, NULL }
 #define NM_INIT_CPU (nm_cpu_t) { 0, 0, 0, 0 }
 
+/* Copy progress: bytes done of total, NM_ERR stops copying */
+typedef int (*nm_copy_cb_t)(uint64_t done, uint64_t total, void *ctx);
+
 void *nm_alloc(size_t size);
 void *nm_calloc(size_t nmemb, size_t size);
 void *nm_realloc(void *p, size_t size);
 void nm_map_file(nm_file_map_t *file);
 void nm_copy_file(const nm_str_t *src, const nm_str_t *dst);
+int nm_copy_file_cb(const nm_str_t *src, const nm_str_t *dst,
+        nm_copy_cb_t cb, void *ctx);
 void nm_unmap_file(const nm_file_map_t *file);
-/* Execute process. Read stdout if answer is not NULL */
+/* Execute process, stdout and stderr go to answer if it is not NULL */
 int nm_spawn_process(const nm_vect_t *argv, nm_str_t *answer);
+int nm_spawn_process_cancel(const nm_vect_t *argv, nm_str_t *answer,
+        const int *cancel, const nm_vect_t *fds);
 
 void nm_bug(const char *fmt, ...)
     __attribute__ ((format(printf, 1, 2)))
@@ -36,6 +43,8 @@ void nm_bug(const char *fmt, ...)
 
 void nm_debug(const char *fmt, ...)
     __attribute__ ((format(printf, 1, 2)));
+const char *nm_strerror_r(int err, char *buf, size_t len);
+int64_t nm_mono_ms(void);
 
 void nm_cmd_str(nm_str_t *str, const nm_vect_t *argv);
 void nm_parse_smp(nm_cpu_t *cpu, const char *src);
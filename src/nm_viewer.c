@@ -73,6 +73,7 @@ void nm_viewer(const nm_str_t *name)
     nm_vmctl_data_t vm = NM_VMCTL_INIT_DATA;
     nm_form_data_t form_data = NM_INIT_FORM_DATA;
     nm_view_data_t vm_new = NM_INIT_VIEW_DATA;
+    nm_str_t port = NM_INIT_STR;
     uint32_t vnc_port;
     size_t msg_len = nm_max_msg_len(nm_form_msg);
 
@@ -92,7 +93,7 @@ void nm_viewer(const nm_str_t *name)
     fields[NM_FLD_COUNT] = NULL;
 #if defined(NM_WITH_SPICE)
     set_field_type(fields[NM_FLD_SPICE], TYPE_ENUM, nm_form_yes_no, false, false);
-    if (nm_str_cmp_st(nm_vect_str(&vm.main, NM_SQL_SPICE), NM_ENABLE) == NM_OK)
+    if (nm_str_cmp_st(nm_db_res_str(&vm.main, NM_SQL_SPICE), NM_ENABLE) == NM_OK)
         set_field_buffer(fields[NM_FLD_SPICE], 0, nm_form_yes_no[0]);
     else
         set_field_buffer(fields[NM_FLD_SPICE], 0, nm_form_yes_no[1]);
@@ -106,14 +107,14 @@ void nm_viewer(const nm_str_t *name)
     field_opts_off(fields[NM_FLD_TTYP], O_STATIC);
     field_opts_off(fields[NM_FLD_SOCK], O_STATIC);
 
-    vnc_port = nm_str_stoui(nm_vect_str(&vm.main, NM_SQL_VNC), 10) + NM_STARTING_VNC_PORT;
-    nm_str_format(nm_vect_str(&vm.main, NM_SQL_VNC), "%u", vnc_port);
-    set_field_buffer(fields[NM_FLD_PORT], 0, nm_vect_str_ctx(&vm.main, NM_SQL_VNC));
-    set_field_buffer(fields[NM_FLD_TTYP], 0, nm_vect_str_ctx(&vm.main, NM_SQL_TTY));
-    set_field_buffer(fields[NM_FLD_SOCK], 0, nm_vect_str_ctx(&vm.main, NM_SQL_SOCK));
-    set_field_buffer(fields[NM_FLD_DSP], 0, nm_vect_str_ctx(&vm.main, NM_SQL_DISPLAY));
+    vnc_port = nm_db_res_int(&vm.main, NM_SQL_VNC) + NM_STARTING_VNC_PORT;
+    nm_str_format(&port, "%u", vnc_port);
+    set_field_buffer(fields[NM_FLD_PORT], 0, port.data);
+    set_field_buffer(fields[NM_FLD_TTYP], 0, nm_db_res_cstr(&vm.main, NM_SQL_TTY));
+    set_field_buffer(fields[NM_FLD_SOCK], 0, nm_db_res_cstr(&vm.main, NM_SQL_SOCK));
+    set_field_buffer(fields[NM_FLD_DSP], 0, nm_db_res_cstr(&vm.main, NM_SQL_DISPLAY));
 
-    if (nm_str_cmp_st(nm_vect_str(&vm.main, NM_SQL_OVER), NM_ENABLE) == NM_OK)
+    if (nm_str_cmp_st(nm_db_res_str(&vm.main, NM_SQL_OVER), NM_ENABLE) == NM_OK)
         set_field_buffer(fields[NM_FLD_SYNC], 0, nm_form_yes_no[0]);
     else
         set_field_buffer(fields[NM_FLD_SYNC], 0, nm_form_yes_no[1]);
@@ -140,6 +141,7 @@ out:
     nm_viewer_free(&vm_new);
     nm_vmctl_free_data(&vm);
     nm_form_free(form, fields);
+    nm_str_free(&port);
 }
 
 static int nm_viewer_get_data(nm_view_data_t *vm)
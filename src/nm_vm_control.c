@@ -1,8 +1,10 @@
 #include <nm_core.h>
+#include <nm_job.h>
 #include <nm_form.h>
 #include <nm_utils.h>
 #include <nm_string.h>
 #include <nm_window.h>
+#include <nm_ncurses.h>
 #include <nm_network.h>
 #include <nm_database.h>
 #include <nm_cfg_file.h>
@@ -18,104 +20,256 @@ enum {
     NM_VIEWER_VNC
 };
 
+enum {NM_VMCTL_CACHE_SIZE = 32};
+
+/*
+ * LRU cache of VM data for the main loop.
+ * Entry is valid while database generation is unchanged,
+ * any write (edit, clone, rename, delete...) makes it stale.
+ */
+typedef struct {
+    nm_str_t name;
+    nm_vmctl_data_t data;
+    uint64_t generation;
+    uint64_t used;
+} nm_vmctl_cache_t;
+
+static nm_vmctl_cache_t nm_vmctl_cache[NM_VMCTL_CACHE_SIZE];
+static uint64_t nm_vmctl_cache_tick;
+
+/* Context of VM start job */
+typedef struct {
+    nm_str_t name;
+    nm_vect_t argv;
+    nm_vect_t tfds;
+} nm_vmctl_start_t;
+
 #if defined(NM_WITH_VNC_CLIENT) || defined(NM_WITH_SPICE)
 static void nm_vmctl_gen_viewer(const nm_str_t *name, uint32_t port, nm_str_t *cmd, int type);
 #endif
 static int nm_vmctl_clear_tap_vect(const nm_vect_t *vms);
+static int nm_vmctl_start_prepare(const nm_str_t *name, int flags,
+                                  nm_vect_t *argv, nm_vect_t *tfds);
+static int nm_vmctl_start_finish(const nm_str_t *name, const nm_vect_t *argv,
+                                 const nm_vect_t *tfds, int rc);
+static int nm_vmctl_start_run(nm_job_t *job);
+static int nm_vmctl_start_done(nm_job_t *job, int rc);
+static void nm_vmctl_start_free(void *ctx);
+static void nm_vmctl_warn(const char *msg);
 
 void nm_vmctl_get_data(const nm_str_t *name, nm_vmctl_data_t *vm)
 {
-    nm_str_t query = NM_INIT_STR;
+    nm_db_read_begin();
+    nm_db_result_vm(NM_STMT_VM_GET_LIST, name->data, &vm->main);
+    nm_db_result_vm(NM_STMT_VM_GET_IFACES, name->data, &vm->ifs);
+    nm_db_result_vm(NM_STMT_VM_GET_DRIVES, name->data, &vm->drives);
+    nm_db_result_vm(NM_STMT_USB_GET, name->data, &vm->usb);
+    nm_db_read_end();
+}
 
-    nm_str_format(&query, NM_VM_GET_LIST_SQL, name->data);
-    nm_db_select(query.data, &vm->main);
+/*
+ * Returned data is owned by the cache and stays valid
+ * until the next nm_vmctl_get_cached() or nm_vmctl_cache_free() call.
+ */
+const nm_vmctl_data_t *nm_vmctl_get_cached(const nm_str_t *name)
+{
+    uint64_t generation = nm_db_generation();
+    nm_vmctl_cache_t *slot = NULL;
 
-    nm_str_format(&query, NM_VM_GET_IFACES_SQL, name->data);
-    nm_db_select(query.data, &vm->ifs);
+    for (size_t n = 0; n < NM_VMCTL_CACHE_SIZE; n++) {
+        nm_vmctl_cache_t *entry = &nm_vmctl_cache[n];
 
-    nm_str_format(&query, NM_VM_GET_DRIVES_SQL, name->data);
-    nm_db_select(query.data, &vm->drives);
+        if (entry->name.len && nm_str_cmp_ss(&entry->name, name) == NM_OK) {
+            slot = entry;
+            break;
+        }
 
-    nm_str_format(&query, NM_USB_GET_SQL, name->data);
-    nm_db_select(query.data, &vm->usb);
+        if (!slot || entry->used < slot->used)
+            slot = entry;
+    }
 
-    nm_str_free(&query);
+    if (nm_str_cmp_ss(&slot->name, name) != NM_OK ||
+            slot->generation != generation) {
+        nm_vmctl_free_data(&slot->data);
+        nm_str_copy(&slot->name, name);
+        nm_vmctl_get_data(name, &slot->data);
+        slot->generation = generation;
+    }
+
+    slot->used = ++nm_vmctl_cache_tick;
+
+    return &slot->data;
 }
 
-void nm_vmctl_start(const nm_str_t *name, int flags)
+void nm_vmctl_cache_free(void)
 {
-    nm_str_t buf = NM_INIT_STR;
+    for (size_t n = 0; n < NM_VMCTL_CACHE_SIZE; n++) {
+        nm_vmctl_free_data(&nm_vmctl_cache[n].data);
+        nm_str_free(&nm_vmctl_cache[n].name);
+        nm_vmctl_cache[n].generation = 0;
+        nm_vmctl_cache[n].used = 0;
+    }
+}
+
+int nm_vmctl_start(const nm_str_t *name, int flags)
+{
+    int rc = NM_ERR;
     nm_vect_t argv = NM_INIT_VECT;
-    nm_vmctl_data_t vm = NM_VMCTL_INIT_DATA;
     nm_vect_t tfds = NM_INIT_VECT;
 
+    if (nm_vmctl_start_prepare(name, flags, &argv, &tfds) == NM_OK) {
+        rc = nm_job_spawn(NULL, &argv, &tfds);
+        if ((rc = nm_vmctl_start_finish(name, &argv, &tfds, rc)) != NM_OK)
+            nm_vmctl_warn(_(NM_MSG_START_ERR));
+    }
+
+    nm_vect_free(&argv, NULL);
+    nm_vect_free(&tfds, NULL);
+
+    return rc;
+}
+
+/*
+ * QEMU is started by background job, main loop is not blocked
+ * while it allocates memory and opens drives.
+ */
+void nm_vmctl_start_job(const nm_str_t *name, int flags)
+{
+    nm_vmctl_start_t *start = nm_calloc(1, sizeof(nm_vmctl_start_t));
+    nm_str_t title = NM_INIT_STR;
+    nm_job_t *job;
+
+    if (nm_vmctl_start_prepare(name, flags, &start->argv, &start->tfds) != NM_OK) {
+        nm_vmctl_start_free(start);
+        return;
+    }
+
+    nm_str_copy(&start->name, name);
+    nm_str_format(&title, "start %s", name->data);
+    job = nm_job_new(&title, nm_vmctl_start_run, nm_vmctl_start_done,
+            start, nm_vmctl_start_free);
+    nm_job_add_vm(job, name);
+    nm_job_submit(job);
+
+    nm_str_free(&title);
+}
+
+/* Returns NM_ERR if there is nothing to run */
+static int nm_vmctl_start_prepare(const nm_str_t *name, int flags,
+                                  nm_vect_t *argv, nm_vect_t *tfds)
+{
+    nm_vmctl_data_t vm = NM_VMCTL_INIT_DATA;
+
+    /* drives of linked clones are backed by drives of this VM */
+    if (nm_vmctl_has_clones(name)) {
+        nm_vmctl_warn(_(NM_MSG_HAS_CLONES));
+        return NM_ERR;
+    }
+
     nm_vmctl_get_data(name, &vm);
 
-    /* check if VM is already installed */
-    if (nm_str_cmp_st(nm_vect_str(&vm.main, NM_SQL_INST), NM_ENABLE) == NM_OK) {
+    /* check if VM is already installed, nobody to ask in CLI mode */
+    if (nm_curses_active() &&
+            nm_str_cmp_st(nm_db_res_str(&vm.main, NM_SQL_INST), NM_ENABLE) == NM_OK) {
         int ch = nm_notify(_(NM_MSG_INST_CONF));
 
         if (ch == 'y') {
             flags &= ~NM_VMCTL_TEMP;
-            nm_str_t query = NM_INIT_STR;
-
-            nm_str_trunc(nm_vect_str(&vm.main, NM_SQL_INST), 0);
-            nm_str_add_text(nm_vect_str(&vm.main, NM_SQL_INST), NM_DISABLE);
-
-            nm_str_alloc_text(&query, "UPDATE vms SET install='0' WHERE name='");
-            nm_str_add_str(&query, name);
-            nm_str_add_char(&query, '\'');
-            nm_db_edit(query.data);
+            nm_db_edit_vm(NM_STMT_RESET_INSTALL, name->data);
 
-            nm_str_free(&query);
+            /* result cells are read-only, reload them */
+            nm_vmctl_free_data(&vm);
+            nm_vmctl_get_data(name, &vm);
         }
     }
 
-    nm_vmctl_gen_cmd(&argv, &vm, name, flags, &tfds);
-    if (argv.n_memb > 0) {
-        if (nm_spawn_process(&argv, NULL) != NM_OK) {
-            nm_str_t qmp_path = NM_INIT_STR;
-            struct stat qmp_info;
+    nm_vmctl_gen_cmd(argv, &vm, name, flags, tfds);
+    nm_vmctl_free_data(&vm);
 
-            nm_str_format(&qmp_path, "%s/%s/%s",
-                nm_cfg_get()->vm_dir.data, name->data, NM_VM_QMP_FILE);
+    return (argv->n_memb > 0) ? NM_OK : NM_ERR;
+}
 
-            /* must delete qmp sock file if exists */
-            if (stat(qmp_path.data, &qmp_info) != -1)
-                unlink(qmp_path.data);
+/* rc is the result of QEMU run */
+static int nm_vmctl_start_finish(const nm_str_t *name, const nm_vect_t *argv,
+                                 const nm_vect_t *tfds, int rc)
+{
+    nm_str_t buf = NM_INIT_STR;
+    int err;
 
-            nm_str_free(&qmp_path);
+    if (rc != NM_OK) {
+        struct stat qmp_info;
 
-            nm_warn(_(NM_MSG_START_ERR));
-        } else {
-            nm_cmd_str(&buf, &argv);
-            nm_debug("cmd=%s\n", buf.data);
-            nm_vmctl_log_last(&buf);
+        nm_str_format(&buf, "%s/%s/%s",
+            nm_cfg_get()->vm_dir.data, name->data, NM_VM_QMP_FILE);
 
-            /* close all tap file descriptors */
-            for (size_t n = 0; n < tfds.n_memb; n++)
-                close(*((int *) tfds.data[n]));
-        }
+        /* must delete qmp sock file if exists */
+        if (stat(buf.data, &qmp_info) != -1)
+            unlink(buf.data);
+    } else {
+        nm_cmd_str(&buf, argv);
+        nm_debug("cmd=%s\n", buf.data);
+        if ((err = nm_vmctl_log_last(&buf)) != 0)
+            nm_bug(_("%s: cannot write log: %s"), __func__, strerror(err));
     }
 
+    /* close all tap file descriptors, QEMU has its own copies */
+    for (size_t n = 0; n < tfds->n_memb; n++)
+        close(*((int *) tfds->data[n]));
+
     nm_str_free(&buf);
-    nm_vect_free(&argv, NULL);
-    nm_vect_free(&tfds, NULL);
-    nm_vmctl_free_data(&vm);
+
+    return rc;
+}
+
+/* Runs in job thread */
+static int nm_vmctl_start_run(nm_job_t *job)
+{
+    nm_vmctl_start_t *start = job->ctx;
+
+    return nm_job_spawn(job, &start->argv, &start->tfds);
+}
+
+static int nm_vmctl_start_done(nm_job_t *job, int rc)
+{
+    nm_vmctl_start_t *start = job->ctx;
+
+    rc = nm_vmctl_start_finish(&start->name, &start->argv, &start->tfds, rc);
+    /* error may be set already if log was not written */
+    if (rc != NM_OK && !nm_job_canceled(job) && !job->error.len)
+        nm_str_format(&job->error, _("start failed, error was logged"));
+
+    return rc;
+}
+
+static void nm_vmctl_start_free(void *ctx)
+{
+    nm_vmctl_start_t *start = ctx;
+
+    nm_str_free(&start->name);
+    nm_vect_free(&start->argv, NULL);
+    nm_vect_free(&start->tfds, NULL);
+    free(start);
+}
+
+/* Start is also called from command line, before ncurses is initialized */
+static void nm_vmctl_warn(const char *msg)
+{
+    if (nm_curses_active())
+        nm_warn(msg);
+    else
+        fprintf(stderr, "%s\n", msg);
 }
 
 void nm_vmctl_delete(const nm_str_t *name)
 {
     nm_str_t vmdir = NM_INIT_STR;
-    nm_str_t query = NM_INIT_STR;
     nm_vect_t drives = NM_INIT_VECT;
     nm_vect_t snaps = NM_INIT_VECT;
     int delete_ok = NM_TRUE;
 
     nm_str_format(&vmdir, "%s/%s/", nm_cfg_get()->vm_dir.data, name->data);
 
-    nm_str_format(&query, NM_SELECT_DRIVE_NAMES_SQL, name->data);
-    nm_db_select(query.data, &drives);
+    nm_db_select_vm(NM_STMT_SELECT_DRIVE_NAMES, name->data, &drives);
 
     for (size_t n = 0; n < drives.n_memb; n++) {
         nm_str_t img_path = NM_INIT_STR;
@@ -150,67 +304,73 @@ void nm_vmctl_delete(const nm_str_t *name)
 
     nm_vmctl_clear_tap(name);
 
-    nm_str_format(&query, NM_DEL_DRIVES_SQL, name->data);
-    nm_db_edit(query.data);
-
-    nm_str_format(&query, NM_DEL_VMSNAP_SQL, name->data);
-    nm_db_edit(query.data);
-
-    nm_str_format(&query, NM_DEL_IFS_SQL, name->data);
-    nm_db_edit(query.data);
-
-    nm_str_format(&query, NM_DEL_USB_SQL, name->data);
-    nm_db_edit(query.data);
-
-    nm_str_format(&query, NM_DEL_VM_SQL, name->data);
-    nm_db_edit(query.data);
+    /* drives, ifaces, usb and snapshots are removed by ON DELETE CASCADE */
+    nm_db_edit_vm(NM_STMT_DEL_VM, name->data);
 
     if (!delete_ok)
         nm_warn(_(NM_MSG_INC_DEL));
 
     nm_str_free(&vmdir);
-    nm_str_free(&query);
     nm_vect_free(&drives, nm_str_vect_free_cb);
     nm_vect_free(&snaps, nm_str_vect_free_cb);
 }
 
-void nm_vmctl_kill(const nm_str_t *name)
+/*
+ * Linked clones use drives of VM as backing files,
+ * such VM must not be started, renamed, deleted or lose a drive.
+ */
+bool nm_vmctl_has_clones(const nm_str_t *name)
+{
+    nm_vect_t clones = NM_INIT_VECT;
+    bool rc;
+
+    nm_db_select_vm(NM_STMT_VM_GET_CLONES, name->data, &clones);
+    rc = (clones.n_memb != 0);
+    nm_vect_free(&clones, nm_str_vect_free_cb);
+
+    return rc;
+}
+
+int nm_vmctl_kill(const nm_str_t *name)
 {
     pid_t pid;
-    int fd;
-    char buf[10];
+
+    if ((pid = nm_vmctl_get_pid(name)) <= 0 || kill(pid, SIGTERM) == -1)
+        return NM_ERR;
+
+    return NM_OK;
+}
+
+/* Returns PID of QEMU process from qemu.pid file or 0 */
+int nm_vmctl_get_pid(const nm_str_t *name)
+{
     nm_str_t pid_file = NM_INIT_STR;
+    char buf[16] = {0};
+    int fd, pid = 0;
 
     nm_str_format(&pid_file, "%s/%s/%s",
         nm_cfg_get()->vm_dir.data, name->data, NM_VM_PID_FILE);
 
-    if ((fd = open(pid_file.data, O_RDONLY)) == -1)
-        return;
-
-    if (read(fd, buf, sizeof(buf)) <= 0) {
-         close(fd);
-         return;
+    if ((fd = open(pid_file.data, O_RDONLY)) != -1) {
+        if (read(fd, buf, sizeof(buf) - 1) > 0)
+            pid = atoi(buf);
+        close(fd);
     }
 
-    pid = atoi(buf);
-    kill(pid, SIGTERM);
-
-    close(fd);
-
     nm_str_free(&pid_file);
+
+    return pid;
 }
 
 #if defined(NM_WITH_VNC_CLIENT) || defined(NM_WITH_SPICE)
 void nm_vmctl_connect(const nm_str_t *name)
 {
     nm_str_t cmd = NM_INIT_STR;
-    nm_str_t query = NM_INIT_STR;
     nm_vect_t res = NM_INIT_VECT;
     uint32_t port;
     int unused __attribute__((unused));
 
-    nm_str_format(&query, NM_VMCTL_GET_VNC_PORT_SQL, name->data);
-    nm_db_select(query.data, &res);
+    nm_db_select_vm(NM_STMT_VMCTL_GET_VNC_PORT, name->data, &res);
     port = nm_str_stoui(nm_vect_str(&res, 0), 10) + NM_STARTING_VNC_PORT;
 #if defined(NM_WITH_SPICE)
     if (nm_str_cmp_st(nm_vect_str(&res, 1), NM_ENABLE) == NM_OK) {
@@ -224,7 +384,6 @@ void nm_vmctl_connect(const nm_str_t *name)
     unused = system(cmd.data);
 
     nm_vect_free(&res, nm_str_vect_free_cb);
-    nm_str_free(&query);
     nm_str_free(&cmd);
 }
 #endif
@@ -238,111 +397,72 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
     size_t ifs_count = vm->ifs.n_memb / NM_IFS_IDX_COUNT;
     int scsi_added = NM_FALSE;
     nm_cpu_t cpu = NM_INIT_CPU;
+    uint32_t vnc_port;
     nm_str_t buf = NM_INIT_STR;
 
     nm_str_format(&vmdir, "%s/%s/", cfg->vm_dir.data, name->data);
 
     nm_str_format(&buf, "%s/%s%s",
         cfg->qemu_bin_path.data, "qemu-system-",
-        nm_vect_str(&vm->main, NM_SQL_ARCH)->data);
+        nm_db_res_str(&vm->main, NM_SQL_ARCH)->data);
     nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
 
     nm_vect_insert_cstr(argv, "-daemonize");
 
-    if (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_USBF), NM_ENABLE) == NM_OK) {
+    if (nm_str_cmp_st(nm_db_res_str(&vm->main, NM_SQL_USBF), NM_ENABLE) == NM_OK) {
         size_t usb_count = vm->usb.n_memb / NM_USB_IDX_COUNT;
         nm_vect_t usb_list = NM_INIT_VECT;
-        nm_vect_t serial_cache = NM_INIT_VECT;
         nm_str_t serial = NM_INIT_STR;
 
         nm_vect_insert_cstr(argv, "-usb");
         nm_vect_insert_cstr(argv, "-device");
 
-        if (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_USBT), NM_DEFAULT_USBVER) == NM_OK)
+        if (nm_str_cmp_st(nm_db_res_str(&vm->main, NM_SQL_USBT), NM_DEFAULT_USBVER) == NM_OK)
             nm_vect_insert_cstr(argv, "qemu-xhci,id=usbbus");
-        else if (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_USBT), *nm_form_usbtype) == NM_OK)
+        else if (nm_str_cmp_st(nm_db_res_str(&vm->main, NM_SQL_USBT), *nm_form_usbtype) == NM_OK)
             nm_vect_insert_cstr(argv, "usb-ehci,id=usbbus");
         else
             nm_vect_insert_cstr(argv, "nec-usb-xhci,id=usbbus");
 
+        /* device list and serials come from registry, no device I/O here */
         if (usb_count > 0)
             nm_usb_get_devs(&usb_list);
 
         for (size_t n = 0; n < usb_count; n++) {
-            int found_in_cache = 0;
-            int found_in_devs = 0;
             size_t idx_shift = NM_USB_IDX_COUNT * n;
-            nm_usb_dev_t *usb = NULL;
-
-            const char *vid = nm_vect_str_ctx(&vm->usb, NM_SQL_USB_VID + idx_shift);
-            const char *pid = nm_vect_str_ctx(&vm->usb, NM_SQL_USB_PID + idx_shift);
-            const char *ser = nm_vect_str_ctx(&vm->usb, NM_SQL_USB_SERIAL + idx_shift);
 
-            /* look for cached data first, libusb_open() is very expensive */
-            for (size_t m = 0; m < serial_cache.n_memb; m++) {
-                usb = *nm_usb_data_dev(serial_cache.data[m]);
-                nm_str_t *ser_str = nm_usb_data_serial(serial_cache.data[m]);
+            const char *vid = nm_db_res_cstr(&vm->usb, NM_SQL_USB_VID + idx_shift);
+            const char *pid = nm_db_res_cstr(&vm->usb, NM_SQL_USB_PID + idx_shift);
+            const char *ser = nm_db_res_cstr(&vm->usb, NM_SQL_USB_SERIAL + idx_shift);
 
-                if ((nm_str_cmp_st(nm_usb_vendor_id(usb), vid) == NM_OK) &&
-                    (nm_str_cmp_st(nm_usb_product_id(usb), pid) == NM_OK) &&
-                    (nm_str_cmp_st(ser_str, ser) == NM_OK)) {
-                    found_in_cache = 1;
-                    break;
-                }
-            }
-
-            if (found_in_cache && usb) {
-                nm_vect_insert_cstr(argv, "-device");
-                nm_str_format(&buf, "usb-host,hostbus=%d,hostaddr=%d,id=usb-%s-%s-%s,bus=usbbus.0",
-                    *nm_usb_bus_num(usb), *nm_usb_dev_addr(usb),
-                    nm_usb_vendor_id(usb)->data, nm_usb_product_id(usb)->data, ser);
-                nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
+            for (size_t m = 0; m < usb_list.n_memb; m++) {
+                const nm_usb_dev_t *usb = usb_list.data[m];
 
-                continue;
-            }
+                if ((nm_str_cmp_st(nm_usb_vendor_id(usb), vid) != NM_OK) ||
+                    (nm_str_cmp_st(nm_usb_product_id(usb), pid) != NM_OK))
+                    continue;
 
-            for (size_t m = 0; m < usb_list.n_memb; m++) {
-                usb = (nm_usb_dev_t *) usb_list.data[m];
-                if ((nm_str_cmp_st(nm_usb_vendor_id(usb), vid) == NM_OK) &&
-                    (nm_str_cmp_st(nm_usb_product_id(usb), pid) == NM_OK)) {
-                    if (serial.len)
-                        nm_str_trunc(&serial, 0);
-
-                    nm_usb_get_serial(usb, &serial);
-                    if (nm_str_cmp_st(&serial, ser) == NM_OK) {
-                        found_in_devs = 1;
-                        break;
-                    } else {
-                        /* save result in cache */
-                        nm_usb_data_t usb_data = NM_INIT_USB_DATA;
-                        nm_str_copy(&usb_data.serial, &serial);
-                        usb_data.dev = usb;
-                        nm_vect_insert(&serial_cache, &usb_data,
-                                sizeof(usb_data), nm_usb_data_vect_ins_cb);
-                        nm_str_free(&usb_data.serial);
-                    }
-                }
-            }
+                nm_str_free(&serial);
+                nm_usb_get_serial(usb, &serial);
+                if (nm_str_cmp_st(&serial, ser) != NM_OK)
+                    continue;
 
-            if (found_in_devs && usb) {
                 nm_vect_insert_cstr(argv, "-device");
                 nm_str_format(&buf, "usb-host,hostbus=%d,hostaddr=%d,id=usb-%s-%s-%s,bus=usbbus.0",
                     *nm_usb_bus_num(usb), *nm_usb_dev_addr(usb),
                     nm_usb_vendor_id(usb)->data, nm_usb_product_id(usb)->data, ser);
                 nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
-
-                continue;
+                break;
             }
         }
 
-        nm_vect_free(&serial_cache, nm_usb_data_vect_free_cb);
         nm_vect_free(&usb_list, nm_usb_vect_free_cb);
         nm_str_free(&serial);
     }
 
     /* setup install source */
-    if (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_INST), NM_ENABLE) == NM_OK) {
-        const char *iso = nm_vect_str_ctx(&vm->main, NM_SQL_ISO);
+    if (nm_str_cmp_st(nm_db_res_str(&vm->main, NM_SQL_INST), NM_ENABLE) == NM_OK) {
+        const char *iso = nm_db_res_cstr(&vm->main, NM_SQL_ISO);
         size_t srcp_len = strlen(iso);
 
         if ((srcp_len == 0) && (!(flags & NM_VMCTL_INFO))) {
@@ -365,7 +485,7 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
             nm_vect_insert_cstr(argv, "usb-storage,drive=usb0,bus=usbbus.0,bootindex=1");
         }
     } else { /* just mount cdrom */
-        const char *iso = nm_vect_str_ctx(&vm->main, NM_SQL_ISO);
+        const char *iso = nm_db_res_cstr(&vm->main, NM_SQL_ISO);
         size_t srcp_len = strlen(iso);
         struct stat info;
         int rc = -1;
@@ -390,9 +510,9 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
         int nvme_drv = NM_FALSE;
         int scsi_drv = NM_FALSE;
         size_t idx_shift = NM_DRV_IDX_COUNT * n;
-        const nm_str_t *drive_img = nm_vect_str(&vm->drives, NM_SQL_DRV_NAME + idx_shift);
-        const nm_str_t *blk_drv = nm_vect_str(&vm->drives, NM_SQL_DRV_TYPE + idx_shift);
-        const nm_str_t *discard = nm_vect_str(&vm->drives, NM_SQL_DRV_DISC + idx_shift);
+        const nm_str_t *drive_img = nm_db_res_str(&vm->drives, NM_SQL_DRV_NAME + idx_shift);
+        const nm_str_t *blk_drv = nm_db_res_str(&vm->drives, NM_SQL_DRV_TYPE + idx_shift);
+        const nm_str_t *discard = nm_db_res_str(&vm->drives, NM_SQL_DRV_DISC + idx_shift);
         const char *blk_drv_type = blk_drv->data;
 
         if (nm_str_cmp_st(blk_drv, "nvme") == NM_OK) {
@@ -432,33 +552,28 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
 
     /* load vm snapshot if exists */
     {
-        nm_str_t query = NM_INIT_STR;
         nm_vect_t snap_res = NM_INIT_VECT;
 
-        nm_str_format(&query, NM_GET_VMSNAP_LOAD_SQL, name->data);
-        nm_db_select(query.data, &snap_res);
+        nm_db_select_vm(NM_STMT_GET_VMSNAP_LOAD, name->data, &snap_res);
 
         if (snap_res.n_memb > 0) {
             nm_vect_insert_cstr(argv, "-loadvm");
             nm_vect_insert_cstr(argv, nm_vect_str_ctx(&snap_res, 0));
 
             /* reset load flag */
-            if (!(flags & NM_VMCTL_INFO)) {
-                nm_str_format(&query, NM_RESET_LOAD_SQL, name->data);
-                nm_db_edit(query.data);
-            }
+            if (!(flags & NM_VMCTL_INFO))
+                nm_db_edit_vm(NM_STMT_RESET_LOAD, name->data);
         }
 
-        nm_str_free(&query);
         nm_vect_free(&snap_res, nm_str_vect_free_cb);
     }
 
     nm_vect_insert_cstr(argv, "-m");
     nm_vect_insert(argv,
-        nm_vect_str(&vm->main, NM_SQL_MEM)->data,
-        nm_vect_str(&vm->main, NM_SQL_MEM)->len + 1, NULL);
+        nm_db_res_str(&vm->main, NM_SQL_MEM)->data,
+        nm_db_res_str(&vm->main, NM_SQL_MEM)->len + 1, NULL);
 
-    nm_parse_smp(&cpu, nm_vect_str_ctx(&vm->main, NM_SQL_SMP));
+    nm_parse_smp(&cpu, nm_db_res_cstr(&vm->main, NM_SQL_SMP));
     if (cpu.smp > 1) {
         nm_str_trunc(&buf, 0);
         nm_vect_insert_cstr(argv, "-smp");
@@ -480,21 +595,21 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
      * guest mount example:
      * mount -t 9p -o trans=virtio,version=9p2000.L hostshare /mnt/host
      */
-    if (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_9FLG), NM_ENABLE) == NM_OK) {
+    if (nm_str_cmp_st(nm_db_res_str(&vm->main, NM_SQL_9FLG), NM_ENABLE) == NM_OK) {
         nm_vect_insert_cstr(argv, "-fsdev");
         nm_str_format(&buf, "local,security_model=none,id=fsdev0,path=%s",
-            nm_vect_str(&vm->main, NM_SQL_9PTH)->data);
+            nm_db_res_str(&vm->main, NM_SQL_9PTH)->data);
         nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
 
         nm_vect_insert_cstr(argv, "-device");
         nm_str_format(&buf, "virtio-9p-pci,fsdev=fsdev0,mount_tag=%s",
-            nm_vect_str(&vm->main, NM_SQL_9ID)->data);
+            nm_db_res_str(&vm->main, NM_SQL_9ID)->data);
         nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
     }
 
-    if (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_KVM), NM_ENABLE) == NM_OK) {
+    if (nm_str_cmp_st(nm_db_res_str(&vm->main, NM_SQL_KVM), NM_ENABLE) == NM_OK) {
         nm_vect_insert_cstr(argv, "-enable-kvm");
-        if (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_HCPU), NM_ENABLE) == NM_OK) {
+        if (nm_str_cmp_st(nm_db_res_str(&vm->main, NM_SQL_HCPU), NM_ENABLE) == NM_OK) {
             nm_vect_insert_cstr(argv, "-cpu");
             nm_vect_insert_cstr(argv, "host");
         }
@@ -503,61 +618,59 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
     /* Save info about usb subsystem status at boot time.
      * Needed for USB hotplug feature. */
     if (!(flags & NM_VMCTL_INFO)) {
-        nm_str_t query = NM_INIT_STR;
-        nm_str_format(&query,
-                      NM_USB_UPDATE_STATE_SQL,
-                      nm_vect_str_ctx(&vm->main, NM_SQL_USBF),
-                      name->data);
-        nm_db_edit(query.data);
-        nm_str_free(&query);
+        nm_db_stmt_t *stmt = nm_db_stmt(NM_STMT_USB_UPDATE_STATE);
+
+        nm_db_bind_text(stmt, 1, name->data);
+        nm_db_bind_text(stmt, 2, nm_db_res_cstr(&vm->main, NM_SQL_USBF));
+        nm_db_stmt_exec(stmt);
     }
 
-    if (nm_vect_str_len(&vm->main, NM_SQL_BIOS)) {
+    if (nm_db_res_len(&vm->main, NM_SQL_BIOS)) {
         nm_vect_insert_cstr(argv, "-bios");
         nm_vect_insert(argv,
-            nm_vect_str(&vm->main, NM_SQL_BIOS)->data,
-            nm_vect_str(&vm->main, NM_SQL_BIOS)->len + 1, NULL);
+            nm_db_res_str(&vm->main, NM_SQL_BIOS)->data,
+            nm_db_res_str(&vm->main, NM_SQL_BIOS)->len + 1, NULL);
     }
 
-    if (nm_vect_str_len(&vm->main, NM_SQL_MACH)) {
+    if (nm_db_res_len(&vm->main, NM_SQL_MACH)) {
         nm_vect_insert_cstr(argv, "-M");
         nm_vect_insert(argv,
-            nm_vect_str(&vm->main, NM_SQL_MACH)->data,
-            nm_vect_str(&vm->main, NM_SQL_MACH)->len + 1, NULL);
+            nm_db_res_str(&vm->main, NM_SQL_MACH)->data,
+            nm_db_res_str(&vm->main, NM_SQL_MACH)->len + 1, NULL);
     }
 
-    if (nm_vect_str_len(&vm->main, NM_SQL_KERN)) {
+    if (nm_db_res_len(&vm->main, NM_SQL_KERN)) {
         nm_vect_insert_cstr(argv, "-kernel");
         nm_vect_insert(argv,
-            nm_vect_str(&vm->main, NM_SQL_KERN)->data,
-            nm_vect_str(&vm->main, NM_SQL_KERN)->len + 1, NULL);
+            nm_db_res_str(&vm->main, NM_SQL_KERN)->data,
+            nm_db_res_str(&vm->main, NM_SQL_KERN)->len + 1, NULL);
 
-        if (nm_vect_str_len(&vm->main, NM_SQL_KAPP)) {
+        if (nm_db_res_len(&vm->main, NM_SQL_KAPP)) {
             nm_vect_insert_cstr(argv, "-append");
             nm_vect_insert(argv,
-                nm_vect_str(&vm->main, NM_SQL_KAPP)->data,
-                nm_vect_str(&vm->main, NM_SQL_KAPP)->len + 1, NULL);
+                nm_db_res_str(&vm->main, NM_SQL_KAPP)->data,
+                nm_db_res_str(&vm->main, NM_SQL_KAPP)->len + 1, NULL);
         }
     }
 
-    if (nm_vect_str_len(&vm->main, NM_SQL_INIT)) {
+    if (nm_db_res_len(&vm->main, NM_SQL_INIT)) {
         nm_vect_insert_cstr(argv, "-initrd");
         nm_vect_insert(argv,
-            nm_vect_str(&vm->main, NM_SQL_INIT)->data,
-            nm_vect_str(&vm->main, NM_SQL_INIT)->len + 1, NULL);
+            nm_db_res_str(&vm->main, NM_SQL_INIT)->data,
+            nm_db_res_str(&vm->main, NM_SQL_INIT)->len + 1, NULL);
     }
 
-    if (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_OVER), NM_ENABLE) == NM_OK) {
+    if (nm_str_cmp_st(nm_db_res_str(&vm->main, NM_SQL_OVER), NM_ENABLE) == NM_OK) {
         nm_vect_insert_cstr(argv, "-device");
         nm_vect_insert_cstr(argv, "usb-tablet,bus=usbbus.0");
     }
 
     /* setup serial socket */
-    if (nm_vect_str_len(&vm->main, NM_SQL_SOCK)) {
+    if (nm_db_res_len(&vm->main, NM_SQL_SOCK)) {
         if (!(flags & NM_VMCTL_INFO)) {
             struct stat info;
 
-            if (stat(nm_vect_str_ctx(&vm->main, NM_SQL_SOCK), &info) != -1) {
+            if (stat(nm_db_res_cstr(&vm->main, NM_SQL_SOCK), &info) != -1) {
                 nm_warn(_(NM_MSG_SOCK_USED));
                 nm_vect_free(argv, NULL);
                 goto out;
@@ -566,7 +679,7 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
 
         nm_vect_insert_cstr(argv, "-chardev");
         nm_str_format(&buf, "socket,path=%s,server,nowait,id=socket_%s",
-            nm_vect_str(&vm->main, NM_SQL_SOCK)->data, name->data);
+            nm_db_res_str(&vm->main, NM_SQL_SOCK)->data, name->data);
         nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
 
         nm_vect_insert_cstr(argv, "-device");
@@ -575,21 +688,21 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
     }
 
     /* setup debug port for GDB */
-    if (nm_vect_str_len(&vm->main, NM_SQL_DEBP)) {
+    if (nm_db_res_len(&vm->main, NM_SQL_DEBP)) {
         nm_vect_insert_cstr(argv, "-gdb");
         nm_str_format(&buf, "tcp::%s",
-            nm_vect_str(&vm->main, NM_SQL_DEBP)->data);
+            nm_db_res_str(&vm->main, NM_SQL_DEBP)->data);
         nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
     }
-    if (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_DEBF), NM_ENABLE) == NM_OK)
+    if (nm_str_cmp_st(nm_db_res_str(&vm->main, NM_SQL_DEBF), NM_ENABLE) == NM_OK)
         nm_vect_insert_cstr(argv, "-S");
 
     /* setup serial TTY */
-    if (nm_vect_str_len(&vm->main, NM_SQL_TTY)) {
+    if (nm_db_res_len(&vm->main, NM_SQL_TTY)) {
         if (!(flags & NM_VMCTL_INFO)) {
             int fd;
 
-            if ((fd = open(nm_vect_str_ctx(&vm->main, NM_SQL_TTY), O_RDONLY)) == -1) {
+            if ((fd = open(nm_db_res_cstr(&vm->main, NM_SQL_TTY), O_RDONLY)) == -1) {
                 nm_warn(_(NM_MSG_TTY_MISS));
                 nm_vect_free(argv, NULL);
                 goto out;
@@ -605,7 +718,7 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
 
         nm_vect_insert_cstr(argv, "-chardev");
         nm_str_format(&buf, "tty,path=%s,id=tty_%s",
-            nm_vect_str(&vm->main, NM_SQL_TTY)->data,
+            nm_db_res_str(&vm->main, NM_SQL_TTY)->data,
             name->data);
         nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
 
@@ -621,18 +734,18 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
 
         nm_vect_insert_cstr(argv, "-device");
         nm_str_format(&buf, "%s,mac=%s,netdev=netdev%zu",
-            nm_vect_str(&vm->ifs, NM_SQL_IF_DRV + idx_shift)->data,
-            nm_vect_str(&vm->ifs, NM_SQL_IF_MAC + idx_shift)->data,
+            nm_db_res_str(&vm->ifs, NM_SQL_IF_DRV + idx_shift)->data,
+            nm_db_res_str(&vm->ifs, NM_SQL_IF_MAC + idx_shift)->data,
             n);
         nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
 
-        if (nm_str_cmp_st(nm_vect_str(&vm->ifs, NM_SQL_IF_USR + idx_shift),
+        if (nm_str_cmp_st(nm_db_res_str(&vm->ifs, NM_SQL_IF_USR + idx_shift),
             NM_ENABLE) == NM_OK) {
 #if defined (NM_OS_LINUX)
             if (!(flags & NM_VMCTL_INFO)) {
                 /* Delete iface if exists, we are in user mode */
                 uint32_t tap_idx = 0;
-                tap_idx = nm_net_iface_idx(nm_vect_str(&vm->ifs,
+                tap_idx = nm_net_iface_idx(nm_db_res_str(&vm->ifs,
                             NM_SQL_IF_NAME + idx_shift));
 
                 if (tap_idx != 0) { /* iface exist */
@@ -643,11 +756,11 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
                     nm_str_format(&tap_path, "/dev/tap%u", tap_idx);
                     if (stat(tap_path.data, &tap_info) == 0) {
                         /* iface is macvtap, delete it */
-                        nm_net_del_iface(nm_vect_str(&vm->ifs,
+                        nm_net_del_iface(nm_db_res_str(&vm->ifs,
                                     NM_SQL_IF_NAME + idx_shift));
                     } else {
                         /* iface is simple tap, delete it */
-                        nm_net_del_tap(nm_vect_str(&vm->ifs,
+                        nm_net_del_tap(nm_db_res_str(&vm->ifs,
                                     NM_SQL_IF_NAME + idx_shift));
                     }
                     nm_str_free(&tap_path);
@@ -658,27 +771,27 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
             nm_vect_insert_cstr(argv, "-netdev");
             nm_str_format(&buf, "user,id=netdev%zu", n);
 
-            if (nm_vect_str_len(&vm->ifs, NM_SQL_IF_FWD + idx_shift) != 0) {
+            if (nm_db_res_len(&vm->ifs, NM_SQL_IF_FWD + idx_shift) != 0) {
                 nm_str_append_format(&buf, ",hostfwd=%s",
-                        nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_FWD + idx_shift));
+                        nm_db_res_cstr(&vm->ifs, NM_SQL_IF_FWD + idx_shift));
             }
-            if (nm_vect_str_len(&vm->ifs, NM_SQL_IF_SMB + idx_shift) != 0) {
+            if (nm_db_res_len(&vm->ifs, NM_SQL_IF_SMB + idx_shift) != 0) {
                 nm_str_append_format(&buf, ",smb=%s",
-                        nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_SMB + idx_shift));
+                        nm_db_res_cstr(&vm->ifs, NM_SQL_IF_SMB + idx_shift));
             }
 
-        } else if (nm_str_cmp_st(nm_vect_str(&vm->ifs, NM_SQL_IF_MVT + idx_shift),
+        } else if (nm_str_cmp_st(nm_db_res_str(&vm->ifs, NM_SQL_IF_MVT + idx_shift),
             NM_DISABLE) == NM_OK) {
             nm_vect_insert_cstr(argv, "-netdev");
             nm_str_format(&buf, "tap,ifname=%s,script=no,downscript=no,id=netdev%zu",
-                nm_vect_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift)->data, n);
+                nm_db_res_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift)->data, n);
 
 #if defined (NM_OS_LINUX)
             /* Delete macvtap iface if exists, we using simple tap iface now.
              * We do not need to create tap interface: QEMU will create it itself. */
             if (!(flags & NM_VMCTL_INFO)) {
                 uint32_t tap_idx = 0;
-                tap_idx = nm_net_iface_idx(nm_vect_str(&vm->ifs,
+                tap_idx = nm_net_iface_idx(nm_db_res_str(&vm->ifs,
                     NM_SQL_IF_NAME + idx_shift));
 
                 if (tap_idx != 0) {
@@ -689,7 +802,7 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
                     nm_str_format(&tap_path, "/dev/tap%u", tap_idx);
                     if (stat(tap_path.data, &tap_info) == 0) {
                         /* iface is macvtap, delete it */
-                        nm_net_del_iface(nm_vect_str(&vm->ifs,
+                        nm_net_del_iface(nm_db_res_str(&vm->ifs,
                             NM_SQL_IF_NAME + idx_shift));
                     }
                     nm_str_free(&tap_path);
@@ -705,44 +818,43 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
                 uint32_t tap_idx = 0;
 
                 /* Delete simple tap iface if exists, we using macvtap iface now */
-                if ((tap_idx = nm_net_iface_idx(nm_vect_str(&vm->ifs,
+                if ((tap_idx = nm_net_iface_idx(nm_db_res_str(&vm->ifs,
                         NM_SQL_IF_NAME + idx_shift))) != 0) {
                     /* is this iface simple tap? */
                     struct stat tap_info;
                     nm_str_format(&tap_path, "/dev/tap%u", tap_idx);
                     if (stat(tap_path.data, &tap_info) != 0) {
                         /* iface is simple tap, delete it */
-                        nm_net_del_tap(nm_vect_str(&vm->ifs,
+                        nm_net_del_tap(nm_db_res_str(&vm->ifs,
                                                    NM_SQL_IF_NAME + idx_shift));
                     }
 
                     tap_idx = 0;
                 }
 
-                if (nm_net_iface_exists(nm_vect_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift)) != NM_OK) {
+                if (nm_net_iface_exists(nm_db_res_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift)) != NM_OK) {
                     wait_perm = 1;
-                    int macvtap_type = nm_str_stoui(nm_vect_str(&vm->ifs,
-                                                                NM_SQL_IF_MVT + idx_shift), 10);
+                    int macvtap_type = nm_db_res_int(&vm->ifs, NM_SQL_IF_MVT + idx_shift);
 
                     /* check for lower iface (parent) exists */
-                    if (nm_vect_str_len(&vm->ifs, NM_SQL_IF_PET + idx_shift) == 0) {
+                    if (nm_db_res_len(&vm->ifs, NM_SQL_IF_PET + idx_shift) == 0) {
                         nm_warn(_(NM_MSG_MTAP_NSET));
                         nm_vect_free(argv, NULL);
                         goto out;
                     }
 
-                    nm_net_add_macvtap(nm_vect_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift),
-                                       nm_vect_str(&vm->ifs, NM_SQL_IF_PET + idx_shift),
-                                       nm_vect_str(&vm->ifs, NM_SQL_IF_MAC + idx_shift),
+                    nm_net_add_macvtap(nm_db_res_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift),
+                                       nm_db_res_str(&vm->ifs, NM_SQL_IF_PET + idx_shift),
+                                       nm_db_res_str(&vm->ifs, NM_SQL_IF_MAC + idx_shift),
                                        macvtap_type);
 
-                    if (nm_vect_str_len(&vm->ifs, NM_SQL_IF_ALT + idx_shift) != 0) {
-                        nm_net_set_altname(nm_vect_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift),
-                                nm_vect_str(&vm->ifs, NM_SQL_IF_ALT + idx_shift));
+                    if (nm_db_res_len(&vm->ifs, NM_SQL_IF_ALT + idx_shift) != 0) {
+                        nm_net_set_altname(nm_db_res_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift),
+                                nm_db_res_str(&vm->ifs, NM_SQL_IF_ALT + idx_shift));
                     }
                 }
 
-                tap_idx = nm_net_iface_idx(nm_vect_str(&vm->ifs,
+                tap_idx = nm_net_iface_idx(nm_db_res_str(&vm->ifs,
                     NM_SQL_IF_NAME + idx_shift));
                 if (tap_idx == 0)
                     nm_bug("%s: MacVTap interface not found", __func__);
@@ -771,7 +883,8 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
                     }
                 }
 
-                tap_fd = open(tap_path.data, O_RDWR);
+                /* only QEMU inherits it, see nm_job_spawn() */
+                tap_fd = open(tap_path.data, O_RDWR | O_CLOEXEC);
                 if (tap_fd == -1)
                     nm_bug("%s: open failed: %s", __func__, strerror(errno));
                 if (tfds == NULL)
@@ -785,8 +898,8 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
                 n, (flags & NM_VMCTL_INFO) ? -1 : tap_fd);
 #endif /* NM_OS_LINUX */
         }
-        if ((nm_str_cmp_st(nm_vect_str(&vm->ifs, NM_SQL_IF_VHO + idx_shift), NM_ENABLE) == NM_OK) &&
-            (nm_str_cmp_st(nm_vect_str(&vm->ifs, NM_SQL_IF_USR + idx_shift), NM_DISABLE) == NM_OK))
+        if ((nm_str_cmp_st(nm_db_res_str(&vm->ifs, NM_SQL_IF_VHO + idx_shift), NM_ENABLE) == NM_OK) &&
+            (nm_str_cmp_st(nm_db_res_str(&vm->ifs, NM_SQL_IF_USR + idx_shift), NM_DISABLE) == NM_OK))
             nm_str_add_text(&buf, ",vhost=on");
         nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
 
@@ -794,25 +907,25 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
         /* Simple tap interface additional setup:
          * If we need to setup IPv4 address or altname we must create
          * the tap interface yourself. */
-        if ((nm_str_cmp_st(nm_vect_str(&vm->ifs, NM_SQL_IF_USR + idx_shift), NM_DISABLE) == NM_OK)) {
+        if ((nm_str_cmp_st(nm_db_res_str(&vm->ifs, NM_SQL_IF_USR + idx_shift), NM_DISABLE) == NM_OK)) {
             if ((!(flags & NM_VMCTL_INFO)) &&
-                    (nm_net_iface_exists(nm_vect_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift)) != NM_OK) &&
-                    (nm_str_cmp_st(nm_vect_str(&vm->ifs, NM_SQL_IF_MVT + idx_shift), NM_DISABLE) == NM_OK)) {
-                nm_net_add_tap(nm_vect_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift));
+                    (nm_net_iface_exists(nm_db_res_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift)) != NM_OK) &&
+                    (nm_str_cmp_st(nm_db_res_str(&vm->ifs, NM_SQL_IF_MVT + idx_shift), NM_DISABLE) == NM_OK)) {
+                nm_net_add_tap(nm_db_res_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift));
 
-                if (nm_vect_str_len(&vm->ifs, NM_SQL_IF_IP4 + idx_shift) != 0) {
-                    nm_net_set_ipaddr(nm_vect_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift),
-                            nm_vect_str(&vm->ifs, NM_SQL_IF_IP4 + idx_shift));
+                if (nm_db_res_len(&vm->ifs, NM_SQL_IF_IP4 + idx_shift) != 0) {
+                    nm_net_set_ipaddr(nm_db_res_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift),
+                            nm_db_res_str(&vm->ifs, NM_SQL_IF_IP4 + idx_shift));
                 }
-                if (nm_vect_str_len(&vm->ifs, NM_SQL_IF_ALT + idx_shift) != 0) {
-                    nm_net_set_altname(nm_vect_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift),
-                            nm_vect_str(&vm->ifs, NM_SQL_IF_ALT + idx_shift));
+                if (nm_db_res_len(&vm->ifs, NM_SQL_IF_ALT + idx_shift) != 0) {
+                    nm_net_set_altname(nm_db_res_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift),
+                            nm_db_res_str(&vm->ifs, NM_SQL_IF_ALT + idx_shift));
                 }
             }
         }
 #elif defined (NM_OS_FREEBSD)
-        if (nm_net_iface_exists(nm_vect_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift)) == NM_OK) {
-            nm_net_del_tap(nm_vect_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift));
+        if (nm_net_iface_exists(nm_db_res_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift)) == NM_OK) {
+            nm_net_del_tap(nm_db_res_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift));
         }
         (void) tfds;
 #endif /* NM_OS_LINUX */
@@ -832,9 +945,10 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
     nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
 
     /* Check if vnc/spice port is available, generate new one if not */
+    vnc_port = nm_db_res_int(&vm->main, NM_SQL_VNC);
     if (!(flags & NM_VMCTL_INFO)) {
         uint32_t in_addr = cfg->listen_any ? INADDR_ANY : INADDR_LOOPBACK;
-        uint32_t curr_port = nm_str_stoui(nm_vect_str(&vm->main, NM_SQL_VNC), 10) + NM_STARTING_VNC_PORT;
+        uint32_t curr_port = vnc_port + NM_STARTING_VNC_PORT;
         if (curr_port > 0xffff)
             nm_bug("%s: port number overflow", __func__);
 
@@ -859,26 +973,25 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
                     break;
             }
 
-            nm_str_format(nm_vect_str(&vm->main, NM_SQL_VNC), "%u", curr_port - NM_STARTING_VNC_PORT);
-            nm_str_t query = NM_INIT_STR;
-            nm_str_format(&query, "UPDATE vms SET vnc='%u' WHERE name='%s'",
-                curr_port - NM_STARTING_VNC_PORT, nm_vect_str_ctx(&vm->main, NM_SQL_NAME));
-            nm_db_edit(query.data);
+            vnc_port = curr_port - NM_STARTING_VNC_PORT;
+            nm_db_stmt_t *stmt = nm_db_stmt(NM_STMT_VM_SET_VNC);
+            nm_db_bind_text(stmt, 1, nm_db_res_cstr(&vm->main, NM_SQL_NAME));
+            nm_db_bind_int(stmt, 2, vnc_port);
+            nm_db_stmt_exec(stmt);
 
             if (occupied_ports)
                 free(occupied_ports);
-            nm_str_free(&query);
             nm_vect_free(&vms_ports, nm_str_vect_free_cb);
         }
     }
 
 #if defined (NM_WITH_SPICE)
-    if (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_SPICE), NM_ENABLE) == NM_OK) {
+    if (nm_str_cmp_st(nm_db_res_str(&vm->main, NM_SQL_SPICE), NM_ENABLE) == NM_OK) {
         nm_vect_insert_cstr(argv, "-vga");
-        nm_vect_insert_cstr(argv, (nm_vect_str(&vm->main, NM_SQL_DISPLAY))->data);
+        nm_vect_insert_cstr(argv, (nm_db_res_str(&vm->main, NM_SQL_DISPLAY))->data);
         nm_vect_insert_cstr(argv, "-spice");
         nm_str_format(&buf, "port=%u,disable-ticketing",
-            nm_str_stoui(nm_vect_str(&vm->main, NM_SQL_VNC), 10) + NM_STARTING_VNC_PORT);
+            vnc_port + NM_STARTING_VNC_PORT);
         if (!cfg->listen_any)
             nm_str_append_format(&buf, ",addr=127.0.0.1");
         nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
@@ -889,16 +1002,16 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
         nm_str_format(&buf, ":");
     else
         nm_str_format(&buf, "127.0.0.1:");
-    nm_str_add_str(&buf, nm_vect_str(&vm->main, NM_SQL_VNC));
+    nm_str_append_format(&buf, "%u", vnc_port);
     nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
 #if defined (NM_WITH_SPICE)
     }
 #endif
 
-    if (nm_vect_str_len(&vm->main, NM_SQL_ARGS)) {
+    if (nm_db_res_len(&vm->main, NM_SQL_ARGS)) {
         nm_vect_t args = NM_INIT_VECT;
 
-        nm_str_append_to_vect(nm_vect_str(&vm->main, NM_SQL_ARGS), &args, " ");
+        nm_str_append_to_vect(nm_db_res_str(&vm->main, NM_SQL_ARGS), &args, " ");
 
         for (size_t n = 0; n < args.n_memb; n++)
             nm_vect_insert_cstr(argv, args.data[n]);
@@ -932,14 +1045,14 @@ nm_str_t nm_vmctl_info(const nm_str_t *name)
         status == NM_OK ? "running" : "stopped");
 
     nm_str_append_format(&info, "%-12s%s\n", "arch: ",
-        nm_vect_str_ctx(&vm.main, NM_SQL_ARCH));
+        nm_db_res_cstr(&vm.main, NM_SQL_ARCH));
     nm_str_append_format(&info, "%-12s%s\n", "cores: ",
-        nm_vect_str_ctx(&vm.main, NM_SQL_SMP));
+        nm_db_res_cstr(&vm.main, NM_SQL_SMP));
     nm_str_append_format(&info, "%-12s%s Mb\n","memory: ",
-        nm_vect_str_ctx(&vm.main, NM_SQL_MEM));
+        nm_db_res_cstr(&vm.main, NM_SQL_MEM));
 
-    if (nm_str_cmp_st(nm_vect_str(&vm.main, NM_SQL_KVM), NM_ENABLE) == NM_OK) {
-        if (nm_str_cmp_st(nm_vect_str(&vm.main, NM_SQL_HCPU), NM_ENABLE) == NM_OK)
+    if (nm_str_cmp_st(nm_db_res_str(&vm.main, NM_SQL_KVM), NM_ENABLE) == NM_OK) {
+        if (nm_str_cmp_st(nm_db_res_str(&vm.main, NM_SQL_HCPU), NM_ENABLE) == NM_OK)
             nm_str_append_format(&info, "%-12s%s\n", "kvm: ", "enabled [+hostcpu]");
         else
             nm_str_append_format(&info, "%-12s%s\n", "kvm: ", "enabled");
@@ -947,16 +1060,16 @@ nm_str_t nm_vmctl_info(const nm_str_t *name)
         nm_str_append_format(&info, "%-12s%s\n", "kvm: ", "disabled");
     }
 
-    if (nm_str_cmp_st(nm_vect_str(&vm.main, NM_SQL_USBF), "1") == NM_OK) {
+    if (nm_str_cmp_st(nm_db_res_str(&vm.main, NM_SQL_USBF), "1") == NM_OK) {
         nm_str_append_format(&info, "%-12s%s [%s]\n", "usb: ", "enabled",
-            nm_vect_str_ctx(&vm.main, NM_SQL_USBT));
+            nm_db_res_cstr(&vm.main, NM_SQL_USBT));
     } else {
         nm_str_append_format(&info, "%-12s%s\n", "usb: ", "disabled");
     }
 
     nm_str_append_format(&info, "%-12s%s [%u]\n", "vnc port: ",
-        nm_vect_str_ctx(&vm.main, NM_SQL_VNC),
-        nm_str_stoui(nm_vect_str(&vm.main, NM_SQL_VNC), 10) + NM_STARTING_VNC_PORT);
+        nm_db_res_cstr(&vm.main, NM_SQL_VNC),
+        (uint32_t) nm_db_res_int(&vm.main, NM_SQL_VNC) + NM_STARTING_VNC_PORT);
 
     ifs_count = vm.ifs.n_memb / NM_IFS_IDX_COUNT;
     for (size_t n = 0; n < ifs_count; n++) {
@@ -964,10 +1077,10 @@ nm_str_t nm_vmctl_info(const nm_str_t *name)
 
         nm_str_append_format(&info, "eth%zu%-8s%s [%s %s%s]\n",
             n, ":",
-            nm_vect_str_ctx(&vm.ifs, NM_SQL_IF_NAME + idx_shift),
-            nm_vect_str_ctx(&vm.ifs, NM_SQL_IF_MAC + idx_shift),
-            nm_vect_str_ctx(&vm.ifs, NM_SQL_IF_DRV + idx_shift),
-            (nm_str_cmp_st(nm_vect_str(&vm.ifs, NM_SQL_IF_VHO + idx_shift),
+            nm_db_res_cstr(&vm.ifs, NM_SQL_IF_NAME + idx_shift),
+            nm_db_res_cstr(&vm.ifs, NM_SQL_IF_MAC + idx_shift),
+            nm_db_res_cstr(&vm.ifs, NM_SQL_IF_DRV + idx_shift),
+            (nm_str_cmp_st(nm_db_res_str(&vm.ifs, NM_SQL_IF_VHO + idx_shift),
                 NM_ENABLE) == NM_OK) ? "+vhost" : "");
     }
 
@@ -976,103 +1089,93 @@ nm_str_t nm_vmctl_info(const nm_str_t *name)
         size_t idx_shift = NM_DRV_IDX_COUNT * n;
         int boot = 0;
 
-        if (nm_str_cmp_st(nm_vect_str(&vm.drives, NM_SQL_DRV_BOOT + idx_shift),
+        if (nm_str_cmp_st(nm_db_res_str(&vm.drives, NM_SQL_DRV_BOOT + idx_shift),
                 NM_ENABLE) == NM_OK)
             boot = 1;
 
         nm_str_append_format(&info, "disk%zu%-7s%s [%sGb %s] %s\n", n, ":",
-            nm_vect_str_ctx(&vm.drives, NM_SQL_DRV_NAME + idx_shift),
-            nm_vect_str_ctx(&vm.drives, NM_SQL_DRV_SIZE + idx_shift),
-            nm_vect_str_ctx(&vm.drives, NM_SQL_DRV_TYPE + idx_shift),
+            nm_db_res_cstr(&vm.drives, NM_SQL_DRV_NAME + idx_shift),
+            nm_db_res_cstr(&vm.drives, NM_SQL_DRV_SIZE + idx_shift),
+            nm_db_res_cstr(&vm.drives, NM_SQL_DRV_TYPE + idx_shift),
             boot ? "*" : "");
     }
 
-    if (nm_str_cmp_st(nm_vect_str(&vm.main, NM_SQL_9FLG), "1") == NM_OK) {
+    if (nm_str_cmp_st(nm_db_res_str(&vm.main, NM_SQL_9FLG), "1") == NM_OK) {
         nm_str_append_format(&info, "%-12s%s [%s]\n", "9pfs: ",
-            nm_vect_str_ctx(&vm.main, NM_SQL_9PTH),
-            nm_vect_str_ctx(&vm.main, NM_SQL_9ID));
+            nm_db_res_cstr(&vm.main, NM_SQL_9PTH),
+            nm_db_res_cstr(&vm.main, NM_SQL_9ID));
     }
 
-    if (nm_vect_str_len(&vm.main, NM_SQL_MACH))
+    if (nm_db_res_len(&vm.main, NM_SQL_MACH))
         nm_str_append_format(&info, "%-12s%s\n", "machine: ",
-            nm_vect_str_ctx(&vm.main, NM_SQL_MACH));
+            nm_db_res_cstr(&vm.main, NM_SQL_MACH));
 
-    if (nm_vect_str_len(&vm.main, NM_SQL_BIOS))
+    if (nm_db_res_len(&vm.main, NM_SQL_BIOS))
         nm_str_append_format(&info,"%-12s%s\n", "bios: ",
-            nm_vect_str_ctx(&vm.main, NM_SQL_BIOS));
+            nm_db_res_cstr(&vm.main, NM_SQL_BIOS));
 
-    if (nm_vect_str_len(&vm.main, NM_SQL_KERN))
+    if (nm_db_res_len(&vm.main, NM_SQL_KERN))
         nm_str_append_format(&info,"%-12s%s\n", "kernel: ",
-            nm_vect_str_ctx(&vm.main, NM_SQL_KERN));
+            nm_db_res_cstr(&vm.main, NM_SQL_KERN));
 
-    if (nm_vect_str_len(&vm.main, NM_SQL_KAPP))
+    if (nm_db_res_len(&vm.main, NM_SQL_KAPP))
         nm_str_append_format(&info, "%-12s%s\n", "cmdline: ",
-            nm_vect_str_ctx(&vm.main, NM_SQL_KAPP));
+            nm_db_res_cstr(&vm.main, NM_SQL_KAPP));
 
-    if (nm_vect_str_len(&vm.main, NM_SQL_INIT))
+    if (nm_db_res_len(&vm.main, NM_SQL_INIT))
         nm_str_append_format(&info, "%-12s%s\n", "initrd: ",
-            nm_vect_str_ctx(&vm.main, NM_SQL_INIT));
+            nm_db_res_cstr(&vm.main, NM_SQL_INIT));
 
-    if (nm_vect_str_len(&vm.main, NM_SQL_TTY))
+    if (nm_db_res_len(&vm.main, NM_SQL_TTY))
         nm_str_append_format(&info, "%-12s%s\n", "tty: ",
-            nm_vect_str_ctx(&vm.main, NM_SQL_TTY));
+            nm_db_res_cstr(&vm.main, NM_SQL_TTY));
 
-    if (nm_vect_str_len(&vm.main, NM_SQL_SOCK))
+    if (nm_db_res_len(&vm.main, NM_SQL_SOCK))
         nm_str_append_format(&info, "%-12s%s\n", "socket: ",
-            nm_vect_str_ctx(&vm.main, NM_SQL_SOCK));
+            nm_db_res_cstr(&vm.main, NM_SQL_SOCK));
 
-    if (nm_vect_str_len(&vm.main, NM_SQL_DEBP))
+    if (nm_db_res_len(&vm.main, NM_SQL_DEBP))
         nm_str_append_format(&info, "%-12s%s\n", "gdb port: ",
-            nm_vect_str_ctx(&vm.main, NM_SQL_DEBP));
+            nm_db_res_cstr(&vm.main, NM_SQL_DEBP));
 
-    if (nm_str_cmp_st(nm_vect_str(&vm.main, NM_SQL_DEBF), NM_ENABLE) == NM_OK)
+    if (nm_str_cmp_st(nm_db_res_str(&vm.main, NM_SQL_DEBF), NM_ENABLE) == NM_OK)
         nm_str_append_format(&info, "%-12s\n", "freeze cpu: yes");
 
-    if (nm_vect_str_len(&vm.main, NM_SQL_ARGS))
+    if (nm_db_res_len(&vm.main, NM_SQL_ARGS))
         nm_str_append_format(&info,"%-12s%s\n", "extra args: ",
-            nm_vect_str_ctx(&vm.main, NM_SQL_ARGS));
+            nm_db_res_cstr(&vm.main, NM_SQL_ARGS));
 
     for (size_t n = 0; n < ifs_count; n++) {
         size_t idx_shift = NM_IFS_IDX_COUNT * n;
 
-        if (!nm_vect_str_len(&vm.ifs, NM_SQL_IF_IP4 + idx_shift))
+        if (!nm_db_res_len(&vm.ifs, NM_SQL_IF_IP4 + idx_shift))
             continue;
 
         nm_str_append_format(&info, "%-12s%s [%s]\n", "host IP: ",
-            nm_vect_str_ctx(&vm.ifs, NM_SQL_IF_NAME + idx_shift),
-            nm_vect_str_ctx(&vm.ifs, NM_SQL_IF_IP4 + idx_shift));
+            nm_db_res_cstr(&vm.ifs, NM_SQL_IF_NAME + idx_shift),
+            nm_db_res_cstr(&vm.ifs, NM_SQL_IF_IP4 + idx_shift));
     }
 
     if (status == NM_OK) {
-        int fd;
-        nm_str_t pid_path = NM_INIT_STR;
-
-        nm_str_format(&pid_path, "%s/%s/%s",
-            nm_cfg_get()->vm_dir.data, name->data, NM_VM_PID_FILE);
+        int pid_num = nm_vmctl_get_pid(name);
 
-        if ((fd = open(pid_path.data, O_RDONLY)) != -1) {
-            char pid[10];
-            ssize_t nread;
-
-            if ((nread = read(fd, pid, sizeof(pid))) > 0) {
-                pid[nread - 1] = '\0';
-                int pid_num = atoi(pid);
-                nm_str_append_format(&info, "%-12s%d\n", "pid: ", pid_num);
+        if (pid_num > 0) {
+            nm_str_append_format(&info, "%-12s%d\n", "pid: ", pid_num);
 #if defined (NM_OS_LINUX)
-                struct timespec ts;
-                memset(&ts, 0, sizeof(ts));
-                ts.tv_nsec = 1e+8; // 0.1 s
+            nm_stat_t stat = NM_INIT_STAT;
 
-                nm_stat_get_usage(pid_num);
-                nanosleep(&ts, NULL);
-                double usage = nm_stat_get_usage(pid_num);
+            if (nm_stat_get(pid_num, &stat) != NM_OK || !stat.ready) {
+                /* not sampled by nm_vmctl_info_sample(), measure it alone */
+                nm_stat_watch(pid_num);
+                nm_vmctl_info_sample(NULL);
+                nm_stat_get(pid_num, &stat);
+            }
 
-                nm_str_append_format(&info, "%-12s%0.1f%%\n", "cpu usage: ", usage);
+            nm_str_append_format(&info, "%-12s%0.1f%%\n", "cpu usage: ", stat.cpu);
+            nm_str_append_format(&info, "%-12s%0.1f MiB\n", "memory: ",
+                (double) stat.rss / (1024 * 1024));
 #endif
-            }
-            close(fd);
         }
-        nm_str_free(&pid_path);
     }
 
     nm_vmctl_free_data(&vm);
@@ -1080,29 +1183,55 @@ nm_str_t nm_vmctl_info(const nm_str_t *name)
     return info;
 }
 
+/*
+ * Take two usage samples of running VMs with one delay for all of them,
+ * so nm_vmctl_info() does not wait for every VM.
+ * names - list of C strings, NULL - sample already watched processes.
+ */
+void nm_vmctl_info_sample(const nm_vect_t *names)
+{
+#if defined (NM_OS_LINUX)
+    struct timespec ts = { .tv_sec = 0, .tv_nsec = 1e+8 }; /* 0.1 s */
+
+    for (size_t n = 0; names && n < names->n_memb; n++) {
+        nm_str_t name = NM_INIT_STR;
+
+        nm_str_alloc_text(&name, nm_vect_at(names, n));
+        nm_stat_watch(nm_vmctl_get_pid(&name));
+        nm_str_free(&name);
+    }
+
+    nm_stat_sample();
+    nanosleep(&ts, NULL);
+    nm_stat_sample();
+#else
+    (void) names;
+#endif
+}
+
 void nm_vmctl_free_data(nm_vmctl_data_t *vm)
 {
-    nm_vect_free(&vm->main, nm_str_vect_free_cb);
-    nm_vect_free(&vm->ifs, nm_str_vect_free_cb);
-    nm_vect_free(&vm->drives, nm_str_vect_free_cb);
-    nm_vect_free(&vm->usb, nm_str_vect_free_cb);
+    nm_db_result_free(&vm->main);
+    nm_db_result_free(&vm->ifs);
+    nm_db_result_free(&vm->drives);
+    nm_db_result_free(&vm->usb);
 }
 
-void nm_vmctl_log_last(const nm_str_t *msg)
+/* Returns 0 or errno value, caller reports it */
+int nm_vmctl_log_last(const nm_str_t *msg)
 {
     FILE *fp;
     const nm_cfg_t *cfg = nm_cfg_get();
 
     if ((msg->len == 0) || (!cfg->log_enabled))
-        return;
+        return 0;
 
-    if ((fp = fopen(cfg->log_path.data, "w+")) == NULL) {
-        nm_bug(_("%s: cannot open file %s:%s"),
-            __func__, cfg->log_path.data, strerror(errno));
-    }
+    if ((fp = fopen(cfg->log_path.data, "w+")) == NULL)
+        return errno;
 
     fprintf(fp, "%s\n", msg->data);
-    fclose(fp);
+
+    return (fclose(fp) != 0) ? errno : 0;
 }
 
 void nm_vmctl_clear_tap(const nm_str_t *name)
@@ -1133,7 +1262,6 @@ void nm_vmctl_clear_all_tap(void)
 static int nm_vmctl_clear_tap_vect(const nm_vect_t *vms)
 {
     nm_str_t lock_path = NM_INIT_STR;
-    nm_str_t query = NM_INIT_STR;
     int clear_done = 0;
 
     for (size_t n = 0; n < vms->n_memb; n++) {
@@ -1147,8 +1275,7 @@ static int nm_vmctl_clear_tap_vect(const nm_vect_t *vms)
         if (stat(lock_path.data, &file_info) == 0)
             continue;
 
-        nm_str_format(&query, NM_VM_GET_IFACES_SQL, nm_vect_str_ctx(vms, n));
-        nm_db_select(query.data, &ifaces);
+        nm_db_select_vm(NM_STMT_VM_GET_IFACES, nm_vect_str_ctx(vms, n), &ifaces);
         ifs_count = ifaces.n_memb / NM_IFS_IDX_COUNT;
 
         for (size_t ifn = 0; ifn < ifs_count; ifn++) {
@@ -1164,11 +1291,9 @@ static int nm_vmctl_clear_tap_vect(const nm_vect_t *vms)
         }
 
         nm_str_trunc(&lock_path, 0);
-        nm_str_trunc(&query, 0);
         nm_vect_free(&ifaces, nm_str_vect_free_cb);
     }
 
-    nm_str_free(&query);
     nm_str_free(&lock_path);
 
     return clear_done;
@@ -3,6 +3,7 @@
 
 #include <nm_string.h>
 #include <nm_vector.h>
+#include <nm_database.h>
 
 static const uint32_t NM_STARTING_VNC_PORT = 5900;
 
@@ -12,27 +13,33 @@ enum vmctl_flags {
 };
 
 typedef struct {
-    nm_vect_t main;
-    nm_vect_t ifs;
-    nm_vect_t drives;
-    nm_vect_t usb;
+    nm_db_result_t main;
+    nm_db_result_t ifs;
+    nm_db_result_t drives;
+    nm_db_result_t usb;
 } nm_vmctl_data_t;
 
 #define NM_VMCTL_INIT_DATA (nm_vmctl_data_t) { \
-                            NM_INIT_VECT, NM_INIT_VECT, \
-                            NM_INIT_VECT, NM_INIT_VECT }
+                            NM_INIT_DB_RESULT, NM_INIT_DB_RESULT, \
+                            NM_INIT_DB_RESULT, NM_INIT_DB_RESULT }
 
-void nm_vmctl_start(const nm_str_t *name, int flags);
+int nm_vmctl_start(const nm_str_t *name, int flags);
+void nm_vmctl_start_job(const nm_str_t *name, int flags);
 void nm_vmctl_delete(const nm_str_t *name);
-void nm_vmctl_kill(const nm_str_t *name);
+bool nm_vmctl_has_clones(const nm_str_t *name);
+int nm_vmctl_kill(const nm_str_t *name);
 void nm_vmctl_get_data(const nm_str_t *name, nm_vmctl_data_t *vm);
+const nm_vmctl_data_t *nm_vmctl_get_cached(const nm_str_t *name);
+void nm_vmctl_cache_free(void);
 void nm_vmctl_free_data(nm_vmctl_data_t *vm);
 void nm_vmctl_clear_tap(const nm_str_t *name);
 void nm_vmctl_clear_all_tap(void);
 void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
     const nm_str_t *name, int flags, nm_vect_t *tfds);
 nm_str_t nm_vmctl_info(const nm_str_t *name);
-void nm_vmctl_log_last(const nm_str_t *msg);
+void nm_vmctl_info_sample(const nm_vect_t *names);
+int nm_vmctl_get_pid(const nm_str_t *name);
+int nm_vmctl_log_last(const nm_str_t *msg);
 #if defined(NM_WITH_VNC_CLIENT) || defined(NM_WITH_SPICE)
 void nm_vmctl_connect(const nm_str_t *name);
 #endif
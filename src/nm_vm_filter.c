@@ -0,0 +1,526 @@
+#include <nm_core.h>
+#include <nm_menu.h>
+#include <nm_utils.h>
+#include <nm_string.h>
+#include <nm_vector.h>
+#include <nm_database.h>
+#include <nm_vm_status.h>
+#include <nm_vm_filter.h>
+
+#include <ctype.h>
+
+/*
+ * VM list search.
+ * Properties of all VMs are read by two queries when VM list is
+ * loaded and kept as one lowercase record per VM:
+ * "name\ngroup\nip...\nmac...\niso", so typing in search does not
+ * touch the database. Query is a list of terms separated by spaces,
+ * every term must match:
+ *   text       - substring of any field, or fuzzy: characters
+ *                of text appear in one field in the same order
+ *   key:text   - substring of name, group (g), ip, mac or iso
+ *   state:text - running or stopped, prefix is enough
+ *   mem>N      - memory in MiB (N may end with g), cpu>N - CPU count,
+ *                operators are < <= > >= and = or :
+ * Substring matches are listed before fuzzy ones, both in name order.
+ * When query is extended while typing, only previous matches are checked.
+ * VM status change invalidates the matches, state: terms depend on it.
+ */
+
+enum {
+    NM_VM_FILTER_NAME = 0,
+    NM_VM_FILTER_GROUP,
+    NM_VM_FILTER_IP,
+    NM_VM_FILTER_MAC,
+    NM_VM_FILTER_ISO,
+    NM_VM_FILTER_FIELDS,
+    NM_VM_FILTER_TEXT = NM_VM_FILTER_FIELDS, /* any field */
+    NM_VM_FILTER_STATE,
+    NM_VM_FILTER_MEM,
+    NM_VM_FILTER_CPU,
+    NM_VM_FILTER_SKIP                       /* number is not typed yet */
+};
+
+enum {
+    NM_VM_FILTER_EQ = 0,
+    NM_VM_FILTER_LT,
+    NM_VM_FILTER_LE,
+    NM_VM_FILTER_GT,
+    NM_VM_FILTER_GE
+};
+
+enum {
+    NM_VM_FILTER_NO = 0,
+    NM_VM_FILTER_EXACT,
+    NM_VM_FILTER_FUZZY
+};
+
+enum {
+    NM_VM_FILTER_TERMS = 16
+};
+
+/* columns of NM_VM_FILTER_LIST_SQL */
+enum {
+    NM_VM_FILTER_SQL_NAME = 0,
+    NM_VM_FILTER_SQL_GROUP,
+    NM_VM_FILTER_SQL_ISO,
+    NM_VM_FILTER_SQL_MEM,
+    NM_VM_FILTER_SQL_SMP
+};
+
+/* columns of NM_VM_FILTER_IFACES_SQL */
+enum {
+    NM_VM_FILTER_SQL_IF_VM = 0,
+    NM_VM_FILTER_SQL_IF_IP4,
+    NM_VM_FILTER_SQL_IF_MAC
+};
+
+typedef struct {
+    size_t off[NM_VM_FILTER_FIELDS + 1]; /* last one is the end of record */
+    uint64_t chars;                      /* characters of record */
+    int64_t mem;
+    int64_t cpu;
+} nm_vm_filter_rec_t;
+
+typedef struct {
+    int key;
+    int op;
+    const char *text;
+    size_t len;
+    uint64_t chars;
+    int64_t num;
+} nm_vm_filter_term_t;
+
+static const struct {
+    const char *name;
+    int key;
+} nm_vm_filter_keys[] = {
+    { "name",  NM_VM_FILTER_NAME },
+    { "group", NM_VM_FILTER_GROUP },
+    { "g",     NM_VM_FILTER_GROUP },
+    { "ip",    NM_VM_FILTER_IP },
+    { "mac",   NM_VM_FILTER_MAC },
+    { "iso",   NM_VM_FILTER_ISO },
+    { "state", NM_VM_FILTER_STATE },
+    { "mem",   NM_VM_FILTER_MEM },
+    { "cpu",   NM_VM_FILTER_CPU },
+    { "smp",   NM_VM_FILTER_CPU }
+};
+
+static nm_vm_filter_rec_t *nm_vm_filter_recs;
+static size_t nm_vm_filter_count;
+static nm_str_t nm_vm_filter_text;      /* records of all VMs */
+static size_t *nm_vm_filter_match;      /* matched VMs in name order */
+static uint8_t *nm_vm_filter_fuzzy;
+static size_t nm_vm_filter_matched;
+static nm_str_t nm_vm_filter_query;     /* query of the matches */
+static bool nm_vm_filter_valid;
+
+static void nm_vm_filter_add(const char *src, char sep);
+static uint64_t nm_vm_filter_chars(const char *text);
+static size_t nm_vm_filter_parse(char *query, nm_vm_filter_term_t *terms);
+static void nm_vm_filter_term(const char *src, nm_vm_filter_term_t *term);
+static bool nm_vm_filter_narrows(const char *query);
+static int nm_vm_filter_test(size_t idx, const nm_vect_t *items,
+                             const nm_vm_filter_term_t *terms, size_t count);
+static bool nm_vm_filter_find(const char *text, size_t len,
+                              const char *pat, size_t pat_len);
+static bool nm_vm_filter_subseq(const char *text, const char *pat);
+static bool nm_vm_filter_cmp(int64_t val, const nm_vm_filter_term_t *term);
+
+/*
+ * Load names of all VMs sorted by name into names and build
+ * the search index for them.
+ */
+void nm_vm_filter_load(nm_vect_t *names)
+{
+    nm_db_result_t vms = NM_INIT_DB_RESULT;
+    nm_db_result_t ifs = NM_INIT_DB_RESULT;
+    size_t rows, if_rows, iface = 0;
+
+    nm_vm_filter_free();
+
+    nm_db_read_begin();
+    nm_db_stmt_result(nm_db_stmt(NM_STMT_VM_FILTER_LIST), &vms);
+    nm_db_stmt_result(nm_db_stmt(NM_STMT_VM_FILTER_IFACES), &ifs);
+    nm_db_read_end();
+
+    if (!(rows = nm_db_res_rows(&vms)))
+        goto out;
+
+    if_rows = nm_db_res_rows(&ifs);
+    nm_vm_filter_recs = nm_calloc(rows, sizeof(nm_vm_filter_rec_t));
+    nm_vm_filter_match = nm_calloc(rows, sizeof(size_t));
+    nm_vm_filter_fuzzy = nm_calloc(rows, sizeof(uint8_t));
+    nm_vm_filter_count = rows;
+
+    for (size_t n = 0; n < rows; n++) {
+        nm_vm_filter_rec_t *rec = &nm_vm_filter_recs[n];
+        size_t row = n * vms.cols;
+        const nm_str_t *name = nm_db_res_str(&vms, row + NM_VM_FILTER_SQL_NAME);
+        nm_cpu_t cpu = NM_INIT_CPU;
+        size_t first;
+
+        nm_vect_insert(names, name, sizeof(nm_str_t), nm_str_vect_ins_cb);
+
+        /* both lists are sorted by VM name */
+        while (iface < if_rows && strcmp(nm_db_res_cstr(&ifs,
+                    iface * ifs.cols + NM_VM_FILTER_SQL_IF_VM), name->data) < 0)
+            iface++;
+        first = iface;
+        while (iface < if_rows && strcmp(nm_db_res_cstr(&ifs,
+                    iface * ifs.cols + NM_VM_FILTER_SQL_IF_VM), name->data) == 0)
+            iface++;
+
+        rec->off[NM_VM_FILTER_NAME] = nm_vm_filter_text.len;
+        nm_vm_filter_add(name->data, '\n');
+
+        rec->off[NM_VM_FILTER_GROUP] = nm_vm_filter_text.len;
+        nm_vm_filter_add(nm_db_res_cstr(&vms, row + NM_VM_FILTER_SQL_GROUP), '\n');
+
+        rec->off[NM_VM_FILTER_IP] = nm_vm_filter_text.len;
+        for (size_t i = first; i < iface; i++)
+            nm_vm_filter_add(nm_db_res_cstr(&ifs,
+                        i * ifs.cols + NM_VM_FILTER_SQL_IF_IP4), ' ');
+        nm_str_add_char_opt(&nm_vm_filter_text, '\n');
+
+        rec->off[NM_VM_FILTER_MAC] = nm_vm_filter_text.len;
+        for (size_t i = first; i < iface; i++)
+            nm_vm_filter_add(nm_db_res_cstr(&ifs,
+                        i * ifs.cols + NM_VM_FILTER_SQL_IF_MAC), ' ');
+        nm_str_add_char_opt(&nm_vm_filter_text, '\n');
+
+        rec->off[NM_VM_FILTER_ISO] = nm_vm_filter_text.len;
+        nm_vm_filter_add(nm_db_res_cstr(&vms, row + NM_VM_FILTER_SQL_ISO), '\0');
+        rec->off[NM_VM_FILTER_FIELDS] = nm_vm_filter_text.len;
+        rec->chars = nm_vm_filter_chars(nm_vm_filter_text.data +
+                rec->off[NM_VM_FILTER_NAME]);
+
+        nm_parse_smp(&cpu, nm_db_res_cstr(&vms, row + NM_VM_FILTER_SQL_SMP));
+        rec->cpu = cpu.smp;
+        rec->mem = nm_db_res_int(&vms, row + NM_VM_FILTER_SQL_MEM);
+    }
+
+out:
+    nm_db_result_free(&vms);
+    nm_db_result_free(&ifs);
+}
+
+/*
+ * Fill view with items (nm_menu_item_t of VMs in load order) matching
+ * query. View shares items with the list: it must be freed with
+ * nm_vm_filter_view_free(), not with nm_vect_free().
+ */
+void nm_vm_filter_apply(const nm_str_t *query, const nm_vect_t *items,
+                        nm_vect_t *view)
+{
+    nm_vm_filter_term_t terms[NM_VM_FILTER_TERMS];
+    nm_str_t buf = NM_INIT_STR;
+    size_t count = 0, total, n_terms;
+    bool narrow;
+
+    if (items->n_memb != nm_vm_filter_count)
+        nm_bug(_("%s: VM index is out of date"), __func__);
+
+    nm_str_alloc_text(&buf, query->len ? query->data : "");
+    for (size_t n = 0; n < buf.len; n++)
+        buf.data[n] = tolower((unsigned char) buf.data[n]);
+
+    narrow = nm_vm_filter_narrows(buf.data);
+    nm_str_copy(&nm_vm_filter_query, &buf);
+    n_terms = nm_vm_filter_parse(buf.data, terms);
+
+    total = narrow ? nm_vm_filter_matched : nm_vm_filter_count;
+    for (size_t n = 0; n < total; n++) {
+        size_t idx = narrow ? nm_vm_filter_match[n] : n;
+        int rc = nm_vm_filter_test(idx, items, terms, n_terms);
+
+        if (rc == NM_VM_FILTER_NO)
+            continue;
+
+        nm_vm_filter_match[count] = idx;
+        nm_vm_filter_fuzzy[count] = (rc == NM_VM_FILTER_FUZZY);
+        count++;
+    }
+
+    nm_vm_filter_matched = count;
+    nm_vm_filter_valid = true;
+
+    if (view->n_alloc < count) {
+        view->data = nm_realloc(view->data, count * sizeof(void *));
+        view->n_alloc = count;
+    }
+
+    view->n_memb = 0;
+    for (uint8_t fuzzy = 0; fuzzy < 2; fuzzy++) {
+        for (size_t n = 0; n < count; n++) {
+            if (nm_vm_filter_fuzzy[n] == fuzzy)
+                view->data[view->n_memb++] = items->data[nm_vm_filter_match[n]];
+        }
+    }
+
+    nm_str_free(&buf);
+}
+
+/* Next nm_vm_filter_apply() checks all VMs, not only previous matches */
+void nm_vm_filter_invalidate(void)
+{
+    nm_vm_filter_valid = false;
+}
+
+void nm_vm_filter_view_free(nm_vect_t *view)
+{
+    free(view->data);
+    view->data = NULL;
+    view->n_memb = 0;
+    view->n_alloc = 0;
+}
+
+void nm_vm_filter_free(void)
+{
+    free(nm_vm_filter_recs);
+    free(nm_vm_filter_match);
+    free(nm_vm_filter_fuzzy);
+    nm_vm_filter_recs = NULL;
+    nm_vm_filter_match = NULL;
+    nm_vm_filter_fuzzy = NULL;
+    nm_vm_filter_count = nm_vm_filter_matched = 0;
+    nm_vm_filter_valid = false;
+    nm_str_free(&nm_vm_filter_text);
+    nm_str_free(&nm_vm_filter_query);
+}
+
+static void nm_vm_filter_add(const char *src, char sep)
+{
+    for (; *src; src++)
+        nm_str_add_char_opt(&nm_vm_filter_text, tolower((unsigned char) *src));
+
+    nm_str_add_char_opt(&nm_vm_filter_text, sep);
+}
+
+/* Set of characters, some share the same bit */
+static uint64_t nm_vm_filter_chars(const char *text)
+{
+    uint64_t chars = 0;
+
+    for (; *text; text++)
+        chars |= UINT64_C(1) << (*text & 63);
+
+    return chars;
+}
+
+/* Split lowercase query in place, returns the number of terms */
+static size_t nm_vm_filter_parse(char *query, nm_vm_filter_term_t *terms)
+{
+    char *saveptr = query;
+    char *term;
+    size_t count = 0;
+
+    while (count < NM_VM_FILTER_TERMS &&
+            (term = strtok_r(saveptr, " ", &saveptr)))
+        nm_vm_filter_term(term, &terms[count++]);
+
+    return count;
+}
+
+static void nm_vm_filter_term(const char *src, nm_vm_filter_term_t *term)
+{
+    size_t key_len = strcspn(src, ":<>=");
+    const char *val = src + key_len;
+    int key = NM_VM_FILTER_TEXT;
+    char *end;
+
+    term->key = NM_VM_FILTER_TEXT;
+    term->op = NM_VM_FILTER_EQ;
+    term->text = src;
+    term->len = strlen(src);
+    term->chars = nm_vm_filter_chars(src);
+    term->num = 0;
+
+    if (!key_len || !*val)
+        return;
+
+    for (size_t n = 0; n < nm_arr_len(nm_vm_filter_keys); n++) {
+        if (strlen(nm_vm_filter_keys[n].name) == key_len &&
+                !memcmp(nm_vm_filter_keys[n].name, src, key_len)) {
+            key = nm_vm_filter_keys[n].key;
+            break;
+        }
+    }
+
+    if (key == NM_VM_FILTER_TEXT)
+        return;
+
+    if (key != NM_VM_FILTER_MEM && key != NM_VM_FILTER_CPU) {
+        if (*val != ':' && *val != '=')
+            return;
+
+        term->key = key;
+        term->text = val + 1;
+        term->len = strlen(term->text);
+        return;
+    }
+
+    switch (*val++) {
+    case '<':
+        term->op = NM_VM_FILTER_LT;
+        break;
+    case '>':
+        term->op = NM_VM_FILTER_GT;
+        break;
+    }
+
+    if (term->op != NM_VM_FILTER_EQ && *val == '=') {
+        term->op++; /* LE, GE */
+        val++;
+    }
+
+    term->key = NM_VM_FILTER_SKIP;
+    term->num = strtoll(val, &end, 10);
+    if (end == val)
+        return;
+
+    if (*end == 'g' && key == NM_VM_FILTER_MEM) {
+        term->num *= 1024;
+        end++;
+    }
+
+    if (!*end)
+        term->key = key;
+}
+
+/*
+ * Matches of the previous query are reused if the new one only adds
+ * terms or appends text to the last term. Appending digits to number
+ * does not narrow: mem>8 and mem>81 or mem<8 and mem<81.
+ */
+static bool nm_vm_filter_narrows(const char *query)
+{
+    const char *prev = nm_vm_filter_query.data;
+    size_t len = nm_vm_filter_query.len;
+    nm_vm_filter_term_t old, cur;
+    nm_str_t buf = NM_INIT_STR;
+    size_t start = len;
+
+    if (!nm_vm_filter_valid || !len || strncmp(query, prev, len) != 0)
+        return false;
+
+    if (prev[len - 1] == ' ')
+        return true;
+
+    while (start && prev[start - 1] != ' ')
+        start--;
+
+    nm_str_add_text_part(&buf, query + start, strcspn(query + start, " "));
+    nm_vm_filter_term(prev + start, &old);
+    nm_vm_filter_term(buf.data, &cur);
+    nm_str_free(&buf);
+
+    return old.key == cur.key &&
+        old.key != NM_VM_FILTER_MEM && old.key != NM_VM_FILTER_CPU;
+}
+
+static int nm_vm_filter_test(size_t idx, const nm_vect_t *items,
+                             const nm_vm_filter_term_t *terms, size_t count)
+{
+    const nm_vm_filter_rec_t *rec = &nm_vm_filter_recs[idx];
+    const char *text = nm_vm_filter_text.data;
+    int rc = NM_VM_FILTER_EXACT;
+
+    for (size_t n = 0; n < count; n++) {
+        const nm_vm_filter_term_t *term = &terms[n];
+        const char *state;
+
+        switch (term->key) {
+        case NM_VM_FILTER_TEXT:
+            /* record has not all characters of text, no need to scan it */
+            if ((rec->chars & term->chars) != term->chars)
+                return NM_VM_FILTER_NO;
+            if (strstr(text + rec->off[NM_VM_FILTER_NAME], term->text))
+                break;
+            if (!nm_vm_filter_subseq(text + rec->off[NM_VM_FILTER_NAME],
+                        term->text))
+                return NM_VM_FILTER_NO;
+            rc = NM_VM_FILTER_FUZZY;
+            break;
+
+        case NM_VM_FILTER_STATE:
+            state = nm_vm_status_get(nm_vect_item_name(items, idx)) ?
+                "running" : "stopped";
+            if (strncmp(state, term->text, term->len) != 0)
+                return NM_VM_FILTER_NO;
+            break;
+
+        case NM_VM_FILTER_MEM:
+            if (!nm_vm_filter_cmp(rec->mem, term))
+                return NM_VM_FILTER_NO;
+            break;
+
+        case NM_VM_FILTER_CPU:
+            if (!nm_vm_filter_cmp(rec->cpu, term))
+                return NM_VM_FILTER_NO;
+            break;
+
+        case NM_VM_FILTER_SKIP:
+            break;
+
+        default: /* one field, separator is not a part of it */
+            if (!nm_vm_filter_find(text + rec->off[term->key],
+                        rec->off[term->key + 1] - rec->off[term->key] - 1,
+                        term->text, term->len))
+                return NM_VM_FILTER_NO;
+        }
+    }
+
+    return rc;
+}
+
+static bool nm_vm_filter_find(const char *text, size_t len,
+                              const char *pat, size_t pat_len)
+{
+    if (!pat_len)
+        return true;
+
+    for (size_t n = 0; n + pat_len <= len; n++) {
+        if (text[n] == *pat && !memcmp(text + n, pat, pat_len))
+            return true;
+    }
+
+    return false;
+}
+
+/* Characters of pat appear in one field of the record in the same order */
+static bool nm_vm_filter_subseq(const char *text, const char *pat)
+{
+    const char *ptr = pat;
+
+    for (; *text; text++) {
+        if (*text == '\n') {
+            ptr = pat;
+            continue;
+        }
+
+        if (*text == *ptr && !*++ptr)
+            return true;
+    }
+
+    return false;
+}
+
+static bool nm_vm_filter_cmp(int64_t val, const nm_vm_filter_term_t *term)
+{
+    switch (term->op) {
+    case NM_VM_FILTER_LT:
+        return val < term->num;
+    case NM_VM_FILTER_LE:
+        return val <= term->num;
+    case NM_VM_FILTER_GT:
+        return val > term->num;
+    case NM_VM_FILTER_GE:
+        return val >= term->num;
+    }
+
+    return val == term->num;
+}
+
+/* vim:set ts=4 sw=4: */
@@ -0,0 +1,15 @@
+#ifndef NM_VM_FILTER_H_
+#define NM_VM_FILTER_H_
+
+#include <nm_string.h>
+#include <nm_vector.h>
+
+void nm_vm_filter_load(nm_vect_t *names);
+void nm_vm_filter_apply(const nm_str_t *query, const nm_vect_t *items,
+                        nm_vect_t *view);
+void nm_vm_filter_invalidate(void);
+void nm_vm_filter_view_free(nm_vect_t *view);
+void nm_vm_filter_free(void);
+
+#endif /* NM_VM_FILTER_H_ */
+/* vim:set ts=4 sw=4: */
@@ -1,4 +1,5 @@
 #include <nm_core.h>
+#include <nm_job.h>
 #include <nm_form.h>
 #include <nm_utils.h>
 #include <nm_string.h>
@@ -38,12 +39,24 @@ typedef struct {
 
 #define NM_INIT_VMSNAP (nm_vmsnap_t) { NM_INIT_STR, NM_INIT_STR, 0 }
 
+/* Context of snapshot deletion job */
+typedef struct {
+    nm_str_t name;
+    nm_str_t snap;
+    nm_vect_t argv;
+} nm_vmsnap_job_t;
+
 static int nm_vm_snapshot_get_data(const nm_str_t *name, nm_vmsnap_t *data);
 static void nm_vm_snapshot_to_db(const nm_str_t *name, const nm_vmsnap_t *data);
 static void __nm_vm_snapshot_load(const nm_str_t *name, const nm_str_t *snap,
                                   int vm_status);
 static void __nm_vm_snapshot_delete(const nm_str_t *name, const nm_str_t *snap,
                                     int vm_status);
+static void nm_vm_snapshot_del_job(const nm_str_t *name, const nm_str_t *snap);
+static int nm_vm_snapshot_del_run(nm_job_t *job);
+static int nm_vm_snapshot_del_done(nm_job_t *job, int rc);
+static void nm_vm_snapshot_del_free(void *ctx);
+static void nm_vm_snapshot_del_db(const nm_str_t *name, const nm_str_t *snap);
 
 static nm_field_t *fields[NM_FLD_COUNT + 1];
 
@@ -108,19 +121,14 @@ void nm_vm_snapshot_delete(const nm_str_t *name, int vm_status)
 {
     nm_form_t *form = NULL;
     nm_vect_t err = NM_INIT_VECT;
-    nm_str_t query = NM_INIT_STR;
     nm_str_t buf = NM_INIT_STR;
     nm_vect_t snaps = NM_INIT_VECT;
     nm_vect_t choices = NM_INIT_VECT;
     nm_form_data_t form_data = NM_INIT_FORM_DATA;
-    nm_spinner_data_t sp_data = NM_INIT_SPINNER;
-    int done = 0;
-    pthread_t spin_th;
     size_t snaps_count = 0;
     size_t msg_len = mbstowcs(NULL, _(NM_FORMSTR_SNAP), strlen(_(NM_FORMSTR_SNAP)));
 
-    nm_str_format(&query, NM_GET_SNAPS_ALL_SQL, name->data);
-    nm_db_select(query.data, &snaps);
+    nm_db_select_vm(NM_STMT_GET_SNAPS_ALL, name->data, &snaps);
 
     if (snaps.n_memb == 0) {
         nm_warn(_(NM_MSG_NO_SNAPS));
@@ -170,17 +178,8 @@ void nm_vm_snapshot_delete(const nm_str_t *name, int vm_status)
         goto clean_and_out;
     }
 
-    sp_data.stop = &done;
-
-    if (pthread_create(&spin_th, NULL, nm_progress_bar, (void *) &sp_data) != 0)
-        nm_bug(_("%s: cannot create thread"), __func__);
-
     __nm_vm_snapshot_delete(name, &buf, vm_status);
 
-    done = 1;
-    if (pthread_join(spin_th, NULL) != 0)
-        nm_bug(_("%s: cannot join thread"), __func__);
-
 clean_and_out:
     werase(help_window);
     nm_init_help_main();
@@ -191,7 +190,6 @@ out:
     nm_vect_free(&snaps, nm_str_vect_free_cb);
     nm_vect_free(&choices, NULL);
     nm_form_free(form, fields);
-    nm_str_free(&query);
     nm_str_free(&buf);
 }
 
@@ -201,7 +199,6 @@ void nm_vm_snapshot_load(const nm_str_t *name, int vm_status)
     nm_vect_t choices = NM_INIT_VECT;
     nm_vect_t err = NM_INIT_VECT;
     nm_form_t *snap_form = NULL;
-    nm_str_t query = NM_INIT_STR;
     nm_str_t buf = NM_INIT_STR;
     nm_form_data_t form_data = NM_INIT_FORM_DATA;
     nm_spinner_data_t sp_data = NM_INIT_SPINNER;
@@ -210,8 +207,7 @@ void nm_vm_snapshot_load(const nm_str_t *name, int vm_status)
     pthread_t spin_th;
     size_t msg_len = mbstowcs(NULL, NM_FORMSTR_SNAP, strlen(NM_FORMSTR_SNAP));
 
-    nm_str_format(&query, NM_GET_SNAPS_ALL_SQL, name->data);
-    nm_db_select(query.data, &snaps);
+    nm_db_select_vm(NM_STMT_GET_SNAPS_ALL, name->data, &snaps);
 
     if (snaps.n_memb == 0) {
         nm_warn(_(NM_MSG_NO_SNAPS));
@@ -282,7 +278,6 @@ out:
     nm_form_free(snap_form, fields);
     nm_vect_free(&snaps, nm_str_vect_free_cb);
     nm_vect_free(&choices, NULL);
-    nm_str_free(&query);
     nm_str_free(&buf);
 }
 
@@ -291,17 +286,16 @@ static void __nm_vm_snapshot_load(const nm_str_t *name, const nm_str_t *snap,
 {
     /* vm is not running, will load snapshot at next boot */
     if (!vm_status) {
-        nm_str_t query = NM_INIT_STR;
+        nm_db_stmt_t *stmt;
 
         /* reset load flag for all snapshots for current vm */
-        nm_str_format(&query, NM_RESET_LOAD_SQL, name->data);
-        nm_db_edit(query.data);
+        nm_db_edit_vm(NM_STMT_RESET_LOAD, name->data);
 
         /* set load flag for current shapshot */
-        nm_str_format(&query, NM_SNAP_UPDATE_LOAD_SQL, name->data, snap->data);
-        nm_db_edit(query.data);
-
-        nm_str_free(&query);
+        stmt = nm_db_stmt(NM_STMT_SNAP_UPDATE_LOAD);
+        nm_db_bind_text(stmt, 1, name->data);
+        nm_db_bind_text(stmt, 2, snap->data);
+        nm_db_stmt_exec(stmt);
         return;
     }
 
@@ -312,65 +306,103 @@ static void __nm_vm_snapshot_load(const nm_str_t *name, const nm_str_t *snap,
 static void __nm_vm_snapshot_delete(const nm_str_t *name, const nm_str_t *snap,
                                     int vm_status)
 {
-    int rc = NM_ERR;
-
+    /* vm is not running, qemu-img is run by background job */
     if (!vm_status) {
-        /* vm is not running, use
-         * qemu-img snapshot -d snapshot_name path_to_drive system command */
-        nm_str_t buf = NM_INIT_STR;
-        nm_vect_t argv = NM_INIT_VECT;
-        nm_str_t query = NM_INIT_STR;
-        nm_vect_t drives = NM_INIT_VECT;
-
-        /* get first drive name */
-        nm_str_format(&query, NM_GET_BOOT_DRIVE_SQL, name->data);
-        nm_db_select(query.data, &drives);
-        if (drives.n_memb == 0) {
-            nm_str_free(&query);
-            return;
-        }
-
-        nm_str_format(&buf, "%s/qemu-img", nm_cfg_get()->qemu_bin_path.data);
-        nm_vect_insert(&argv, buf.data, buf.len + 1, NULL);
-
-        nm_vect_insert_cstr(&argv, "snapshot");
-        nm_vect_insert_cstr(&argv, "-d");
-
-        nm_vect_insert(&argv, snap->data, snap->len + 1, NULL);
-
-        nm_str_format(&buf, "%s/%s/%s", nm_cfg_get()->vm_dir.data, name->data, nm_vect_str_ctx(&drives, 0));
-        nm_vect_insert(&argv, buf.data, buf.len + 1, NULL);
-
-        nm_vect_end_zero(&argv);
-        if (nm_spawn_process(&argv, NULL) != NM_OK)
-            nm_bug(_("%s: cannot delete snapshot"), __func__);
-
-        rc = NM_OK;
-        nm_str_free(&buf);
-        nm_vect_free(&argv, NULL);
-        nm_vect_free(&drives, nm_str_vect_free_cb);
-        nm_str_free(&query);
-    } else {
-        /* vm is running, delete snapshot using QMP command delvm */
-        rc = nm_qmp_delvm(name, snap);
+        nm_vm_snapshot_del_job(name, snap);
+        return;
     }
 
+    /* vm is running, delete snapshot using QMP command delvm */
+    if (nm_qmp_delvm(name, snap) == NM_OK)
+        nm_vm_snapshot_del_db(name, snap);
+}
 
-    if (rc == NM_OK) {
-        /* delete snapshot from database */
-        nm_str_t query = NM_INIT_STR;
+/* qemu-img snapshot -d snapshot_name path_to_drive */
+static void nm_vm_snapshot_del_job(const nm_str_t *name, const nm_str_t *snap)
+{
+    nm_vmsnap_job_t *del;
+    nm_job_t *job;
+    nm_str_t buf = NM_INIT_STR;
+    nm_vect_t drives = NM_INIT_VECT;
 
-        nm_str_format(&query, NM_DELETE_SNAP_SQL, name->data, snap->data);
-        nm_db_edit(query.data);
+    /* get first drive name */
+    nm_db_select_vm(NM_STMT_GET_BOOT_DRIVE, name->data, &drives);
+    if (drives.n_memb == 0)
+        goto out;
 
-        nm_str_free(&query);
-    }
+    del = nm_calloc(1, sizeof(nm_vmsnap_job_t));
+    nm_str_copy(&del->name, name);
+    nm_str_copy(&del->snap, snap);
+
+    nm_str_format(&buf, "%s/qemu-img", nm_cfg_get()->qemu_bin_path.data);
+    nm_vect_insert(&del->argv, buf.data, buf.len + 1, NULL);
+
+    nm_vect_insert_cstr(&del->argv, "snapshot");
+    nm_vect_insert_cstr(&del->argv, "-d");
+
+    nm_vect_insert(&del->argv, snap->data, snap->len + 1, NULL);
+
+    nm_str_format(&buf, "%s/%s/%s", nm_cfg_get()->vm_dir.data, name->data, nm_vect_str_ctx(&drives, 0));
+    nm_vect_insert(&del->argv, buf.data, buf.len + 1, NULL);
+    nm_vect_end_zero(&del->argv);
+
+    nm_str_format(&buf, "delete snapshot %s of %s", snap->data, name->data);
+    job = nm_job_new(&buf, nm_vm_snapshot_del_run, nm_vm_snapshot_del_done,
+            del, nm_vm_snapshot_del_free);
+    nm_job_add_vm(job, name);
+    nm_job_submit(job);
+
+out:
+    nm_str_free(&buf);
+    nm_vect_free(&drives, nm_str_vect_free_cb);
+}
+
+/* Runs in job thread */
+static int nm_vm_snapshot_del_run(nm_job_t *job)
+{
+    nm_vmsnap_job_t *del = job->ctx;
+    int rc;
+
+    rc = nm_job_spawn(job, &del->argv, NULL);
+    if (rc != NM_OK && !nm_job_canceled(job))
+        nm_str_format(&job->error, _("cannot delete snapshot"));
+
+    return rc;
+}
+
+static int nm_vm_snapshot_del_done(nm_job_t *job, int rc)
+{
+    nm_vmsnap_job_t *del = job->ctx;
+
+    if (rc == NM_OK)
+        nm_vm_snapshot_del_db(&del->name, &del->snap);
+
+    return rc;
+}
+
+static void nm_vm_snapshot_del_free(void *ctx)
+{
+    nm_vmsnap_job_t *del = ctx;
+
+    nm_str_free(&del->name);
+    nm_str_free(&del->snap);
+    nm_vect_free(&del->argv, NULL);
+    free(del);
+}
+
+static void nm_vm_snapshot_del_db(const nm_str_t *name, const nm_str_t *snap)
+{
+    nm_db_stmt_t *stmt = nm_db_stmt(NM_STMT_DELETE_SNAP);
+
+    nm_db_bind_text(stmt, 1, name->data);
+    nm_db_bind_text(stmt, 2, snap->data);
+    nm_db_stmt_exec(stmt);
 }
 
 static int nm_vm_snapshot_get_data(const nm_str_t *name, nm_vmsnap_t *data)
 {
     int rc = NM_OK;
-    nm_str_t query = NM_INIT_STR;
+    nm_db_stmt_t *stmt;
     nm_vect_t names = NM_INIT_VECT;
     nm_vect_t err = NM_INIT_VECT;
 
@@ -385,8 +417,10 @@ static int nm_vm_snapshot_get_data(const nm_str_t *name, nm_vmsnap_t *data)
         goto out;
     }
 
-    nm_str_format(&query, NM_SNAP_GET_NAME_SQL, name->data, data->snap_name.data);
-    nm_db_select(query.data, &names);
+    stmt = nm_db_stmt(NM_STMT_SNAP_GET_NAME);
+    nm_db_bind_text(stmt, 1, name->data);
+    nm_db_bind_text(stmt, 2, data->snap_name.data);
+    nm_db_stmt_select(stmt, &names);
 
     if (names.n_memb != 0) {
         curs_set(0);
@@ -396,28 +430,21 @@ static int nm_vm_snapshot_get_data(const nm_str_t *name, nm_vmsnap_t *data)
 
 out:
     nm_vect_free(&names, nm_str_vect_free_cb);
-    nm_str_free(&query);
     return rc;
 }
 
 static void nm_vm_snapshot_to_db(const nm_str_t *name, const nm_vmsnap_t *data)
 {
-    nm_str_t query = NM_INIT_STR;
+    nm_db_stmt_t *stmt;
     int load = 0;
 
     if (nm_str_cmp_st(&data->load, "yes") == NM_OK)
         load = 1;
 
-    if (!data->update) {
-        nm_str_format(&query, NM_INSERT_SNAP_SQL,
-            name->data, data->snap_name.data, load);
-    } else {
-        nm_str_format(&query, NM_UPDATE_SNAP_SQL, load,
-            name->data, data->snap_name.data);
-    }
-
-    nm_db_edit(query.data);
-
-    nm_str_free(&query);
+    stmt = nm_db_stmt(data->update ? NM_STMT_UPDATE_SNAP : NM_STMT_INSERT_SNAP);
+    nm_db_bind_text(stmt, 1, name->data);
+    nm_db_bind_text(stmt, 2, data->snap_name.data);
+    nm_db_bind_int(stmt, 3, load);
+    nm_db_stmt_exec(stmt);
 }
 /* vim:set ts=4 sw=4: */
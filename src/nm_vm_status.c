@@ -0,0 +1,324 @@
+#include <nm_core.h>
+#include <nm_utils.h>
+#include <nm_string.h>
+#include <nm_vector.h>
+#include <nm_cfg_file.h>
+#include <nm_vm_status.h>
+#include <nm_qmp_control.h>
+#include <nm_vm_control.h>
+
+#include <time.h>
+#include <signal.h>
+
+#if defined (NM_OS_LINUX)
+#include <sys/inotify.h>
+#endif
+
+/*
+ * VM status cache.
+ * Instead of probing QMP socket of every visible VM on every
+ * redraw, status is kept in memory and updated only when something
+ * happens with qmp.sock or qemu.pid in the VM directory.
+ * QEMU killed by SIGKILL leaves stale files behind and does not
+ * generate any events, so every NM_VM_STATUS_RESYNC seconds PIDs of
+ * running VMs are checked with kill(pid, 0), QMP socket is probed
+ * only if the process is gone. VMs without inotify watch are probed
+ * only if their qemu.pid points to a live process.
+ */
+
+enum {
+    NM_VM_STATUS_RESYNC = 2,  /* seconds */
+    NM_VM_STATUS_RECHECK = 2, /* extra probes after event */
+    NM_VM_STATUS_EVBUF = 4096
+};
+
+typedef struct nm_vm_status {
+    const nm_str_t *name;
+    int wd;
+    pid_t pid;      /* QEMU of running VM, 0 if unknown */
+    uint8_t recheck;
+    uint32_t running:1;
+} nm_vm_status_t;
+
+#define NM_VM_STATUS_INIT (nm_vm_status_t) { NULL, -1, 0, 0, 0 }
+
+static nm_vect_t nm_vm_status_list = NM_INIT_VECT;
+static time_t nm_vm_status_synced;
+#if defined (NM_OS_LINUX)
+static int nm_vm_status_fd = -1;
+static int nm_vm_status_root_wd = -1;
+#endif
+
+static nm_vm_status_t *nm_vm_status_find(const char *name);
+static int nm_vm_status_probe(nm_vm_status_t *item);
+static int nm_vm_status_resync(const nm_vm_status_t *item);
+static int nm_vm_status_alive(pid_t pid);
+static int nm_vm_status_cmp_cb(const void *key, const void *item);
+static time_t nm_vm_status_now(void);
+#if defined (NM_OS_LINUX)
+static void nm_vm_status_watch(nm_vm_status_t *item);
+static void nm_vm_status_read_events(void);
+#endif
+
+static inline nm_vm_status_t *nm_vm_status_at(size_t idx)
+{
+    return (nm_vm_status_t *) nm_vect_at(&nm_vm_status_list, idx);
+}
+
+void nm_vm_status_init(void)
+{
+#if defined (NM_OS_LINUX)
+    if (nm_vm_status_fd != -1)
+        return;
+
+    if ((nm_vm_status_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1) {
+        nm_debug("%s: inotify_init1: %s\n", __func__, strerror(errno));
+        return;
+    }
+
+    nm_vm_status_root_wd = inotify_add_watch(nm_vm_status_fd,
+            nm_cfg_get()->vm_dir.data, IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+    if (nm_vm_status_root_wd == -1) {
+        nm_debug("%s: cannot watch %s: %s\n", __func__,
+                nm_cfg_get()->vm_dir.data, strerror(errno));
+    }
+#endif
+}
+
+/*
+ * vms - list of VM names sorted by name, as returned by NM_GET_VMS_SQL.
+ * List must not be changed or freed until the next rebuild.
+ */
+void nm_vm_status_rebuild(const nm_vect_t *vms)
+{
+#if defined (NM_OS_LINUX)
+    for (size_t n = 0; n < nm_vm_status_list.n_memb; n++) {
+        nm_vm_status_t *item = nm_vm_status_at(n);
+
+        if (item->wd != -1)
+            inotify_rm_watch(nm_vm_status_fd, item->wd);
+    }
+#endif
+    nm_vect_free(&nm_vm_status_list, NULL);
+
+    for (size_t n = 0; n < vms->n_memb; n++) {
+        nm_vm_status_t item = NM_VM_STATUS_INIT;
+
+        item.name = nm_vect_str(vms, n);
+#if defined (NM_OS_LINUX)
+        nm_vm_status_watch(&item);
+#endif
+        nm_vm_status_probe(&item);
+        nm_vect_insert(&nm_vm_status_list, &item, sizeof(item), NULL);
+    }
+
+    nm_vm_status_synced = nm_vm_status_now();
+}
+
+/*
+ * Process pending events without blocking.
+ * Returns the number of VMs which status has been changed.
+ */
+size_t nm_vm_status_poll(void)
+{
+    size_t changed = 0;
+    int resync = NM_FALSE;
+    time_t now = nm_vm_status_now();
+
+#if defined (NM_OS_LINUX)
+    nm_vm_status_read_events();
+#endif
+
+    if ((now - nm_vm_status_synced) >= NM_VM_STATUS_RESYNC) {
+        nm_vm_status_synced = now;
+        resync = NM_TRUE;
+    }
+
+    for (size_t n = 0; n < nm_vm_status_list.n_memb; n++) {
+        nm_vm_status_t *item = nm_vm_status_at(n);
+        int probe = NM_FALSE;
+
+        if (item->recheck) {
+            item->recheck--;
+            probe = NM_TRUE;
+        }
+
+        if (resync && nm_vm_status_resync(item))
+            probe = NM_TRUE;
+
+        if (probe && nm_vm_status_probe(item) == NM_OK)
+            changed++;
+    }
+
+    return changed;
+}
+
+int nm_vm_status_get(const nm_str_t *name)
+{
+    nm_vm_status_t *item = nm_vm_status_find(name->data);
+
+    if (!item) {
+        /* not in the cache, e.g. VM was added right now */
+        return (nm_qmp_test_socket(name) == NM_OK);
+    }
+
+    return item->running;
+}
+
+void nm_vm_status_free(void)
+{
+    nm_vect_free(&nm_vm_status_list, NULL);
+#if defined (NM_OS_LINUX)
+    if (nm_vm_status_fd != -1) {
+        close(nm_vm_status_fd);
+        nm_vm_status_fd = -1;
+        nm_vm_status_root_wd = -1;
+    }
+#endif
+}
+
+/* Returns NM_OK if status has been changed. */
+static int nm_vm_status_probe(nm_vm_status_t *item)
+{
+    int running = (nm_qmp_test_socket(item->name) == NM_OK);
+
+    item->pid = running ? nm_vmctl_get_pid(item->name) : 0;
+
+    if (running == item->running)
+        return NM_ERR;
+
+    item->running = running;
+
+    return NM_OK;
+}
+
+/* Returns NM_TRUE if VM must be probed on periodic resync */
+static int nm_vm_status_resync(const nm_vm_status_t *item)
+{
+    if (item->running)
+        return !item->pid || !nm_vm_status_alive(item->pid);
+
+    /* stopped VM with watch will be seen by inotify */
+    if (item->wd != -1)
+        return NM_FALSE;
+
+    return nm_vm_status_alive(nm_vmctl_get_pid(item->name));
+}
+
+static int nm_vm_status_alive(pid_t pid)
+{
+    if (pid <= 0)
+        return NM_FALSE;
+
+    return (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+static nm_vm_status_t *nm_vm_status_find(const char *name)
+{
+    void *match;
+
+    if (!nm_vm_status_list.n_memb)
+        return NULL;
+
+    match = bsearch(name, nm_vm_status_list.data, nm_vm_status_list.n_memb,
+            sizeof(void *), nm_vm_status_cmp_cb);
+
+    return match ? *((nm_vm_status_t **) match) : NULL;
+}
+
+static int nm_vm_status_cmp_cb(const void *key, const void *item)
+{
+    const nm_vm_status_t **p = (const nm_vm_status_t **) item;
+
+    return strcmp(key, (*p)->name->data);
+}
+
+static time_t nm_vm_status_now(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        return 0;
+
+    return ts.tv_sec;
+}
+
+#if defined (NM_OS_LINUX)
+static void nm_vm_status_watch(nm_vm_status_t *item)
+{
+    nm_str_t path = NM_INIT_STR;
+
+    if (nm_vm_status_fd == -1)
+        return;
+
+    nm_str_format(&path, "%s/%s", nm_cfg_get()->vm_dir.data, item->name->data);
+
+    item->wd = inotify_add_watch(nm_vm_status_fd, path.data,
+            IN_CREATE | IN_DELETE | IN_CLOSE_WRITE |
+            IN_MOVED_TO | IN_MOVED_FROM | IN_ONLYDIR);
+
+    nm_str_free(&path);
+}
+
+static void nm_vm_status_read_events(void)
+{
+    char buf[NM_VM_STATUS_EVBUF]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t nread;
+
+    if (nm_vm_status_fd == -1)
+        return;
+
+    while ((nread = read(nm_vm_status_fd, buf, sizeof(buf))) > 0) {
+        const struct inotify_event *ev;
+
+        for (char *ptr = buf; ptr < buf + nread;
+                ptr += sizeof(struct inotify_event) + ev->len) {
+            nm_vm_status_t *item = NULL;
+
+            ev = (const struct inotify_event *) ptr;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                /* events were lost, recheck everything */
+                for (size_t n = 0; n < nm_vm_status_list.n_memb; n++)
+                    nm_vm_status_at(n)->recheck = NM_VM_STATUS_RECHECK;
+                continue;
+            }
+
+            if (ev->wd == nm_vm_status_root_wd) {
+                /* VM directory appeared after the list was built */
+                if (ev->len && (item = nm_vm_status_find(ev->name)) != NULL) {
+                    if (item->wd == -1)
+                        nm_vm_status_watch(item);
+                    item->recheck = NM_VM_STATUS_RECHECK;
+                }
+                continue;
+            }
+
+            for (size_t n = 0; n < nm_vm_status_list.n_memb; n++) {
+                if (nm_vm_status_at(n)->wd == ev->wd) {
+                    item = nm_vm_status_at(n);
+                    break;
+                }
+            }
+
+            if (!item)
+                continue;
+
+            if (ev->mask & IN_IGNORED) {
+                /* VM directory was removed */
+                item->wd = -1;
+                item->recheck = NM_VM_STATUS_RECHECK;
+                continue;
+            }
+
+            if (ev->len && (!strcmp(ev->name, NM_VM_QMP_FILE) ||
+                        !strcmp(ev->name, NM_VM_PID_FILE))) {
+                item->recheck = NM_VM_STATUS_RECHECK;
+            }
+        }
+    }
+}
+#endif /* NM_OS_LINUX */
+
+/* vim:set ts=4 sw=4: */
@@ -0,0 +1,433 @@
+#include <nm_core.h>
+#include <nm_utils.h>
+#include <nm_string.h>
+#include <nm_vector.h>
+#include <nm_window.h>
+#include <nm_database.h>
+#include <nm_vm_top.h>
+#include <nm_vm_status.h>
+#include <nm_vm_control.h>
+#include <nm_stat_usage.h>
+
+#include <time.h>
+#include <langinfo.h>
+
+/*
+ * Resource usage of running VMs, top-like.
+ * Every tick all running VMs are sampled at once, values are kept
+ * in fixed-size per-VM history. List is sorted by selected metric,
+ * history of this metric is drawn as sparkline.
+ * Network usage is the sum of VM tap interfaces counters.
+ */
+
+enum {
+    NM_TOP_HISTORY = 64,  /* samples */
+    NM_TOP_TICK = 1000,   /* ms */
+    NM_TOP_SPARK_MIN = 8, /* do not draw narrower sparkline */
+    NM_TOP_BUF_LEN = 64
+};
+
+enum {
+    NM_TOP_CPU = 0,
+    NM_TOP_MEM,
+    NM_TOP_DISK,
+    NM_TOP_NET,
+    NM_TOP_METRICS
+};
+
+static const char *nm_top_titles[] = {
+    "cpu", "memory", "disk", "network"
+};
+
+/* U+2581..U+2588 */
+static const char *nm_top_spark_utf[] = {
+    "\xe2\x96\x81", "\xe2\x96\x82", "\xe2\x96\x83", "\xe2\x96\x84",
+    "\xe2\x96\x85", "\xe2\x96\x86", "\xe2\x96\x87", "\xe2\x96\x88"
+};
+
+static const char *nm_top_spark_ascii[] = {
+    "_", ".", ",", "-", "=", "+", "*", "#"
+};
+
+typedef struct {
+    const nm_str_t *name;
+    int pid;
+    int *net_fds;       /* rx_bytes, tx_bytes of every tap */
+    size_t net_nfds;
+    uint64_t net_bytes;
+    int64_t net_time;
+    double hist[NM_TOP_METRICS][NM_TOP_HISTORY];
+    size_t head;        /* next slot in history */
+    size_t count;
+} nm_top_vm_t;
+
+static int nm_top_metric = NM_TOP_CPU;
+
+static void nm_vm_top_sample(const nm_vect_t *top);
+static void nm_vm_top_draw(const nm_vect_t *top, size_t *first);
+static void nm_vm_top_attach(nm_top_vm_t *vm);
+static void nm_vm_top_detach(nm_top_vm_t *vm);
+static uint64_t nm_vm_top_net_bytes(const nm_top_vm_t *vm);
+static double nm_vm_top_last(const nm_top_vm_t *vm, int metric);
+static void nm_vm_top_human(double val, char *buf, size_t len);
+static void nm_vm_top_spark(const nm_top_vm_t *vm, double max, size_t width);
+static int nm_vm_top_cmp_cb(const void *a, const void *b);
+
+static inline nm_top_vm_t *nm_vm_top_at(const nm_vect_t *v, size_t idx)
+{
+    return (nm_top_vm_t *) nm_vect_at(v, idx);
+}
+
+void nm_vm_top(void)
+{
+    nm_vect_t names = NM_INIT_VECT;
+    nm_vect_t top = NM_INIT_VECT;
+    int64_t last = 0;
+    size_t first = 0;
+    int ch = 0;
+
+    nm_db_select(NM_GET_VMS_SQL, &names);
+
+    for (size_t n = 0; n < names.n_memb; n++) {
+        nm_top_vm_t vm;
+
+        memset(&vm, 0, sizeof(vm));
+        vm.name = nm_vect_str(&names, n);
+        nm_vect_insert(&top, &vm, sizeof(vm), NULL);
+    }
+
+    werase(help_window);
+    nm_init_help_top();
+
+    do {
+        int64_t now;
+
+        switch (ch) {
+        case NM_KEY_C:
+            nm_top_metric = NM_TOP_CPU;
+            break;
+        case NM_KEY_M:
+            nm_top_metric = NM_TOP_MEM;
+            break;
+        case NM_KEY_D:
+            nm_top_metric = NM_TOP_DISK;
+            break;
+        case NM_KEY_N:
+            nm_top_metric = NM_TOP_NET;
+            break;
+        case KEY_UP:
+            if (first)
+                first--;
+            break;
+        case KEY_DOWN:
+            first++;
+            break;
+        }
+
+        if (redraw_window) {
+            nm_destroy_windows();
+            endwin();
+            refresh();
+            nm_create_windows();
+            nm_init_help_top();
+            nm_init_side();
+            redraw_window = 0;
+        }
+
+        /* keys do not shift sampling period */
+        if ((now = nm_mono_ms()) - last >= NM_TOP_TICK) {
+            nm_vm_top_sample(&top);
+            last = now;
+        }
+
+        nm_vm_top_draw(&top, &first);
+
+        now = NM_TOP_TICK - (nm_mono_ms() - last);
+        wtimeout(action_window, (now > 0) ? now : 0);
+    } while ((ch = wgetch(action_window)) != NM_KEY_Q);
+
+    for (size_t n = 0; n < top.n_memb; n++)
+        nm_vm_top_detach(nm_vm_top_at(&top, n));
+
+    wtimeout(action_window, -1);
+    werase(action_window);
+    werase(help_window);
+    nm_init_help_main();
+
+    nm_vect_free(&top, NULL);
+    nm_vect_free(&names, nm_str_vect_free_cb);
+}
+
+static void nm_vm_top_sample(const nm_vect_t *top)
+{
+    int64_t now;
+
+    nm_vm_status_poll();
+
+    for (size_t n = 0; n < top->n_memb; n++) {
+        nm_top_vm_t *vm = nm_vm_top_at(top, n);
+        int running = nm_vm_status_get(vm->name);
+
+        if (running && !vm->pid)
+            nm_vm_top_attach(vm);
+        else if (!running && vm->pid)
+            nm_vm_top_detach(vm);
+    }
+
+    /* all VMs at once */
+    nm_stat_sample();
+    now = nm_mono_ms();
+
+    for (size_t n = 0; n < top->n_memb; n++) {
+        nm_top_vm_t *vm = nm_vm_top_at(top, n);
+        nm_stat_t stat = NM_INIT_STAT;
+        uint64_t net;
+        double net_rate = 0;
+
+        if (!vm->pid)
+            continue;
+
+        if (nm_stat_get(vm->pid, &stat) != NM_OK) {
+            /* process has exited */
+            nm_vm_top_detach(vm);
+            continue;
+        }
+
+        net = nm_vm_top_net_bytes(vm);
+        if (vm->net_time && now > vm->net_time && net >= vm->net_bytes)
+            net_rate = (double) (net - vm->net_bytes) * 1000 / (now - vm->net_time);
+        vm->net_bytes = net;
+        vm->net_time = now;
+
+        if (!stat.ready)
+            continue;
+
+        vm->hist[NM_TOP_CPU][vm->head] = stat.cpu;
+        vm->hist[NM_TOP_MEM][vm->head] = (double) stat.rss;
+        vm->hist[NM_TOP_DISK][vm->head] = stat.rd_rate + stat.wr_rate;
+        vm->hist[NM_TOP_NET][vm->head] = net_rate;
+
+        vm->head = (vm->head + 1) % NM_TOP_HISTORY;
+        if (vm->count < NM_TOP_HISTORY)
+            vm->count++;
+    }
+}
+
+static void nm_vm_top_draw(const nm_vect_t *top, size_t *first)
+{
+    nm_str_t title = NM_INIT_STR;
+    size_t rows, cols, running = 0, visible, spark;
+    double max = 0;
+    int y = 4;
+
+    getmaxyx(action_window, rows, cols);
+
+    /* running VMs sorted by selected metric go first */
+    qsort(top->data, top->n_memb, sizeof(void *), nm_vm_top_cmp_cb);
+
+    for (size_t n = 0; n < top->n_memb; n++) {
+        const nm_top_vm_t *vm = nm_vm_top_at(top, n);
+
+        if (!vm->pid)
+            continue;
+
+        running++;
+        for (size_t i = 0; i < vm->count; i++) {
+            if (vm->hist[nm_top_metric][i] > max)
+                max = vm->hist[nm_top_metric][i];
+        }
+    }
+
+    visible = (rows > 5) ? rows - 5 : 0;
+    if (*first + visible > running)
+        *first = (running > visible) ? running - visible : 0;
+
+    /* name cpu mem disk net, see the header below */
+    spark = (cols > 64) ? cols - 64 : 0;
+    if (spark > NM_TOP_HISTORY)
+        spark = NM_TOP_HISTORY;
+
+    nm_str_format(&title, _("Resource usage [%s]"), _(nm_top_titles[nm_top_metric]));
+    werase(action_window);
+    nm_init_action(title.data);
+
+    if (!running) {
+        mvwprintw(action_window, 3, 2, "%s", _("There are no running VMs"));
+        goto out;
+    }
+
+    wattron(action_window, A_BOLD);
+    mvwprintw(action_window, 3, 2, "%-20s %6s %9s %9s %9s%s",
+            "NAME", "CPU%", "MEM", "DISK/s", "NET/s",
+            (spark >= NM_TOP_SPARK_MIN) ? "  HISTORY" : "");
+    wattroff(action_window, A_BOLD);
+
+    for (size_t n = 0, shown = 0; n < top->n_memb && shown < visible; n++) {
+        const nm_top_vm_t *vm = nm_vm_top_at(top, n);
+        char mem[NM_TOP_BUF_LEN], disk[NM_TOP_BUF_LEN], net[NM_TOP_BUF_LEN];
+
+        if (!vm->pid)
+            continue;
+        if (n < *first)
+            continue;
+
+        nm_vm_top_human(nm_vm_top_last(vm, NM_TOP_MEM), mem, sizeof(mem));
+        nm_vm_top_human(nm_vm_top_last(vm, NM_TOP_DISK), disk, sizeof(disk));
+        nm_vm_top_human(nm_vm_top_last(vm, NM_TOP_NET), net, sizeof(net));
+
+        mvwprintw(action_window, y, 2, "%-20.20s %6.1f %9s %9s %9s  ",
+                vm->name->data, nm_vm_top_last(vm, NM_TOP_CPU), mem, disk, net);
+
+        if (spark >= NM_TOP_SPARK_MIN)
+            nm_vm_top_spark(vm, max, spark);
+
+        y++;
+        shown++;
+    }
+
+out:
+    wrefresh(action_window);
+    nm_str_free(&title);
+}
+
+static void nm_vm_top_attach(nm_top_vm_t *vm)
+{
+    const nm_vmctl_data_t *props;
+
+    if ((vm->pid = nm_vmctl_get_pid(vm->name)) <= 0) {
+        vm->pid = 0;
+        return;
+    }
+
+    nm_stat_watch(vm->pid);
+
+    if ((props = nm_vmctl_get_cached(vm->name)) == NULL)
+        return;
+
+    for (size_t n = 0; n < props->ifs.n_memb / NM_IFS_IDX_COUNT; n++) {
+        const char *ifname = nm_db_res_cstr(&props->ifs,
+                NM_SQL_IF_NAME + n * NM_IFS_IDX_COUNT);
+        const char *files[] = { "rx_bytes", "tx_bytes" };
+        nm_str_t path = NM_INIT_STR;
+
+        for (size_t i = 0; i < nm_arr_len(files); i++) {
+            int fd;
+
+            /* user mode network has no tap */
+            nm_str_format(&path, "/sys/class/net/%s/statistics/%s", ifname, files[i]);
+            if ((fd = open(path.data, O_RDONLY | O_CLOEXEC)) == -1)
+                continue;
+
+            vm->net_fds = nm_realloc(vm->net_fds, sizeof(int) * (vm->net_nfds + 1));
+            vm->net_fds[vm->net_nfds++] = fd;
+        }
+
+        nm_str_free(&path);
+    }
+}
+
+static void nm_vm_top_detach(nm_top_vm_t *vm)
+{
+    const nm_str_t *name = vm->name;
+
+    if (vm->pid)
+        nm_stat_unwatch(vm->pid);
+
+    for (size_t n = 0; n < vm->net_nfds; n++)
+        close(vm->net_fds[n]);
+    free(vm->net_fds);
+
+    memset(vm, 0, sizeof(*vm));
+    vm->name = name;
+}
+
+static uint64_t nm_vm_top_net_bytes(const nm_top_vm_t *vm)
+{
+    uint64_t total = 0;
+
+    for (size_t n = 0; n < vm->net_nfds; n++) {
+        char buf[32];
+        ssize_t nread;
+
+        if ((nread = pread(vm->net_fds[n], buf, sizeof(buf) - 1, 0)) <= 0)
+            continue;
+
+        buf[nread] = '\0';
+        total += strtoull(buf, NULL, 10);
+    }
+
+    return total;
+}
+
+static double nm_vm_top_last(const nm_top_vm_t *vm, int metric)
+{
+    if (!vm->count)
+        return 0;
+
+    return vm->hist[metric][(vm->head + NM_TOP_HISTORY - 1) % NM_TOP_HISTORY];
+}
+
+static void nm_vm_top_human(double val, char *buf, size_t len)
+{
+    const char *units[] = { "B", "K", "M", "G", "T" };
+    size_t unit = 0;
+
+    while (val >= 1024 && unit < nm_arr_len(units) - 1) {
+        val /= 1024;
+        unit++;
+    }
+
+    snprintf(buf, len, unit ? "%.1f%s" : "%.0f%s", val, units[unit]);
+}
+
+/* Newest sample is on the right */
+static void nm_vm_top_spark(const nm_top_vm_t *vm, double max, size_t width)
+{
+    static int utf = -1;
+    const char **glyphs;
+    size_t levels = nm_arr_len(nm_top_spark_utf);
+
+    if (utf == -1)
+        utf = !strcmp(nl_langinfo(CODESET), "UTF-8");
+
+    glyphs = utf ? nm_top_spark_utf : nm_top_spark_ascii;
+
+    for (size_t n = width; n > 0; n--) {
+        size_t age = n - 1; /* 0 - the newest */
+        double val;
+        size_t level;
+
+        if (age >= vm->count) {
+            waddch(action_window, ' ');
+            continue;
+        }
+
+        val = vm->hist[nm_top_metric]
+            [(vm->head + NM_TOP_HISTORY - 1 - age) % NM_TOP_HISTORY];
+        level = (max > 0) ? (size_t) (val / max * (levels - 1) + 0.5) : 0;
+        if (level >= levels)
+            level = levels - 1;
+
+        waddstr(action_window, glyphs[level]);
+    }
+}
+
+static int nm_vm_top_cmp_cb(const void *a, const void *b)
+{
+    const nm_top_vm_t *vm_a = *((const nm_top_vm_t **) a);
+    const nm_top_vm_t *vm_b = *((const nm_top_vm_t **) b);
+    double va, vb;
+
+    if (!vm_a->pid != !vm_b->pid)
+        return vm_a->pid ? -1 : 1;
+
+    va = nm_vm_top_last(vm_a, nm_top_metric);
+    vb = nm_vm_top_last(vm_b, nm_top_metric);
+
+    if (va != vb)
+        return (va > vb) ? -1 : 1;
+
+    return strcmp(vm_a->name->data, vm_b->name->data);
+}
+
+/* vim:set ts=4 sw=4: */
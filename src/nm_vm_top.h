@@ -0,0 +1,7 @@
+#ifndef NM_VM_TOP_H_
+#define NM_VM_TOP_H_
+
+void nm_vm_top(void);
+
+#endif /* NM_VM_TOP_H_ */
+/* vim:set ts=4 sw=4: */
@@ -8,10 +8,32 @@
 #include <nm_cfg_file.h>
 #include <nm_usb_plug.h>
 #include <nm_stat_usage.h>
+#include <nm_vm_control.h>
 
 static float nm_window_scale = 0.7;
 
+/*
+ * Rows of side and action windows as they were printed last time.
+ * Printing of unchanged row is skipped, so periodic redraw of VM list
+ * and properties touches only changed rows. Rows are forgotten when
+ * window is initialized (nm_init_*), it is erased before that.
+ */
+typedef struct {
+    nm_str_t text;      /* data is NULL if row is unknown */
+    chtype attr;
+} nm_row_t;
+
+typedef struct {
+    nm_row_t *rows;
+    size_t count;
+} nm_rows_t;
+
+static nm_rows_t nm_side_rows;
+static nm_rows_t nm_action_rows;
+
 static void nm_init_window__(nm_window_t *w, const char *msg);
+static nm_rows_t *nm_rows_get(const nm_window_t *w);
+static void nm_rows_reset(nm_rows_t *rows);
 static void nm_print_help_lines(const char **msg, size_t objs, int err);
 static void nm_print_help__(const char **keys, const char **values,
                             size_t hotkey_num, size_t maxlen);
@@ -41,7 +63,10 @@ static void nm_print_help__(const char **keys, const char **values,
     X(iface, "q:Back", "enter:Edit")          \
     X(clone, "esc:Cancel", "enter:Clone")     \
     X(export, "esc:Cancel", "enter:Export")   \
-    X(delete, "q:Back", "enter:Delete")
+    X(delete, "q:Back", "enter:Delete")       \
+    X(top, "q:Back", "c:CPU", "m:Memory", "d:Disk", "n:Network") \
+    X(jobs, "q:Back", "c:Cancel", "x:Clear finished") \
+    X(search, "esc:Cancel", "enter:Apply", "^U:Clear")
 
 #define X(name, ...)                                         \
     void nm_init_help_ ## name(void) {                       \
@@ -72,6 +97,9 @@ void nm_create_windows(void)
     help_panel = new_panel(help_window);
     side_panel = new_panel(side_window);
     action_panel = new_panel(action_window);
+
+    nm_rows_reset(&nm_side_rows);
+    nm_rows_reset(&nm_action_rows);
 }
 
 void nm_init_help(const char *msg, int err)
@@ -109,17 +137,6 @@ void nm_init_side(void)
     wtimeout(side_window, 500);
 }
 
-void nm_init_side_group(const nm_str_t *name)
-{
-    nm_str_t title = NM_INIT_STR;
-
-    nm_str_format(&title, "VM list [%s]", name->data);
-    wattroff(side_window, COLOR_PAIR(NM_COLOR_HIGHLIGHT));
-    nm_init_window__(side_window, _(title.data));
-    nm_str_free(&title);
-    wtimeout(side_window, 500);
-}
-
 void nm_init_side_lan(void)
 {
     wattroff(side_window, COLOR_PAIR(NM_COLOR_HIGHLIGHT));
@@ -150,6 +167,10 @@ static void nm_init_window__(nm_window_t *w, const char *msg)
 {
     int cols = getmaxx(w);
     size_t mb_len = mbstowcs(NULL, msg, strlen(msg));
+    nm_rows_t *rows;
+
+    if ((rows = nm_rows_get(w)) != NULL)
+        nm_rows_reset(rows);
 
     box(w, 0, 0);
     mvwprintw(w, 1, (cols - mb_len) / 2, msg);
@@ -172,6 +193,63 @@ void nm_destroy_windows(void)
     help_window = NULL;
     side_window = NULL;
     action_window = NULL;
+
+    nm_rows_reset(&nm_side_rows);
+    nm_rows_reset(&nm_action_rows);
+    free(nm_side_rows.rows);
+    free(nm_action_rows.rows);
+    nm_side_rows = nm_action_rows = (nm_rows_t) { NULL, 0 };
+}
+
+/*
+ * Returns NM_TRUE if row y of window differs from the last printed one,
+ * the row is remembered as printed then. Rows of windows other than
+ * side and action are always reported as changed.
+ */
+int nm_row_changed(const nm_window_t *w, int y, const char *text, chtype attr)
+{
+    nm_rows_t *rows = nm_rows_get(w);
+    nm_row_t *row;
+
+    if (!rows || y < 0)
+        return NM_TRUE;
+
+    if ((size_t) y >= rows->count) {
+        size_t count = y + 1;
+
+        rows->rows = nm_realloc(rows->rows, count * sizeof(nm_row_t));
+        memset(rows->rows + rows->count, 0,
+                (count - rows->count) * sizeof(nm_row_t));
+        rows->count = count;
+    }
+
+    row = &rows->rows[y];
+    if (row->text.data && row->attr == attr &&
+            nm_str_cmp_st(&row->text, text) == NM_OK)
+        return NM_FALSE;
+
+    nm_str_alloc_text(&row->text, text);
+    row->attr = attr;
+
+    return NM_TRUE;
+}
+
+static nm_rows_t *nm_rows_get(const nm_window_t *w)
+{
+    if (!w)
+        return NULL;
+    if (w == side_window)
+        return &nm_side_rows;
+    if (w == action_window)
+        return &nm_action_rows;
+
+    return NULL;
+}
+
+static void nm_rows_reset(nm_rows_t *rows)
+{
+    for (size_t n = 0; n < rows->count; n++)
+        nm_str_free(&rows->rows[n].text);
 }
 
 void nm_print_cmd(const nm_str_t *name)
@@ -316,19 +394,19 @@ void nm_print_iface_info(const nm_vmctl_data_t *vm, size_t idx)
 
     getmaxyx(action_window, rows, cols);
 
-    if (nm_str_cmp_st(nm_vect_str(&vm->ifs, NM_SQL_IF_USR + idx_shift),
+    if (nm_str_cmp_st(nm_db_res_str(&vm->ifs, NM_SQL_IF_USR + idx_shift),
                 NM_ENABLE) == NM_OK) {
         nm_str_format(&buf, "%-12s%s", "User mode: ", "enabled");
         NM_PR_VM_INFO();
 
-        if (nm_vect_str_len(&vm->ifs, NM_SQL_IF_FWD + idx_shift) != 0) {
+        if (nm_db_res_len(&vm->ifs, NM_SQL_IF_FWD + idx_shift) != 0) {
             nm_str_format(&buf, "%-12s%s", "hostfwd: ",
-                    nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_FWD + idx_shift));
+                    nm_db_res_cstr(&vm->ifs, NM_SQL_IF_FWD + idx_shift));
             NM_PR_VM_INFO();
         }
-        if (nm_vect_str_len(&vm->ifs, NM_SQL_IF_SMB + idx_shift) != 0) {
+        if (nm_db_res_len(&vm->ifs, NM_SQL_IF_SMB + idx_shift) != 0) {
             nm_str_format(&buf, "%-12s%s", "smb: ",
-                    nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_SMB + idx_shift));
+                    nm_db_res_cstr(&vm->ifs, NM_SQL_IF_SMB + idx_shift));
             NM_PR_VM_INFO();
         }
 
@@ -336,30 +414,30 @@ void nm_print_iface_info(const nm_vmctl_data_t *vm, size_t idx)
     }
 
     nm_str_format(&buf, "%-12s%s", "hwaddr: ",
-            nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_MAC + idx_shift));
+            nm_db_res_cstr(&vm->ifs, NM_SQL_IF_MAC + idx_shift));
     NM_PR_VM_INFO();
 
     nm_str_format(&buf, "%-12s%s", "driver: ",
-            nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_DRV + idx_shift));
+            nm_db_res_cstr(&vm->ifs, NM_SQL_IF_DRV + idx_shift));
     NM_PR_VM_INFO();
 
-    if (nm_vect_str_len(&vm->ifs, NM_SQL_IF_IP4 + idx_shift) > 0) {
+    if (nm_db_res_len(&vm->ifs, NM_SQL_IF_IP4 + idx_shift) > 0) {
         nm_str_format(&buf, "%-12s%s", "host addr: ",
-                nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_IP4 + idx_shift));
+                nm_db_res_cstr(&vm->ifs, NM_SQL_IF_IP4 + idx_shift));
         NM_PR_VM_INFO();
     }
 
     nm_str_format(&buf, "%-12s%s", "vhost: ",
-            (nm_str_cmp_st(nm_vect_str(&vm->ifs, NM_SQL_IF_VHO + idx_shift),
+            (nm_str_cmp_st(nm_db_res_str(&vm->ifs, NM_SQL_IF_VHO + idx_shift),
                            NM_ENABLE) == NM_OK) ? "yes" : "no");
     NM_PR_VM_INFO();
 
-    mvtap_idx = nm_str_stoui(nm_vect_str(&vm->ifs, NM_SQL_IF_MVT + idx_shift), 10);
+    mvtap_idx = nm_db_res_int(&vm->ifs, NM_SQL_IF_MVT + idx_shift);
     if (!mvtap_idx)
         nm_str_format(&buf, "%-12s%s", "MacVTap: ", nm_form_macvtap[mvtap_idx]);
     else
         nm_str_format(&buf, "%-12s%s [iface: %s]", "MacVTap: ", nm_form_macvtap[mvtap_idx],
-            nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_PET + idx_shift));
+            nm_db_res_cstr(&vm->ifs, NM_SQL_IF_PET + idx_shift));
     NM_PR_VM_INFO();
 out:
     nm_str_free(&buf);
@@ -378,10 +456,10 @@ void nm_print_vm_info(const nm_str_t *name, const nm_vmctl_data_t *vm, int statu
     getmaxyx(action_window, rows, cols);
 
     nm_str_format(&buf, "%-12s%s", "arch: ",
-        nm_vect_str_ctx(&vm->main, NM_SQL_ARCH));
+        nm_db_res_cstr(&vm->main, NM_SQL_ARCH));
     NM_PR_VM_INFO();
 
-    nm_parse_smp(&cpu, nm_vect_str_ctx(&vm->main, NM_SQL_SMP));
+    nm_parse_smp(&cpu, nm_db_res_cstr(&vm->main, NM_SQL_SMP));
     nm_str_format(&buf, "%-12s%zu %s (%zu %s), threads %zu", "cpu: ",
             (cpu.sockets) ? cpu.sockets : cpu.smp,
             (cpu.sockets > 1) ? "cpus" : "cpu",
@@ -391,11 +469,11 @@ void nm_print_vm_info(const nm_str_t *name, const nm_vmctl_data_t *vm, int statu
     NM_PR_VM_INFO();
 
     nm_str_format(&buf, "%-12s%s %s", "memory: ",
-        nm_vect_str_ctx(&vm->main, NM_SQL_MEM), "Mb");
+        nm_db_res_cstr(&vm->main, NM_SQL_MEM), "Mb");
     NM_PR_VM_INFO();
 
-    if (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_KVM), NM_ENABLE) == NM_OK) {
-        if (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_HCPU), NM_ENABLE) == NM_OK)
+    if (nm_str_cmp_st(nm_db_res_str(&vm->main, NM_SQL_KVM), NM_ENABLE) == NM_OK) {
+        if (nm_str_cmp_st(nm_db_res_str(&vm->main, NM_SQL_HCPU), NM_ENABLE) == NM_OK)
             nm_str_format(&buf, "%-12s%s", "kvm: ", "enabled [+hostcpu]");
         else
             nm_str_format(&buf, "%-12s%s", "kvm: ", "enabled");
@@ -404,9 +482,9 @@ void nm_print_vm_info(const nm_str_t *name, const nm_vmctl_data_t *vm, int statu
     }
     NM_PR_VM_INFO();
 
-    if (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_USBF), "1") == NM_OK) {
+    if (nm_str_cmp_st(nm_db_res_str(&vm->main, NM_SQL_USBF), "1") == NM_OK) {
         nm_str_format(&buf, "%-12s%s [%s]", "usb: ", "enabled",
-                nm_vect_str_ctx(&vm->main, NM_SQL_USBT));
+                nm_db_res_cstr(&vm->main, NM_SQL_USBT));
     } else {
         nm_str_format(&buf, "%-12s%s", "usb: ", "disabled");
     }
@@ -429,8 +507,8 @@ void nm_print_vm_info(const nm_str_t *name, const nm_vmctl_data_t *vm, int statu
     }
 
     nm_str_format(&buf, "%-12s%s [%u]", "vnc port: ",
-             nm_vect_str_ctx(&vm->main, NM_SQL_VNC),
-             nm_str_stoui(nm_vect_str(&vm->main, NM_SQL_VNC), 10) + NM_STARTING_VNC_PORT);
+             nm_db_res_cstr(&vm->main, NM_SQL_VNC),
+             (uint32_t) nm_db_res_int(&vm->main, NM_SQL_VNC) + NM_STARTING_VNC_PORT);
     NM_PR_VM_INFO();
 
     /* print network interfaces info */
@@ -438,18 +516,18 @@ void nm_print_vm_info(const nm_str_t *name, const nm_vmctl_data_t *vm, int statu
 
     for (size_t n = 0; n < ifs_count; n++) {
         size_t idx_shift = NM_IFS_IDX_COUNT * n;
-        if (nm_str_cmp_st(nm_vect_str(&vm->ifs, NM_SQL_IF_USR + idx_shift),
+        if (nm_str_cmp_st(nm_db_res_str(&vm->ifs, NM_SQL_IF_USR + idx_shift),
                     NM_ENABLE) == NM_OK) {
             nm_str_format(&buf, "eth%zu%-8s%s [user mode]",
                     n, ":",
-                    nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_NAME + idx_shift));
+                    nm_db_res_cstr(&vm->ifs, NM_SQL_IF_NAME + idx_shift));
         } else {
             nm_str_format(&buf, "eth%zu%-8s%s [%s %s%s]",
                     n, ":",
-                    nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_NAME + idx_shift),
-                    nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_MAC + idx_shift),
-                    nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_DRV + idx_shift),
-                    (nm_str_cmp_st(nm_vect_str(&vm->ifs, NM_SQL_IF_VHO + idx_shift),
+                    nm_db_res_cstr(&vm->ifs, NM_SQL_IF_NAME + idx_shift),
+                    nm_db_res_cstr(&vm->ifs, NM_SQL_IF_MAC + idx_shift),
+                    nm_db_res_cstr(&vm->ifs, NM_SQL_IF_DRV + idx_shift),
+                    (nm_str_cmp_st(nm_db_res_str(&vm->ifs, NM_SQL_IF_VHO + idx_shift),
                                    NM_ENABLE) == NM_OK) ? "+vhost" : "");
         }
 
@@ -463,82 +541,82 @@ void nm_print_vm_info(const nm_str_t *name, const nm_vmctl_data_t *vm, int statu
         size_t idx_shift = NM_DRV_IDX_COUNT * n;
         int boot = 0;
 
-        if (nm_str_cmp_st(nm_vect_str(&vm->drives, NM_SQL_DRV_BOOT + idx_shift),
+        if (nm_str_cmp_st(nm_db_res_str(&vm->drives, NM_SQL_DRV_BOOT + idx_shift),
                 NM_ENABLE) == NM_OK) {
             boot = 1;
         }
 
         nm_str_format(&buf, "disk%zu%-7s%s [%sGb %s discard=%s] %s", n, ":",
-                 nm_vect_str_ctx(&vm->drives, NM_SQL_DRV_NAME + idx_shift),
-                 nm_vect_str_ctx(&vm->drives, NM_SQL_DRV_SIZE + idx_shift),
-                 nm_vect_str_ctx(&vm->drives, NM_SQL_DRV_TYPE + idx_shift),
-                 (nm_str_cmp_st(nm_vect_str(&vm->drives, NM_SQL_DRV_DISC + idx_shift),
+                 nm_db_res_cstr(&vm->drives, NM_SQL_DRV_NAME + idx_shift),
+                 nm_db_res_cstr(&vm->drives, NM_SQL_DRV_SIZE + idx_shift),
+                 nm_db_res_cstr(&vm->drives, NM_SQL_DRV_TYPE + idx_shift),
+                 (nm_str_cmp_st(nm_db_res_str(&vm->drives, NM_SQL_DRV_DISC + idx_shift),
                                 NM_ENABLE) == NM_OK) ? "on" : "off",
                  boot ? "*" : "");
         NM_PR_VM_INFO();
     }
 
     /* print 9pfs info */
-    if (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_9FLG), "1") == NM_OK) {
+    if (nm_str_cmp_st(nm_db_res_str(&vm->main, NM_SQL_9FLG), "1") == NM_OK) {
         nm_str_format(&buf, "%-12s%s [%s]", "9pfs: ",
-                 nm_vect_str_ctx(&vm->main, NM_SQL_9PTH),
-                 nm_vect_str_ctx(&vm->main, NM_SQL_9ID));
+                 nm_db_res_cstr(&vm->main, NM_SQL_9PTH),
+                 nm_db_res_cstr(&vm->main, NM_SQL_9ID));
         NM_PR_VM_INFO();
     }
 
     /* generate guest boot settings info */
-    if (nm_vect_str_len(&vm->main, NM_SQL_MACH)) {
+    if (nm_db_res_len(&vm->main, NM_SQL_MACH)) {
         nm_str_format(&buf, "%-12s%s", "machine: ",
-                nm_vect_str_ctx(&vm->main, NM_SQL_MACH));
+                nm_db_res_cstr(&vm->main, NM_SQL_MACH));
         NM_PR_VM_INFO();
     }
-    if (nm_vect_str_len(&vm->main, NM_SQL_BIOS)) {
+    if (nm_db_res_len(&vm->main, NM_SQL_BIOS)) {
         nm_str_format(&buf,"%-12s%s", "bios: ",
-                nm_vect_str_ctx(&vm->main, NM_SQL_BIOS));
+                nm_db_res_cstr(&vm->main, NM_SQL_BIOS));
         NM_PR_VM_INFO();
     }
-    if (nm_vect_str_len(&vm->main, NM_SQL_KERN)) {
+    if (nm_db_res_len(&vm->main, NM_SQL_KERN)) {
         nm_str_format(&buf,"%-12s%s", "kernel: ",
-                nm_vect_str_ctx(&vm->main, NM_SQL_KERN));
+                nm_db_res_cstr(&vm->main, NM_SQL_KERN));
         NM_PR_VM_INFO();
     }
-    if (nm_vect_str_len(&vm->main, NM_SQL_KAPP)) {
+    if (nm_db_res_len(&vm->main, NM_SQL_KAPP)) {
         nm_str_format(&buf, "%-12s%s", "cmdline: ",
-                nm_vect_str_ctx(&vm->main, NM_SQL_KAPP));
+                nm_db_res_cstr(&vm->main, NM_SQL_KAPP));
         NM_PR_VM_INFO();
     }
-    if (nm_vect_str_len(&vm->main, NM_SQL_INIT)) {
+    if (nm_db_res_len(&vm->main, NM_SQL_INIT)) {
         nm_str_format(&buf, "%-12s%s", "initrd: ",
-                nm_vect_str_ctx(&vm->main, NM_SQL_INIT));
+                nm_db_res_cstr(&vm->main, NM_SQL_INIT));
         NM_PR_VM_INFO();
     }
-    if (nm_vect_str_len(&vm->main, NM_SQL_TTY)) {
+    if (nm_db_res_len(&vm->main, NM_SQL_TTY)) {
         nm_str_format(&buf, "%-12s%s", "tty: ",
-                nm_vect_str_ctx(&vm->main, NM_SQL_TTY));
+                nm_db_res_cstr(&vm->main, NM_SQL_TTY));
         NM_PR_VM_INFO();
     }
-    if (nm_vect_str_len(&vm->main, NM_SQL_SOCK)) {
+    if (nm_db_res_len(&vm->main, NM_SQL_SOCK)) {
         nm_str_format(&buf, "%-12s%s", "socket: ",
-                nm_vect_str_ctx(&vm->main, NM_SQL_SOCK));
+                nm_db_res_cstr(&vm->main, NM_SQL_SOCK));
         NM_PR_VM_INFO();
     }
-    if (nm_vect_str_len(&vm->main, NM_SQL_DEBP)) {
+    if (nm_db_res_len(&vm->main, NM_SQL_DEBP)) {
         nm_str_format(&buf, "%-12s%s", "gdb port: ",
-                nm_vect_str_ctx(&vm->main, NM_SQL_DEBP));
+                nm_db_res_cstr(&vm->main, NM_SQL_DEBP));
         NM_PR_VM_INFO();
     }
-    if (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_DEBF), NM_ENABLE) == NM_OK) {
+    if (nm_str_cmp_st(nm_db_res_str(&vm->main, NM_SQL_DEBF), NM_ENABLE) == NM_OK) {
         nm_str_format(&buf, "%-12s", "freeze cpu: yes");
         NM_PR_VM_INFO();
     }
-    if (nm_vect_str_len(&vm->main, NM_SQL_ARGS)) {
+    if (nm_db_res_len(&vm->main, NM_SQL_ARGS)) {
         nm_str_format(&buf,"%-12s%s", "extra args: ",
-                nm_vect_str_ctx(&vm->main, NM_SQL_ARGS));
+                nm_db_res_cstr(&vm->main, NM_SQL_ARGS));
         NM_PR_VM_INFO();
     }
-    if (nm_vect_str_len(&vm->main, NM_SQL_GROUP)) {
+    if (nm_db_res_len(&vm->main, NM_SQL_GROUP)) {
         nm_str_format(&buf,"%-12s%s", "group: ",
-                nm_vect_str_ctx(&vm->main, NM_SQL_GROUP));
+                nm_db_res_cstr(&vm->main, NM_SQL_GROUP));
         NM_PR_VM_INFO();
     }
 
@@ -546,57 +624,44 @@ void nm_print_vm_info(const nm_str_t *name, const nm_vmctl_data_t *vm, int statu
     for (size_t n = 0; n < ifs_count; n++) {
         size_t idx_shift = NM_IFS_IDX_COUNT * n;
 
-        if (!nm_vect_str_len(&vm->ifs, NM_SQL_IF_IP4 + idx_shift))
+        if (!nm_db_res_len(&vm->ifs, NM_SQL_IF_IP4 + idx_shift))
             continue;
 
         nm_str_format(&buf, "%-12s%s [%s]", "host IP: ",
-            nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_NAME + idx_shift),
-            nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_IP4 + idx_shift));
+            nm_db_res_cstr(&vm->ifs, NM_SQL_IF_NAME + idx_shift),
+            nm_db_res_cstr(&vm->ifs, NM_SQL_IF_IP4 + idx_shift));
         NM_PR_VM_INFO();
 
     }
 
     /* print PID */
     {
-        int fd;
-        nm_str_t pid_path = NM_INIT_STR;
+        int pid_num = nm_vmctl_get_pid(name);
 
-        nm_str_format(&pid_path, "%s/%s/%s",
-            nm_cfg_get()->vm_dir.data, name->data, NM_VM_PID_FILE);
-
-        if ((status && (fd = open(pid_path.data, O_RDONLY)) != -1)) {
-            char pid[10];
-            ssize_t nread;
-            int pid_num = 0;
+        if (status && pid_num > 0) {
+            nm_str_format(&buf, "%-12s%d", "pid: ", pid_num);
+            NM_PR_VM_INFO();
 
-            if ((nread = read(fd, pid, sizeof(pid))) > 0) {
-                pid[nread - 1] = '\0';
-                pid_num = atoi(pid);
+#if defined (NM_OS_LINUX)
+            double usage = nm_stat_get_usage(pid_num);
+            nm_stat_t stat = NM_INIT_STAT;
 
-                nm_str_format(&buf, "%-12s%d", "pid: ", pid_num);
-                NM_PR_VM_INFO();
-            }
-            close(fd);
+            nm_str_format(&buf, "%-12s%0.1f%%", "cpu usage: ", usage);
+            NM_PR_VM_INFO();
 
-#if defined (NM_OS_LINUX)
-            if (pid_num) {
-                double usage = nm_stat_get_usage(pid_num);
-                nm_str_format(&buf, "%-12s%0.1f%%", "cpu usage: ", usage);
-                mvwhline(action_window, y, 1, ' ', cols - 4);
-                NM_PR_VM_INFO();
-            }
-#else
-            (void) pid_num;
+            nm_stat_get(pid_num, &stat);
+            nm_str_format(&buf, "%-12s%0.1f MiB", "mem usage: ",
+                    (double) stat.rss / (1024 * 1024));
+            NM_PR_VM_INFO();
 #endif
-        } else { /* clear PID file info and cpu usage data */
+        } else { /* clear PID info, drop usage data of this VM only */
             if (y < (rows - 2)) {
                 mvwhline(action_window, y, 1, ' ', cols - 4);
                 mvwhline(action_window, y + 1, 1, ' ', cols - 4);
             }
-            NM_STAT_CLEAN();
+            if (pid_num > 0)
+                nm_stat_unwatch(pid_num);
         }
-
-        nm_str_free(&pid_path);
     }
 
     nm_str_free(&buf);
@@ -636,7 +701,7 @@ void nm_print_help(void)
 #if defined (NM_OS_LINUX)
         "+", "-",
 #endif
-        "k", "/"
+        "k", "/", "o", "j"
 };
 
     const char *values[] = {
@@ -671,6 +736,8 @@ void nm_print_help(void)
 #endif
         "kill vm process",
         "search vm, filters",
+        "resource usage of running vms",
+        "background jobs",
         NULL
     };
 
@@ -27,12 +27,15 @@ void nm_init_help_install(void);
 void nm_init_help_clone(void);
 void nm_init_help_export(void);
 void nm_init_help_delete(void);
+void nm_init_help_top(void);
+void nm_init_help_jobs(void);
+void nm_init_help_search(void);
 void nm_init_side(void);
-void nm_init_side_group(const nm_str_t *name);
 void nm_init_side_lan(void);
 void nm_init_side_if_list(void);
 void nm_init_side_drives(void);
 void nm_align2line(nm_str_t *str, size_t line_len);
+int nm_row_changed(const nm_window_t *w, int y, const char *text, chtype attr);
 int nm_warn(const char *msg);
 int nm_notify(const char *msg);
 size_t nm_max_msg_len(const char **msg);
@@ -100,6 +103,7 @@ extern nm_panel_t *action_panel;
 #define NM_MSG_Q_SE_ERR   "Error send message to QMP socket" NM_MSG_ANY_KEY
 #define NM_MSG_Q_NO_ANS   "QMP: no answer" NM_MSG_ANY_KEY
 #define NM_MSG_Q_EXEC_E   "QMP: execute error" NM_MSG_ANY_KEY
+#define NM_MSG_Q_BUSY     "QMP: too many jobs in progress, try later" NM_MSG_ANY_KEY
 #define NM_MSG_START_ERR  "Start failed, error was logged" NM_MSG_ANY_KEY
 #define NM_MSG_INC_DEL    "Some files was not deleted!" NM_MSG_ANY_KEY
 #define NM_MSG_SOCK_USED  "Socket is already used!" NM_MSG_ANY_KEY
@@ -119,6 +123,7 @@ extern nm_panel_t *action_panel;
 #define NM_MSG_VTAP_NOP   "MacVTap parent interface does not exists" NM_MSG_ANY_KEY
 #define NM_MSG_NAME_DIFF  "Names must be different" NM_MSG_ANY_KEY
 #define NM_MSG_OVF_MISS   "OVF file is not found" NM_MSG_ANY_KEY
+#define NM_MSG_OVA_EFMT   "Cannot read OVA, tar archive expected" NM_MSG_ANY_KEY
 #define NM_MSG_OVF_EPAR   "Cannot parse OVF file" NM_MSG_ANY_KEY
 #define NM_MSG_XPATH_ERR  "Cannot create new XPath context" NM_MSG_ANY_KEY
 #define NM_MSG_NS_ERROR   "Cannot register xml namespaces" NM_MSG_ANY_KEY
@@ -127,6 +132,9 @@ extern nm_panel_t *action_panel;
 #define NM_MSG_USB_ATTAC  "Already attached" NM_MSG_ANY_KEY
 #define NM_MSG_BAD_OVF    "Incorrect OVF version" NM_MSG_ANY_KEY
 #define NM_MSG_NO_DAEMON  "Start daemon: nemu --daemon" NM_MSG_ANY_KEY
+#define NM_MSG_HAS_CLONES "VM is a base of linked clones" NM_MSG_ANY_KEY
+#define NM_MSG_JOB_BUSY   "VM is busy with background job" NM_MSG_ANY_KEY
+#define NM_MSG_JOB_QUIT   "Background jobs will be canceled, quit? (y/n)"
 
 #define NM_ERASE_TITLE(t, cols) \
     mvwhline(t ## _window, 1, 1, ' ', (cols) - 2)
@@ -139,6 +147,7 @@ enum nm_color {
 
 enum nm_key {
     NM_KEY_ENTER    = 10,
+    NM_KEY_CTRL_U   = 21,
     NM_KEY_ESC      = 27,
     NM_KEY_QUESTION = 63,
     NM_KEY_PLUS     = 43,
@@ -153,9 +162,11 @@ enum nm_key {
     NM_KEY_G = 103,
     NM_KEY_H = 104,
     NM_KEY_I = 105,
+    NM_KEY_J = 106,
     NM_KEY_K = 107,
     NM_KEY_L = 108,
     NM_KEY_M = 109,
+    NM_KEY_N = 110,
     NM_KEY_O = 111,
     NM_KEY_P = 112,
     NM_KEY_Q = 113,
@@ -184,7 +195,7 @@ enum nm_key_upper {
 };
 
 /*
-** Fit string in action window.
+** Fit string in action window, unchanged row is skipped.
 ** ch1 and ch2 need for snapshot tree.
 ** I dont know how to print ACS_* chars in mvwprintw().
 */
@@ -194,13 +205,17 @@ enum nm_key_upper {
             mvwprintw(action_window, y, x, "...");              \
             return;                                             \
         }                                                       \
-        if (ch1 && ch2) {                                       \
-            mvwaddch(action_window, y, x, ch1 );                \
-            mvwaddch(action_window, y, x + 1, ch2 );            \
-        }                                                       \
         nm_align2line(&buf, (ch1 && ch2) ? cols - 2 : cols);    \
-        mvwprintw(action_window, y++,                           \
-                (ch1 && ch2) ? x + 2 : x, "%s", buf.data);      \
+        if (nm_row_changed(action_window, y, buf.data, ch1)) {  \
+            mvwhline(action_window, y, 1, ' ', cols - 4);       \
+            if (ch1 && ch2) {                                   \
+                mvwaddch(action_window, y, x, ch1 );            \
+                mvwaddch(action_window, y, x + 1, ch2 );        \
+            }                                                   \
+            mvwprintw(action_window, y,                         \
+                    (ch1 && ch2) ? x + 2 : x, "%s", buf.data);  \
+        }                                                       \
+        y++;                                                    \
         ch1 = ch2 = 0;                                          \
     } while (0)
 